@@ -52,6 +52,7 @@ extern "C" {
 #define APIC_TIMER_DIVCODE APIC_TIMER_DIV_16
     
 #define APIC_BASE_MSR        0x0000001b
+#define APIC_TSC_DEADLINE_MSR 0x000006e0
     
 #define IA32_APIC_BASE_MSR_BSP    0x100 
 #define IA32_APIC_BASE_MSR_ENABLE 0x800
@@ -237,6 +238,8 @@ struct apic_dev {
     uint64_t cycles_per_tick;
     uint8_t  timer_set;
     uint32_t current_ticks; // timeout currently being computed
+    uint8_t  tsc_deadline;     // timer is in TSC-deadline mode
+    uint64_t current_deadline; // TSC at which it fires (0 => disarmed)
     uint64_t timer_count;
 
 		// These fields are now located in `struct cpu` to aid in portability
@@ -369,6 +372,8 @@ uint64_t apic_realtime_to_cycles(struct apic_dev *apic, uint64_t ns);
 // ns
 uint64_t apic_cycles_to_realtime(struct apic_dev *apic, uint64_t cycles);
 
+// ticks of -1 means as far in the future as possible, which
+// in TSC-deadline mode means never
 void     apic_set_oneshot_timer(struct apic_dev *apic, uint32_t ticks);
 
 // updating the timer 
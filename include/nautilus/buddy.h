@@ -46,12 +46,22 @@ struct buddy_mempool {
 };
 
 struct buddy_mempool * buddy_init(ulong_t base_addr, ulong_t pool_order, ulong_t min_order);
+// as buddy_init(), but the tag bits must be cleared before use (see buddy.c)
+struct buddy_mempool * buddy_init_untagged(ulong_t base_addr, ulong_t pool_order, ulong_t min_order);
+void buddy_clear_tags(struct buddy_mempool * mp, ulong_t offset, ulong_t len);
 
 void buddy_free(struct buddy_mempool * mp, void * addr, ulong_t order);
 void * buddy_alloc(struct buddy_mempool * mp, ulong_t order);
 
+// resize an allocated block in place, which grow may fail to do
+int  buddy_grow(struct buddy_mempool * mp, void * addr, ulong_t order, ulong_t new_order);
+void buddy_shrink(struct buddy_mempool * mp, void * addr, ulong_t order, ulong_t new_order);
+
 int  buddy_sanity_check(struct buddy_mempool *mp);
 
+// order of the free block starting at addr, or -1 if none starts there
+long buddy_free_order(struct buddy_mempool *mp, void *addr);
+
 struct buddy_pool_stats {
     void   *start_addr;
     void   *end_addr;
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __KMEM_CACHE_H__
+#define __KMEM_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nautilus/naut_types.h>
+
+//
+// Typed object caches
+//
+// A cache hands out objects of a single type that are kept in their
+// constructed state while they are free.  The constructor runs when
+// an object is first allocated from the kernel allocator, and the
+// destructor runs when the object is finally given back to it, not
+// on each allocation and free.  A user must therefore return an
+// object to its constructed state before freeing it to the cache.
+//
+// Free objects are held in small per-CPU caches that are used with
+// interrupts off and no locks, backed by a shared, locked depot.
+//
+
+#define NK_KMEM_CACHE_NAME_LEN 32
+
+struct nk_kmem_cache;
+
+// ctor returns nonzero on failure, in which case the object is not used
+// align is a power of two of at most 4 KB, 0 => default (16 bytes)
+struct nk_kmem_cache *nk_kmem_cache_create(char *name,
+					   size_t size,
+					   size_t align,
+					   int  (*ctor)(void *obj),
+					   void (*dtor)(void *obj));
+
+// all objects must have been freed to the cache
+void  nk_kmem_cache_destroy(struct nk_kmem_cache *cache);
+
+void *nk_kmem_cache_alloc(struct nk_kmem_cache *cache);
+// allocate an object for use on the given cpu (-1 => current cpu)
+void *nk_kmem_cache_alloc_specific(struct nk_kmem_cache *cache, int cpu);
+void  nk_kmem_cache_free(struct nk_kmem_cache *cache, void *obj);
+
+// destroy the free objects in the depot, returns how many
+uint64_t nk_kmem_cache_shrink(struct nk_kmem_cache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
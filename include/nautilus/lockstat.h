@@ -0,0 +1,115 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __LOCKSTAT_H__
+#define __LOCKSTAT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nautilus/naut_types.h>
+#include <nautilus/cpu.h>
+
+/*
+  Lock contention statistics (NAUT_CONFIG_LOCKSTAT)
+
+  Spinlocks, ticket locks and MCS locks are grouped into classes.  A
+  lock's class is the place its init function was called from.  A
+  lock that was never initialized, such as a zeroed static one, is a
+  class of its own, keyed by its address.  While lockstat is on, each
+  cpu counts, per class, the acquisitions it made, how many of those
+  had to wait, the total and longest wait, and the longest hold.
+  A hold is only timed when the lock is released on the cpu that
+  took it.
+  The "lockstat" shell command starts and stops this, and it merges
+  the cpus' tables to list the most contended classes.
+
+  All times are in cycles.
+*/
+
+#ifdef NAUT_CONFIG_LOCKSTAT
+
+extern volatile int nk_lockstat_on;
+
+// site is where the lock's init function was called from
+void nk_lockstat_init_lock(void *lock, void *site);
+void nk_lockstat_deinit_lock(void *lock);
+
+// start==0 => acquired without waiting, else when the wait began
+void nk_lockstat_acquired(void *lock, uint64_t start);
+void nk_lockstat_released(void *lock);
+
+// start clears the tables
+int  nk_lockstat_start(void);
+void nk_lockstat_stop(void);
+
+// only for use in a lock's (non-inline) init function
+#define NK_LOCKSTAT_INIT(l)   nk_lockstat_init_lock((void*)(l), __builtin_return_address(0))
+#define NK_LOCKSTAT_DEINIT(l) nk_lockstat_deinit_lock((void*)(l))
+
+#define NK_LOCKSTAT_ACQUIRED(l, start)			\
+    do {						\
+	if (nk_lockstat_on) {				\
+	    nk_lockstat_acquired((void*)(l), (start));	\
+	}						\
+    } while (0)
+
+#define NK_LOCKSTAT_RELEASED(l)				\
+    do {						\
+	if (nk_lockstat_on) {				\
+	    nk_lockstat_released((void*)(l));		\
+	}						\
+    } while (0)
+
+// acquire by retrying "busy" (which tries to take the lock, or checks
+// whether we may have it) until it is false, timing it if it was not
+// false at once
+#define NK_LOCKSTAT_SPIN(l, busy, wait)			\
+    do {						\
+	uint64_t _ls_start = 0;				\
+	if (busy) {					\
+	    _ls_start = rdtsc();			\
+	    while (busy) {				\
+		wait;					\
+	    }						\
+	}						\
+	NK_LOCKSTAT_ACQUIRED(l, _ls_start);		\
+    } while (0)
+
+#else
+
+#define NK_LOCKSTAT_INIT(l)
+#define NK_LOCKSTAT_DEINIT(l)
+#define NK_LOCKSTAT_ACQUIRED(l, start)
+#define NK_LOCKSTAT_RELEASED(l)
+#define NK_LOCKSTAT_SPIN(l, busy, wait)			\
+    do {						\
+	while (busy) {					\
+	    wait;					\
+	}						\
+    } while (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
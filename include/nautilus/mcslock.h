@@ -26,6 +26,7 @@
 #include <nautilus/cpu.h>
 #include <nautilus/atomic.h>
 #include <nautilus/smp.h>
+#include <nautilus/lockstat.h>
 
 struct nk_mcs_lock {
     struct nk_mcs_lock * next;
@@ -33,6 +34,9 @@ struct nk_mcs_lock {
 };
 
 typedef struct nk_mcs_lock nk_mcs_lock_t;
+
+void nk_mcs_lock_init(nk_mcs_lock_t * l);
+void nk_mcs_lock_deinit(nk_mcs_lock_t * l);
     
 //void nk_mcs_lock(nk_mcs_lock_t * l, nk_mcs_lock_t * me);
 //void nk_mcs_unlock(nk_mcs_lock_t * l, nk_mcs_lock_t * me);
@@ -50,6 +54,7 @@ nk_mcs_lock (nk_mcs_lock_t * l, nk_mcs_lock_t * me)
 
     /* did we get it? */
     if (likely(!last)) {
+        NK_LOCKSTAT_ACQUIRED(l, 0);
         return;
 
     /* someone else locked it */
@@ -57,7 +62,7 @@ nk_mcs_lock (nk_mcs_lock_t * l, nk_mcs_lock_t * me)
 
         *(volatile nk_mcs_lock_t**)(&(last->next)) = me;
 
-        PAUSE_WHILE(me->locked != 1);
+        NK_LOCKSTAT_SPIN(l, *(volatile int*)(&(me->locked)) != 1, pause());
     }
 }
 
@@ -67,6 +72,8 @@ nk_mcs_unlock (nk_mcs_lock_t * l, nk_mcs_lock_t * me)
 {
     nk_mcs_lock_t * next = me->next;
 
+    NK_LOCKSTAT_RELEASED(l);
+
     if (likely(!me->next)) {
 
         if (likely(atomic_cmpswap(l->next, me, NULL) == me)) {
@@ -95,7 +102,12 @@ nk_mcs_trylock (nk_mcs_lock_t * l, nk_mcs_lock_t * me)
 
     last = atomic_cmpswap(l->next, NULL, me);
 
-    return (!last) ? 0 : -1;
+    if (last) {
+        return -1;
+    }
+
+    NK_LOCKSTAT_ACQUIRED(l, 0);
+    return 0;
 }
 
 #endif
@@ -81,11 +81,53 @@ void mm_boot_free(void *addr, ulong_t size);
 
 /* KMEM FUNCTIONS */
 
+// Per-thread memory policies, which determine which NUMA domain the
+// allocations of a thread come from when they do not name a cpu or
+// domain themselves.  A new thread inherits its creator's policy.
+typedef enum {
+    NK_MEM_POLICY_LOCAL = 0,    // domain of the current cpu, then by distance
+    NK_MEM_POLICY_BIND,         // domain node only, fail if it is exhausted
+    NK_MEM_POLICY_INTERLEAVE,   // round-robin across all domains, a page at a time
+    NK_MEM_POLICY_PREFERRED,    // domain node, then by distance from it
+} nk_mem_policy_mode_t;
+
+struct nk_mem_policy {
+    nk_mem_policy_mode_t mode;
+    int                  node;      // for BIND and PREFERRED
+    uint32_t             il_next;   // for INTERLEAVE: next domain to use
+    uint64_t             il_bytes;  // and the bytes it has received so far
+};
+
+// set or get the policy of the current thread, node is ignored
+// for LOCAL and INTERLEAVE
+int nk_mem_policy_set(nk_mem_policy_mode_t mode, int node);
+int nk_mem_policy_get(nk_mem_policy_mode_t *mode, int *node);
+
+struct kmem_cpu_cache;
+struct kmem_size_class;
+
 struct kmem_data {
     struct list_head ordered_regions;
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    struct kmem_cpu_cache *cache;   // this cpu's magazines (see kmem.c)
+#endif
+#ifndef NAUT_CONFIG_GARBAGE_COLLECTION
+    struct kmem_size_class *classes;  // size classes for sub-page requests (see kmem.c)
+#endif
 };
 
 int nk_kmem_init(void);
+// register the shrinkers of kmem's own caches, once malloc works
+int nk_kmem_shrinkers_init(void);
+// with NAUT_CONFIG_KMEM_PARALLEL_INIT, help set up the memory left
+// for after boot, returning once all of it is (called by every cpu)
+void nk_kmem_init_deferred(void);
+// print the time since memory initialization began
+void nk_kmem_boot_time(char *event);
+
+// zero a block for the pre-zeroed pools, returns nonzero if there was
+// one to zero (called by the idle threads)
+int nk_kmem_zero_pool_fill(void);
 
 struct mem_region;
 
@@ -105,6 +147,14 @@ void * kmem_mallocz(size_t size);
 void * kmem_realloc(void * ptr, size_t size);
 void   kmem_free(void * addr);
 
+// Physically contiguous memory aligned to a huge page (PAGE_SIZE_2MB
+// or PAGE_SIZE_1GB) from the zones of a NUMA domain (-1 => wherever
+// the current thread's memory policy places it).  Size is rounded up
+// to a multiple of the page size.  This memory is not seen by
+// kmem_free() or garbage collection
+void * nk_malloc_huge(size_t size, uint64_t page_size, int numa_node);
+void   nk_free_huge(void * addr);
+
 // Support functions for garbage collection
 // We currently assume these are done with the world stopped,
 // hence no locking
@@ -112,7 +162,8 @@ void   kmem_free(void * addr);
 // find the matching block that contains addr and its flags
 // returns nonzero if the addr is invalid or within no allocated block
 // user flags are allocate from low bit up, while kmem's flags are allocated
-// high bit down
+// high bit down.  kmem keeps 8 bits of flags per block, and only when
+// garbage collection is configured
 int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, uint64_t *flags);
 // set the flags of an allocated block
 int  kmem_set_block_flags(void *block_addr, uint64_t flags);
@@ -172,12 +223,39 @@ void *nk_gc_pdsgc_malloc_specific(uint64_t, int cpu);
 #endif
 
 
+// utilization of a size class (see kmem.c)
+// bytes_held - bytes_in_use is the memory the class holds but does not use
+struct kmem_class_stats {
+    uint64_t size;          // object size of the class
+    uint64_t slab_size;     // bytes per slab
+    uint64_t num_slabs;
+    uint64_t objs_total;    // objects in all slabs
+    uint64_t objs_in_use;
+    uint64_t bytes_held;    // bytes in all slabs
+    uint64_t bytes_in_use;  // bytes in objects in use
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+#define KMEM_MAX_SIZE_CLASSES 32
+
 struct kmem_stats {
     uint64_t total_num_pools; // how many memory pools there are
     uint64_t total_blocks_free;
     uint64_t total_bytes_free;
     uint64_t min_alloc_size;
     uint64_t max_alloc_size;
+    uint64_t num_classes;     // how many size classes were written in the following
+    struct kmem_class_stats class_stats[KMEM_MAX_SIZE_CLASSES];
+    uint64_t huge_allocs;     // outstanding nk_malloc_huge() allocations
+    uint64_t huge_bytes;      // bytes in them
+    uint64_t huge_bytes_2mb;  // of which the identity map uses 2MB pages for
+    uint64_t huge_bytes_1gb;  // of which the identity map uses 1GB pages for
+    uint64_t zero_pool_bytes;         // bytes held pre-zeroed (see NAUT_CONFIG_KMEM_ZERO_POOL)
+    uint64_t zero_pool_bytes_filled;  // bytes zeroed in idle time
+    uint64_t zero_pool_hits;          // zeroing allocations that avoided zeroing
+    uint64_t zero_pool_bytes_avoided; // and the bytes they did not have to zero
+    uint64_t zero_pool_misses;        // zeroing allocations that found the pool empty
     uint64_t max_pools;  // how many pools can we written in the following
     uint64_t num_pools;   // how many pools were written in the following
     struct buddy_pool_stats pool_stats[0];
@@ -185,6 +263,9 @@ struct kmem_stats {
 
 uint64_t kmem_num_pools();
 void     kmem_stats(struct kmem_stats *stats);
+// bytes the allocator manages, and bytes allocated from it (including
+// what its own caches and pools hold)
+void     kmem_get_usage(uint64_t *managed, uint64_t *allocated);
 
 #ifdef __cplusplus
 }
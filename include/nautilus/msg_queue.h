@@ -28,11 +28,14 @@
 // And you probably do not want to use message queues at all
 // in interrupt context unless you know what you are doing
 
-typedef enum { NK_MSG_QUEUE_DEFAULT=0 } nk_msg_queue_type_t;
+// DEFAULT queues are guarded by a spinlock
+// MPMC queues are lock-free rings that touch their wait queues
+//   only when they are empty or full
+typedef enum { NK_MSG_QUEUE_DEFAULT=0, NK_MSG_QUEUE_MPMC } nk_msg_queue_type_t;
 
 #define NK_MSG_QUEUE_NAME_LEN 32
 
-// name is optional, currently there is only one mq type and no characteristics
+// name is optional, neither mq type has characteristics
 struct nk_msg_queue *nk_msg_queue_create(char *name,
 					 uint64_t size,
 					 nk_msg_queue_type_t type,
@@ -64,6 +67,15 @@ int  nk_msg_queue_try_pull(struct nk_msg_queue *queue, void **msg);
 int  nk_msg_queue_push_timeout(struct nk_msg_queue *queue, void *msg, uint64_t timeout_ns);
 int  nk_msg_queue_pull_timeout(struct nk_msg_queue *queue, void **msg, uint64_t timeout_ns);
 
+// batches - these are for threads only, not for interrupts
+// try versions move up to n messages without blocking and return how many
+uint64_t nk_msg_queue_try_push_many(struct nk_msg_queue *queue, void **msgs, uint64_t n);
+uint64_t nk_msg_queue_try_pull_many(struct nk_msg_queue *queue, void **msgs, uint64_t n);
+// push_many blocks until all n are pushed
+// pull_many blocks until at least one is pulled and returns how many
+void     nk_msg_queue_push_many(struct nk_msg_queue *queue, void **msgs, uint64_t n);
+uint64_t nk_msg_queue_pull_many(struct nk_msg_queue *queue, void **msgs, uint64_t n);
+
 int  nk_msg_queue_init();
 void nk_msg_queue_deinit();
 
@@ -0,0 +1,108 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __MUTEX_H__
+#define __MUTEX_H__
+
+#include <nautilus/nautilus.h>
+#include <nautilus/cpu.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/list.h>
+#include <nautilus/waitqueue.h>
+
+// Mutexes are for threads only, and are not recursive
+//
+// A contended lock spins while the owner is running on another cpu,
+// and sleeps once the owner is not.  Taking and releasing a free
+// mutex is a single compare-and-swap each.
+
+#define NK_MUTEX_NAME_LEN 32
+
+// low bit of the owner word: threads may be sleeping on the mutex
+#define NK_MUTEX_WAITERS  0x1ULL
+
+struct nk_mutex_stats {
+    uint64_t acquires;
+    uint64_t contended;   // acquires that did not find it free
+    uint64_t spun;        // contended acquires that did not sleep
+    uint64_t blocked;     // times a thread slept on it
+    uint64_t hold_cycles; // total time it was held
+    uint64_t hold_max;
+};
+
+typedef struct nk_mutex {
+    volatile uint64_t  owner;   // owning thread | NK_MUTEX_WAITERS, 0 => free
+    nk_wait_queue_t   *wait;
+    struct list_head   node;    // for the global list of mutexes
+    char               name[NK_MUTEX_NAME_LEN];
+#ifdef NAUT_CONFIG_MUTEX_STATS
+    uint64_t           acquired_at;
+    struct nk_mutex_stats stats;
+#endif
+} nk_mutex_t;
+
+// name is optional
+nk_mutex_t *nk_mutex_create(char *name);
+void        nk_mutex_destroy(nk_mutex_t *m);
+
+void _nk_mutex_lock_slow(nk_mutex_t *m);
+void _nk_mutex_unlock_slow(nk_mutex_t *m);
+
+static inline void nk_mutex_lock(nk_mutex_t *m)
+{
+    if (!__sync_bool_compare_and_swap(&m->owner, 0, (uint64_t)get_cur_thread())) {
+	_nk_mutex_lock_slow(m);
+    }
+#ifdef NAUT_CONFIG_MUTEX_STATS
+    m->stats.acquires++;
+    m->acquired_at = rdtsc();
+#endif
+}
+
+// 0 return indicates success
+static inline int nk_mutex_try_lock(nk_mutex_t *m)
+{
+    if (!__sync_bool_compare_and_swap(&m->owner, 0, (uint64_t)get_cur_thread())) {
+	return -1;
+    }
+#ifdef NAUT_CONFIG_MUTEX_STATS
+    m->stats.acquires++;
+    m->acquired_at = rdtsc();
+#endif
+    return 0;
+}
+
+static inline void nk_mutex_unlock(nk_mutex_t *m)
+{
+#ifdef NAUT_CONFIG_MUTEX_STATS
+    uint64_t held = rdtsc() - m->acquired_at;
+    m->stats.hold_cycles += held;
+    if (held > m->stats.hold_max) {
+	m->stats.hold_max = held;
+    }
+#endif
+    if (!__sync_bool_compare_and_swap(&m->owner, (uint64_t)get_cur_thread(), 0)) {
+	_nk_mutex_unlock_slow(m);
+    }
+}
+
+void nk_mutex_dump_mutexes(void);
+
+#endif
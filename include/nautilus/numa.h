@@ -43,6 +43,7 @@ struct numa_domain {
 };
 
 struct buddy_mempool;
+struct kmem_zone_deferred;
 
 struct mem_reg_entry {
     struct mem_region * mem;
@@ -66,6 +67,9 @@ struct mem_region {
 
     /* used by the kernel memory allocator */
     struct buddy_mempool * mm_state;
+    uint8_t * mm_blocks;   /* block descriptor per 2^MIN_ORDER frame (see kmem.c) */
+    uint8_t * mm_flags;    /* per-block flags, only kept for garbage collection */
+    struct kmem_zone_deferred * mm_deferred; /* setup left for after boot (see kmem.c) */
 
     struct list_head entry;
 
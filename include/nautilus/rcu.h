@@ -0,0 +1,124 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __RCU_H__
+#define __RCU_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nautilus/nautilus.h>
+#include <nautilus/list.h>
+
+/*
+  Read-copy-update
+
+  Readers of an RCU-protected structure take no lock and write
+  nothing shared.  Writers still serialize among themselves with
+  their own lock.  They unlink an object so that new readers cannot
+  find it.  They free it only after a grace period, which is a time
+  in which every cpu has passed through a quiescent state.  Any
+  reader that could still see the object has finished by then.
+
+  Read sections run with preemption off, so a cpu is quiescent
+  whenever the scheduler runs on it with preemption on.  That covers
+  every context switch, timer interrupt and idle pass.  Read
+  sections may nest and may be in interrupt context, but they must
+  not sleep or yield.
+
+  nk_synchronize_rcu() waits for a grace period.  It must be called
+  from a thread, outside any read section.  nk_call_rcu() queues a
+  callback on the calling cpu instead.  It can be called from any
+  context except the scheduler.  The rcu thread runs the queued
+  callbacks of all cpus together after a grace period.
+*/
+
+struct nk_rcu_head {
+    struct nk_rcu_head *next;
+    void              (*func)(struct nk_rcu_head *head);
+};
+
+static inline void nk_rcu_read_lock(void)
+{
+    preempt_disable();
+}
+
+static inline void nk_rcu_read_unlock(void)
+{
+    preempt_enable();
+}
+
+// publish a pointer to an initialized object
+#define nk_rcu_assign_pointer(p, v) ({ __sync_synchronize(); (p) = (v); })
+// read a pointer once in a read section
+#define nk_rcu_dereference(p) (*(volatile __typeof__(p) *)&(p))
+
+void nk_synchronize_rcu(void);
+void nk_call_rcu(struct nk_rcu_head *head, void (*func)(struct nk_rcu_head *head));
+
+// the scheduler reports quiescent states here
+void nk_rcu_quiescent(void);
+
+// start the rcu thread, once the scheduler runs on all cpus
+int  nk_rcu_init(void);
+
+
+//
+// Lists whose readers are in read sections.  Writers use the usual
+// list functions for anything but adding and removing entries, and
+// must not reuse a removed entry before a grace period.
+//
+static inline void list_add_rcu(struct list_head *nelm, struct list_head *head)
+{
+    struct list_head *next = head->next;
+
+    nelm->next = next;
+    nelm->prev = head;
+    nk_rcu_assign_pointer(head->next, nelm);
+    next->prev = nelm;
+}
+
+static inline void list_add_tail_rcu(struct list_head *nelm, struct list_head *head)
+{
+    struct list_head *prev = head->prev;
+
+    nelm->next = head;
+    nelm->prev = prev;
+    nk_rcu_assign_pointer(prev->next, nelm);
+    head->prev = nelm;
+}
+
+// entry->next stays valid for readers still on the entry
+static inline void list_del_rcu(struct list_head *entry)
+{
+    __list_del(entry->prev, entry->next);
+    entry->prev = LIST_POISON2;
+}
+
+#define list_for_each_rcu(pos, head) \
+    for (pos = nk_rcu_dereference((head)->next); pos != (head); \
+	 pos = nk_rcu_dereference(pos->next))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
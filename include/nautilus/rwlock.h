@@ -46,6 +46,42 @@ int nk_rwlock_wr_unlock_irq_restore(nk_rwlock_t * l, uint8_t flags);
 
 void nk_rwlock_test(void);
 
+
+//
+// "Big reader" lock, for data that is read far more often than it
+// is written.  Each cpu counts its readers on its own cache line,
+// so readers on different cpus share no line that is written.
+// Writers are preferred: once one wants the lock, new readers wait,
+// so it waits only for the readers already inside.
+//
+// Read sections run with preemption off, may be in interrupt
+// context, and must not sleep.  They may nest, including from an
+// interrupt taken inside one, since a cpu already reading does not
+// wait for a pending writer.  Write sections run with interrupts
+// off and must be in thread context.  With more cpus than slots,
+// cpus share slots.
+//
+#define NK_BRLOCK_SLOTS (NAUT_CONFIG_MAX_CPUS < 64 ? NAUT_CONFIG_MAX_CPUS : 64)
+#define NK_BRLOCK_CPUS_PER_SLOT ((NAUT_CONFIG_MAX_CPUS + NK_BRLOCK_SLOTS - 1) / NK_BRLOCK_SLOTS)
+
+struct nk_brlock_slot {
+    volatile uint64_t readers;
+    uint8_t           depth[NK_BRLOCK_CPUS_PER_SLOT];  // read nesting of each cpu on the slot
+} __attribute__((aligned(64)));
+
+struct nk_brlock {
+    volatile uint64_t     writer;   // nonzero => a writer holds or wants the lock
+    struct nk_brlock_slot slots[NK_BRLOCK_SLOTS];
+};
+
+typedef struct nk_brlock nk_brlock_t;
+
+void    nk_brlock_init(nk_brlock_t *l);
+void    nk_brlock_rd_lock(nk_brlock_t *l);
+void    nk_brlock_rd_unlock(nk_brlock_t *l);
+uint8_t nk_brlock_wr_lock_irq_save(nk_brlock_t *l);
+void    nk_brlock_wr_unlock_irq_restore(nk_brlock_t *l, uint8_t flags);
+
 #ifdef __cplusplus
 }
 #endif
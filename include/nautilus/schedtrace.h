@@ -0,0 +1,85 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __SCHEDTRACE_H__
+#define __SCHEDTRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nautilus/naut_types.h>
+#include <nautilus/intrinsics.h>
+
+//
+// Scheduler event tracing
+//
+// Each cpu records scheduler events into its own ring buffer, which
+// overwrites its oldest records when full.  Tracing is always compiled
+// in, but costs only a test of a flag until it is started with the
+// "schedtrace" shell command.  A record is claimed with an atomic
+// increment of its ring's head, so events can be recorded from any
+// context, including interrupt handlers, without locks.
+//
+// The rings are dumped as text, or as a binary stream (printed as hex
+// lines) that scripts/schedtrace.py turns into a timeline.
+//
+
+typedef enum {
+    NK_SCHED_TRACE_SWITCH = 1,   // tid is switched to, arg is the tid switched from
+    NK_SCHED_TRACE_WAKEUP,       // tid is made runnable on cpu
+    NK_SCHED_TRACE_MIGRATE,      // tid moves to cpu, arg is the cpu it left
+    NK_SCHED_TRACE_STEAL,        // tid is stolen from cpu
+    NK_SCHED_TRACE_ADMIT,        // tid is admitted, arg is its constraint type
+    NK_SCHED_TRACE_DEADLINE_MISS,// tid missed its deadline, arg is by how much (ns)
+} nk_sched_trace_event_t;
+
+// arg of an ADMIT for a thread that was not admitted
+#define NK_SCHED_TRACE_ADMIT_FAILED 0x100
+
+// this layout is also the binary stream's, so keep the script in sync
+struct nk_sched_trace_rec {
+    uint64_t tsc;
+    uint32_t event;
+    uint32_t cpu;    // the other cpu involved, if any
+    uint64_t tid;
+    uint64_t arg;
+};
+
+extern volatile int nk_sched_trace_on;
+
+void _nk_sched_trace(nk_sched_trace_event_t event, uint64_t tid, uint32_t cpu, uint64_t arg);
+
+#define NK_SCHED_TRACE(event,tid,cpu,arg)				\
+    do {								\
+	if (unlikely(nk_sched_trace_on)) {				\
+	    _nk_sched_trace(event,tid,cpu,arg);				\
+	}								\
+    } while (0)
+
+// entries is per cpu, rounded up to a power of two, and only
+// honored when the rings are first allocated (0 => default)
+int  nk_sched_trace_start(uint64_t entries);
+void nk_sched_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -63,7 +63,14 @@ struct nk_sched_aperiodic_constraints {
     uint64_t priority;  // higher number = lower priority; essentially quantum
 };
 
-typedef enum { APERIODIC = 0, SPORADIC = 1, PERIODIC = 2} nk_sched_constraint_type_t;
+// batch threads run only when no real-time or aperiodic thread
+// wants the cpu, with quanta that grow while they keep using them
+// (requires NAUT_CONFIG_SCHED_BATCH)
+struct nk_sched_batch_constraints {
+    uint64_t priority;  // higher number = lower priority among batch threads
+};
+
+typedef enum { APERIODIC = 0, SPORADIC = 1, PERIODIC = 2, BATCH = 3} nk_sched_constraint_type_t;
 struct nk_sched_constraints {
     nk_sched_constraint_type_t type;
     // the interrupt priority class that must be exceeded
@@ -81,6 +88,7 @@ struct nk_sched_constraints {
 	struct nk_sched_periodic_constraints     periodic;
 	struct nk_sched_sporadic_constraints     sporadic;
 	struct nk_sched_aperiodic_constraints    aperiodic;
+	struct nk_sched_batch_constraints        batch;
     } ;
 } ;
 
@@ -116,16 +124,48 @@ int nk_sched_thread_pre_destroy(struct nk_thread *thread);
 // nonzero return => failed
 int    nk_sched_thread_change_constraints(struct nk_sched_constraints *constraints);
 
+// Change the scheduling state of the calling thread, choosing the cpu
+// for a periodic or sporadic reservation across the whole system
+// instead of only the current one.  The cpus it fits on, by their
+// utilization limits and reservations, are tried in order until one
+// admits it, moving the thread to each.  On failure, the thread is
+// left aperiodic, possibly on another cpu.  Bound threads can only
+// be admitted on their cpu.
+typedef enum {
+    NK_SCHED_FIT_FIRST = 1,  // lowest numbered cpu first
+    NK_SCHED_FIT_WORST,      // cpu with the most reservation left first
+} nk_sched_fit_t;
+
+int    nk_sched_thread_change_constraints_global(struct nk_sched_constraints *constraints,
+						 nk_sched_fit_t fit);
+
 // Move the thread to the new cpu
 // a thread cannot move itself
 // a running thread cannot be moved
-// currently only aperiodic threads can be moved
+// currently only aperiodic and batch threads can be moved
 // block=1 => will keep trying until successful
 int    nk_sched_thread_move(struct nk_thread *thread, int new_cpu, int block);
 
+// Where a thread blocked on a wait queue is placed when it is woken
+typedef enum {
+    NK_SCHED_WAKE_DEFAULT = 0,  // AFFINE with NAUT_CONFIG_WAKE_AFFINE, else LAST
+    NK_SCHED_WAKE_LAST,         // always on the cpu it last ran on
+    NK_SCHED_WAKE_WAKER,        // on the waker's cpu, if the waker is a thread
+    NK_SCHED_WAKE_AFFINE,       // last cpu, an idle one sharing its LLC, or
+                                // the waker's, by load and how long it slept
+} nk_sched_wake_policy_t;
+
+// bound, real-time, and special threads are always woken on their last cpu
+int    nk_sched_thread_set_wake_policy(struct nk_thread *thread, nk_sched_wake_policy_t policy);
+
+// choose the cpu a woken thread is to be made runnable on, updating
+// its current_cpu - called by the wait queues before nk_sched_awaken()
+int    nk_sched_wake_placement(struct nk_thread *thread);
+
 //
 // Have this CPU attempt to steal at most max threads from cpu
-// Stealable threads are runnable aperiodic threads 
+// Stealable threads are runnable batch and aperiodic threads,
+// batch threads first
 // cpu==-1 means the scheduler will select a cpu
 // This makes a single pass, and there is no guarantee 
 // any threads are stolen
@@ -140,6 +180,16 @@ int    nk_sched_make_runnable(struct nk_thread *thread, int cpu, int admit);
 // force a scheduling event on the CPU
 void   nk_sched_kick_cpu(int cpu);
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+// turn dynamic ticks on or off for all CPUs (on at boot), returns
+// the previous setting - CPUs pick up the change at their next
+// scheduling event
+int    nk_sched_set_tickless(int on);
+// a timer has been started, so the CPU handling timers must
+// reconsider when it next needs to wake up
+void   nk_sched_tickless_timer_started(void);
+#endif
+
 // Put the thread to sleep / awaken it
 // these signal the scheduler that the thread is now on a 
 // non-scheduler queue (sleep) or is to be returned to a scheduler 
@@ -188,6 +238,13 @@ void nk_sched_dump_cores(int cpu);
 // -1 => all CPUs
 void nk_sched_dump_time(int cpu);
 
+#ifdef NAUT_CONFIG_SCHED_STATS
+// print out the latency histograms of the cpu, or reset them
+// -1 => all CPUs
+void nk_sched_dump_stats(int cpu);
+void nk_sched_reset_stats(int cpu);
+#endif
+
 // map a functor over all threads on a cpu.
 // cpu==-means all cpus
 void nk_sched_map_threads(int cpu, void (func)(struct nk_thread *t, void *state), void *state);
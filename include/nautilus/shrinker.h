@@ -0,0 +1,69 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#ifndef __SHRINKER_H__
+#define __SHRINKER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <nautilus/naut_types.h>
+
+//
+// Memory reclaim callbacks
+//
+// A subsystem that holds on to free memory for reuse (a pool, a
+// free list, a cache of objects) registers a shrinker so that the
+// kernel allocator can ask for the memory back.  Shrinkers are
+// invoked when an allocation fails, before it is retried, and by
+// the watermark thread (NAUT_CONFIG_KMEM_WATERMARK_THREAD) when
+// free memory runs low.
+//
+// count returns how many objects the subsystem could free right now.
+// scan frees up to nr of them and returns how many it freed.
+//
+// Both may be invoked from within a failing allocation, and thus
+// with arbitrary locks held, so they must not allocate or block, and
+// must use try-locks for any locks that are held across allocations.
+//
+
+#define NK_KMEM_SHRINKER_NAME_LEN 32
+
+typedef uint64_t (*nk_kmem_shrinker_count_t)(void);
+typedef uint64_t (*nk_kmem_shrinker_scan_t)(uint64_t nr);
+
+struct nk_kmem_shrinker;
+
+struct nk_kmem_shrinker *nk_kmem_register_shrinker(char *name,
+						   nk_kmem_shrinker_count_t count,
+						   nk_kmem_shrinker_scan_t scan);
+void nk_kmem_unregister_shrinker(struct nk_kmem_shrinker *s);
+
+// ask every shrinker for count >> priority of its objects
+// (0 => everything it can free), returns the number freed
+uint64_t nk_kmem_shrink(int priority);
+
+int nk_kmem_watermark_start(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
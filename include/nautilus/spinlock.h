@@ -33,6 +33,7 @@ extern "C" {
 #include <nautilus/cpu.h>
 #include <nautilus/cpu_state.h>
 #include <nautilus/instrument.h>
+#include <nautilus/lockstat.h>
 
 #define SPINLOCK_INITIALIZER 0
 
@@ -49,9 +50,7 @@ spin_lock (volatile spinlock_t * lock)
 {
     NK_PROFILE_ENTRY();
     
-    while (__sync_lock_test_and_set(lock, 1)) {
-	// spin away
-    }
+    NK_LOCKSTAT_SPIN(lock, __sync_lock_test_and_set(lock, 1), /* spin away */);
 
     NK_PROFILE_EXIT();
 }
@@ -60,14 +59,18 @@ spin_lock (volatile spinlock_t * lock)
 static inline int
 spin_try_lock(volatile spinlock_t *lock)
 {
-    return  __sync_lock_test_and_set(lock,1) ? -1 : 0 ;
+    if (__sync_lock_test_and_set(lock,1)) {
+	return -1;
+    }
+    NK_LOCKSTAT_ACQUIRED(lock, 0);
+    return 0;
 }
 
 static inline uint8_t
 spin_lock_irq_save (volatile spinlock_t * lock)
 {
     uint8_t flags = irq_disable_save();
-    PAUSE_WHILE(__sync_lock_test_and_set(lock, 1));
+    NK_LOCKSTAT_SPIN(lock, __sync_lock_test_and_set(lock, 1), pause());
     return flags;
 }
 
@@ -79,6 +82,7 @@ spin_try_lock_irq_save(volatile spinlock_t *lock, uint8_t *flags)
 	irq_enable_restore(*flags);
 	return -1;
     } else {
+	NK_LOCKSTAT_ACQUIRED(lock, 0);
 	return 0;
     }
 }
@@ -93,6 +97,7 @@ static inline void
 spin_unlock (volatile spinlock_t * lock) 
 {
     NK_PROFILE_ENTRY();
+    NK_LOCKSTAT_RELEASED(lock);
     __sync_lock_release(lock);
     NK_PROFILE_EXIT();
 }
@@ -100,6 +105,7 @@ spin_unlock (volatile spinlock_t * lock)
 static inline void
 spin_unlock_irq_restore (volatile spinlock_t * lock, uint8_t flags)
 {
+    NK_LOCKSTAT_RELEASED(lock);
     __sync_lock_release(lock);
     irq_enable_restore(flags);
 }
@@ -111,7 +117,7 @@ spin_unlock_irq_restore (volatile spinlock_t * lock, uint8_t flags)
 // this expects the struct, not the pointer to it
 #define NK_LOCK_GLBINIT(l) 
 #define NK_LOCK_T         nk_ticket_lock_t
-#define NK_LOCK_INIT(l)   nk_ticket_lock_deinit(l)
+#define NK_LOCK_INIT(l)   nk_ticket_lock_init(l)
 #define NK_LOCK(l)        nk_ticket_lock(l)
 #define NK_TRY_LOCK(l)    nk_ticket_trylock(l)
 #define NK_UNLOCK(l)      nk_ticket_unlock(l)
@@ -65,14 +65,19 @@ struct nk_task {
 
 
 // create and queue a task
-// cpu == -1 => any cpu
+// cpu == -1 => this cpu, from which other cpus can steal it
 // size == 0 => unknown size, otherwise worst case run time in ns
 // null return indicated the task cannot be queued
 struct nk_task *nk_task_produce(int cpu, uint64_t size_ns, void * (*f)(void*), void *input, uint64_t flags);
 
+// create and queue count tasks of f, one for each of inputs[], which
+// are written to tasks[] unless it is null (for detached tasks)
+// returns the number queued, which are the first ones
+uint64_t nk_task_produce_batch(int cpu, uint64_t size_ns, void * (*f)(void*), void **inputs, uint64_t count, uint64_t flags, struct nk_task **tasks);
+
 // dequeue a task, typically used internally
 // dequeuing a task does not execute it.
-// cpu = -1 => any cpu
+// cpu = -1 => any other cpu, nearest first
 // size = 0 => unsized first, then sized
 // size > 0 => search sized queue for up to search_limit steps
 struct nk_task *nk_task_consume(int cpu, uint64_t size, uint64_t search_limit);
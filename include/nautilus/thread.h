@@ -37,6 +37,7 @@ extern "C" {
 // Always included so we get the necessary type
 #include <nautilus/cachepart.h>
 #include <nautilus/aspace.h>
+#include <nautilus/mm.h>
 
 typedef uint64_t nk_stack_size_t;
     
@@ -121,6 +122,18 @@ void nk_thread_exit(void * retval) __attribute__((noreturn));
 // by the reaper logic in the scheduler
 void nk_thread_destroy(nk_thread_id_t t);
 
+// set up thread allocation - called by the scheduler on the BSP
+int nk_thread_init(void);
+
+#ifdef NAUT_CONFIG_THREAD_POOL
+// add a warm thread to a pool of the current cpu that is short of
+// them, returns nonzero if there was one (called by the idle threads)
+int nk_thread_pool_fill(void);
+// turn the pools on or off (they are on at boot), returns the
+// previous setting
+int nk_thread_pool_enable(int on);
+#endif
+
 
 #ifndef __LEGION__
 nk_thread_id_t nk_get_tid(void);
@@ -218,6 +231,8 @@ struct nk_thread {
 
     struct nk_virtual_console *vc;
 
+    struct nk_mem_policy mem_policy;    // where this thread's allocations come from
+
 #ifdef NAUT_CONFIG_GARBAGE_COLLECTION
     void  *gc_state;
 #endif
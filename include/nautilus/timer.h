@@ -106,4 +106,8 @@ void nk_timer_dump_timers();
 // called again at the latest.
 uint64_t nk_timer_handler(void);
 
+// The time (ns, as for time_ns) at which the earliest active timer
+// expires, or -1 if there is none
+uint64_t nk_timer_next_event(void);
+
 #endif
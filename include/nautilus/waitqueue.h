@@ -96,6 +96,8 @@ typedef struct nk_wait_queue {
 
 nk_wait_queue_t *nk_wait_queue_create(char *name);
 void             nk_wait_queue_destroy(nk_wait_queue_t *q);
+// for queues that are kept constructed and reused under new names
+void             nk_wait_queue_rename(nk_wait_queue_t *q, char *name);
 
 
 static inline nk_wait_queue_entry_t *nk_wait_queue_alloc_entry(nk_wait_queue_t *q, nk_thread_t *t)
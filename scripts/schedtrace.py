@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Convert the binary stream printed by the "schedtrace bin" shell
+# command into a timeline.  The input is any log (e.g., a serial port
+# capture) that contains the stream between its "schedtrace-begin"
+# and "schedtrace-end" lines.
+#
+# By default, all events of all cpus are printed in time order.  With
+# --chrome, a trace viewable in chrome://tracing or Perfetto is also
+# written, with the threads each cpu ran as spans and the other events
+# as instants.
+#
+# The layout of the stream is that of struct nk_sched_trace_rec in
+# include/nautilus/schedtrace.h and the headers in
+# src/nautilus/schedtrace.c
+#
+
+import sys
+import json
+import struct
+import argparse
+
+TRACE_MAGIC     = 0x54534b4e
+TRACE_CPU_MAGIC = 0x20555043
+
+EVENTS = {
+    1: "switch",
+    2: "wakeup",
+    3: "migrate",
+    4: "steal",
+    5: "admit",
+    6: "miss",
+}
+
+ADMIT_FAILED = 0x100
+CONSTRAINTS = {0: "aperiodic", 1: "sporadic", 2: "periodic"}
+
+
+def read_lines(f):
+    lines = []
+    inside = False
+    for line in f:
+        line = line.strip()
+        if line.endswith("schedtrace-begin"):
+            inside = True
+            lines = []
+        elif line.endswith("schedtrace-end"):
+            inside = False
+        elif inside:
+            pos = line.find("ST ")
+            if pos >= 0:
+                lines.append(bytes.fromhex(line[pos+3:].strip()))
+    return lines
+
+
+def parse(lines):
+    if not lines:
+        sys.exit("no schedtrace stream found")
+
+    magic, version, num_cpus, rec_size, tsc_hz, start_tsc = \
+        struct.unpack("<IIIIQQ", lines[0])
+    if magic != TRACE_MAGIC or version != 1:
+        sys.exit("bad stream header")
+
+    events = []
+    i = 1
+    while i < len(lines):
+        magic, cpu, count, lost, _ = struct.unpack("<IIQQQ", lines[i])
+        if magic != TRACE_CPU_MAGIC:
+            sys.exit("bad cpu header at line %d" % i)
+        if lost:
+            print("cpu %d lost %d records" % (cpu, lost), file=sys.stderr)
+        for rec in lines[i+1:i+1+count]:
+            tsc, event, other, tid, arg = struct.unpack("<QIIQQ", rec[:rec_size])
+            events.append((tsc, cpu, event, other, tid, arg))
+        i += 1 + count
+
+    events.sort()
+    return tsc_hz, start_tsc, events
+
+
+def describe(event, other, tid, arg):
+    name = EVENTS.get(event, "unknown")
+    if event == 1:
+        return "%-8s %d -> %d" % (name, arg, tid)
+    if event == 2:
+        return "%-8s %d on cpu %d" % (name, tid, other)
+    if event == 3:
+        return "%-8s %d cpu %d -> %d" % (name, tid, arg, other)
+    if event == 4:
+        return "%-8s %d from cpu %d" % (name, tid, other)
+    if event == 5:
+        return "%-8s %d %s%s" % (name, tid,
+                                 CONSTRAINTS.get(arg & 0xff, "?"),
+                                 " FAILED" if arg & ADMIT_FAILED else "")
+    if event == 6:
+        return "%-8s %d late by %d ns" % (name, tid, arg)
+    return "%-8s %d 0x%x" % (name, tid, arg)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="schedtrace stream to timeline")
+    parser.add_argument("log", nargs="?", help="log containing the stream (default: stdin)")
+    parser.add_argument("--chrome", metavar="FILE", help="also write a Chrome trace")
+    args = parser.parse_args()
+
+    f = open(args.log, errors="replace") if args.log else sys.stdin
+    tsc_hz, start_tsc, events = parse(read_lines(f))
+
+    if tsc_hz:
+        to_us = lambda tsc: (tsc - start_tsc) * 1e6 / tsc_hz
+        unit = "us"
+    else:
+        to_us = lambda tsc: float(tsc - start_tsc)
+        unit = "cycles"
+
+    print("%14s  cpu  event (time in %s)" % ("time", unit))
+    for tsc, cpu, event, other, tid, arg in events:
+        print("%14.3f  %3d  %s" % (to_us(tsc), cpu, describe(event, other, tid, arg)))
+
+    if args.chrome:
+        trace = []
+        running = {}
+        for tsc, cpu, event, other, tid, arg in events:
+            ts = to_us(tsc)
+            if event == 1:
+                if cpu in running:
+                    prev_tid, prev_ts = running[cpu]
+                    trace.append({"name": "tid %d" % prev_tid, "ph": "X",
+                                  "pid": 0, "tid": cpu, "ts": prev_ts,
+                                  "dur": ts - prev_ts})
+                running[cpu] = (tid, ts)
+            else:
+                trace.append({"name": describe(event, other, tid, arg), "ph": "i",
+                              "s": "t", "pid": 0, "tid": cpu, "ts": ts})
+        # the threads still running end with the trace
+        end = to_us(events[-1][0]) if events else 0
+        for cpu, (tid, ts) in running.items():
+            trace.append({"name": "tid %d" % tid, "ph": "X", "pid": 0,
+                          "tid": cpu, "ts": ts, "dur": end - ts})
+        for cpu in range(max([e[1] for e in events] + [0]) + 1):
+            trace.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+                          "args": {"name": "cpu %d" % cpu}})
+        with open(args.chrome, "w") as out:
+            json.dump({"traceEvents": trace}, out)
+
+
+if __name__ == "__main__":
+    main()
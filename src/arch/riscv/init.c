@@ -48,6 +48,7 @@
 #include <nautilus/percpu.h>
 #include <nautilus/prog.h>
 #include <nautilus/random.h>
+#include <nautilus/rcu.h>
 #include <nautilus/semaphore.h>
 #include <nautilus/shell.h>
 #include <nautilus/smp.h>
@@ -280,6 +281,8 @@ void init_full(unsigned long hartid, unsigned long fdt) {
 
   nk_vc_init();
 
+  nk_rcu_init();
+
   nk_fs_init();
 
   // nk_linker_init(naut);
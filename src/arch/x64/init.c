@@ -51,6 +51,8 @@
 #include <nautilus/acpi.h>
 #include <nautilus/atomic.h>
 #include <nautilus/mm.h>
+#include <nautilus/shrinker.h>
+#include <nautilus/rcu.h>
 #include <nautilus/libccompat.h>
 #include <nautilus/barrier.h>
 #include <nautilus/vc.h>
@@ -372,6 +374,9 @@ init (unsigned long mbd,
      * allocated in the boot mem allocator are kept reserved */
     mm_boot_kmem_init();
 
+    /* and kmem's own caches can now be shrunk */
+    nk_kmem_shrinkers_init();
+
 #ifdef NAUT_CONFIG_ASPACES
     nk_aspace_init();
 #endif
@@ -478,6 +483,11 @@ init (unsigned long mbd,
     vga_init();
     serial_init();
 
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+    /* set up the rest of memory, together with the APs */
+    nk_kmem_init_deferred();
+#endif
+
     nk_sched_start();
     
 #ifdef NAUT_CONFIG_FIBER_ENABLE
@@ -495,6 +505,12 @@ init (unsigned long mbd,
 
     nk_vc_init();
 
+    nk_rcu_init();
+
+#ifdef NAUT_CONFIG_KMEM_WATERMARK_THREAD
+    nk_kmem_watermark_start();
+#endif
+
     
 #ifdef NAUT_CONFIG_VIRTUAL_CONSOLE_CHARDEV_CONSOLE
     nk_vc_start_chardev_console(NAUT_CONFIG_VIRTUAL_CONSOLE_CHARDEV_CONSOLE_NAME);
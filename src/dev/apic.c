@@ -486,6 +486,19 @@ apic_timer_setup (struct apic_dev * apic, uint32_t quantum_ms)
 
     calibrate_apic_timer(apic);
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    // A deadline is an absolute TSC value, so a dynamic tick can be
+    // programmed exactly, and an idle timer can be left disarmed
+    if (tscdeadline) {
+	apic->tsc_deadline = 1;
+	apic->current_deadline = 0;
+	apic_write(apic, APIC_REG_LVTT, APIC_TIMER_TSCDLINE | APIC_DEL_MODE_FIXED | APIC_TIMER_INT_VEC);
+	// the LVT write must be visible before the first deadline write
+	__asm__ __volatile__ ("mfence" : : : "memory");
+	APIC_PRINT("APIC 0x%x timer is in TSC-deadline mode\n", apic->id);
+    }
+#endif
+
     apic_set_oneshot_timer(apic,apic_realtime_to_ticks(apic,quantum_ms*1000000ULL));
 }
 
@@ -963,8 +976,34 @@ apic_init (struct cpu * core)
 
 
 
+// the TSC value at which a timer of this many ticks from now fires, 
+// 0 (disarmed) for the "infinite" -1
+static inline uint64_t apic_ticks_to_deadline(struct apic_dev *apic, uint32_t ticks)
+{
+    if (ticks == (uint32_t)-1) {
+	return 0;
+    }
+    if (!ticks) {
+	ticks = 1;
+    }
+    return rdtsc() + ticks * apic->cycles_per_tick;
+}
+
+static inline void apic_set_deadline(struct apic_dev *apic, uint64_t deadline)
+{
+    _apic_msr_write(APIC_TSC_DEADLINE_MSR, deadline);
+    apic->current_deadline = deadline;
+    apic->timer_set = !!deadline;
+}
+
 void apic_set_oneshot_timer(struct apic_dev *apic, uint32_t ticks) 
 {
+    if (apic->tsc_deadline) {
+	apic_set_deadline(apic, apic_ticks_to_deadline(apic,ticks));
+	apic->current_ticks = ticks;
+	return;
+    }
+
     apic_write(apic, APIC_REG_LVTT, APIC_TIMER_ONESHOT | APIC_DEL_MODE_FIXED | APIC_TIMER_INT_VEC);
     apic_write(apic, APIC_REG_TMDCR, APIC_TIMER_DIVCODE);
 
@@ -981,6 +1020,22 @@ void apic_update_oneshot_timer(struct apic_dev *apic, uint32_t ticks,
 {
     if (!apic->timer_set) { 
 	apic_set_oneshot_timer(apic,ticks);
+    } else if (apic->tsc_deadline) {
+	// deadlines are absolute, so compare them directly, with
+	// a disarmed timer (0) being the latest of all
+	uint64_t deadline = apic_ticks_to_deadline(apic,ticks);
+	switch (cond) {
+	case UNCOND:
+	    apic_set_deadline(apic,deadline);
+	    break;
+	case IF_EARLIER:
+	    if (deadline-1 < apic->current_deadline-1) { apic_set_deadline(apic,deadline); }
+	    break;
+	case IF_LATER:
+	    if (deadline-1 > apic->current_deadline-1) { apic_set_deadline(apic,deadline); }
+	    break;
+	}
+	apic->current_ticks = ticks;
     } else {
 	switch (cond) { 
 	case UNCOND:
@@ -1363,6 +1418,7 @@ int apic_timer_handler(excp_entry_t * excp, excp_vec_t vec, void *state)
     apic->timer_count++;
 
     apic->timer_set = 0;
+    apic->current_deadline = 0;
 
     // do all our callbacks
     // note that currently all cores see the events
@@ -23,6 +23,7 @@
 
 #include <nautilus/nautilus.h>
 #include <nautilus/spinlock.h>
+#include <nautilus/rcu.h>
 #include <nautilus/dev.h>
 #include <nautilus/thread.h>
 #include <nautilus/waitqueue.h>
@@ -39,9 +40,12 @@
 
 static spinlock_t state_lock;
 
+// lookups take no lock, (un)registrations serialize on state_lock
 #define STATE_LOCK_CONF uint8_t _state_lock_flags
 #define STATE_LOCK() _state_lock_flags = spin_lock_irq_save(&state_lock)
 #define STATE_UNLOCK() spin_unlock_irq_restore(&state_lock, _state_lock_flags);
+#define STATE_READ_LOCK() nk_rcu_read_lock()
+#define STATE_READ_UNLOCK() nk_rcu_read_unlock();
 
 static struct list_head dev_list;
 
@@ -95,7 +99,7 @@ struct nk_dev *nk_dev_register(char *name, nk_dev_type_t type, uint64_t flags, s
     d->interface = inter;
 
     STATE_LOCK();
-    list_add(&d->dev_list_node,&dev_list);
+    list_add_rcu(&d->dev_list_node,&dev_list);
     STATE_UNLOCK();
     
     INFO("Added device with name %s, type %lu, flags 0x%lx\n", d->name, d->type,d->flags);
@@ -108,9 +112,12 @@ int            nk_dev_unregister(struct nk_dev *d)
     STATE_LOCK_CONF;
     
     STATE_LOCK();
-    list_del(&d->dev_list_node);
+    list_del_rcu(&d->dev_list_node);
     STATE_UNLOCK();
 
+    // lookups may still be looking at it
+    nk_synchronize_rcu();
+
     nk_wait_queue_wake_all(d->waiting_threads);
     nk_wait_queue_destroy(d->waiting_threads);
     INFO("Unregistered device %s\n",d->name);
@@ -122,15 +129,14 @@ struct nk_dev *nk_dev_find(char *name)
 {
     struct list_head *cur;
     struct nk_dev *target=0;
-    STATE_LOCK_CONF;
-    STATE_LOCK();
-    list_for_each(cur,&dev_list) {
+    STATE_READ_LOCK();
+    list_for_each_rcu(cur,&dev_list) {
 	if (!strncasecmp(list_entry(cur,struct nk_dev,dev_list_node)->name,name,DEV_NAME_LEN)) { 
 	    target = list_entry(cur,struct nk_dev, dev_list_node);
 	    break;
 	}
     }
-    STATE_UNLOCK();
+    STATE_READ_UNLOCK();
     return target;
 }
 
@@ -160,9 +166,8 @@ void nk_dev_signal(struct nk_dev *d)
 void nk_dev_dump_devices()
 {
     struct list_head *cur;
-    STATE_LOCK_CONF;
-    STATE_LOCK();
-    list_for_each(cur,&dev_list) {
+    STATE_READ_LOCK();
+    list_for_each_rcu(cur,&dev_list) {
 	struct nk_dev *d = list_entry(cur,struct nk_dev, dev_list_node);
 	nk_vc_printf("%s: %s flags=0x%lx interface=%p state=%p\n",
 		     d->name, 
@@ -179,7 +184,7 @@ void nk_dev_dump_devices()
 		     d->state);
 		     
     }
-    STATE_UNLOCK();
+    STATE_READ_UNLOCK();
 }
 
 
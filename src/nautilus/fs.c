@@ -25,6 +25,7 @@
  */
 #include <nautilus/nautilus.h>
 #include <nautilus/fs.h>
+#include <nautilus/rcu.h>
 #include <nautilus/testfs.h>
 #include <nautilus/shell.h>
 #include <nautilus/blkdev.h>
@@ -38,9 +39,12 @@
 #define DEBUG(fmt, args...)
 #endif
 
+// lookups take no lock, (un)registrations serialize on state_lock
 #define STATE_LOCK_CONF uint8_t _state_lock_flags
 #define STATE_LOCK() _state_lock_flags = spin_lock_irq_save(&state_lock)
 #define STATE_UNLOCK() spin_unlock_irq_restore(&state_lock, _state_lock_flags);
+#define STATE_READ_LOCK() nk_rcu_read_lock()
+#define STATE_READ_UNLOCK() nk_rcu_read_unlock();
 
 #define FILE_LOCK_CONF uint8_t _file_lock_flags
 #define FILE_LOCK(fd) _file_lock_flags = spin_lock_irq_save(&fd->lock)
@@ -227,7 +231,7 @@ struct nk_fs *nk_fs_register(char *name, uint64_t flags, struct nk_fs_int *inter
     f->state = state;
 
     STATE_LOCK();
-    list_add(&f->fs_list_node,&fs_list);
+    list_add_rcu(&f->fs_list_node,&fs_list);
     STATE_UNLOCK();
     
     INFO("Added filesystem with name %s and flags 0x%lx\n", f->name,f->flags);
@@ -239,8 +243,9 @@ int            nk_fs_unregister(struct nk_fs *f)
 {
     STATE_LOCK_CONF;
     STATE_LOCK();
-    list_del(&f->fs_list_node);
+    list_del_rcu(&f->fs_list_node);
     STATE_UNLOCK();
+    nk_synchronize_rcu();
     INFO("Unregistered filesystem %s\n",f->name);
     free(f);
     return 0;
@@ -250,7 +255,7 @@ static struct nk_fs *__fs_find(char *name)
 {
     struct list_head *cur;
     struct nk_fs *target=0;
-    list_for_each(cur,&fs_list) {
+    list_for_each_rcu(cur,&fs_list) {
 	if (!strncasecmp(list_entry(cur,struct nk_fs,fs_list_node)->name,name,FS_NAME_LEN)) { 
 	    target = list_entry(cur,struct nk_fs, fs_list_node);
 	    break;
@@ -261,11 +266,10 @@ static struct nk_fs *__fs_find(char *name)
 
 struct nk_fs *nk_fs_find(char *name)
 {
-    STATE_LOCK_CONF;
     struct nk_fs *fs=0;
-    STATE_LOCK();
+    STATE_READ_LOCK();
     fs = __fs_find(name);
-    STATE_UNLOCK();
+    STATE_READ_UNLOCK();
     return fs;
 }
 
@@ -293,7 +297,6 @@ static char *decode_path(char *path, char *fs_name)
 
 int nk_fs_stat(char *path, struct nk_fs_stat *st)
 {
-    STATE_LOCK_CONF;
     struct nk_fs *fs;
     char fs_name[strlen(path)+1];
 
@@ -301,9 +304,9 @@ int nk_fs_stat(char *path, struct nk_fs_stat *st)
 
     DEBUG("decode has fs_name %s path %s\n", fs_name,path);
 
-    STATE_LOCK();
+    STATE_READ_LOCK();
     fs = __fs_find(fs_name);
-    STATE_UNLOCK();
+    STATE_READ_UNLOCK();
 
     if (!fs) { 
 	ERROR("Cannot find filesystem named %s\n",fs_name);
@@ -343,9 +346,9 @@ nk_fs_fd_t nk_fs_open(char *path, int flags, int mode)
 
     path=decode_path(path,fs_name);
 
-    STATE_LOCK();
+    STATE_READ_LOCK();
     fs = __fs_find(fs_name);
-    STATE_UNLOCK();
+    STATE_READ_UNLOCK();
 
     if (!fs) { 
 	ERROR("Cannot find filesystem named %s\n",fs_name);
@@ -526,16 +529,15 @@ ssize_t nk_fs_tell(nk_fs_fd_t fd)
 
 void nk_fs_dump_filesystems()
 {
-    STATE_LOCK_CONF;
     struct list_head *cur;
 
-    STATE_LOCK();
+    STATE_READ_LOCK();
 
-    list_for_each(cur,&fs_list) {
+    list_for_each_rcu(cur,&fs_list) {
 	struct nk_fs *fs = list_entry(cur,struct nk_fs,fs_list_node);
 	nk_vc_printf("%s:\n", fs->name);
     }
-    STATE_UNLOCK();
+    STATE_READ_UNLOCK();
 }
 
 
@@ -24,103 +24,75 @@
 #include <nautilus/nautilus.h>
 #include <nautilus/future.h>
 
-#define NUM_SEED_FUTURES NAUT_CONFIG_MAX_CPUS
+#include <nautilus/kmem_cache.h>
 
-static spinlock_t state_lock;
+#define NUM_SEED_FUTURES NAUT_CONFIG_MAX_CPUS
 
 // number of the next future
 static uint64_t         future_num=0;
 
-// number of available  futures in the pool
-// ideally will be per-cpu
-static uint64_t         future_free_count=0;
-static struct list_head future_free_list;
-
-#define STATE_LOCK_CONF uint8_t _state_lock_flags
-#define STATE_LOCK() _state_lock_flags = spin_lock_irq_save(&state_lock)
-#define STATE_UNLOCK() spin_unlock_irq_restore(&state_lock, _state_lock_flags);
+// free futures are kept constructed, that is, with their wait queue
+static struct nk_kmem_cache *future_cache;
 
-
-// must be called with state lock held, or on init
-// does explicit allocation but does not
-static nk_future_t * _nk_future_alloc()
+static int future_ctor(void *obj)
 {
+    nk_future_t *f = (nk_future_t *)obj;
     char buf[NK_WAIT_QUEUE_NAME_LEN];
 
-    snprintf(buf,NK_WAIT_QUEUE_NAME_LEN,"future%lu",future_num++);
+    snprintf(buf,NK_WAIT_QUEUE_NAME_LEN,"future%lu",__sync_fetch_and_add(&future_num,1));
 
     FU_DEBUG("base alloc wq name %s\n",buf);
     
-    nk_wait_queue_t *wq = nk_wait_queue_create(buf);
-    if (!wq) {
-	FU_ERROR("failed to allocate wq\n");
-	return 0;
-    }
-    
-    nk_future_t *f = malloc(sizeof(*f));
+    memset(f,0,sizeof(*f));
 
-    if (!f) {
-	FU_ERROR("Failed to allocate future\n");
-	free(wq);
-	return 0;
+    f->waitqueue = nk_wait_queue_create(buf);
+
+    if (!f->waitqueue) {
+	FU_ERROR("failed to allocate wq\n");
+	return -1;
     }
 
-    memset(f,0,sizeof(*f));
+    INIT_LIST_HEAD(&f->node);
 
-    f->waitqueue = wq;
+    f->state = NK_FUTURE_FREE;
 
-    INIT_LIST_HEAD(&f->node);
+    return 0;
+}
 
-    f->state = NK_FUTURE_IN_PROGRESS;
+static void future_dtor(void *obj)
+{
+    nk_future_t *f = (nk_future_t *)obj;
 
-    FU_DEBUG("allocation returns %p (%s)\n",f,f->waitqueue->name);
-    
-    return f;
+    nk_wait_queue_destroy(f->waitqueue);
 }
 
 nk_future_t * nk_future_alloc()
 {
-    STATE_LOCK_CONF;
-
     FU_DEBUG("alloc\n");
     
-    STATE_LOCK();
+    nk_future_t *f = nk_kmem_cache_alloc(future_cache);
 
-    if (list_empty(&future_free_list)) {
-	STATE_UNLOCK();
-	return _nk_future_alloc();
+    if (!f) {
+	FU_ERROR("Failed to allocate future\n");
+	return 0;
     }
 
-    nk_future_t *f = list_first_entry(&future_free_list, struct nk_future, node);
-    list_del_init(&f->node);
-    future_free_count--;
-
-    STATE_UNLOCK();
+    INIT_LIST_HEAD(&f->node);
 
     f->state = NK_FUTURE_IN_PROGRESS;
 
-    FU_DEBUG("fast alloc returns %p (%s)\n",f, f->waitqueue->name);
+    FU_DEBUG("alloc returns %p (%s)\n",f, f->waitqueue->name);
     
     return f;
 }
 	
 
-//
-// Note that this never shrinks the pool
-//
 void nk_future_free(nk_future_t *f)
 {
-    STATE_LOCK_CONF;
-
     f->state = NK_FUTURE_FREE;
     f->result = 0;
     
-    STATE_LOCK();
-    
-    list_add(&f->node,&future_free_list);
-    future_free_count++;
-
-    STATE_UNLOCK();
+    nk_kmem_cache_free(future_cache,f);
 }
 
 static int cond_check(void *s)
@@ -141,20 +113,28 @@ int nk_future_wait_block(nk_future_t *f, void **result)
 }
 
 
-// ideally this would create a per-cpu pool, but for
-// now we create one global pool
 int nk_future_init()
 {
-    int i;
-    INIT_LIST_HEAD(&future_free_list);
-    spinlock_init(&state_lock);
+    nk_future_t *seed[NUM_SEED_FUTURES];
+    int i, n;
+
+    future_cache = nk_kmem_cache_create("future",sizeof(nk_future_t),0,future_ctor,future_dtor);
+
+    if (!future_cache) {
+	FU_ERROR("failed to create cache\n");
+	return -1;
+    }
+
     // seed the pool
     for (i=0;i<NUM_SEED_FUTURES;i++) {
-	nk_future_t *f = _nk_future_alloc();
-	f->state=NK_FUTURE_FREE;
-	list_add(&f->node,&future_free_list);
+	if (!(seed[i] = nk_future_alloc())) {
+	    break;
+	}
+    }
+    for (n=i;i>0;) {
+	nk_future_free(seed[--i]);
     }
-    FU_INFO("inited (seeded pool with %d futures)\n", i);
+    FU_INFO("inited (seeded pool with %d futures)\n", n);
 
     return 0;
 }
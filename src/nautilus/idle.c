@@ -85,6 +85,16 @@ idle (void * in, void ** out)
 	} while (task);
 #endif
 	
+#ifdef NAUT_CONFIG_KMEM_ZERO_POOL
+	// zero memory for later zeroing allocations while we have nothing to do
+	nk_kmem_zero_pool_fill();
+#endif
+
+#ifdef NAUT_CONFIG_THREAD_POOL
+	// and warm up threads for later thread creations
+	nk_thread_pool_fill();
+#endif
+
 #if NAUT_CONFIG_WORK_STEALING
 	runtime = nk_sched_get_runtime(get_cur_thread());
 	if ((runtime - last_steal) > (NAUT_CONFIG_WORK_STEALING_INTERVAL_MS*1000000ULL)) {
@@ -0,0 +1,441 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/cpu.h>
+#include <nautilus/irq.h>
+#include <nautilus/mm.h>
+#include <nautilus/lockstat.h>
+#include <nautilus/shell.h>
+
+//
+// Nothing on the recording path may take a lock, since it is called
+// from the locks
+//
+
+#define LS_ERROR(fmt, args...) ERROR_PRINT("lockstat: " fmt, ##args)
+#define LS_INFO(fmt, args...)  INFO_PRINT("lockstat: " fmt, ##args)
+
+#define SITE_SLOTS   8192    // initialized locks we remember, power of two
+#define CLASS_SLOTS  1024    // classes per cpu, power of two
+#define HELD_SLOTS   32      // locks a cpu can hold and time at once
+
+// a lock's address => where it was initialized
+// slots are claimed and never given back, deinit just forgets the site
+struct site_slot {
+    void *lock;
+    void *site;
+};
+
+struct lock_class {
+    void     *key;          // site, or lock if anon
+    int       anon;
+    uint64_t  acquires;
+    uint64_t  contended;
+    uint64_t  wait_total;
+    uint64_t  wait_max;
+    uint64_t  hold_max;
+};
+
+struct held_lock {
+    void              *lock;
+    struct lock_class *class;
+    uint64_t           start;
+};
+
+struct cpu_table {
+    uint64_t          dropped;   // acquisitions that found no free class slot
+    int               num_held;
+    struct held_lock  held[HELD_SLOTS];
+    struct lock_class classes[CLASS_SLOTS];
+};
+
+volatile int nk_lockstat_on = 0;
+
+static struct site_slot  sites[SITE_SLOTS];
+static uint64_t          sites_full;
+
+// tables are never freed once allocated, since a cpu may be recording
+// into one as lockstat is stopped
+static struct cpu_table *tables[NAUT_CONFIG_MAX_CPUS];
+
+
+static inline uint64_t hash_ptr(void *p)
+{
+    return ((uint64_t)p >> 3) * 0x9e3779b97f4a7c15ULL;
+}
+
+void nk_lockstat_init_lock(void *lock, void *site)
+{
+    uint64_t h = hash_ptr(lock);
+    struct site_slot *s;
+    void *cur;
+    int i;
+
+    for (i=0;i<SITE_SLOTS;i++) {
+	s = &sites[(h+i) & (SITE_SLOTS-1)];
+	cur = s->lock;
+	if (!cur) {
+	    cur = __sync_val_compare_and_swap(&s->lock,0,lock);
+	}
+	if (!cur || cur==lock) {
+	    s->site = site;
+	    return;
+	}
+    }
+
+    // the lock will be its own class
+    __sync_fetch_and_add(&sites_full,1);
+}
+
+void nk_lockstat_deinit_lock(void *lock)
+{
+    uint64_t h = hash_ptr(lock);
+    struct site_slot *s;
+    int i;
+
+    for (i=0;i<SITE_SLOTS;i++) {
+	s = &sites[(h+i) & (SITE_SLOTS-1)];
+	if (!s->lock) {
+	    return;
+	}
+	if (s->lock==lock) {
+	    s->site = 0;
+	    return;
+	}
+    }
+}
+
+static void *lock_site(void *lock)
+{
+    uint64_t h = hash_ptr(lock);
+    struct site_slot *s;
+    int i;
+
+    for (i=0;i<SITE_SLOTS;i++) {
+	s = &sites[(h+i) & (SITE_SLOTS-1)];
+	if (!s->lock) {
+	    return 0;
+	}
+	if (s->lock==lock) {
+	    return s->site;
+	}
+    }
+
+    return 0;
+}
+
+static struct lock_class *find_class(struct cpu_table *t, void *lock)
+{
+    void *key = lock_site(lock);
+    int anon = !key;
+    struct lock_class *c;
+    uint64_t h;
+    int i;
+
+    if (anon) {
+	key = lock;
+    }
+
+    h = hash_ptr(key);
+
+    for (i=0;i<CLASS_SLOTS;i++) {
+	c = &t->classes[(h+i) & (CLASS_SLOTS-1)];
+	if (c->key==key) {
+	    return c;
+	}
+	if (!c->key) {
+	    c->key = key;
+	    c->anon = anon;
+	    return c;
+	}
+    }
+
+    return 0;
+}
+
+void nk_lockstat_acquired(void *lock, uint64_t start)
+{
+    struct cpu_table *t;
+    struct lock_class *c;
+    uint64_t now = rdtsc();
+    uint64_t wait;
+    uint8_t flags;
+
+    flags = irq_disable_save();
+
+    t = tables[my_cpu_id()];
+
+    if (!t) {
+	goto out;
+    }
+
+    c = find_class(t,lock);
+
+    if (!c) {
+	t->dropped++;
+	goto out;
+    }
+
+    c->acquires++;
+
+    if (start) {
+	wait = now - start;
+	c->contended++;
+	c->wait_total += wait;
+	if (wait > c->wait_max) {
+	    c->wait_max = wait;
+	}
+    }
+
+    // if the stack is full, forget the oldest, which is most likely
+    // one that was released on some other cpu
+    if (t->num_held==HELD_SLOTS) {
+	memmove(&t->held[0],&t->held[1],(HELD_SLOTS-1)*sizeof(struct held_lock));
+	t->num_held--;
+    }
+
+    t->held[t->num_held].lock = lock;
+    t->held[t->num_held].class = c;
+    t->held[t->num_held].start = now;
+    t->num_held++;
+
+ out:
+    irq_enable_restore(flags);
+}
+
+void nk_lockstat_released(void *lock)
+{
+    struct cpu_table *t;
+    struct held_lock *h;
+    uint64_t hold;
+    uint8_t flags;
+    int i;
+
+    flags = irq_disable_save();
+
+    t = tables[my_cpu_id()];
+
+    if (!t) {
+	goto out;
+    }
+
+    // locks are usually released in the reverse order of acquisition
+    for (i=t->num_held-1;i>=0;i--) {
+	h = &t->held[i];
+	if (h->lock==lock) {
+	    hold = rdtsc() - h->start;
+	    if (hold > h->class->hold_max) {
+		h->class->hold_max = hold;
+	    }
+	    memmove(h,h+1,(t->num_held-i-1)*sizeof(struct held_lock));
+	    t->num_held--;
+	    break;
+	}
+    }
+
+ out:
+    irq_enable_restore(flags);
+}
+
+int nk_lockstat_start(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int i;
+
+    if (nk_lockstat_on) {
+	return 0;
+    }
+
+    for (i=0;i<sys->num_cpus;i++) {
+	if (!tables[i]) {
+	    tables[i] = malloc_specific(sizeof(struct cpu_table), i);
+	    if (!tables[i]) {
+		LS_ERROR("Cannot allocate table for cpu %d\n", i);
+		return -1;
+	    }
+	}
+	memset(tables[i],0,sizeof(struct cpu_table));
+    }
+
+    __sync_synchronize();
+    nk_lockstat_on = 1;
+
+    LS_INFO("Started\n");
+
+    return 0;
+}
+
+void nk_lockstat_stop(void)
+{
+    nk_lockstat_on = 0;
+    __sync_synchronize();
+}
+
+
+static int by_contended(struct lock_class *a, struct lock_class *b)
+{
+    return a->contended > b->contended ||
+	(a->contended == b->contended && a->wait_total > b->wait_total);
+}
+
+static int by_wait(struct lock_class *a, struct lock_class *b)
+{
+    return a->wait_total > b->wait_total;
+}
+
+static int by_hold(struct lock_class *a, struct lock_class *b)
+{
+    return a->hold_max > b->hold_max;
+}
+
+// merge the cpus' tables and print the top classes
+static void dump(int max, int (*before)(struct lock_class *, struct lock_class *))
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct lock_class *all, *c, *m, tmp;
+    uint64_t dropped = 0;
+    uint64_t slots = 1;
+    int n = 0, cpu, i, j;
+
+    while (slots < 2*CLASS_SLOTS*sys->num_cpus) {
+	slots <<= 1;
+    }
+
+    all = malloc(sizeof(struct lock_class)*slots);
+
+    if (!all) {
+	nk_vc_printf("Cannot allocate merge table\n");
+	return;
+    }
+
+    memset(all,0,sizeof(struct lock_class)*slots);
+
+    for (cpu=0;cpu<sys->num_cpus;cpu++) {
+	if (!tables[cpu]) {
+	    continue;
+	}
+	dropped += tables[cpu]->dropped;
+	for (i=0;i<CLASS_SLOTS;i++) {
+	    c = &tables[cpu]->classes[i];
+	    if (!c->key) {
+		continue;
+	    }
+	    for (j=0;;j++) {
+		m = &all[(hash_ptr(c->key)+j) & (slots-1)];
+		if (!m->key || m->key==c->key) {
+		    break;
+		}
+	    }
+	    if (!m->key) {
+		*m = *c;
+	    } else {
+		m->acquires += c->acquires;
+		m->contended += c->contended;
+		m->wait_total += c->wait_total;
+		if (c->wait_max > m->wait_max) {
+		    m->wait_max = c->wait_max;
+		}
+		if (c->hold_max > m->hold_max) {
+		    m->hold_max = c->hold_max;
+		}
+	    }
+	}
+    }
+
+    // pack the classes at the front
+    for (i=0;i<slots;i++) {
+	if (all[i].key) {
+	    all[n++] = all[i];
+	}
+    }
+
+    // we only print the top few, so select them rather than sort all
+    for (i=0;i<n && i<max;i++) {
+	for (j=i+1;j<n;j++) {
+	    if (before(&all[j],&all[i])) {
+		tmp = all[i];
+		all[i] = all[j];
+		all[j] = tmp;
+	    }
+	}
+    }
+
+    nk_vc_printf("lockstat is %s, %d classes, %lu acquisitions dropped, %lu locks without site slots\n",
+		 nk_lockstat_on ? "on" : "off", n, dropped, sites_full);
+    nk_vc_printf("%-4s %-18s %12s %12s %14s %12s %12s %12s\n",
+		 "", "class", "acquires", "contended", "wait total", "wait avg", "wait max", "hold max");
+
+    for (i=0;i<n && i<max;i++) {
+	c = &all[i];
+	nk_vc_printf("%-4s 0x%016lx %12lu %12lu %14lu %12lu %12lu %12lu\n",
+		     c->anon ? "lock" : "site", (uint64_t)c->key,
+		     c->acquires, c->contended, c->wait_total,
+		     c->contended ? c->wait_total/c->contended : 0,
+		     c->wait_max, c->hold_max);
+    }
+
+    free(all);
+}
+
+static int
+handle_lockstat (char * buf, void * priv)
+{
+    int max = 20;
+    char how[16];
+
+    if (!strcmp(buf,"lockstat start")) {
+	if (nk_lockstat_start()) {
+	    nk_vc_printf("Failed to start lockstat\n");
+	}
+	return 0;
+    }
+
+    if (!strcmp(buf,"lockstat stop")) {
+	nk_lockstat_stop();
+	return 0;
+    }
+
+    how[0] = 0;
+
+    if (sscanf(buf,"lockstat %d %15s",&max,how)>=1 || !strcmp(buf,"lockstat")) {
+	if (!how[0] || !strcmp(how,"contended")) {
+	    dump(max,by_contended);
+	} else if (!strcmp(how,"wait")) {
+	    dump(max,by_wait);
+	} else if (!strcmp(how,"hold")) {
+	    dump(max,by_hold);
+	} else {
+	    nk_vc_printf("unknown order %s\n", how);
+	}
+	return 0;
+    }
+
+    nk_vc_printf("unknown lockstat request\n");
+
+    return 0;
+}
+
+static struct shell_cmd_impl lockstat_impl = {
+    .cmd      = "lockstat",
+    .help_str = "lockstat [start | stop | count [contended|wait|hold]]",
+    .handler  = handle_lockstat,
+};
+nk_register_shell_cmd(lockstat_impl);
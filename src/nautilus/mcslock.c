@@ -0,0 +1,40 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+#include <nautilus/nautilus.h>
+#include <nautilus/mcslock.h>
+
+// these are out of line so that lockstat can see who called them
+
+void
+nk_mcs_lock_init (nk_mcs_lock_t * l)
+{
+    l->next = NULL;
+    l->locked = 0;
+    NK_LOCKSTAT_INIT(l);
+}
+
+
+void
+nk_mcs_lock_deinit (nk_mcs_lock_t * l)
+{
+    l->next = NULL;
+    l->locked = 0;
+    NK_LOCKSTAT_DEINIT(l);
+}
@@ -558,6 +558,7 @@ mm_boot_kmem_init (void)
     BMM_PRINT("    =======\n");
     BMM_PRINT("    [TOTAL] (%lu.%lu MB)\n", count/1000000, count%1000000);
 
+    nk_kmem_boot_time("boot memory added");
 }
 
 void 
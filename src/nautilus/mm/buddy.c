@@ -200,10 +200,11 @@ find_buddy (struct buddy_mempool *mp, struct block *block, ulong_t order)
 }
 
 
-struct buddy_mempool *
-buddy_init (ulong_t base_addr,
-            ulong_t pool_order,
-            ulong_t min_order)
+static struct buddy_mempool *
+buddy_create (ulong_t base_addr,
+              ulong_t pool_order,
+              ulong_t min_order,
+              int     clear_tags)
 {
     struct buddy_mempool *mp;
     ulong_t i;
@@ -260,7 +261,9 @@ buddy_init (ulong_t base_addr,
 		BITS_TO_LONGS(mp->num_blocks)*sizeof(long));
 
     /* Initially mark all minimum-sized blocks as allocated */
-    bitmap_zero(mp->tag_bits, mp->num_blocks);
+    if (clear_tags) {
+        bitmap_zero(mp->tag_bits, mp->num_blocks);
+    }
 
     BUDDY_DEBUG("Created memory pool %p\n",mp);
 
@@ -268,6 +271,54 @@ buddy_init (ulong_t base_addr,
 }
 
 
+struct buddy_mempool *
+buddy_init (ulong_t base_addr,
+            ulong_t pool_order,
+            ulong_t min_order)
+{
+    return buddy_create(base_addr, pool_order, min_order, 1);
+}
+
+
+/**
+ * Creates a pool whose tag bits are left uninitialized.  Before memory
+ * is freed into the pool, the caller must clear the tag bits with
+ * buddy_clear_tags() of every range that memory is freed into, and of
+ * every block that can be a buddy of a block freed.
+ */
+struct buddy_mempool *
+buddy_init_untagged (ulong_t base_addr,
+                     ulong_t pool_order,
+                     ulong_t min_order)
+{
+    return buddy_create(base_addr, pool_order, min_order, 0);
+}
+
+
+/**
+ * Marks the minimum-sized blocks in [offset, offset+len) of the pool
+ * as allocated, where offset is relative to the base of the pool
+ */
+void
+buddy_clear_tags (struct buddy_mempool *mp, ulong_t offset, ulong_t len)
+{
+    ulong_t first = offset >> mp->min_order;
+    ulong_t num   = len >> mp->min_order;
+    ulong_t i;
+
+    ASSERT(first + num <= mp->num_blocks);
+
+    if (!(first % 8) && !(num % 8)) {
+        memset((uint8_t *)mp->tag_bits + first / 8, 0, num / 8);
+        return;
+    }
+
+    for (i = first; i < first + num; i++) {
+        __clear_bit(i, (volatile char *)mp->tag_bits);
+    }
+}
+
+
 /**
  * Allocates a block of memory of the requested size (2^order bytes).
  *
@@ -402,6 +453,8 @@ buddy_free(
 
         /* OK, we're good to go... buddy merge! */
         list_del_init(&buddy->link);
+        /* the buddy no longer heads a free block of its own */
+        mark_allocated(mp, buddy);
         if (buddy < block) {
             block = buddy;
 	}
@@ -432,6 +485,90 @@ buddy_free(
 }
 
 
+/**
+ * Grows the allocated block at addr from 2^order to 2^new_order bytes
+ * in place by absorbing the free blocks that follow it.  This is only
+ * possible if at each order from order to new_order-1 the block is
+ * the lower buddy and its upper buddy is a free block of that order.
+ * Returns 0 on success, and nonzero, with the pool unchanged, otherwise.
+ */
+int
+buddy_grow (struct buddy_mempool *mp, void *addr, ulong_t order, ulong_t new_order)
+{
+    struct block *buddy;
+    ulong_t j;
+
+    if (new_order > mp->pool_order) {
+        return -1;
+    }
+
+    for (j = order; j < new_order; j++) {
+        if (((ulong_t)addr - mp->base_addr) & (1UL << j)) {
+            BUDDY_DEBUG("cannot grow %p past order %lu as it is an upper buddy\n", addr, j);
+            return -1;
+        }
+        buddy = find_buddy(mp, (struct block *)addr, j);
+        if (!is_available(mp, buddy) || buddy->order != j) {
+            BUDDY_DEBUG("cannot grow %p past order %lu as buddy %p is not free\n", addr, j, buddy);
+            return -1;
+        }
+    }
+
+    for (j = order; j < new_order; j++) {
+        buddy = find_buddy(mp, (struct block *)addr, j);
+        list_del_init(&buddy->link);
+        mark_allocated(mp, buddy);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Shrinks the allocated block at addr from 2^order to 2^new_order bytes
+ * in place, returning its tail to the pool.  The tail becomes one free
+ * block of each order from new_order to order-1.  None of these can
+ * coalesce, since each one's buddy is part of the block that is kept.
+ */
+void
+buddy_shrink (struct buddy_mempool *mp, void *addr, ulong_t order, ulong_t new_order)
+{
+    struct block *tail;
+    ulong_t j;
+
+    if (new_order < mp->min_order) {
+        new_order = mp->min_order;
+    }
+
+    for (j = new_order; j < order; j++) {
+        tail = (struct block *)((ulong_t)addr + (1UL << j));
+        tail->order = j;
+        mark_available(mp, tail);
+        list_add(&tail->link, &mp->avail[j]);
+    }
+}
+
+
+/**
+ * Returns the order of the free block that starts at addr, or -1 if
+ * no free block starts there.  The caller must keep the pool from
+ * changing, for example by holding its lock.
+ */
+long
+buddy_free_order (struct buddy_mempool *mp, void *addr)
+{
+    struct block *block = (struct block *)addr;
+
+    if ((ulong_t)addr < mp->base_addr ||
+        (ulong_t)addr >= mp->base_addr + (1UL << mp->pool_order) ||
+        (((ulong_t)addr - mp->base_addr) & ((1UL << mp->min_order) - 1))) {
+        return -1;
+    }
+
+    return is_available(mp, block) ? (long)block->order : -1;
+}
+
+
 /*
   Sanity-checks and gets statistics of the buddy pool
  */
@@ -36,6 +36,7 @@
 #include <nautilus/intrinsics.h>
 #include <nautilus/percpu.h>
 #include <nautilus/shell.h>
+#include <nautilus/shrinker.h>
 
 #include <dev/gpio.h>
 
@@ -66,15 +67,20 @@
 
 /**
  * This specifies the minimum sized memory block to request from the underlying
- * buddy system memory allocator, 2^MIN_ORDER bytes. It must be at least big
- * enough to hold a 'struct kmem_block_hdr'.
+ * buddy system memory allocator, 2^MIN_ORDER bytes. It is also the size
+ * of the frames that the block descriptors of a zone describe.
+ *
+ * Garbage collection keeps flags per block, so blocks of any size are
+ * buddy blocks, each with a descriptor.  Otherwise, requests smaller
+ * than a page are served from the slabs of the size classes, which
+ * know the size of their objects, so a descriptor per page suffices.
  */
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
 #define MIN_ORDER   5  /* 32 bytes */
-
-// The factor by which to reduce the hash table size
-// next_prime(total_mem >> 5 / BLOAT) is the maximum number of
-// blocks we can allocate with malloc
-#define BLOAT  1024
+#else
+#define MIN_ORDER   12 /* 4 KB */
+#define KMEM_SLABS  1
+#endif
 
 
 /**
@@ -94,175 +100,2348 @@ static struct list_head glob_zone_list;
 
 
 /**
- * Each block of memory allocated from the kernel memory pool has 
- * associated with it one of these structures.   The structure 
- * maps the address handed out by malloc to the order of the block
- * that was allocated and the buddy allocator that provided the
- * block 
+ * Each zone has an array of block descriptors, one byte for each
+ * 2^MIN_ORDER byte frame of its region, that is, for each page unless
+ * garbage collection is configured.  The descriptor of the frame
+ * at which an allocated block starts holds the order of the block.
+ * All other descriptors are zero.  Finding the order and zone of a
+ * block handed out by malloc is therefore an index computation rather
+ * than a search.  Every frame of a size class slab has a descriptor
+ * that holds the order of the slab with KMEM_DESC_SLAB set, so an
+ * object inside a slab also leads to its slab by index computation.
+ *
+ * When garbage collection is configured, each zone also has a parallel
+ * array of per-block flags.
+ */
+#define KMEM_DESC_ORDER_MASK 0x3f
+#define KMEM_DESC_SLAB       0x40   /* frame is part of a size class slab */
+#define KMEM_DESC_CACHED     0x80   /* block is held by a per-cpu magazine */
+
+static inline uint64_t kmem_zone_num_frames(struct mem_region *reg)
+{
+    return (reg->len + (1ULL << MIN_ORDER) - 1) >> MIN_ORDER;
+}
+
+// clear=0 leaves the descriptors for the caller to clear
+static int kmem_zone_desc_init(struct mem_region *reg, int clear)
+{
+    uint64_t n = kmem_zone_num_frames(reg);
+
+    KMEM_DEBUG("Block descriptors for region at %p: %lu frames (%lu bytes)\n",
+	       reg->base_addr, n, n);
+
+    reg->mm_blocks = mm_boot_alloc(n);
+    if (!reg->mm_blocks) {
+	KMEM_ERROR("Failed to allocate block descriptors for region at %p\n", reg->base_addr);
+	return -1;
+    }
+    if (clear) {
+	memset(reg->mm_blocks, 0, n);
+    }
+
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+    reg->mm_flags = mm_boot_alloc(n);
+    if (!reg->mm_flags) {
+	KMEM_ERROR("Failed to allocate block flags for region at %p\n", reg->base_addr);
+	return -1;
+    }
+    if (clear) {
+	memset(reg->mm_flags, 0, n);
+    }
+#endif
+
+    return 0;
+}
+
+static inline uint64_t kmem_block_index(struct mem_region *reg, const void *addr)
+{
+    return ((addr_t)addr - reg->mm_state->base_addr) >> MIN_ORDER;
+}
+
+
+struct mem_region *
+kmem_get_base_zone (void)
+{
+    KMEM_DEBUG("getting base zone\n");
+    return list_first_entry(&glob_zone_list, struct mem_region, glob_link);
+}
+
+
+/* TODO: if we're going to be using this at runtime, really need to 
+ * key these regions in a tree
+ */
+struct mem_region *
+kmem_get_region_by_addr (ulong_t addr)
+{
+    struct mem_region * region = NULL;
+    list_for_each_entry(region, &glob_zone_list, glob_link) {
+        if (addr >= region->base_addr && 
+            addr < (region->base_addr + region->len)) {
+            return region;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the descriptor of the frame that contains addr, and its zone,
+ * or NULL if addr is not in any zone
+ */
+static inline uint8_t *
+kmem_find_frame (const void *addr, struct mem_region **reg)
+{
+    *reg = kmem_get_region_by_addr(va_to_pa((addr_t)addr));
+
+    if (!*reg || !(*reg)->mm_blocks) {
+	return 0;
+    }
+
+    return &(*reg)->mm_blocks[kmem_block_index(*reg, addr)];
+}
+
+static inline int kmem_frame_aligned(struct mem_region *reg, const void *addr)
+{
+    return !(((addr_t)addr - reg->mm_state->base_addr) & ((1ULL << MIN_ORDER) - 1));
+}
+
+/*
+ * Returns the descriptor of the block that starts at addr, and its zone,
+ * or NULL if addr is not in any zone or is not aligned to a frame
+ */
+static inline uint8_t *
+kmem_find_desc (const void *addr, struct mem_region **reg)
+{
+    uint8_t *desc = kmem_find_frame(addr, reg);
+
+    if (!desc || !kmem_frame_aligned(*reg, addr)) {
+	return 0;
+    }
+
+    return desc;
+}
+
+/*
+ * Allocates a block of the given order from the first zone, in the
+ * affinity order of kd, that has one, and returns the zone it came from.
+ * Only zones of domain bind are considered, unless bind is -1.
+ * The caller sets the block's descriptor.
+ */
+static void *
+kmem_zone_alloc (struct kmem_data *kd, ulong_t order, int bind, struct mem_region **zone_reg)
+{
+    struct mem_reg_entry * reg = NULL;
+    void *block;
+
+    list_for_each_entry(reg, &(kd->ordered_regions), mem_ent) {
+        struct buddy_mempool * zone = reg->mem->mm_state;
+
+        if (bind >= 0 && reg->mem->domain_id != bind) {
+            continue;
+        }
+
+        uint8_t flags = spin_lock_irq_save(&zone->lock);
+        block = buddy_alloc(zone, order);
+        spin_unlock_irq_restore(&zone->lock, flags);
+
+        if (block) {
+	    *zone_reg = reg->mem;
+	    return block;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Memory policies
+ *
+ * Each domain has an affinity ordered list of zones, like each cpu
+ * does, which the non-local policies scan instead of the list of the
+ * cpu.  Policies are only looked up once some thread has set a
+ * non-local one, so the common case costs a single test.
+ */
+static struct kmem_data kmem_domain_data[MAX_NUMA_DOMAINS];
+
+// the domains that have zones, which interleaving cycles through
+static uint32_t kmem_num_mem_domains;
+static uint32_t kmem_mem_domains[MAX_NUMA_DOMAINS];
+
+static int kmem_policy_used = 0;
+
+static int kmem_domain_has_memory(int node)
+{
+    struct nk_locality_info * numa_info = &(nk_get_nautilus_info()->sys.locality_info);
+    struct mem_region * reg;
+
+    if (node < 0 || node >= numa_info->num_domains || !numa_info->domains[node]) {
+	return 0;
+    }
+
+    list_for_each_entry(reg, &(numa_info->domains[node]->regions), entry) {
+	if (reg->mm_state) {
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+int nk_mem_policy_set(nk_mem_policy_mode_t mode, int node)
+{
+    struct nk_mem_policy * p = &get_cur_thread()->mem_policy;
+
+    switch (mode) {
+    case NK_MEM_POLICY_LOCAL:
+    case NK_MEM_POLICY_INTERLEAVE:
+	node = -1;
+	break;
+    case NK_MEM_POLICY_BIND:
+    case NK_MEM_POLICY_PREFERRED:
+	if (!kmem_domain_has_memory(node)) {
+	    KMEM_ERROR("Memory policy names domain %d, which has no memory\n", node);
+	    return -1;
+	}
+	break;
+    default:
+	KMEM_ERROR("Unknown memory policy %d\n", mode);
+	return -1;
+    }
+
+    p->mode = mode;
+    p->node = node;
+    p->il_next = 0;
+    p->il_bytes = 0;
+
+    if (mode != NK_MEM_POLICY_LOCAL) {
+	kmem_policy_used = 1;
+    }
+
+    KMEM_DEBUG("Thread %lu memory policy set to %d (node %d)\n", get_cur_thread()->tid, mode, node);
+
+    return 0;
+}
+
+int nk_mem_policy_get(nk_mem_policy_mode_t *mode, int *node)
+{
+    struct nk_mem_policy * p = &get_cur_thread()->mem_policy;
+
+    *mode = p->mode;
+    *node = p->node;
+
+    return 0;
+}
+
+/*
+ * Returns the zones that an allocation of size bytes by the current
+ * thread should be made from, and the only domain they may be in
+ * (-1 => any), or NULL if the allocation is local.  Interleaving
+ * moves to the next domain once a page's worth of memory has been
+ * placed on the current one, so small allocations are packed while
+ * large ones are spread.  A single allocation is physically contiguous,
+ * so it cannot itself be spread across domains.
+ */
+static struct kmem_data *
+kmem_policy_zones (size_t size, int *bind)
+{
+    struct nk_thread * t;
+    struct nk_mem_policy * p;
+    uint32_t d;
+
+    *bind = -1;
+
+    // interrupt handlers allocate on behalf of no thread in particular
+    if (!kmem_policy_used || in_interrupt_context() || !(t = get_cur_thread())) {
+	return 0;
+    }
+
+    p = &t->mem_policy;
+
+    switch (p->mode) {
+    case NK_MEM_POLICY_BIND:
+	*bind = p->node;
+	return &kmem_domain_data[p->node];
+    case NK_MEM_POLICY_PREFERRED:
+	return &kmem_domain_data[p->node];
+    case NK_MEM_POLICY_INTERLEAVE:
+	d = kmem_mem_domains[p->il_next % kmem_num_mem_domains];
+	p->il_bytes += size;
+	if (p->il_bytes >= PAGE_SIZE_4KB) {
+	    p->il_bytes = 0;
+	    p->il_next = (p->il_next + 1) % kmem_num_mem_domains;
+	}
+	return &kmem_domain_data[d];
+    default:
+	return 0;
+    }
+}
+
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+/*
+ * Per-CPU magazine cache
+ *
+ * Blocks of order MIN_ORDER..KMEM_MAG_MAX_ORDER are cached in
+ * per-CPU, per-order magazines.  A cached block remains allocated
+ * as far as its buddy zone is concerned, and its descriptor keeps
+ * its order with KMEM_DESC_CACHED set, so a hit in the magazine
+ * does not involve the zone lock.  A magazine is only touched by
+ * its own CPU, with interrupts off.
+ *
+ * An empty magazine is refilled with a batch of blocks taken from
+ * the zones with one lock acquisition per zone, and a full
+ * magazine drains a batch of its oldest blocks back the same way.
+ *
+ * A block freed on a CPU outside of the NUMA domain of the block's
+ * zone is pushed onto the lock-free remote-free list of its home
+ * CPU, which is a CPU in that domain.  The home CPU pulls its
+ * remote-free list into its magazines when it next misses.
+ *
+ * With size classes, each CPU also has a magazine in front of each
+ * of its own classes (see the size classes below).
  */
-struct kmem_block_hdr {
-    void *   addr;   /* address of block */
-    uint64_t order;  /* order of the block allocated from buddy system */
-                     /* order>=MIN_ORDER => in use, safe to examine */
-                     /* order==0 => unallocated header */
-                     /* order==1 => allocation in progress, unsafe */
-    struct buddy_mempool * zone; /* zone to which this block belongs */
-    uint64_t flags;  /* flags for this allocated block */
-} __packed __attribute((aligned(8)));
-
-
-static struct kmem_block_hdr *block_hash_entries=0;
-static uint64_t               block_hash_num_entries=0;
-
-// roughly power-of-two primes
-static const uint64_t primes[] = 
-{ 
-    53, 97, 193, 389,
-    769, 1543, 3079, 6151,
-    12289, 24593, 49157, 98317,
-    196613, 393241, 786433, 1572869,
-    3145739, 6291469, 12582917, 25165843,
-    50331653, 100663319, 201326611, 402653189,
-    805306457, 1610612741 
+
+#ifdef KMEM_SLABS
+#define KMEM_MAG_MAX_ORDER  14   /* 16 KB, smaller requests go to the slabs */
+#else
+#define KMEM_MAG_MAX_ORDER  12   /* 4 KB */
+#endif
+#define KMEM_MAG_NUM_ORDERS (KMEM_MAG_MAX_ORDER - MIN_ORDER + 1)
+#define KMEM_MAG_MAX_SIZE   64
+
+struct kmem_magazine {
+    uint32_t count;     // number of blocks currently cached
+    uint32_t size;      // capacity for this order
+    uint32_t batch;     // number of blocks per refill or drain
+    void    *blocks[KMEM_MAG_MAX_SIZE];
+};
+
+struct kmem_mag_stats {
+    uint64_t alloc_hits;     // allocations served from the magazine
+    uint64_t alloc_misses;   // allocations that had to refill first
+    uint64_t local_frees;    // frees into this cpu's magazine
+    uint64_t remote_frees;   // frees handed to another cpu
+    uint64_t refills;        // batches taken from the zones
+    uint64_t drains;         // batches returned to the zones
+};
+
+// Overlaid on a block while it sits on a remote-free list
+struct kmem_remote_block {
+    struct kmem_remote_block *next;
+    uint64_t                  order;
 };
 
-static uint64_t next_prime(uint64_t n)
+struct kmem_cpu_cache {
+    struct kmem_magazine      mags[KMEM_MAG_NUM_ORDERS];
+    struct kmem_mag_stats     stats[KMEM_MAG_NUM_ORDERS];
+    struct kmem_remote_block *remote_free;
+    uint32_t                  domain;
+#ifdef KMEM_SLABS
+    // by class index, the order of a remote block is its class index
+    struct kmem_magazine      class_mags[KMEM_MAX_SIZE_CLASSES];
+    struct kmem_mag_stats     class_stats[KMEM_MAX_SIZE_CLASSES];
+    struct kmem_remote_block *class_remote_free;
+    uint32_t                  class_remote_count[KMEM_MAX_SIZE_CLASSES];
+#endif
+} __attribute__((aligned(64)));
+
+#ifdef KMEM_SLABS
+static void kmem_cache_class_flush(struct kmem_cpu_cache *c);
+static void kmem_cache_class_dump(void);
+#endif
+
+// cpus of each domain, used to pick the home cpu of a block
+static struct {
+    uint32_t  num_cpus;
+    cpu_id_t *cpus;
+} kmem_domain_cpus[MAX_NUMA_DOMAINS];
+
+static int kmem_cache_ready = 0;
+
+static inline uint32_t kmem_mag_size(ulong_t order)
+{
+    return order <= 8 ? 64 : order <= 10 ? 32 : 16;
+}
+
+static int kmem_cache_init(void)
 {
-  uint64_t i;
-  for (i=0;i<sizeof(primes)/sizeof(primes[0]);i++) {
-    if (primes[i]>=n) { 
-      return primes[i];
+    struct sys_info * sys = &(nk_get_nautilus_info()->sys);
+    uint32_t i, j;
+
+    for (i = 0; i < sys->num_cpus; i++) {
+	struct kmem_cpu_cache *c = mm_boot_alloc_aligned(sizeof(*c), 64);
+	if (!c) {
+	    KMEM_ERROR("Failed to allocate magazines for cpu %u\n", i);
+	    return -1;
+	}
+	memset(c, 0, sizeof(*c));
+	for (j = 0; j < KMEM_MAG_NUM_ORDERS; j++) {
+	    c->mags[j].size = kmem_mag_size(j + MIN_ORDER);
+	    c->mags[j].batch = c->mags[j].size / 2;
+	}
+	c->domain = sys->cpus[i]->domain->id;
+	sys->cpus[i]->kmem.cache = c;
+
+	if (c->domain < MAX_NUMA_DOMAINS) {
+	    kmem_domain_cpus[c->domain].num_cpus++;
+	}
+    }
+
+    for (i = 0; i < MAX_NUMA_DOMAINS; i++) {
+	if (kmem_domain_cpus[i].num_cpus) {
+	    kmem_domain_cpus[i].cpus = mm_boot_alloc(kmem_domain_cpus[i].num_cpus * sizeof(cpu_id_t));
+	    if (!kmem_domain_cpus[i].cpus) {
+		KMEM_ERROR("Failed to allocate cpu list for domain %u\n", i);
+		return -1;
+	    }
+	    kmem_domain_cpus[i].num_cpus = 0;
+	}
+    }
+
+    for (i = 0; i < sys->num_cpus; i++) {
+	uint32_t d = sys->cpus[i]->kmem.cache->domain;
+	if (d < MAX_NUMA_DOMAINS) {
+	    kmem_domain_cpus[d].cpus[kmem_domain_cpus[d].num_cpus++] = i;
+	}
     }
-  }
-  KMEM_DEBUG("next_prime: %lu is too big, returning maximum prime in table (%lu)\n",primes[i-1]);
 
-  return primes[i-1];
+    KMEM_PRINT("Per-CPU magazines enabled for orders %d-%d\n", MIN_ORDER, KMEM_MAG_MAX_ORDER);
+
+    kmem_cache_ready = 1;
+
+    return 0;
 }
 
-static int block_hash_init(uint64_t bytes)
+// Returns the home cpu of a block in the given zone, or -1 if the current cpu will do
+static inline int kmem_cache_home_cpu(struct kmem_cpu_cache *c, struct mem_region *reg, void *block)
 {
-  uint64_t num_entries = next_prime((bytes >> MIN_ORDER) / BLOAT);
-  uint64_t entry_size = sizeof(*block_hash_entries);
-  
-  KMEM_DEBUG("block_hash_init with %lu entries each of size %lu bytes (%lu bytes)\n",
-	     num_entries, entry_size, num_entries*entry_size);
+    if (reg->domain_id == c->domain || reg->domain_id >= MAX_NUMA_DOMAINS ||
+	!kmem_domain_cpus[reg->domain_id].num_cpus) {
+	return -1;
+    }
+
+    return kmem_domain_cpus[reg->domain_id].cpus[((addr_t)block >> PAGE_SHIFT_4KB) %
+						 kmem_domain_cpus[reg->domain_id].num_cpus];
+}
 
-  block_hash_entries = mm_boot_alloc(num_entries*entry_size);
+// Return the oldest n blocks of a magazine to their zones
+// called with interrupts off
+static void kmem_mag_drain(struct kmem_magazine *m, struct kmem_mag_stats *s, ulong_t order, uint32_t n)
+{
+    struct mem_region *zone = 0;
+    uint8_t flags = 0;
+    uint32_t i;
 
-  if (!block_hash_entries) { 
-    KMEM_ERROR("block_hash_init failed\n");
-    return -1;
-  }
+    if (n > m->count) {
+	n = m->count;
+    }
 
-  memset(block_hash_entries,0,num_entries*entry_size);
-  
-  block_hash_num_entries = num_entries;
+    for (i = 0; i < n; i++) {
+	struct mem_region *reg;
+	uint8_t *desc = kmem_find_desc(m->blocks[i], &reg);
+	if (reg != zone) {
+	    if (zone) {
+		spin_unlock_irq_restore(&zone->mm_state->lock, flags);
+	    }
+	    zone = reg;
+	    flags = spin_lock_irq_save(&zone->mm_state->lock);
+	}
+	*desc = 0;
+	kmem_bytes_allocated -= (1UL << order);
+	buddy_free(zone->mm_state, m->blocks[i], order);
+    }
+    if (zone) {
+	spin_unlock_irq_restore(&zone->mm_state->lock, flags);
+    }
+
+    memmove(&m->blocks[0], &m->blocks[n], (m->count - n) * sizeof(m->blocks[0]));
+    m->count -= n;
+    s->drains++;
+}
+
+// Place a block in a magazine of this cpu, draining first if needed
+// called with interrupts off
+static inline void kmem_mag_put(struct kmem_cpu_cache *c, void *block, ulong_t order)
+{
+    struct kmem_magazine *m = &c->mags[order - MIN_ORDER];
 
-  return 0;
+    if (m->count == m->size) {
+	kmem_mag_drain(m, &c->stats[order - MIN_ORDER], order, m->batch);
+    }
+    m->blocks[m->count++] = block;
 }
 
-static inline uint64_t block_hash_hash(const void *ptr)
+// Pull in blocks that other cpus have freed back to us
+// called with interrupts off
+static void kmem_cache_reclaim_remote(struct kmem_cpu_cache *c)
 {
-  uint64_t n = ((uint64_t) ptr)>>MIN_ORDER;
+    struct kmem_remote_block *rb;
 
-  n =  n ^ (n>>1) ^ (n<<2) ^ (n>>3) ^ (n<<5) ^ (n>>7)
-    ^ (n<<11) ^ (n>>13) ^ (n<<17) ^ (n>>19) ^ (n<<23) 
-    ^ (n>>29) ^ (n<<31) ^ (n>>37) ^ (n<<41) ^ (n>>43)
-    ^ (n<<47) ^ (n<<53) ^ (n>>59) ^ (n<<61);
+    if (!c->remote_free) {
+	return;
+    }
 
-  n = n % block_hash_num_entries;
+    rb = __sync_lock_test_and_set(&c->remote_free, 0);
 
-  KMEM_DEBUG("hash of %p returns 0x%lx\n",ptr, n);
-  
-  return n;
+    while (rb) {
+	struct kmem_remote_block *next = rb->next;
+	kmem_mag_put(c, rb, rb->order);
+	rb = next;
+    }
 }
-    
-static inline struct kmem_block_hdr * block_hash_find_entry(const void *ptr)
+
+// Fill a magazine with up to a batch of blocks from the zones
+// closest to this cpu.   Called with interrupts off
+static void kmem_mag_refill(struct kmem_cpu_cache *c, struct kmem_data *kd, ulong_t order)
+{
+    struct kmem_magazine *m = &c->mags[order - MIN_ORDER];
+    struct mem_reg_entry *reg = NULL;
+
+    list_for_each_entry(reg, &kd->ordered_regions, mem_ent) {
+	struct buddy_mempool *zone = reg->mem->mm_state;
+	uint8_t flags;
+	void *block;
+
+	flags = spin_lock_irq_save(&zone->lock);
+	while (m->count < m->batch && (block = buddy_alloc(zone, order))) {
+	    reg->mem->mm_blocks[kmem_block_index(reg->mem, block)] = KMEM_DESC_CACHED | order;
+	    kmem_bytes_allocated += (1UL << order);
+	    m->blocks[m->count++] = block;
+	}
+	spin_unlock_irq_restore(&zone->lock, flags);
+
+	if (m->count == m->batch) {
+	    break;
+	}
+    }
+
+    c->stats[order - MIN_ORDER].refills++;
+}
+
+static void *kmem_cache_alloc(ulong_t order)
 {
-  uint64_t i;
-  uint64_t start = block_hash_hash(ptr);
-  
-  for (i=start;i<block_hash_num_entries;i++) { 
-    if (block_hash_entries[i].order>=MIN_ORDER && block_hash_entries[i].addr == ptr) { 
-      KMEM_DEBUG("Find entry scanned %lu entries\n", i-start+1);
-      return &block_hash_entries[i];
+    struct mem_region *reg;
+    struct kmem_cpu_cache *c;
+    struct kmem_magazine *m;
+    void *block = 0;
+    uint8_t flags;
+
+    flags = irq_disable_save();
+
+    c = per_cpu_get(kmem.cache);
+    m = &c->mags[order - MIN_ORDER];
+
+    if (m->count) {
+	c->stats[order - MIN_ORDER].alloc_hits++;
+    } else {
+	c->stats[order - MIN_ORDER].alloc_misses++;
+	kmem_cache_reclaim_remote(c);
+	if (!m->count) {
+	    kmem_mag_refill(c, &(nk_get_nautilus_info()->sys.cpus[my_cpu_id()]->kmem), order);
+	}
     }
-  }
-  for (i=0;i<start;i++) { 
-    if (block_hash_entries[i].order>=MIN_ORDER && block_hash_entries[i].addr == ptr) { 
-      KMEM_DEBUG("Find entry scanned %lu entries\n", block_hash_num_entries-start + i + 1);
-      return &block_hash_entries[i];
+
+    if (m->count) {
+	block = m->blocks[--m->count];
+	*kmem_find_desc(block, &reg) = order;
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+	reg->mm_flags[kmem_block_index(reg, block)] = 0;
+#endif
     }
-  }
-  return 0;
+
+    irq_enable_restore(flags);
+
+    return block;
 }
 
-static inline struct kmem_block_hdr * block_hash_alloc(void *ptr)
+// Returns nonzero if the cache has taken responsibility for the block
+static int kmem_cache_free(struct mem_region *reg, uint8_t *desc, void *block, ulong_t order)
 {
-  uint64_t i;
-  uint64_t start = block_hash_hash(ptr);
-  
-  for (i=start;i<block_hash_num_entries;i++) { 
-    if (__sync_bool_compare_and_swap(&block_hash_entries[i].order,0,1)) {
-      KMEM_DEBUG("Allocation scanned %lu entries\n", i-start+1);
-      return &block_hash_entries[i];
+    struct kmem_cpu_cache *c;
+    uint8_t flags;
+    int home;
+
+    if (!kmem_cache_ready || order > KMEM_MAG_MAX_ORDER) {
+	return 0;
+    }
+
+    if (!__sync_bool_compare_and_swap(desc, order, KMEM_DESC_CACHED | order)) {
+	KMEM_ERROR("Likely double free ignored- addr=%p desc=0x%x\n", block, *desc);
+	KMEM_ERROR_BACKTRACE();
+	return 1;
+    }
+
+    flags = irq_disable_save();
+
+    c = per_cpu_get(kmem.cache);
+    home = kmem_cache_home_cpu(c, reg, block);
+
+    if (home < 0) {
+	c->stats[order - MIN_ORDER].local_frees++;
+	kmem_mag_put(c, block, order);
+    } else {
+	struct kmem_cpu_cache *hc = nk_get_nautilus_info()->sys.cpus[home]->kmem.cache;
+	struct kmem_remote_block *rb = (struct kmem_remote_block *)block;
+	c->stats[order - MIN_ORDER].remote_frees++;
+	rb->order = order;
+	do {
+	    rb->next = hc->remote_free;
+	} while (!__sync_bool_compare_and_swap(&hc->remote_free, rb->next, rb));
     }
-  }
-  for (i=0;i<start;i++) { 
-    if (__sync_bool_compare_and_swap(&block_hash_entries[i].order,0,1)) {
-      KMEM_DEBUG("Allocation scanned %lu entries\n", block_hash_num_entries-start + i + 1);
-      return &block_hash_entries[i];
+
+    irq_enable_restore(flags);
+
+    return 1;
+}
+
+// Return everything this cpu has cached to the zones
+static void kmem_cache_flush(void)
+{
+    struct kmem_cpu_cache *c;
+    uint8_t flags;
+    int i;
+
+    flags = irq_disable_save();
+
+    c = per_cpu_get(kmem.cache);
+#ifdef KMEM_SLABS
+    // first, since slabs it empties go back to the zones
+    kmem_cache_class_flush(c);
+#endif
+    kmem_cache_reclaim_remote(c);
+    for (i = 0; i < KMEM_MAG_NUM_ORDERS; i++) {
+	if (c->mags[i].count) {
+	    kmem_mag_drain(&c->mags[i], &c->stats[i], i + MIN_ORDER, c->mags[i].count);
+	}
     }
-  }
-  return 0;
+
+    irq_enable_restore(flags);
 }
 
-static inline void block_hash_free_entry(struct kmem_block_hdr *b)
+static void kmem_cache_dump(void)
 {
-  b->addr = 0;
-  b->zone = 0;
-  b->flags = 0;
-  __sync_fetch_and_and (&b->order,0);
+    struct sys_info * sys = &(nk_get_nautilus_info()->sys);
+    uint64_t hits, misses, local, remote, refills, drains, cached;
+    uint64_t thits = 0, tmisses = 0;
+    uint32_t i, j;
+
+    nk_vc_printf("per-cpu magazines:\n");
+
+    for (j = 0; j < KMEM_MAG_NUM_ORDERS; j++) {
+	hits = misses = local = remote = refills = drains = cached = 0;
+	for (i = 0; i < sys->num_cpus; i++) {
+	    struct kmem_cpu_cache *c = sys->cpus[i]->kmem.cache;
+	    hits += c->stats[j].alloc_hits;
+	    misses += c->stats[j].alloc_misses;
+	    local += c->stats[j].local_frees;
+	    remote += c->stats[j].remote_frees;
+	    refills += c->stats[j].refills;
+	    drains += c->stats[j].drains;
+	    cached += c->mags[j].count;
+	}
+	thits += hits;
+	tmisses += misses;
+	nk_vc_printf("  %5lu bytes: %lu hits %lu misses (%lu%% hit) %lu local frees %lu remote frees\n"
+		     "               %lu refills %lu drains %lu blks cached\n",
+		     1UL << (j + MIN_ORDER), hits, misses,
+		     hits + misses ? (100 * hits) / (hits + misses) : 0,
+		     local, remote, refills, drains, cached);
+    }
+
+    nk_vc_printf("  total: %lu hits %lu misses (%lu%% hit)\n", thits, tmisses,
+		 thits + tmisses ? (100 * thits) / (thits + tmisses) : 0);
+
+#ifdef KMEM_SLABS
+    kmem_cache_class_dump();
+#endif
 }
 
-static inline int block_hash_free(void *ptr)
-{
-  struct kmem_block_hdr *b = block_hash_find_entry(ptr);
+#endif
+
+#ifdef KMEM_SLABS
+/*
+ * Size classes
+ *
+ * Requests smaller than a page, the smallest buddy block, are served
+ * from power of two size classes.  With NAUT_CONFIG_KMEM_SIZE_CLASSES,
+ * requests that a power of two would round up badly are served from
+ * further classes that sit between the powers of two, for example 48
+ * bytes between 32 and 64, or 192 bytes between 128 and 256.  The
+ * objects of a class are carved out of slabs.  A slab is a buddy
+ * block with a header at its start that holds a bitmap of the slab's
+ * free objects.  All frames of a slab have KMEM_DESC_SLAB set in their
+ * descriptors, which is how kmem_free() gets from an object to its
+ * slab.
+ *
+ * An object is aligned to the largest power of two that divides the
+ * size of its class, so an object of a power of two class is aligned
+ * to its size, as the buddy block it stands in for would be.  The 48
+ * byte class is 16 byte aligned, and the other classes are multiples
+ * of a cache line, so that a request of 64 bytes or more, which may
+ * hold an aligned(64) structure, is at least cache line aligned.
+ *
+ * Every cpu, and every domain for the memory policies, has its own
+ * classes, and allocations for a cpu, including specific ones, use
+ * that cpu's, so a slab is taken from the zones near the cpu it is
+ * allocated for, and cpus only meet on a class lock when one frees an
+ * object another allocated.  Each class keeps its slabs that have free
+ * objects on a partial list and its full slabs on a full list, under
+ * the class lock.  A slab that becomes empty is returned to its zone
+ * unless it is the only partial slab of its class.
+ *
+ * With NAUT_CONFIG_KMEM_PERCPU_CACHE, a cpu's own classes are fronted
+ * by magazines in its kmem_cpu_cache, just as the zones are for
+ * blocks, so most small mallocs and frees take no lock.  An object in
+ * a magazine is allocated as far as its slab's free map is concerned,
+ * and has its bit set in the slab's cached map, which is changed
+ * atomically and so catches double frees without the class lock.
+ * Magazines are refilled from and drained to their class in batches,
+ * under one acquisition of the class lock.  An object freed on a cpu
+ * other than the one whose class it belongs to is pushed onto the
+ * lock-free class remote-free list of that cpu, which pulls the list
+ * into its magazines when it next misses.  A domain's classes, which
+ * only allocations under a memory policy use, have no magazines.
+ */
+
+#define KMEM_SLAB_MAP_WORDS  8
+#define KMEM_SLAB_MAX_OBJS   (KMEM_SLAB_MAP_WORDS * 64)
+#define KMEM_CLASS_GRAIN     16     /* granularity of the class lookup */
+#define KMEM_CLASS_MAX_SIZE  3072
+
+struct kmem_size_class;
+
+struct kmem_slab {
+    struct list_head         node;       // on the partial or full list of cls
+    struct kmem_size_class  *cls;
+    struct mem_region       *reg;        // zone the slab was taken from
+    uint32_t                 nfree;
+    uint32_t                 nobjs;
+    uint64_t                 free_map[KMEM_SLAB_MAP_WORDS];  // set bit => free object
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    uint64_t                 cached_map[KMEM_SLAB_MAP_WORDS];  // set bit => in a magazine
+#endif
+} __attribute__((aligned(64)));
+
+struct kmem_size_class {
+    spinlock_t        lock;
+    int               cpu;          // whose classes these are, -1 => a domain's
+    uint32_t          index;        // in kmem_class_sizes
+    uint32_t          size;
+    uint32_t          first;        // offset of the first object in a slab
+    uint32_t          slab_order;
+    uint32_t          objs_per_slab;
+    uint32_t          num_partial;
+    struct list_head  partial;
+    struct list_head  full;
+    uint64_t          num_slabs;
+    uint64_t          objs_in_use;
+    uint64_t          allocs;
+    uint64_t          frees;
+} __attribute__((aligned(64)));
+
+// in increasing order, and from 64 bytes on, multiples of a cache line
+static const uint32_t kmem_class_sizes[] =
+#ifdef NAUT_CONFIG_KMEM_SIZE_CLASSES
+    { 32, 48, 64, 128, 192, 256, 320, 384, 512, 640, 768, 1024, 1280, 1536, 2048, 2560, 3072 };
+#else
+    { 32, 64, 128, 256, 512, 1024, 2048 };
+#endif
+
+#define KMEM_NUM_CLASSES (sizeof(kmem_class_sizes)/sizeof(kmem_class_sizes[0]))
+
+// the classes of every cpu and domain
+static struct kmem_size_class *kmem_class_sets[NAUT_CONFIG_MAX_CPUS + MAX_NUMA_DOMAINS];
+static uint32_t kmem_num_class_sets;
+
+// The class of each request size, in units of KMEM_CLASS_GRAIN,
+// or -1 if the request is better served by a power of two
+static sint8_t kmem_class_of[KMEM_CLASS_MAX_SIZE / KMEM_CLASS_GRAIN + 1];
+
+static int kmem_classes_ready = 0;
+
+static struct kmem_size_class *kmem_class_set_create(int cpu)
+{
+    struct kmem_size_class *classes;
+    uint32_t align, i;
+
+    classes = mm_boot_alloc_aligned(sizeof(struct kmem_size_class) * KMEM_NUM_CLASSES, 64);
+    if (!classes) {
+	return 0;
+    }
+    memset(classes, 0, sizeof(struct kmem_size_class) * KMEM_NUM_CLASSES);
+
+    for (i = 0; i < KMEM_NUM_CLASSES; i++) {
+	struct kmem_size_class *c = &classes[i];
+	spinlock_init(&c->lock);
+	c->cpu = cpu;
+	c->index = i;
+	c->size = kmem_class_sizes[i];
+	align = c->size & -c->size;
+	c->first = (sizeof(struct kmem_slab) + align - 1) & ~(align - 1);
+	c->slab_order = c->size <= 768 ? 14 : 16;
+	c->objs_per_slab = ((1UL << c->slab_order) - c->first) / c->size;
+	if (c->objs_per_slab > KMEM_SLAB_MAX_OBJS) {
+	    c->objs_per_slab = KMEM_SLAB_MAX_OBJS;
+	}
+	INIT_LIST_HEAD(&c->partial);
+	INIT_LIST_HEAD(&c->full);
+	if (!kmem_num_class_sets) {
+	    KMEM_DEBUG("size class %u: %u objects per %lu byte slab\n",
+		       c->size, c->objs_per_slab, 1UL << c->slab_order);
+	}
+    }
+
+    kmem_class_sets[kmem_num_class_sets++] = classes;
+
+    return classes;
+}
+
+static int kmem_classes_init(void)
+{
+    struct sys_info * sys = &(nk_get_nautilus_info()->sys);
+    struct nk_locality_info * numa_info = &(sys->locality_info);
+    uint64_t size;
+    uint32_t i, j;
+
+    for (i = 0; i < sys->num_cpus; i++) {
+	if (!(sys->cpus[i]->kmem.classes = kmem_class_set_create(i))) {
+	    KMEM_ERROR("Failed to allocate size classes for cpu %u\n", i);
+	    return -1;
+	}
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+	for (j = 0; j < KMEM_NUM_CLASSES; j++) {
+	    struct kmem_magazine *m = &sys->cpus[i]->kmem.cache->class_mags[j];
+	    m->size = kmem_mag_size(ilog2(roundup_pow_of_two(kmem_class_sizes[j])));
+	    m->batch = m->size / 2;
+	}
+#endif
+    }
+
+    for (i = 0; i < numa_info->num_domains; i++) {
+	if (numa_info->domains[i] && !(kmem_domain_data[i].classes = kmem_class_set_create(-1))) {
+	    KMEM_ERROR("Failed to allocate size classes for domain %u\n", i);
+	    return -1;
+	}
+    }
+
+    // a size gets the smallest class that fits it, which is never
+    // larger than the power of two it would otherwise round up to,
+    // since the sub-page powers of two are classes themselves
+    for (j = 0; j <= KMEM_CLASS_MAX_SIZE / KMEM_CLASS_GRAIN; j++) {
+	size = j * KMEM_CLASS_GRAIN;
+	kmem_class_of[j] = -1;
+	for (i = 0; i < KMEM_NUM_CLASSES; i++) {
+	    if (kmem_class_sizes[i] >= size) {
+		kmem_class_of[j] = i;
+		break;
+	    }
+	}
+    }
+
+    kmem_classes_ready = 1;
+
+    return 0;
+}
+
+// the class for size among the classes of kd, if any
+static inline struct kmem_size_class *kmem_class_lookup(struct kmem_data *kd, size_t size)
+{
+    int i;
+
+    if (!kmem_classes_ready || !kd->classes || size > KMEM_CLASS_MAX_SIZE) {
+	return 0;
+    }
+
+    i = kmem_class_of[(size + KMEM_CLASS_GRAIN - 1) / KMEM_CLASS_GRAIN];
+
+    return i < 0 ? 0 : &kd->classes[i];
+}
+
+// The slab containing addr, given the descriptor of addr's frame
+static inline struct kmem_slab *kmem_slab_of(struct mem_region *reg, uint8_t desc, void *addr)
+{
+    addr_t base = reg->mm_state->base_addr;
+    ulong_t order = desc & KMEM_DESC_ORDER_MASK;
+
+    return (struct kmem_slab *)(base + (((addr_t)addr - base) & ~((1ULL << order) - 1)));
+}
+
+static inline void *kmem_slab_obj(struct kmem_slab *s, uint32_t i)
+{
+    return (void*)((addr_t)s + s->cls->first + (addr_t)i * s->cls->size);
+}
+
+// Takes the slab from the zones of kd, only those of domain bind unless bind is -1
+// Called with the class lock held
+static struct kmem_slab *kmem_slab_create(struct kmem_size_class *c, struct kmem_data *kd, int bind)
+{
+    struct mem_region *reg;
+    struct kmem_slab *s = kmem_zone_alloc(kd, c->slab_order, bind, &reg);
+    uint32_t i;
+
+    if (!s) {
+	return 0;
+    }
+
+    memset(&reg->mm_blocks[kmem_block_index(reg, s)], KMEM_DESC_SLAB | c->slab_order,
+	   1ULL << (c->slab_order - MIN_ORDER));
+
+    s->cls = c;
+    s->reg = reg;
+    s->nobjs = s->nfree = c->objs_per_slab;
+    memset(s->free_map, 0, sizeof(s->free_map));
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    memset(s->cached_map, 0, sizeof(s->cached_map));
+#endif
+    for (i = 0; i < s->nobjs; i += 64) {
+	s->free_map[i / 64] = s->nobjs - i >= 64 ? ~0ULL : (1ULL << (s->nobjs - i)) - 1;
+    }
+
+    kmem_bytes_allocated += 1UL << c->slab_order;
+
+    return s;
+}
+
+// Called with the class lock held
+static void kmem_slab_release(struct kmem_slab *s)
+{
+    struct mem_region *reg = s->reg;
+    ulong_t order = s->cls->slab_order;
+    uint8_t flags;
+
+    memset(&reg->mm_blocks[kmem_block_index(reg, s)], 0, 1ULL << (order - MIN_ORDER));
+
+    flags = spin_lock_irq_save(&reg->mm_state->lock);
+    kmem_bytes_allocated -= 1UL << order;
+    buddy_free(reg->mm_state, s, order);
+    spin_unlock_irq_restore(&reg->mm_state->lock, flags);
+}
+
+// The first partial slab of a class that is in domain bind, unless bind is -1
+// Called with the class lock held
+static struct kmem_slab *kmem_class_partial(struct kmem_size_class *c, int bind)
+{
+    struct kmem_slab *s;
+
+    list_for_each_entry(s, &c->partial, node) {
+	if (bind < 0 || s->reg->domain_id == bind) {
+	    return s;
+	}
+    }
+
+    return 0;
+}
+
+// Takes an object of class c from its slabs, which come from the zones
+// of kd, and only from those of domain bind unless bind is -1
+// Called with the class lock held
+static void *kmem_class_take(struct kmem_size_class *c, struct kmem_data *kd, int bind)
+{
+    struct kmem_slab *s;
+    uint32_t w, bit;
+
+    // a domain's classes are shared by all policies on it, so under
+    // a binding policy, slabs from other domains do not qualify
+    if (!(s = kmem_class_partial(c, bind))) {
+	s = kmem_slab_create(c, kd, bind);
+	if (!s) {
+	    return 0;
+	}
+	list_add(&s->node, &c->partial);
+	c->num_partial++;
+	c->num_slabs++;
+    }
+
+    for (w = 0; !s->free_map[w]; w++) {
+    }
+    bit = ctz(s->free_map[w]);
+    s->free_map[w] &= ~(1ULL << bit);
+
+    if (!--s->nfree) {
+	list_move(&s->node, &c->full);
+	c->num_partial--;
+    }
+
+    c->objs_in_use++;
+    c->allocs++;
+
+    return kmem_slab_obj(s, w * 64 + bit);
+}
+
+static void *kmem_class_alloc(struct kmem_size_class *c, struct kmem_data *kd, int bind)
+{
+    uint8_t flags = spin_lock_irq_save(&c->lock);
+    void *obj = kmem_class_take(c, kd, bind);
+
+    spin_unlock_irq_restore(&c->lock, flags);
+
+    return obj;
+}
+
+// The index of addr in its slab s, or -1 if addr is not an object of s
+static inline sint64_t kmem_slab_index(struct kmem_slab *s, void *addr)
+{
+    addr_t first = (addr_t)kmem_slab_obj(s, 0);
+    addr_t off = (addr_t)addr - first;
+
+    if ((addr_t)addr < first || off % s->cls->size || off / s->cls->size >= s->nobjs) {
+	return -1;
+    }
+
+    return off / s->cls->size;
+}
+
+// Returns object i to its slab, or nonzero if it is free already
+// Called with the class lock held
+static int kmem_class_put(struct kmem_slab *s, uint32_t i)
+{
+    struct kmem_size_class *c = s->cls;
+
+    if (s->free_map[i / 64] & (1ULL << (i % 64))) {
+	return -1;
+    }
+
+    s->free_map[i / 64] |= 1ULL << (i % 64);
+
+    if (!s->nfree++) {
+	list_move(&s->node, &c->partial);
+	c->num_partial++;
+    }
+
+    if (s->nfree == s->nobjs && c->num_partial > 1) {
+	list_del_init(&s->node);
+	c->num_partial--;
+	c->num_slabs--;
+	kmem_slab_release(s);
+    }
+
+    c->objs_in_use--;
+    c->frees++;
+
+    return 0;
+}
+
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+
+// The slab of an object that is known to be in one
+static inline struct kmem_slab *kmem_obj_slab(void *obj)
+{
+    struct mem_region *reg;
+    uint8_t *desc = kmem_find_frame(obj, &reg);
+
+    return kmem_slab_of(reg, *desc, obj);
+}
+
+// Marks the object in or out of a magazine, returns whether it was in one
+static inline int kmem_slab_cache_mark(struct kmem_slab *s, uint32_t i, int cached)
+{
+    uint64_t bit = 1ULL << (i % 64);
+
+    if (cached) {
+	return !!(__sync_fetch_and_or(&s->cached_map[i / 64], bit) & bit);
+    } else {
+	return !!(__sync_fetch_and_and(&s->cached_map[i / 64], ~bit) & bit);
+    }
+}
+
+// Return the oldest n objects of a class magazine to their class
+// called with interrupts off
+static void kmem_class_mag_drain(struct kmem_cpu_cache *cc, uint32_t idx, uint32_t n)
+{
+    struct kmem_magazine *m = &cc->class_mags[idx];
+    struct kmem_size_class *c;
+    struct kmem_slab *s;
+    sint64_t j;
+    uint8_t flags;
+    uint32_t i;
+
+    if (n > m->count) {
+	n = m->count;
+    }
+    if (!n) {
+	return;
+    }
+
+    c = kmem_obj_slab(m->blocks[0])->cls;
+
+    flags = spin_lock_irq_save(&c->lock);
+    for (i = 0; i < n; i++) {
+	s = kmem_obj_slab(m->blocks[i]);
+	j = kmem_slab_index(s, m->blocks[i]);
+	kmem_slab_cache_mark(s, j, 0);
+	kmem_class_put(s, j);
+    }
+    spin_unlock_irq_restore(&c->lock, flags);
+
+    memmove(&m->blocks[0], &m->blocks[n], (m->count - n) * sizeof(m->blocks[0]));
+    m->count -= n;
+    cc->class_stats[idx].drains++;
+}
+
+// called with interrupts off
+static inline void kmem_class_mag_put(struct kmem_cpu_cache *cc, uint32_t idx, void *obj)
+{
+    struct kmem_magazine *m = &cc->class_mags[idx];
+
+    if (m->count == m->size) {
+	kmem_class_mag_drain(cc, idx, m->batch);
+    }
+    m->blocks[m->count++] = obj;
+}
+
+// Pull in objects of our classes that other cpus have freed
+// called with interrupts off
+static void kmem_class_reclaim_remote(struct kmem_cpu_cache *cc)
+{
+    struct kmem_remote_block *rb;
+
+    if (!cc->class_remote_free) {
+	return;
+    }
+
+    rb = __sync_lock_test_and_set(&cc->class_remote_free, 0);
+
+    while (rb) {
+	struct kmem_remote_block *next = rb->next;
+	uint32_t idx = rb->order;
+	__sync_fetch_and_sub(&cc->class_remote_count[idx], 1);
+	kmem_class_mag_put(cc, idx, rb);
+	rb = next;
+    }
+}
+
+// Fill a class magazine with up to a batch of objects of this cpu's class
+// called with interrupts off
+static void kmem_class_mag_refill(struct kmem_cpu_cache *cc, uint32_t idx)
+{
+    struct kmem_data *kd = &(nk_get_nautilus_info()->sys.cpus[my_cpu_id()]->kmem);
+    struct kmem_size_class *c = &kd->classes[idx];
+    struct kmem_magazine *m = &cc->class_mags[idx];
+    struct kmem_slab *s;
+    uint8_t flags;
+    void *obj;
+
+    flags = spin_lock_irq_save(&c->lock);
+    while (m->count < m->batch && (obj = kmem_class_take(c, kd, -1))) {
+	s = kmem_obj_slab(obj);
+	kmem_slab_cache_mark(s, kmem_slab_index(s, obj), 1);
+	m->blocks[m->count++] = obj;
+    }
+    spin_unlock_irq_restore(&c->lock, flags);
+
+    cc->class_stats[idx].refills++;
+}
+
+// Allocates an object of class idx of the current cpu through its magazine
+static void *kmem_cache_class_alloc(uint32_t idx)
+{
+    struct kmem_cpu_cache *cc;
+    struct kmem_magazine *m;
+    struct kmem_slab *s;
+    void *obj = 0;
+    uint8_t flags;
+
+    flags = irq_disable_save();
+
+    cc = per_cpu_get(kmem.cache);
+    m = &cc->class_mags[idx];
+
+    if (m->count) {
+	cc->class_stats[idx].alloc_hits++;
+    } else {
+	cc->class_stats[idx].alloc_misses++;
+	kmem_class_reclaim_remote(cc);
+	if (!m->count) {
+	    kmem_class_mag_refill(cc, idx);
+	}
+    }
+
+    if (m->count) {
+	obj = m->blocks[--m->count];
+	s = kmem_obj_slab(obj);
+	kmem_slab_cache_mark(s, kmem_slab_index(s, obj), 0);
+    }
+
+    irq_enable_restore(flags);
+
+    return obj;
+}
+
+// Returns nonzero if the magazines have taken responsibility for object i of slab s
+static int kmem_cache_class_free(struct kmem_slab *s, uint32_t i, void *obj)
+{
+    struct kmem_size_class *c = s->cls;
+    struct kmem_cpu_cache *cc;
+    uint8_t flags;
+
+    if (!kmem_cache_ready || c->cpu < 0) {
+	return 0;
+    }
+
+    if ((s->free_map[i / 64] & (1ULL << (i % 64))) || kmem_slab_cache_mark(s, i, 1)) {
+	KMEM_ERROR("Likely double free ignored- addr=%p, slab=%p size=%u\n", obj, s, c->size);
+	KMEM_ERROR_BACKTRACE();
+	return 1;
+    }
+
+    flags = irq_disable_save();
+
+    cc = per_cpu_get(kmem.cache);
+
+    if (c->cpu == my_cpu_id()) {
+	cc->class_stats[c->index].local_frees++;
+	kmem_class_mag_put(cc, c->index, obj);
+    } else {
+	struct kmem_cpu_cache *hc = nk_get_nautilus_info()->sys.cpus[c->cpu]->kmem.cache;
+	struct kmem_remote_block *rb = (struct kmem_remote_block *)obj;
+	cc->class_stats[c->index].remote_frees++;
+	rb->order = c->index;
+	__sync_fetch_and_add(&hc->class_remote_count[c->index], 1);
+	do {
+	    rb->next = hc->class_remote_free;
+	} while (!__sync_bool_compare_and_swap(&hc->class_remote_free, rb->next, rb));
+    }
+
+    irq_enable_restore(flags);
+
+    return 1;
+}
+
+// Return everything the class magazines of this cpu hold to the classes
+// called with interrupts off
+static void kmem_cache_class_flush(struct kmem_cpu_cache *cc)
+{
+    uint32_t i;
+
+    kmem_class_reclaim_remote(cc);
+    for (i = 0; i < KMEM_NUM_CLASSES; i++) {
+	kmem_class_mag_drain(cc, i, cc->class_mags[i].count);
+    }
+}
+
+// Objects of class c that are in magazines or on their way to one
+static inline uint64_t kmem_class_cached(struct kmem_size_class *c)
+{
+    struct kmem_cpu_cache *cc;
+
+    if (!kmem_cache_ready || c->cpu < 0) {
+	return 0;
+    }
+
+    cc = nk_get_nautilus_info()->sys.cpus[c->cpu]->kmem.cache;
+
+    return cc->class_mags[c->index].count + cc->class_remote_count[c->index];
+}
+
+static void kmem_cache_class_dump(void)
+{
+    struct sys_info * sys = &(nk_get_nautilus_info()->sys);
+    uint64_t hits, misses, local, remote, refills, drains, cached;
+    uint32_t i, j;
+
+    for (j = 0; j < KMEM_NUM_CLASSES; j++) {
+	hits = misses = local = remote = refills = drains = cached = 0;
+	for (i = 0; i < sys->num_cpus; i++) {
+	    struct kmem_cpu_cache *c = sys->cpus[i]->kmem.cache;
+	    hits += c->class_stats[j].alloc_hits;
+	    misses += c->class_stats[j].alloc_misses;
+	    local += c->class_stats[j].local_frees;
+	    remote += c->class_stats[j].remote_frees;
+	    refills += c->class_stats[j].refills;
+	    drains += c->class_stats[j].drains;
+	    cached += c->class_mags[j].count;
+	}
+	if (!hits && !misses) {
+	    continue;
+	}
+	nk_vc_printf("  class %4u: %lu hits %lu misses (%lu%% hit) %lu local frees %lu remote frees\n"
+		     "              %lu refills %lu drains %lu objs cached\n",
+		     kmem_class_sizes[j], hits, misses,
+		     hits + misses ? (100 * hits) / (hits + misses) : 0,
+		     local, remote, refills, drains, cached);
+    }
+}
+
+#endif
+
+static void kmem_class_free(struct mem_region *reg, uint8_t desc, void *addr)
+{
+    struct kmem_slab *s = kmem_slab_of(reg, desc, addr);
+    sint64_t i = kmem_slab_index(s, addr);
+    uint8_t flags;
+    int rc;
+
+    if (i < 0) {
+	KMEM_ERROR("Free of %p, which is not an object of the %u byte slab at %p, ignored\n",
+		   addr, s->cls->size, s);
+	BACKTRACE(KMEM_ERROR,3);
+	return;
+    }
+
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    if (kmem_cache_class_free(s, i, addr)) {
+	return;
+    }
+#endif
+
+    flags = spin_lock_irq_save(&s->cls->lock);
+    rc = kmem_class_put(s, i);
+    spin_unlock_irq_restore(&s->cls->lock, flags);
+
+    if (rc) {
+	KMEM_ERROR("Likely double free ignored- addr=%p, slab=%p size=%u\n", addr, s, s->cls->size);
+	BACKTRACE(KMEM_ERROR,3);
+    }
+}
+
+// Count the empty slabs that the classes hold on to
+static uint64_t kmem_classes_count(void)
+{
+    struct kmem_slab *s;
+    uint64_t n = 0;
+    uint8_t flags;
+    uint32_t set, i;
+
+    if (!kmem_classes_ready) {
+	return 0;
+    }
+
+    for (set = 0; set < kmem_num_class_sets; set++) {
+	for (i = 0; i < KMEM_NUM_CLASSES; i++) {
+	    struct kmem_size_class *c = &kmem_class_sets[set][i];
+	    flags = spin_lock_irq_save(&c->lock);
+	    list_for_each_entry(s, &c->partial, node) {
+		n += s->nfree == s->nobjs;
+	    }
+	    spin_unlock_irq_restore(&c->lock, flags);
+	}
+    }
+
+    return n;
+}
+
+// Return up to nr of the empty slabs that the classes hold on to
+static uint64_t kmem_classes_shrink(uint64_t nr)
+{
+    struct kmem_slab *s, *n;
+    uint64_t freed = 0;
+    uint8_t flags;
+    uint32_t set, i;
+
+    if (!kmem_classes_ready) {
+	return 0;
+    }
+
+    for (set = 0; set < kmem_num_class_sets && freed < nr; set++) {
+	for (i = 0; i < KMEM_NUM_CLASSES && freed < nr; i++) {
+	    struct kmem_size_class *c = &kmem_class_sets[set][i];
+	    flags = spin_lock_irq_save(&c->lock);
+	    list_for_each_entry_safe(s, n, &c->partial, node) {
+		if (freed == nr) {
+		    break;
+		}
+		if (s->nfree == s->nobjs) {
+		    list_del_init(&s->node);
+		    c->num_partial--;
+		    c->num_slabs--;
+		    kmem_slab_release(s);
+		    freed++;
+		}
+	    }
+	    spin_unlock_irq_restore(&c->lock, flags);
+	}
+    }
+
+    return freed;
+}
+
+// sums each class over the cpus and domains
+static void kmem_classes_stats(struct kmem_stats *stats)
+{
+    uint32_t set, i;
+
+    for (i = 0; i < KMEM_NUM_CLASSES && i < KMEM_MAX_SIZE_CLASSES; i++) {
+	struct kmem_class_stats *cs = &stats->class_stats[i];
+	memset(cs, 0, sizeof(*cs));
+	cs->size = kmem_class_sizes[i];
+	for (set = 0; set < kmem_num_class_sets; set++) {
+	    struct kmem_size_class *c = &kmem_class_sets[set][i];
+	    uint8_t flags = spin_lock_irq_save(&c->lock);
+	    uint64_t in_use = c->objs_in_use;
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+	    // objects held by magazines are free to the user
+	    uint64_t cached = kmem_class_cached(c);
+	    in_use = in_use > cached ? in_use - cached : 0;
+#endif
+	    cs->slab_size = 1UL << c->slab_order;
+	    cs->num_slabs += c->num_slabs;
+	    cs->objs_total += c->num_slabs * c->objs_per_slab;
+	    cs->objs_in_use += in_use;
+	    cs->bytes_held += c->num_slabs << c->slab_order;
+	    cs->bytes_in_use += in_use * c->size;
+	    cs->allocs += c->allocs;
+	    cs->frees += c->frees;
+	    spin_unlock_irq_restore(&c->lock, flags);
+	}
+    }
+
+    stats->num_classes = i;
+}
+
+#endif
+
+#ifdef NAUT_CONFIG_KMEM_ZERO_POOL
+/*
+ * Pre-zeroed block pools
+ *
+ * Each NUMA domain has a pool of blocks of order KMEM_ZERO_MIN_ORDER
+ * to KMEM_ZERO_MAX_ORDER that have already been zeroed.  The idle
+ * thread of each cpu tops up the pool of its domain one block at a
+ * time, zeroing it with non-temporal stores so that the zeroing does
+ * not evict the cache, and zeroing allocations take from the pool
+ * before falling back to zeroing the block themselves.
+ *
+ * A pooled block is allocated as far as its zone is concerned, and
+ * its descriptor keeps its order with KMEM_DESC_CACHED set, as for
+ * a block held by a magazine.  The blocks of a pool are linked
+ * through their first word, which is cleared when a block is taken.
+ */
+
+#define KMEM_ZERO_MIN_ORDER  12   /* 4 KB */
+#define KMEM_ZERO_MAX_ORDER  21   /* 2 MB */
+#define KMEM_ZERO_NUM_ORDERS (KMEM_ZERO_MAX_ORDER - KMEM_ZERO_MIN_ORDER + 1)
+
+#define KMEM_ZERO_POOL_BYTES ((uint64_t)NAUT_CONFIG_KMEM_ZERO_POOL_KB * 1024)
+
+static struct kmem_zero_pool {
+    spinlock_t lock;
+    void      *head[KMEM_ZERO_NUM_ORDERS];
+    uint32_t   count[KMEM_ZERO_NUM_ORDERS];
+    uint64_t   hits;           // zeroing allocations served from the pool
+    uint64_t   misses;         // zeroing allocations that found it empty
+    uint64_t   bytes_avoided;  // bytes that allocations did not have to zero
+    uint64_t   bytes_filled;   // bytes zeroed in idle time
+} __attribute__((aligned(64))) kmem_zero_pools[MAX_NUMA_DOMAINS];
+
+static int kmem_zero_ready = 0;
+
+static inline uint32_t kmem_zero_target(ulong_t order)
+{
+    uint64_t n = KMEM_ZERO_POOL_BYTES >> order;
+    return n ? n : 1;
+}
+
+// zero len bytes (a multiple of 64) at p, bypassing the cache
+static void kmem_zero_nt(void *p, uint64_t len)
+{
+#ifdef NAUT_CONFIG_ARCH_X86
+    uint64_t *q = (uint64_t *)p;
+    uint64_t *end = (uint64_t *)(p + len);
+
+    for (; q < end; q += 8) {
+	__asm__ __volatile__ ("movnti %1, 0(%0)\n\t"
+			      "movnti %1, 8(%0)\n\t"
+			      "movnti %1, 16(%0)\n\t"
+			      "movnti %1, 24(%0)\n\t"
+			      "movnti %1, 32(%0)\n\t"
+			      "movnti %1, 40(%0)\n\t"
+			      "movnti %1, 48(%0)\n\t"
+			      "movnti %1, 56(%0)\n\t"
+			      : : "r"(q), "r"(0UL) : "memory");
+    }
+    // make the stores visible before the block is published
+    __asm__ __volatile__ ("sfence" : : : "memory");
+#else
+    memset(p, 0, len);
+#endif
+}
+
+static void kmem_zero_pool_init(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_NUMA_DOMAINS; i++) {
+	spinlock_init(&kmem_zero_pools[i].lock);
+    }
+
+    kmem_zero_ready = 1;
+}
+
+/*
+ * Takes a zeroed block of the given order from the pool of domain,
+ * or returns NULL if there is none, or order is not pooled
+ */
+static void *kmem_zero_pool_take(int domain, ulong_t order)
+{
+    struct kmem_zero_pool *z = &kmem_zero_pools[domain];
+    struct mem_region *reg;
+    uint8_t *desc;
+    void *block;
+    uint8_t flags;
+
+    if (!kmem_zero_ready || order < KMEM_ZERO_MIN_ORDER || order > KMEM_ZERO_MAX_ORDER) {
+	return 0;
+    }
+
+    flags = spin_lock_irq_save(&z->lock);
+    block = z->head[order - KMEM_ZERO_MIN_ORDER];
+    if (block) {
+	z->head[order - KMEM_ZERO_MIN_ORDER] = *(void **)block;
+	z->count[order - KMEM_ZERO_MIN_ORDER]--;
+	z->hits++;
+	z->bytes_avoided += 1UL << order;
+    } else {
+	z->misses++;
+    }
+    spin_unlock_irq_restore(&z->lock, flags);
+
+    if (!block) {
+	return 0;
+    }
+
+    *(void **)block = 0;
+
+    desc = kmem_find_desc(block, &reg);
+    *desc = order;
+
+    return block;
+}
+
+/**
+ * Zeroes one block for the pool of the current cpu's domain, if the
+ * pool is short of any, and returns nonzero if it did.  Called from
+ * the idle thread.
+ */
+int nk_kmem_zero_pool_fill(void)
+{
+    int domain = nk_get_nautilus_info()->sys.cpus[my_cpu_id()]->domain->id;
+    struct kmem_zero_pool *z = &kmem_zero_pools[domain];
+    struct mem_region *reg;
+    ulong_t order;
+    void *block;
+    uint8_t flags;
+
+    if (!kmem_zero_ready) {
+	return 0;
+    }
+
+    // the counts are read racily, which at worst over or underfills by a block
+    for (order = KMEM_ZERO_MIN_ORDER; order <= KMEM_ZERO_MAX_ORDER; order++) {
+	if (z->count[order - KMEM_ZERO_MIN_ORDER] < kmem_zero_target(order)) {
+	    break;
+	}
+    }
+
+    if (order > KMEM_ZERO_MAX_ORDER) {
+	return 0;
+    }
+
+    block = kmem_zone_alloc(&kmem_domain_data[domain], order, domain, &reg);
+
+    if (!block) {
+	return 0;
+    }
+
+    reg->mm_blocks[kmem_block_index(reg, block)] = order | KMEM_DESC_CACHED;
+    __sync_fetch_and_add(&kmem_bytes_allocated, 1UL << order);
+
+    kmem_zero_nt(block, 1UL << order);
+
+    flags = spin_lock_irq_save(&z->lock);
+    *(void **)block = z->head[order - KMEM_ZERO_MIN_ORDER];
+    z->head[order - KMEM_ZERO_MIN_ORDER] = block;
+    z->count[order - KMEM_ZERO_MIN_ORDER]++;
+    z->bytes_filled += 1UL << order;
+    spin_unlock_irq_restore(&z->lock, flags);
+
+    return 1;
+}
+
+// Count the pooled blocks
+static uint64_t kmem_zero_pool_count(void)
+{
+    struct nk_locality_info * numa_info = &(nk_get_nautilus_info()->sys.locality_info);
+    uint64_t n = 0;
+    int i, j;
+
+    for (i = 0; i < numa_info->num_domains; i++) {
+	for (j = 0; j < KMEM_ZERO_NUM_ORDERS; j++) {
+	    n += kmem_zero_pools[i].count[j];
+	}
+    }
+
+    return n;
+}
+
+// Return up to nr pooled blocks to their zones, largest first
+static uint64_t kmem_zero_pool_drain(uint64_t nr)
+{
+    struct nk_locality_info * numa_info = &(nk_get_nautilus_info()->sys.locality_info);
+    struct kmem_zero_pool *z;
+    struct mem_region *reg;
+    uint64_t freed = 0;
+    void *block;
+    uint8_t *desc;
+    uint8_t flags;
+    ulong_t order;
+    int i;
+
+    if (!kmem_zero_ready) {
+	return 0;
+    }
+
+    for (order = KMEM_ZERO_MAX_ORDER; order >= KMEM_ZERO_MIN_ORDER; order--) {
+	for (i = 0; i < numa_info->num_domains; i++) {
+	    z = &kmem_zero_pools[i];
+	    while (freed < nr) {
+		flags = spin_lock_irq_save(&z->lock);
+		block = z->head[order - KMEM_ZERO_MIN_ORDER];
+		if (block) {
+		    z->head[order - KMEM_ZERO_MIN_ORDER] = *(void **)block;
+		    z->count[order - KMEM_ZERO_MIN_ORDER]--;
+		}
+		spin_unlock_irq_restore(&z->lock, flags);
+
+		if (!block) {
+		    break;
+		}
+
+		desc = kmem_find_desc(block, &reg);
+		*desc = 0;
+		flags = spin_lock_irq_save(&reg->mm_state->lock);
+		kmem_bytes_allocated -= 1UL << order;
+		buddy_free(reg->mm_state, block, order);
+		spin_unlock_irq_restore(&reg->mm_state->lock, flags);
+		freed++;
+	    }
+	}
+    }
+
+    return freed;
+}
+
+static void kmem_zero_pool_stats(struct kmem_stats *stats)
+{
+    struct nk_locality_info * numa_info = &(nk_get_nautilus_info()->sys.locality_info);
+    struct kmem_zero_pool *z;
+    ulong_t order;
+    int i;
+
+    for (i = 0; i < numa_info->num_domains; i++) {
+	z = &kmem_zero_pools[i];
+	stats->zero_pool_hits += z->hits;
+	stats->zero_pool_misses += z->misses;
+	stats->zero_pool_bytes_avoided += z->bytes_avoided;
+	stats->zero_pool_bytes_filled += z->bytes_filled;
+	for (order = KMEM_ZERO_MIN_ORDER; order <= KMEM_ZERO_MAX_ORDER; order++) {
+	    stats->zero_pool_bytes += (uint64_t)z->count[order - KMEM_ZERO_MIN_ORDER] << order;
+	}
+    }
+}
+
+#endif
+
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+static void kmem_deferred_take (void);
+#endif
+
+/*
+ * Gets memory back into the zones before a failed allocation is
+ * retried: blocks held by this cpu's magazines, whatever the
+ * registered shrinkers can give back, and zone setup that no cpu has
+ * taken yet
+ */
+static void
+kmem_reclaim (void)
+{
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    if (kmem_cache_ready) {
+	kmem_cache_flush();
+    }
+#endif
+    nk_kmem_shrink(0);
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+    kmem_deferred_take();
+#endif
+}
+
+/*
+ * Huge allocations
+ *
+ * nk_malloc_huge() carves a range that is aligned to a 2MB or 1GB
+ * page out of a buddy block taken from a zone of the chosen domain,
+ * and gives the rest of the block back to the zone.  The range need
+ * not be a buddy block itself, so it has no block descriptor, and
+ * is instead tracked on a list until nk_free_huge() gives it back.
+ */
+struct kmem_huge {
+    void               *addr;
+    uint64_t            size;       // a multiple of page_size
+    uint64_t            page_size;  // alignment that was asked for
+    uint64_t            mapped;     // page size the identity map uses for it
+    struct mem_region  *reg;
+    struct list_head    node;
+};
+
+static spinlock_t       kmem_huge_lock;
+static struct list_head kmem_huge_list = LIST_HEAD_INIT(kmem_huge_list);
+
+/*
+ * Gives the whole frames of [addr, addr+len) back to the zone of reg
+ * as blocks that are aligned to their size relative to the start of
+ * the zone, and returns the bytes given.  The range must be allocated
+ * as far as the zone is concerned.  The caller holds the zone lock.
+ */
+static uint64_t
+kmem_zone_free_range (struct mem_region *reg, addr_t addr, uint64_t len)
+{
+    struct buddy_mempool *zone = reg->mm_state;
+    addr_t off, end = addr + len;
+    uint64_t bytes = 0;
+    ulong_t order;
+
+    // the buddy allocator would take a partial frame as a whole one
+    off = (addr - zone->base_addr + (1ULL << MIN_ORDER) - 1) & ~((1ULL << MIN_ORDER) - 1);
+    addr = zone->base_addr + off;
+
+    while (addr < end && end - addr >= (1ULL << MIN_ORDER)) {
+	off = addr - zone->base_addr;
+	order = ilog2(end - addr);
+	if (off && ctz(off) < order) {
+	    order = ctz(off);
+	}
+	buddy_free(zone, (void*)addr, order);
+	addr += 1ULL << order;
+	bytes += 1ULL << order;
+    }
+
+    return bytes;
+}
+
+/*
+ * Allocates size bytes aligned to page_size from the zone of reg,
+ * where size is a multiple of page_size
+ */
+static void *
+kmem_huge_carve (struct mem_region *reg, uint64_t size, uint64_t page_size)
+{
+    struct buddy_mempool *zone = reg->mm_state;
+    uint64_t skew = va_to_pa(zone->base_addr) & (page_size - 1);
+    ulong_t order = ilog2(roundup_pow_of_two(size));
+    addr_t block, addr;
+    uint8_t flags;
+
+    // blocks are aligned to their size relative to the start of the
+    // zone, so if the zone is not aligned to the page, we need a block
+    // large enough to contain an aligned range past its skew
+    if (skew) {
+	order = ilog2(roundup_pow_of_two(size + page_size));
+    }
+
+    flags = spin_lock_irq_save(&zone->lock);
+
+    block = (addr_t)buddy_alloc(zone, order);
+
+    if (!block) {
+	spin_unlock_irq_restore(&zone->lock, flags);
+	return 0;
+    }
+
+    addr = block + ((page_size - skew) & (page_size - 1));
+
+    kmem_zone_free_range(reg, block, addr - block);
+    kmem_zone_free_range(reg, addr + size, block + (1ULL << order) - (addr + size));
+
+    kmem_bytes_allocated += size;
+
+    spin_unlock_irq_restore(&zone->lock, flags);
+
+    return (void*)addr;
+}
+
+// page size of the identity map that backs a range aligned to page_size
+static uint64_t
+kmem_huge_mapped_page_size (uint64_t page_size)
+{
+#ifdef NAUT_CONFIG_ARCH_X86
+    uint64_t ps = nk_paging_default_page_size();
+    return ps < page_size ? ps : page_size;
+#else
+    return PAGE_SIZE_4KB;
+#endif
+}
+
+/**
+ * Allocates physically contiguous memory that is aligned to a huge
+ * page from a zone of the given NUMA domain, or of the domain that
+ * the current thread's memory policy selects.  The size is rounded up
+ * to a multiple of the page size.  The memory must be freed with
+ * nk_free_huge().
+ *
+ * Arguments:
+ *       [IN] size:      Amount of memory to allocate in bytes.
+ *       [IN] page_size: PAGE_SIZE_2MB or PAGE_SIZE_1GB
+ *       [IN] numa_node: domain to allocate from (-1 => per memory policy)
+ *
+ * Returns:
+ *       Success: Pointer to the start of the allocated memory.
+ *       Failure: NULL
+ */
+void *
+nk_malloc_huge (size_t size, uint64_t page_size, int numa_node)
+{
+    struct kmem_data * kd;
+    struct mem_reg_entry * re;
+    struct mem_region * reg = 0;
+    struct kmem_huge * h;
+    void * addr = 0;
+    int first = 1;
+    int bind;
+    uint8_t flags;
+
+    if (page_size != PAGE_SIZE_2MB && page_size != PAGE_SIZE_1GB) {
+	KMEM_ERROR("Huge allocation with unsupported page size %lu\n", page_size);
+	return 0;
+    }
+
+    if (!size) {
+	return 0;
+    }
+
+    size = (size + page_size - 1) & ~(page_size - 1);
+
+    if (numa_node >= 0) {
+	if (!kmem_domain_has_memory(numa_node)) {
+	    KMEM_ERROR("Huge allocation from domain %d, which has no memory\n", numa_node);
+	    return 0;
+	}
+	kd = &kmem_domain_data[numa_node];
+	bind = numa_node;
+    } else if (!(kd = kmem_policy_zones(size, &bind))) {
+	kd = &(nk_get_nautilus_info()->sys.cpus[my_cpu_id()]->kmem);
+    }
+
+    h = kmem_malloc(sizeof(*h));
+
+    if (!h) {
+	KMEM_ERROR("Failed to allocate huge allocation record\n");
+	return 0;
+    }
+
+ retry:
+    list_for_each_entry(re, &(kd->ordered_regions), mem_ent) {
+	if (!re->mem->mm_state || (bind >= 0 && re->mem->domain_id != bind)) {
+	    continue;
+	}
+	if ((addr = kmem_huge_carve(re->mem, size, page_size))) {
+	    reg = re->mem;
+	    break;
+	}
+    }
+
+    if (!addr) {
+	if (first) {
+	    KMEM_DEBUG("huge malloc initially failed for size %lu attempting reap\n", size);
+	    kmem_reclaim();
+	    first = 0;
+	    goto retry;
+	}
+	KMEM_DEBUG("huge malloc of %lu bytes aligned to %lu failed\n", size, page_size);
+	kmem_free(h);
+	return 0;
+    }
+
+    h->addr = addr;
+    h->size = size;
+    h->page_size = page_size;
+    h->mapped = kmem_huge_mapped_page_size(page_size);
+    h->reg = reg;
+
+    flags = spin_lock_irq_save(&kmem_huge_lock);
+    list_add_tail(&h->node, &kmem_huge_list);
+    spin_unlock_irq_restore(&kmem_huge_lock, flags);
+
+    KMEM_DEBUG("huge malloc succeeded: size %lu page size %lu domain %u -> %p\n",
+	       size, page_size, reg->domain_id, addr);
+
+    return addr;
+}
+
+/**
+ * Frees memory previously allocated with nk_malloc_huge().
+ */
+void
+nk_free_huge (void * addr)
+{
+    struct kmem_huge * h;
+    uint8_t flags;
+
+    if (!addr) {
+	return;
+    }
+
+    flags = spin_lock_irq_save(&kmem_huge_lock);
+    list_for_each_entry(h, &kmem_huge_list, node) {
+	if (h->addr == addr) {
+	    list_del_init(&h->node);
+	    break;
+	}
+    }
+    spin_unlock_irq_restore(&kmem_huge_lock, flags);
+
+    if (&h->node == &kmem_huge_list) {
+	KMEM_ERROR("Failed to find huge allocation %p in nk_free_huge()\n", addr);
+	KMEM_ERROR_BACKTRACE();
+	return;
+    }
+
+    flags = spin_lock_irq_save(&h->reg->mm_state->lock);
+    kmem_zone_free_range(h->reg, (addr_t)addr, h->size);
+    kmem_bytes_allocated -= h->size;
+    spin_unlock_irq_restore(&h->reg->mm_state->lock, flags);
+
+    KMEM_DEBUG("huge free succeeded: addr=%p size=%lu\n", addr, h->size);
+
+    kmem_free(h);
+}
+
+static void kmem_huge_stats(struct kmem_stats *stats)
+{
+    struct kmem_huge * h;
+    uint8_t flags;
+
+    flags = spin_lock_irq_save(&kmem_huge_lock);
+    list_for_each_entry(h, &kmem_huge_list, node) {
+	stats->huge_allocs++;
+	stats->huge_bytes += h->size;
+	if (h->mapped == PAGE_SIZE_2MB) {
+	    stats->huge_bytes_2mb += h->size;
+	} else if (h->mapped == PAGE_SIZE_1GB) {
+	    stats->huge_bytes_1gb += h->size;
+	}
+    }
+    spin_unlock_irq_restore(&kmem_huge_lock, flags);
+}
+
+
+
+/*
+ * Boot timing of memory initialization, relative to the start of
+ * nk_kmem_init()
+ */
+static uint64_t kmem_boot_tsc;
+
+void
+nk_kmem_boot_time (char *event)
+{
+    struct sys_info * sys = &(nk_get_nautilus_info()->sys);
+    uint64_t cycles = rdtsc() - kmem_boot_tsc;
+    uint64_t khz = sys->cpus[0] ? sys->cpus[0]->cpu_khz : 0;
+
+    if (khz) {
+	KMEM_PRINT("Boot time: %s at +%lu cycles (%lu us)\n", event, cycles, cycles * 1000 / khz);
+    } else {
+	KMEM_PRINT("Boot time: %s at +%lu cycles\n", event, cycles);
+    }
+}
+
+
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+/*
+ * Parallel initialization
+ *
+ * Setting up a zone means clearing a descriptor byte and a tag bit for
+ * each of its frames, and freeing its memory into it, which takes
+ * seconds on a large machine if the BSP does it all.  Instead, a zone
+ * larger than a chunk is only set up at boot below its frontier, which
+ * advances a chunk at a time until enough memory has been added below
+ * it.  Memory added above the frontier is recorded as extents.  Once
+ * the APs are up, every cpu calls nk_kmem_init_deferred(), which hands
+ * the chunks above the frontiers of all zones out to them.  A cpu
+ * clears the descriptors and tag bits of the chunks it takes, and then
+ * frees the extents within them into their zone.  An allocation that
+ * fails before then takes whatever chunks are left too, so the work is
+ * also done on demand, but it never waits for chunks other cpus are
+ * on, since it may have interrupted one of them.  Memory added after
+ * the work is handed out is freed at once into chunks that are done,
+ * and is otherwise kept on a list in the memory itself, which the cpu
+ * that finishes its chunk frees.
+ *
+ * The tag bits of all chunk-aligned blocks are cleared when the zone
+ * is created, so that a block freed in a part of the zone that is set
+ * up finds its buddy allocated if the buddy is in a chunk that is not.
+ */
+#define KMEM_DEFER_CHUNK_ORDER  30   /* 1 GB */
+#define KMEM_DEFER_CHUNK        (1ULL << KMEM_DEFER_CHUNK_ORDER)
+#define KMEM_DEFER_EAGER_BYTES  ((uint64_t)NAUT_CONFIG_KMEM_PARALLEL_INIT_EAGER_MB << 20)
+#define KMEM_DEFER_MAX_EXTENTS  64
+
+// memory added to a chunk that is not done, kept at its start
+struct kmem_deferred_late {
+    struct kmem_deferred_late *next;
+    uint64_t start;         // offsets in the zone, within one chunk
+    uint64_t end;
+};
+
+struct kmem_zone_deferred {
+    uint64_t frontier;      // offset in the zone below which it is set up
+    uint64_t eager_bytes;   // memory added below the frontier
+    uint64_t first_chunk;   // index of the zone's first chunk in the work
+    uint64_t num_chunks;
+    uint8_t  *chunk_done;   // of each chunk, set under the zone lock
+    struct kmem_deferred_late *late;   // protected by the zone lock
+    uint32_t num_extents;
+    struct {
+	uint64_t start;     // offsets in the zone
+	uint64_t end;
+    } extents[KMEM_DEFER_MAX_EXTENTS];
+};
+
+static struct {
+    spinlock_t lock;
+    int        started;      // memory added from now on is not deferred
+    uint64_t   total_chunks;
+    uint64_t   next_chunk;
+    uint64_t   done_chunks;
+    uint64_t   num_cpus;     // that have taken a chunk
+} kmem_deferred;
+
+static inline uint64_t
+kmem_zone_pool_size (struct mem_region *reg)
+{
+    return 1ULL << reg->mm_state->pool_order;
+}
+
+static void
+kmem_deferred_zone_init (struct mem_region *reg, struct buddy_mempool *pool)
+{
+    struct kmem_zone_deferred *d;
+    uint64_t off;
+
+    d = mm_boot_alloc(sizeof(struct kmem_zone_deferred));
+    if (!d) {
+	panic("Failed to allocate deferred state for region at %p\n", reg->base_addr);
+    }
+    memset(d, 0, sizeof(*d));
+
+    d->chunk_done = mm_boot_alloc((1ULL << pool->pool_order) >> KMEM_DEFER_CHUNK_ORDER);
+    if (!d->chunk_done) {
+	panic("Failed to allocate deferred chunk state for region at %p\n", reg->base_addr);
+    }
+    memset(d->chunk_done, 0, (1ULL << pool->pool_order) >> KMEM_DEFER_CHUNK_ORDER);
+
+    for (off = 0; off < (1ULL << pool->pool_order); off += KMEM_DEFER_CHUNK) {
+	buddy_clear_tags(pool, off, 1ULL << pool->min_order);
+    }
+
+    reg->mm_deferred = d;
+}
+
+// clear the descriptors and tag bits of [start,end) of the zone
+static void
+kmem_deferred_clear (struct mem_region *reg, uint64_t start, uint64_t end)
+{
+    uint64_t first = start >> MIN_ORDER;
+    uint64_t last  = end >> MIN_ORDER;
+    uint64_t num_frames = kmem_zone_num_frames(reg);
+
+    buddy_clear_tags(reg->mm_state, start, end - start);
+
+    if (last > num_frames) {
+	last = num_frames;
+    }
+    if (first < last) {
+	memset(reg->mm_blocks + first, 0, last - first);
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+	memset(reg->mm_flags + first, 0, last - first);
+#endif
+    }
+}
+
+// free the recorded memory in [start,end) of the zone into it,
+// returns the bytes freed
+static uint64_t
+kmem_deferred_free (struct mem_region *reg, uint64_t start, uint64_t end)
+{
+    struct kmem_zone_deferred *d = reg->mm_deferred;
+    uint64_t bytes = 0;
+    uint64_t s, e;
+    uint32_t i;
+
+    for (i = 0; i < d->num_extents; i++) {
+	s = d->extents[i].start > start ? d->extents[i].start : start;
+	e = d->extents[i].end < end ? d->extents[i].end : end;
+	if (s < e) {
+	    bytes += kmem_zone_free_range(reg, reg->mm_state->base_addr + s, e - s);
+	}
+    }
+
+    return bytes;
+}
+
+// free the memory added to [start,end) of the zone after the work was
+// handed out into it, with the zone lock held, returns the bytes freed
+static uint64_t
+kmem_deferred_free_late (struct mem_region *reg, uint64_t start, uint64_t end)
+{
+    struct kmem_zone_deferred *d = reg->mm_deferred;
+    struct kmem_deferred_late **p = &d->late;
+    struct kmem_deferred_late *l;
+    uint64_t bytes = 0;
+    uint64_t s, e;
+
+    while ((l = *p)) {
+	if (l->start >= start && l->end <= end) {
+	    *p = l->next;
+	    // freeing it overwrites it
+	    s = l->start;
+	    e = l->end;
+	    bytes += kmem_zone_free_range(reg, reg->mm_state->base_addr + s, e - s);
+	} else {
+	    p = &l->next;
+	}
+    }
+
+    return bytes;
+}
+
+// at boot, set up the zone up to the frontier given
+static void
+kmem_deferred_advance (struct mem_region *reg, uint64_t frontier)
+{
+    struct kmem_zone_deferred *d = reg->mm_deferred;
+    uint64_t bytes;
+    uint32_t i, j;
+
+    if (frontier > kmem_zone_pool_size(reg)) {
+	frontier = kmem_zone_pool_size(reg);
+    }
+    if (frontier <= d->frontier) {
+	return;
+    }
+
+    kmem_deferred_clear(reg, d->frontier, frontier);
+    bytes = kmem_deferred_free(reg, d->frontier, frontier);
+    kmem_bytes_managed += bytes;
+    d->eager_bytes += bytes;
+
+    // keep only what remains above the new frontier
+    for (i = j = 0; i < d->num_extents; i++) {
+	if (d->extents[i].end > frontier) {
+	    d->extents[j].start = d->extents[i].start > frontier ? d->extents[i].start : frontier;
+	    d->extents[j].end = d->extents[i].end;
+	    j++;
+	}
+    }
+    d->num_extents = j;
+    d->frontier = frontier;
+}
+
+static void
+kmem_deferred_start (void)
+{
+    struct mem_region *reg;
+    struct kmem_zone_deferred *d;
+    uint8_t flags;
+
+    if (__sync_fetch_and_add(&kmem_deferred.started, 0)) {
+	return;
+    }
+
+    flags = spin_lock_irq_save(&kmem_deferred.lock);
+    if (!kmem_deferred.started) {
+	list_for_each_entry(reg, &glob_zone_list, glob_link) {
+	    if (!(d = reg->mm_deferred)) {
+		continue;
+	    }
+	    d->first_chunk = kmem_deferred.total_chunks;
+	    d->num_chunks = (kmem_zone_pool_size(reg) - d->frontier + KMEM_DEFER_CHUNK - 1) >> KMEM_DEFER_CHUNK_ORDER;
+	    kmem_deferred.total_chunks += d->num_chunks;
+	}
+	KMEM_PRINT("Setting up %lu chunks of zones in parallel\n", kmem_deferred.total_chunks);
+	nk_kmem_boot_time("deferred zone setup starts");
+	__sync_synchronize();
+	kmem_deferred.started = 1;
+    }
+    spin_unlock_irq_restore(&kmem_deferred.lock, flags);
+}
+
+// the zone of a chunk of the work, and the chunk's index in it
+static struct mem_region *
+kmem_deferred_find (uint64_t chunk, uint64_t *index)
+{
+    struct mem_region *reg;
+    struct kmem_zone_deferred *d;
+
+    list_for_each_entry(reg, &glob_zone_list, glob_link) {
+	d = reg->mm_deferred;
+	if (d && chunk >= d->first_chunk && chunk < d->first_chunk + d->num_chunks) {
+	    *index = chunk - d->first_chunk;
+	    return reg;
+	}
+    }
+
+    return NULL;
+}
+
+static void
+kmem_deferred_chunk (uint64_t chunk)
+{
+    struct mem_region *reg;
+    struct kmem_zone_deferred *d;
+    uint64_t index, start, end, bytes;
+    uint8_t flags;
+
+    reg = kmem_deferred_find(chunk, &index);
+
+    if (!reg) {
+	KMEM_ERROR("No zone has deferred chunk %lu\n", chunk);
+	return;
+    }
+
+    d = reg->mm_deferred;
+
+    start = d->frontier + (index << KMEM_DEFER_CHUNK_ORDER);
+    end = start + KMEM_DEFER_CHUNK;
+    if (end > kmem_zone_pool_size(reg)) {
+	end = kmem_zone_pool_size(reg);
+    }
+
+    // nothing is allocated from the chunk yet, so no lock is needed to clear it
+    kmem_deferred_clear(reg, start, end);
+
+    flags = spin_lock_irq_save(&reg->mm_state->lock);
+    bytes = kmem_deferred_free(reg, start, end);
+    bytes += kmem_deferred_free_late(reg, start, end);
+    d->chunk_done[index] = 1;
+    spin_unlock_irq_restore(&reg->mm_state->lock, flags);
+
+    __sync_fetch_and_add(&kmem_bytes_managed, bytes);
+}
+
+/*
+ * Takes chunks of deferred zone setup until there are none left,
+ * without waiting for the chunks other cpus took
+ */
+static void
+kmem_deferred_take (void)
+{
+    uint64_t chunk;
+    int      took = 0;
+
+    kmem_deferred_start();
+
+    while (kmem_deferred.next_chunk < kmem_deferred.total_chunks &&
+	   (chunk = __sync_fetch_and_add(&kmem_deferred.next_chunk, 1)) < kmem_deferred.total_chunks) {
+	if (!took) {
+	    __sync_fetch_and_add(&kmem_deferred.num_cpus, 1);
+	    took = 1;
+	}
+	kmem_deferred_chunk(chunk);
+	if (__sync_add_and_fetch(&kmem_deferred.done_chunks, 1) == kmem_deferred.total_chunks) {
+	    KMEM_PRINT("Deferred zone setup done by %lu cpus\n", kmem_deferred.num_cpus);
+	    nk_kmem_boot_time("deferred zone setup done");
+	}
+    }
+}
+
+/*
+ * Called by every cpu once they are all up.  Takes chunks of deferred
+ * zone setup until there are none left, and waits until the chunks
+ * other cpus took are done too
+ */
+void
+nk_kmem_init_deferred (void)
+{
+    kmem_deferred_take();
+
+    while (__sync_fetch_and_add(&kmem_deferred.done_chunks, 0) < kmem_deferred.total_chunks) {
+	// another cpu is still setting up its chunk
+    }
+}
+
+/*
+ * Memory added after the work is handed out goes into its zone at
+ * once where the zone is set up, and is otherwise left for whoever
+ * sets up its chunk
+ */
+static void
+kmem_deferred_add_late (struct mem_region *reg, uint64_t start, uint64_t end)
+{
+    struct kmem_zone_deferred *d = reg->mm_deferred;
+    struct kmem_deferred_late *l;
+    uint64_t bytes = 0;
+    uint64_t s, e;
+    uint8_t flags;
+
+    flags = spin_lock_irq_save(&reg->mm_state->lock);
+
+    for (s = start; s < end; s = e) {
+	e = (s & ~(KMEM_DEFER_CHUNK - 1)) + KMEM_DEFER_CHUNK;
+	if (e > end) {
+	    e = end;
+	}
+	if (s < d->frontier || d->chunk_done[(s - d->frontier) >> KMEM_DEFER_CHUNK_ORDER]) {
+	    bytes += kmem_zone_free_range(reg, reg->mm_state->base_addr + s, e - s);
+	} else if (e - s >= (1ULL << MIN_ORDER)) {
+	    l = (struct kmem_deferred_late *)(reg->mm_state->base_addr + s);
+	    l->start = s;
+	    l->end = e;
+	    l->next = d->late;
+	    d->late = l;
+	}
+    }
+
+    spin_unlock_irq_restore(&reg->mm_state->lock, flags);
 
-  if (!b) { 
-    return -1;
-  } else {
-    block_hash_free_entry(b);
-    return 0;
-  }
+    __sync_fetch_and_add(&kmem_bytes_managed, bytes);
 }
 
-
-struct mem_region *
-kmem_get_base_zone (void)
+/*
+ * Called by kmem_add_memory(), returns nonzero if it took care of the
+ * memory, or zero if the caller should free it into the zone as usual
+ */
+static int
+kmem_deferred_add (struct mem_region *reg, uint64_t pa, uint64_t len)
 {
-    KMEM_DEBUG("getting base zone\n");
-    return list_first_entry(&glob_zone_list, struct mem_region, glob_link);
-}
+    struct kmem_zone_deferred *d = reg->mm_deferred;
+    uint64_t start = pa - reg->base_addr;
+    uint64_t end = start + len;
+    uint32_t n = d->num_extents;
+
+    if (__sync_fetch_and_add(&kmem_deferred.started, 0)) {
+	kmem_deferred_add_late(reg, start, end);
+	return 1;
+    }
 
+    if (end <= d->frontier) {
+	d->eager_bytes += len;
+	return 0;
+    }
 
-/* TODO: if we're going to be using this at runtime, really need to 
- * key these regions in a tree
- */
-struct mem_region *
-kmem_get_region_by_addr (ulong_t addr)
-{
-    struct mem_region * region = NULL;
-    list_for_each_entry(region, &glob_zone_list, glob_link) {
-        if (addr >= region->base_addr && 
-            addr < (region->base_addr + region->len)) {
-            return region;
-        }
+    if (d->eager_bytes < KMEM_DEFER_EAGER_BYTES || start < d->frontier) {
+	kmem_deferred_advance(reg, round_up(end, KMEM_DEFER_CHUNK));
+	d->eager_bytes += len;
+	return 0;
     }
 
-    return NULL;
+    if (n && d->extents[n-1].end == start) {
+	d->extents[n-1].end = end;
+    } else if (n < KMEM_DEFER_MAX_EXTENTS) {
+	d->extents[n].start = start;
+	d->extents[n].end = end;
+	d->num_extents++;
+    } else {
+	// out of extents, so set up the zone up to here instead
+	kmem_deferred_advance(reg, round_up(end, KMEM_DEFER_CHUNK));
+	d->eager_bytes += len;
+	return 0;
+    }
+
+    return 1;
 }
 
+#endif
+
 
 /**
  * This adds a zone to the kernel memory pool. Zones exist to allow there to be
@@ -302,8 +2481,26 @@ create_zone (struct mem_region * region)
     /* add this region to the global region list */
     list_add(&(region->glob_link), &glob_zone_list);
 
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+    /* Zones larger than a chunk are mostly set up after boot */
+    if (pool_order > KMEM_DEFER_CHUNK_ORDER) {
+        pool = buddy_init_untagged(pa_to_va(region->base_addr), pool_order, min_order);
+        if (pool && !kmem_zone_desc_init(region, 0)) {
+            kmem_deferred_zone_init(region, pool);
+            return pool;
+        }
+        return NULL;
+    }
+#endif
+
     /* Initialize the underlying buddy allocator */
-    return buddy_init(pa_to_va(region->base_addr), pool_order, min_order);
+    pool = buddy_init(pa_to_va(region->base_addr), pool_order, min_order);
+
+    if (pool && kmem_zone_desc_init(region, 1)) {
+        return NULL;
+    }
+
+    return pool;
 }
 
 
@@ -325,27 +2522,75 @@ kmem_add_memory (struct mem_region * mem,
      * kmem buddy allocator is initially empty.
      * Memory is added to it via buddy_free().
      * buddy_free() will panic if there are any problems with the args.
-     * However, buddy_free() does expect chunks of memory aligned
-     * to their size, which we manufacture out of the memory given.
+     * However, buddy_free() does expect whole frames aligned to their
+     * size, which kmem_zone_free_range() manufactures out of the memory
+     * given, dropping any partial frames at its ends.
      * buddy_free() will coalesce these chunks as appropriate
      */
 
-    uint64_t max_chunk_size = base_addr ? 1ULL << ctz(base_addr) : size;
-    uint64_t chunk_size = max_chunk_size < size ? max_chunk_size : size;
-    uint64_t chunk_order = ilog2(chunk_size); // floor
-    uint64_t num_chunks = size/chunk_size; // floor
     void *addr=(void*)pa_to_va(base_addr);
-    uint64_t i;
+    uint64_t bytes;
+    uint8_t flags;
 
-    KMEM_DEBUG("Add Memory to region %p base_addr=0x%llx size=0x%llx chunk_size=0x%llx, chunk_order=0x%llx, num_chunks=0x%llx, addr=%p\n",
-	       mem,base_addr,size,chunk_size,chunk_order,num_chunks,addr);
-    
-    for (i=0;i<num_chunks;i++) { 
-	buddy_free(mem->mm_state, addr+i*chunk_size, chunk_order);
+    KMEM_DEBUG("Add Memory to region %p base_addr=0x%llx size=0x%llx addr=%p\n",
+	       mem,base_addr,size,addr);
+
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+    if (mem->mm_deferred && kmem_deferred_add(mem, base_addr, size)) {
+	return;
     }
+#endif
+
+    flags = spin_lock_irq_save(&mem->mm_state->lock);
+    bytes = kmem_zone_free_range(mem, (addr_t)addr, size);
+    spin_unlock_irq_restore(&mem->mm_state->lock, flags);
 
     /* Update statistics */
-    kmem_bytes_managed += chunk_size*num_chunks;
+    __sync_fetch_and_add(&kmem_bytes_managed, bytes);
+}
+
+/*
+ * Builds the list of regions, in order of distance from dom, that an
+ * allocation on behalf of dom scans
+ */
+static int
+kmem_order_regions (struct list_head * list, struct numa_domain * dom)
+{
+    struct domain_adj_entry * rem_dom_ent = NULL;
+    struct mem_region * mem = NULL;
+
+    INIT_LIST_HEAD(list);
+
+    // first add the local domain's regions
+    list_for_each_entry(mem, &dom->regions, entry) {
+        struct mem_reg_entry * newent = mm_boot_alloc(sizeof(struct mem_reg_entry));
+        if (!newent) {
+            KMEM_ERROR("Could not allocate mem region entry\n");
+            return -1;
+        }
+        newent->mem = mem;
+        KMEM_DEBUG("Adding region [%p] in domain %u to local region list\n",
+                mem->base_addr, 
+                dom->id);
+        list_add_tail(&newent->mem_ent, list);
+    }
+
+    list_for_each_entry(rem_dom_ent, &dom->adj_list, list_ent) {
+        struct numa_domain * rem_dom = rem_dom_ent->domain;
+        struct mem_region *rem_reg = NULL;
+
+        list_for_each_entry(rem_reg, &rem_dom->regions, entry) {
+            struct mem_reg_entry * newent = mm_boot_alloc(sizeof(struct mem_reg_entry));
+            if (!newent) {
+                ERROR_PRINT("Could not allocate mem region entry\n");
+                return -1;
+            }
+            newent->mem = rem_reg;
+            list_add_tail(&newent->mem_ent, list);
+        }
+    }
+
+    return 0;
 }
 
 void *boot_mm_get_cur_top();
@@ -367,6 +2612,8 @@ nk_kmem_init (void)
     uint64_t total_mem=0;
     uint64_t total_phys_mem=0;
     
+    kmem_boot_tsc = rdtsc();
+
     kmem_private_start = boot_mm_get_cur_top();
 
     /* initialize the global zone list */
@@ -394,43 +2641,24 @@ nk_kmem_init (void)
      * based on distance from its home node. 
      * We'll try to allocate from these in order */
     for (i = 0; i < sys->num_cpus; i++) {
-        struct list_head * local_regions = &(sys->cpus[i]->kmem.ordered_regions);
-        INIT_LIST_HEAD(local_regions);
-
-        // first add the local domain's regions
-        struct numa_domain * loc_dom = sys->cpus[i]->domain;
-        struct mem_region * mem = NULL;
-        list_for_each_entry(mem, &loc_dom->regions, entry) {
-            struct mem_reg_entry * newent = mm_boot_alloc(sizeof(struct mem_reg_entry));
-            if (!newent) {
-                KMEM_ERROR("Could not allocate mem region entry\n");
-                return -1;
-            }
-            newent->mem = mem;
-            KMEM_DEBUG("Adding region [%p] in domain %u to CPU %u's local region list\n",
-                    mem->base_addr, 
-                    loc_dom->id,
-                    i);
-            list_add_tail(&newent->mem_ent, local_regions);
+        KMEM_DEBUG("Ordering regions for CPU %u\n", i);
+        if (kmem_order_regions(&(sys->cpus[i]->kmem.ordered_regions), sys->cpus[i]->domain)) {
+            return -1;
         }
+    }
 
-        struct domain_adj_entry * rem_dom_ent = NULL;
-        list_for_each_entry(rem_dom_ent, &loc_dom->adj_list, list_ent) {
-            struct numa_domain * rem_dom = rem_dom_ent->domain;
-            struct mem_region *rem_reg = NULL;
-
-            list_for_each_entry(rem_reg, &rem_dom->regions, entry) {
-                struct mem_reg_entry * newent = mm_boot_alloc(sizeof(struct mem_reg_entry));
-                if (!newent) {
-                    ERROR_PRINT("Could not allocate mem region entry\n");
-                    return -1;
-                }
-                newent->mem = rem_reg;
-                list_add_tail(&newent->mem_ent, local_regions);
-            }
-
+    /* and each domain gets the same, for the memory policies */
+    for (i = 0; i < numa_info->num_domains; i++) {
+        if (!numa_info->domains[i]) {
+            INIT_LIST_HEAD(&kmem_domain_data[i].ordered_regions);
+            continue;
+        }
+        if (kmem_order_regions(&kmem_domain_data[i].ordered_regions, numa_info->domains[i])) {
+            return -1;
+        }
+        if (kmem_domain_has_memory(i)) {
+            kmem_mem_domains[kmem_num_mem_domains++] = i;
         }
-
     }
 
     total_mem = 0;
@@ -451,16 +2679,33 @@ nk_kmem_init (void)
 
     KMEM_PRINT("Malloc configured to support a maximum of: 0x%lx bytes of physical memory\n", total_phys_mem);
 
-    if (block_hash_init(total_phys_mem)) { 
-      KMEM_ERROR("Failed to initialize block hash\n");
-      return -1;
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    if (kmem_cache_init()) {
+	KMEM_ERROR("Failed to initialize per-cpu magazines\n");
+	return -1;
+    }
+#endif
+
+#ifdef KMEM_SLABS
+    if (kmem_classes_init()) {
+	KMEM_ERROR("Failed to initialize size classes\n");
+	return -1;
     }
+#endif
+
+    spinlock_init(&kmem_huge_lock);
+
+#ifdef NAUT_CONFIG_KMEM_ZERO_POOL
+    kmem_zero_pool_init();
+#endif
 
 
     // the assumption here is that no further boot_mm allocations will
     // be made by kmem from this point on
     kmem_private_end = boot_mm_get_cur_top();
 
+    nk_kmem_boot_time("zones created");
+
     return 0;
 }
 
@@ -481,6 +2726,7 @@ void kmem_inform_boot_allocation(void *low, void *high)
 }
 
 
+
 /**
  * Allocates memory from the kernel memory pool. This will return a memory
  * region that is at least 16-byte aligned. The memory returned is 
@@ -501,10 +2747,10 @@ _kmem_malloc (size_t size, int cpu, int zero)
     NK_GPIO_OUTPUT_MASK(0x20,GPIO_OR);
     int first = 1;
     void *block = 0;
-    struct kmem_block_hdr *hdr = NULL;
-    struct mem_reg_entry * reg = NULL;
+    struct mem_region * reg = NULL;
     ulong_t order;
     cpu_id_t my_id;
+    int bind = -1;
 
     if (cpu<0 || cpu>= nk_get_num_cpus()) {
 	my_id = my_cpu_id();
@@ -514,6 +2760,13 @@ _kmem_malloc (size_t size, int cpu, int zero)
 
     struct kmem_data * my_kmem = &(nk_get_nautilus_info()->sys.cpus[my_id]->kmem);
 
+    // an allocation for a specific cpu overrides the thread's policy
+    struct kmem_data * policy_kmem = cpu<0 ? kmem_policy_zones(size, &bind) : 0;
+
+    if (policy_kmem) {
+	my_kmem = policy_kmem;
+    }
+
     KMEM_DEBUG("malloc of %lu bytes (zero=%d) from:\n",size,zero);
     KMEM_DEBUG_BACKTRACE();
 
@@ -530,46 +2783,70 @@ _kmem_malloc (size_t size, int cpu, int zero)
         order = MIN_ORDER;
     }
 
- retry:
-
-    /* scan the blocks in order of affinity */
-    list_for_each_entry(reg, &(my_kmem->ordered_regions), mem_ent) {
-        struct buddy_mempool * zone = reg->mem->mm_state;
+#ifdef KMEM_SLABS
+    // under a policy, the classes of the domain it picked
+    struct kmem_size_class *cls = kmem_class_lookup(my_kmem, size);
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    // a cpu's own classes are fronted by its magazines
+    if (cls && kmem_cache_ready && !policy_kmem && (cpu < 0 || my_id == my_cpu_id())) {
+	block = kmem_cache_class_alloc(cls->index);
+    }
+#endif
+    if (cls && !block) {
+	block = kmem_class_alloc(cls, my_kmem, bind);
+    }
+    if (block) {
+	KMEM_DEBUG("malloc succeeded from size class: size %lu class %u -> 0x%lx\n",size, cls->size, block);
+	if (zero) {
+	    memset(block,0,cls->size);
+	}
+	NK_GPIO_OUTPUT_MASK(~0x20,GPIO_AND);
+	return block;
+    }
+    // otherwise fall back to a power of two block, which may reclaim memory
+#endif
 
-        /* Allocate memory from the underlying buddy system */
-        uint8_t flags = spin_lock_irq_save(&zone->lock);
-        block = buddy_alloc(zone, order);
-        spin_unlock_irq_restore(&zone->lock, flags);
+#ifdef NAUT_CONFIG_KMEM_ZERO_POOL
+    if (zero && !policy_kmem) {
+	block = kmem_zero_pool_take(nk_get_nautilus_info()->sys.cpus[my_id]->domain->id, order);
+	if (block) {
+	    KMEM_DEBUG("malloc succeeded from zero pool: size %lu order %lu -> 0x%lx\n",size, order, block);
+	    NK_GPIO_OUTPUT_MASK(~0x20,GPIO_AND);
+	    return block;
+	}
+    }
+#endif
 
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    if (kmem_cache_ready && order <= KMEM_MAG_MAX_ORDER && !policy_kmem && (cpu < 0 || my_id == my_cpu_id())) {
+	block = kmem_cache_alloc(order);
 	if (block) {
-	  hdr = block_hash_alloc(block);
-	  if (!hdr) {
-            KMEM_DEBUG("malloc cannot allocate header, releasing block\n");
-	    flags = spin_lock_irq_save(&zone->lock);
-	    buddy_free(zone,block,order);
-	    spin_unlock_irq_restore(&zone->lock, flags);
-	    block=0;
-	  }
-	}
-
-        if (hdr) {
-	    hdr->addr = block;
-            hdr->zone = zone;
-	    // force a software barrier here, since our next write must come last
-	    __asm__ __volatile__ ("" :::"memory");
-	    hdr->order = order; // allocation complete
-            break;
-        }
-        
+	    KMEM_DEBUG("malloc succeeded from magazine: size %lu order %lu -> 0x%lx\n",size, order, block);
+	    if (zero) {
+		memset(block,0,1ULL << order);
+	    }
+	    NK_GPIO_OUTPUT_MASK(~0x20,GPIO_AND);
+	    return block;
+	}
     }
+#endif
+
+ retry:
+
+    /* scan the zones in order of affinity */
+    block = kmem_zone_alloc(my_kmem, order, bind, &reg);
 
-    if (hdr) {
+    if (block) {
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+	reg->mm_flags[kmem_block_index(reg, block)] = 0;
+#endif
+	reg->mm_blocks[kmem_block_index(reg, block)] = order;
         kmem_bytes_allocated += (1UL << order);
     } else {
 	// attempt to get memory back by reaping threads now...
 	if (first) {
 	    KMEM_DEBUG("malloc initially failed for size %lu order %lu attempting reap\n",size,order);
-	    nk_sched_reap(1);
+	    kmem_reclaim();
 	    first=0;
 	    goto retry;
 	}
@@ -581,7 +2858,7 @@ _kmem_malloc (size_t size, int cpu, int zero)
     KMEM_DEBUG("malloc succeeded: size %lu order %lu -> 0x%lx\n",size, order, block);
  
     if (zero) { 
-	memset(block,0,1ULL << hdr->order);
+	memset(block,0,1ULL << order);
     }
      
 #if SANITY_CHECK_PER_OP
@@ -619,16 +2896,15 @@ void *kmem_malloc_specific(size_t size, int cpu, int zero)
  * Arguments:
  *       [IN] addr: Address of the memory region to free.
  *
- * NOTE: The size of the memory region being freed is assumed to be in a
- *       'struct kmem_block_hdr' header located immediately before the address
- *       passed in by the caller. This header is created and initialized by
- *       kmem_alloc().
+ * NOTE: The order of the memory region being freed is found in the
+ *       block descriptor of its zone, which is set by kmem_alloc().
  */
 void
 kmem_free (void * addr)
 {
-    struct kmem_block_hdr *hdr;
+    struct mem_region * reg;
     struct buddy_mempool * zone;
+    uint8_t * desc;
     uint64_t order;
 
     KMEM_DEBUG("free of address %p from:\n", addr);
@@ -646,32 +2922,47 @@ kmem_free (void * addr)
     }
 
 
-    // Note that if the user is doing a double-free, it is possible
-    // that we race on the block hash entry and so could end up invoking
-    // the buddy free more than once
+    desc = kmem_find_frame(addr, &reg);
 
-    hdr = block_hash_find_entry(addr);
+#ifdef KMEM_SLABS
+    if (desc && (*desc & KMEM_DESC_SLAB)) {
+	kmem_class_free(reg, *desc, addr);
+	KMEM_DEBUG("free succeeded into size class: addr=0x%lx\n",addr);
+	return;
+    }
+#endif
 
-    if (!hdr) { 
+    if (!desc || !kmem_frame_aligned(reg, addr)) { 
       KMEM_ERROR("Failed to find entry for block %p in kmem_free()\n",addr);
       KMEM_ERROR_BACKTRACE();
       return;
     }
 
-    zone = hdr->zone;
-    order = hdr->order;
+    zone = reg->mm_state;
+    order = *desc;
 
-    // Sanity check things here
-    // this will in some cases catch a double free that is causing a
-    // race on the header
-    if (!zone || order<MIN_ORDER) {
-	KMEM_ERROR("Likely double free ignored- addr=%p, zone=%p order=%lu, hdr=%p, hdr->addr=%p, hdr->order=%lu\n", addr,zone, order, hdr,hdr->addr,hdr->order);
+    // Sanity check things here - this catches frees of addresses
+    // that are not the start of a block and most double frees
+    if (order<MIN_ORDER || (order & KMEM_DESC_CACHED)) {
+	KMEM_ERROR("Likely double free ignored- addr=%p, zone=%p desc=0x%lx\n", addr, zone, order);
 	BACKTRACE(KMEM_ERROR,3);
-	// avoid freeing the header a second time
-	// block_hash_free_entry(hdr);
 	return;
     }
 
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    if (kmem_cache_free(reg, desc, addr, order)) {
+	KMEM_DEBUG("free succeeded into magazine: addr=0x%lx order=%lu\n",addr,order);
+	return;
+    }
+#endif
+
+    // Claim the descriptor so that a racing double free
+    // cannot also invoke the buddy free
+    if (!__sync_bool_compare_and_swap(desc, order, 0)) {
+	KMEM_ERROR("Likely double free ignored- addr=%p, zone=%p order=%lu\n", addr, zone, order);
+	BACKTRACE(KMEM_ERROR,3);
+	return;
+    }
     
     /* Return block to the underlying buddy system */
     uint8_t flags = spin_lock_irq_save(&zone->lock);
@@ -679,7 +2970,6 @@ kmem_free (void * addr)
     buddy_free(zone, addr, order);
     spin_unlock_irq_restore(&zone->lock, flags);
     KMEM_DEBUG("free succeeded: addr=0x%lx order=%lu\n",addr,order);
-    block_hash_free_entry(hdr);
 
 #if SANITY_CHECK_PER_OP
     if (kmem_sanity_check()) { 
@@ -691,16 +2981,97 @@ kmem_free (void * addr)
 }
 
 /*
- * This is a *dead simple* implementation of realloc that tries to change the
- * size of the allocation pointed to by ptr to size, and returns ptr.  Realloc will
- * malloc a new block of memory, copy as much of the old data as it can, and free the
- * old block. If ptr is NULL, this is equivalent to a malloc for the specified size.
+ * Returns the usable size of the allocated block at addr, or 0 if
+ * addr is not the start of an allocated block
+ */
+static size_t
+kmem_block_size (void * addr)
+{
+	struct mem_region *reg;
+	uint8_t *desc = kmem_find_frame(addr, &reg);
+
+	if (!desc) {
+		return 0;
+	}
+
+#ifdef KMEM_SLABS
+	if (*desc & KMEM_DESC_SLAB) {
+		return kmem_slab_of(reg, *desc, addr)->cls->size;
+	}
+#endif
+
+	if (!kmem_frame_aligned(reg, addr) || *desc < MIN_ORDER || (*desc & KMEM_DESC_CACHED)) {
+		return 0;
+	}
+
+	return 1ULL << *desc;
+}
+
+/*
+ * Attempts to resize the allocated block at ptr in place so that it
+ * holds at least size bytes.  A block that already has room keeps
+ * its order, a block that has too much room gives its tail back to
+ * its zone, and a block that is too small absorbs its free buddies
+ * if it can.  Returns 0 on success.
+ */
+static int
+kmem_realloc_in_place (void * ptr, size_t size)
+{
+	struct mem_region *reg;
+	uint8_t *desc = kmem_find_frame(ptr, &reg);
+	ulong_t order, new_order;
+	uint8_t flags;
+	int rc = 0;
+
+	if (!desc) {
+		return -1;
+	}
+
+#ifdef KMEM_SLABS
+	if (*desc & KMEM_DESC_SLAB) {
+		return size <= kmem_slab_of(reg, *desc, ptr)->cls->size ? 0 : -1;
+	}
+#endif
+
+	if (!kmem_frame_aligned(reg, ptr) || *desc < MIN_ORDER || (*desc & KMEM_DESC_CACHED)) {
+		return -1;
+	}
+
+	order = *desc;
+	new_order = size > (1ULL << MIN_ORDER) ? ilog2(roundup_pow_of_two(size)) : MIN_ORDER;
+
+	if (new_order == order) {
+		return 0;
+	}
+
+	flags = spin_lock_irq_save(&reg->mm_state->lock);
+	if (new_order < order) {
+		buddy_shrink(reg->mm_state, ptr, order, new_order);
+		kmem_bytes_allocated -= (1UL << order) - (1UL << new_order);
+		*desc = new_order;
+	} else if (!(rc = buddy_grow(reg->mm_state, ptr, order, new_order))) {
+		kmem_bytes_allocated += (1UL << new_order) - (1UL << order);
+		*desc = new_order;
+	}
+	spin_unlock_irq_restore(&reg->mm_state->lock, flags);
+
+	KMEM_DEBUG("realloc of %p from order %lu to order %lu in place %s\n",
+		   ptr, order, new_order, rc ? "failed" : "succeeded");
+
+	return rc;
+}
+
+/*
+ * Changes the size of the allocation pointed to by ptr to size.  The
+ * block is resized in place if possible, otherwise realloc will malloc
+ * a new block of memory, copy as much of the old data as it can, and
+ * free the old block. If ptr is NULL, this is equivalent to a malloc
+ * for the specified size.
  *
  */
 void * 
 kmem_realloc (void * ptr, size_t size)
 {
-	struct kmem_block_hdr *hdr;
 	size_t old_size;
 	void * tmp = NULL;
 
@@ -709,14 +3080,17 @@ kmem_realloc (void * ptr, size_t size)
 		return kmem_malloc(size);
 	}
 
-	hdr = block_hash_find_entry(ptr);
+	if (!kmem_realloc_in_place(ptr, size)) {
+		return ptr;
+	}
+
+	old_size = kmem_block_size(ptr);
 
-	if (!hdr) {
+	if (!old_size) {
 		KMEM_DEBUG("Realloc failed to find entry for block %p\n", ptr);
 		return NULL;
 	}
 
-	old_size = 1 << hdr->order;
 	tmp = kmem_malloc(size);
 	if (!tmp) {
 		panic("Realloc failed\n");
@@ -773,6 +3147,17 @@ static uint64_t _kmem_stats(struct kmem_stats *stats, stat_type_t what)
     }
     if (what==GET) {
 	stats->total_num_pools=cur;
+#ifdef KMEM_SLABS
+	if (kmem_classes_ready) {
+	    kmem_classes_stats(stats);
+	}
+#endif
+	kmem_huge_stats(stats);
+#ifdef NAUT_CONFIG_KMEM_ZERO_POOL
+	if (kmem_zero_ready) {
+	    kmem_zero_pool_stats(stats);
+	}
+#endif
     }
     return cur;
 }
@@ -788,6 +3173,31 @@ void kmem_stats(struct kmem_stats *stats)
     _kmem_stats(stats,GET);
 }
 
+void kmem_get_usage(uint64_t *managed, uint64_t *allocated)
+{
+    *managed = kmem_bytes_managed;
+    *allocated = kmem_bytes_allocated;
+}
+
+int nk_kmem_shrinkers_init(void)
+{
+    int rc = 0;
+
+#ifdef KMEM_SLABS
+    rc |= !nk_kmem_register_shrinker("kmem-size-classes", kmem_classes_count, kmem_classes_shrink);
+#endif
+#ifdef NAUT_CONFIG_KMEM_ZERO_POOL
+    rc |= !nk_kmem_register_shrinker("kmem-zero-pool", kmem_zero_pool_count, kmem_zero_pool_drain);
+#endif
+
+    if (rc) {
+	KMEM_ERROR("Failed to register shrinkers\n");
+	return -1;
+    }
+
+    return 0;
+}
+
 int kmem_sanity_check()
 {
     int rc=0;
@@ -813,17 +3223,45 @@ void  kmem_get_internal_pointer_range(void **start, void **end)
     *end = kmem_private_end;
 }
 
+/*
+ * Walk the allocated blocks of a zone, stepping over each allocated
+ * or free block as a whole, and invoke func on each allocated block.
+ * Blocks held by per-cpu magazines are free as far as users are
+ * concerned and are skipped.   We assume the world is stopped.
+ */
+static int kmem_zone_walk(struct mem_region *reg,
+			  int (*func)(struct mem_region *reg, uint64_t frame, void *state),
+			  void *state)
+{
+    uint64_t n = kmem_zone_num_frames(reg);
+    uint64_t i = 0;
+
+    while (i < n) {
+	uint8_t d = reg->mm_blocks[i];
+	uint64_t order = d & KMEM_DESC_ORDER_MASK;
+	if (order >= MIN_ORDER) {
+	    if (!(d & KMEM_DESC_CACHED) && func(reg, i, state)) {
+		return -1;
+	    }
+	} else {
+	    long free_order = buddy_free_order(reg->mm_state, (void*)(reg->mm_state->base_addr + (i << MIN_ORDER)));
+	    order = free_order >= MIN_ORDER ? free_order : MIN_ORDER;
+	}
+	i += 1ULL << (order - MIN_ORDER);
+    }
+
+    return 0;
+}
+
 int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, uint64_t *flags)
 {
-    uint64_t i;
     uint64_t order;
     addr_t   zone_base;
-    uint64_t zone_min_order;
     uint64_t zone_max_order;
     addr_t   any_offset;
     struct mem_region *reg;
 
-    if (!(reg = kmem_get_region_by_addr((addr_t)any_addr))) {
+    if (!(reg = kmem_get_region_by_addr(va_to_pa((addr_t)any_addr))) || !reg->mm_blocks) {
 	// not in any region we manage
 	return -1;
     }
@@ -838,22 +3276,24 @@ int  kmem_find_block(void *any_addr, void **block_addr, uint64_t *block_size, ui
     }
 
     zone_base = reg->mm_state->base_addr;
-    zone_min_order = reg->mm_state->min_order;
     zone_max_order = reg->mm_state->pool_order;
 
     any_offset = (addr_t)any_addr - (addr_t)zone_base;
-    
-    for (order=zone_min_order;order<=zone_max_order;order++) {
-	addr_t mask = ~((1ULL << order)-1);
-	void *search_addr = (void*)(zone_base + (any_offset & mask));
-	struct kmem_block_hdr *hdr = block_hash_find_entry(search_addr);
-	// must exist and must be allocated
-	if (hdr && hdr->order>=MIN_ORDER) { 
-	    *block_addr = search_addr;
-	    *block_size = 0x1ULL<<hdr->order;
-	    *flags = hdr->flags;
+
+    // A block of order k that contains the address must start at
+    // the address rounded down to a multiple of 2^k, so there is
+    // one descriptor to check per order
+    for (order=MIN_ORDER;order<=zone_max_order;order++) {
+	addr_t offset = any_offset & ~((1ULL << order)-1);
+	if (reg->mm_blocks[offset >> MIN_ORDER] == order) {
+	    *block_addr = (void*)(zone_base + offset);
+	    *block_size = 0x1ULL<<order;
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+	    *flags = reg->mm_flags[offset >> MIN_ORDER];
+#else
+	    *flags = 0;
+#endif
 	    return 0;
-	    
 	}
     }
     return -1;
@@ -868,45 +3308,89 @@ int  kmem_set_block_flags(void *block_addr, uint64_t flags)
 	return 0;
 
     } else {
-
-	struct kmem_block_hdr *h =  block_hash_find_entry(block_addr);
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+	struct mem_region *reg;
+	uint8_t *desc = kmem_find_desc(block_addr, &reg);
 	
-	if (!h || h->order<MIN_ORDER) { 
+	if (!desc || *desc<MIN_ORDER || (*desc & KMEM_DESC_CACHED)) { 
 	    return -1;
 	} else {
-	    h->flags = flags;
+	    reg->mm_flags[kmem_block_index(reg, block_addr)] = flags;
 	    return 0;
 	}
+#else
+	// per-block flags are only kept when garbage collection is configured
+	return -1;
+#endif
+    }
+}
+
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+struct mask_state {
+    uint8_t mask;
+    int     or;
+};
+
+static int mask_block(struct mem_region *reg, uint64_t frame, void *state)
+{
+    struct mask_state *m = (struct mask_state *)state;
+
+    if (m->or) {
+	reg->mm_flags[frame] |= m->mask;
+    } else {
+	reg->mm_flags[frame] &= m->mask;
     }
+    return 0;
 }
+#endif
 
 // applies only to allocated blocks
 int  kmem_mask_all_blocks_flags(uint64_t mask, int or)
 {
-    uint64_t i;
-
     if (!or) { 
 	boot_flags &= mask;
-	for (i=0;i<block_hash_num_entries;i++) { 
-	    if (block_hash_entries[i].order>=MIN_ORDER) { 
-		block_hash_entries[i].flags &= mask;
-	    }
-	}
     } else {
 	boot_flags |= mask;
-	for (i=0;i<block_hash_num_entries;i++) { 
-	    if (block_hash_entries[i].order>=MIN_ORDER) { 
-		block_hash_entries[i].flags |= mask;
-	    }
-	}
     }
 
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+    struct mask_state m = { .mask = mask, .or = or };
+    struct mem_region *reg;
+
+    list_for_each_entry(reg, &glob_zone_list, glob_link) {
+	kmem_zone_walk(reg, mask_block, &m);
+    }
+#endif
+
+    return 0;
+}
+
+struct apply_state {
+    uint64_t mask;
+    uint64_t flags;
+    int    (*func)(void *block, void *state);
+    void    *state;
+};
+
+static int apply_block(struct mem_region *reg, uint64_t frame, void *state)
+{
+    struct apply_state *a = (struct apply_state *)state;
+#ifdef NAUT_CONFIG_GARBAGE_COLLECTION
+    uint64_t flags = reg->mm_flags[frame];
+#else
+    uint64_t flags = 0;
+#endif
+
+    if ((flags & a->mask) == a->flags) {
+	return a->func((void*)(reg->mm_state->base_addr + (frame << MIN_ORDER)), a->state);
+    }
     return 0;
 }
     
 int  kmem_apply_to_matching_blocks(uint64_t mask, uint64_t flags, int (*func)(void *block, void *state), void *state)
 {
-    uint64_t i;
+    struct apply_state a = { .mask = mask, .flags = flags, .func = func, .state = state };
+    struct mem_region *reg;
     
     if (((boot_flags & mask) == flags)) {
 	if (func(boot_start,state)) { 
@@ -914,15 +3398,11 @@ int  kmem_apply_to_matching_blocks(uint64_t mask, uint64_t flags, int (*func)(vo
 	}
     }
 
-    for (i=0;i<block_hash_num_entries;i++) { 
-	if (block_hash_entries[i].order>=MIN_ORDER) { 
-	    if ((block_hash_entries[i].flags & mask) == flags) {
-		if (func(block_hash_entries[i].addr,state)) { 
-		    return -1;
-		}
-	    }
+    list_for_each_entry(reg, &glob_zone_list, glob_link) {
+	if (reg->mm_blocks && kmem_zone_walk(reg, apply_block, &a)) {
+	    return -1;
 	}
-    } 
+    }
     
     return 0;
 }
@@ -1007,8 +3487,36 @@ handle_meminfo (char * buf, void * priv)
     nk_vc_printf("%lu pools %lu blks free %lu bytes free\n", s->total_num_pools, s->total_blocks_free, s->total_bytes_free);
     nk_vc_printf("  %lu bytes min %lu bytes max\n", s->min_alloc_size, s->max_alloc_size);
 
+    for (i=0;i<s->num_classes;i++) {
+	struct kmem_class_stats *c = &s->class_stats[i];
+	if (!c->num_slabs && !c->allocs) {
+	    continue;
+	}
+        nk_vc_printf("class %4lu bytes: %lu slabs (%lu bytes) %lu/%lu objs in use (%lu%% utilized, %lu bytes unused)\n"
+		     "                  %lu allocs %lu frees\n",
+		     c->size, c->num_slabs, c->bytes_held, c->objs_in_use, c->objs_total,
+		     c->bytes_held ? (100*c->bytes_in_use)/c->bytes_held : 0,
+		     c->bytes_held - c->bytes_in_use, c->allocs, c->frees);
+    }
+
+    if (s->zero_pool_hits || s->zero_pool_misses || s->zero_pool_bytes) {
+        nk_vc_printf("zero pools: %lu bytes held, %lu bytes zeroed while idle\n"
+		     "  %lu zeroing allocs avoided zeroing (%lu bytes), %lu did not\n",
+		     s->zero_pool_bytes, s->zero_pool_bytes_filled,
+		     s->zero_pool_hits, s->zero_pool_bytes_avoided, s->zero_pool_misses);
+    }
+
+    if (s->huge_allocs) {
+        nk_vc_printf("%lu huge allocations %lu bytes (%lu bytes on 2MB pages, %lu bytes on 1GB pages)\n",
+		     s->huge_allocs, s->huge_bytes, s->huge_bytes_2mb, s->huge_bytes_1gb);
+    }
+
     free(s);
 
+#ifdef NAUT_CONFIG_KMEM_PERCPU_CACHE
+    kmem_cache_dump();
+#endif
+
     return 0;
 }
 
@@ -0,0 +1,447 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/mm.h>
+#include <nautilus/kmem_cache.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/list.h>
+#include <nautilus/math.h>
+#include <nautilus/numa.h>
+#include <nautilus/shell.h>
+#include <nautilus/shrinker.h>
+
+#ifndef NAUT_CONFIG_DEBUG_KMEM
+#undef DEBUG_PRINT
+#define DEBUG_PRINT(fmt, args...)
+#endif
+
+#define CACHE_DEBUG(fmt, args...) DEBUG_PRINT("kmem_cache: " fmt, ##args)
+#define CACHE_ERROR(fmt, args...) ERROR_PRINT("kmem_cache: " fmt, ##args)
+#define CACHE_INFO(fmt, args...)  INFO_PRINT("kmem_cache: " fmt, ##args)
+
+// kmem blocks are at least this aligned
+#define CACHE_MIN_ALIGN  16
+// a power of two block is aligned to its size only as far as its
+// zone's start is, which is where a firmware memory range starts,
+// in practice on a page boundary
+#define CACHE_MAX_ALIGN  PAGE_SIZE_4KB
+
+#define CACHE_CPU_OBJS   32   // objects held per cpu
+#define CACHE_BATCH      16   // objects moved to or from the depot at once
+#define CACHE_DEPOT_OBJS 256  // objects held in the depot
+
+struct nk_kmem_cache_cpu {
+    uint32_t count;
+    void    *objs[CACHE_CPU_OBJS];
+
+    uint64_t allocs;
+    uint64_t cpu_hits;      // allocations served from this cpu's objects
+    uint64_t depot_hits;    // allocations served after a refill from the depot
+    uint64_t frees;
+} __attribute__((aligned(64)));
+
+struct nk_kmem_cache {
+    char      name[NK_KMEM_CACHE_NAME_LEN];
+    size_t    size;         // object size as allocated from kmem
+    size_t    align;
+    int     (*ctor)(void *obj);
+    void    (*dtor)(void *obj);
+
+    spinlock_t lock;        // protects the depot
+    uint32_t   depot_count;
+    void      *depot[CACHE_DEPOT_OBJS];
+
+    uint64_t   constructed; // objects created with the constructor
+    uint64_t   destructed;  // objects given back to kmem
+
+    struct list_head node;  // on the list of all caches
+
+    uint32_t   num_cpus;
+    struct nk_kmem_cache_cpu *cpus;
+};
+
+static spinlock_t       cache_list_lock;
+static struct list_head cache_list = LIST_HEAD_INIT(cache_list);
+
+static int              shrinker_registered;
+
+#define CACHE_LIST_LOCK_CONF uint8_t _cache_list_lock_flags
+#define CACHE_LIST_LOCK() _cache_list_lock_flags = spin_lock_irq_save(&cache_list_lock)
+#define CACHE_LIST_UNLOCK() spin_unlock_irq_restore(&cache_list_lock, _cache_list_lock_flags)
+
+
+static uint64_t caches_shrink_count(void);
+static uint64_t caches_shrink_scan(uint64_t nr);
+
+struct nk_kmem_cache *nk_kmem_cache_create(char *name,
+					   size_t size,
+					   size_t align,
+					   int  (*ctor)(void *obj),
+					   void (*dtor)(void *obj))
+{
+    CACHE_LIST_LOCK_CONF;
+    struct nk_kmem_cache *c;
+    uint32_t num_cpus = nk_get_num_cpus();
+
+    if (!align) {
+	align = CACHE_MIN_ALIGN;
+    }
+
+    if (align & (align - 1)) {
+	CACHE_ERROR("Alignment %lu of cache %s is not a power of two\n", align, name);
+	return 0;
+    }
+
+    if (align > CACHE_MAX_ALIGN) {
+	CACHE_ERROR("Alignment %lu of cache %s is more than the %lu kmem can provide\n",
+		    align, name, CACHE_MAX_ALIGN);
+	return 0;
+    }
+
+    c = malloc(sizeof(*c));
+
+    if (!c) {
+	CACHE_ERROR("Failed to allocate cache %s\n", name);
+	return 0;
+    }
+
+    memset(c, 0, sizeof(*c));
+
+    c->cpus = malloc(sizeof(struct nk_kmem_cache_cpu) * num_cpus);
+
+    if (!c->cpus) {
+	CACHE_ERROR("Failed to allocate per-cpu state of cache %s\n", name);
+	free(c);
+	return 0;
+    }
+
+    memset(c->cpus, 0, sizeof(struct nk_kmem_cache_cpu) * num_cpus);
+
+    strncpy(c->name, name, NK_KMEM_CACHE_NAME_LEN);
+    c->name[NK_KMEM_CACHE_NAME_LEN-1] = 0;
+
+    // kmem guarantees 16 byte alignment.  A power of two size gets
+    // either a buddy block or an object of a power of two size class,
+    // and both are aligned to their size relative to the start of
+    // their zone.  Sizing objects to a power of two therefore meets
+    // larger alignments up to that of the zone, which
+    // cache_construct() checks.
+    c->size = (size + CACHE_MIN_ALIGN - 1) & ~(CACHE_MIN_ALIGN - 1);
+    if (align > CACHE_MIN_ALIGN) {
+	c->size = roundup_pow_of_two(c->size < align ? align : c->size);
+    }
+    c->align = align;
+    c->ctor = ctor;
+    c->dtor = dtor;
+    c->num_cpus = num_cpus;
+
+    spinlock_init(&c->lock);
+
+    CACHE_LIST_LOCK();
+    list_add_tail(&c->node, &cache_list);
+    CACHE_LIST_UNLOCK();
+
+    // one shrinker covers the depots of all caches
+    if (!__sync_lock_test_and_set(&shrinker_registered, 1) &&
+	!nk_kmem_register_shrinker("kmem-cache-depots", caches_shrink_count, caches_shrink_scan)) {
+	CACHE_ERROR("Failed to register shrinker\n");
+    }
+
+    CACHE_DEBUG("Created cache %s (%lu byte objects, %lu byte alignment)\n", c->name, c->size, c->align);
+
+    return c;
+}
+
+
+static void *cache_construct(struct nk_kmem_cache *c, int cpu)
+{
+    void *obj = cpu < 0 ? malloc(c->size) : malloc_specific(c->size, cpu);
+
+    if (!obj) {
+	CACHE_ERROR("Failed to allocate object for cache %s\n", c->name);
+	return 0;
+    }
+
+    if ((addr_t)obj & (c->align - 1)) {
+	CACHE_ERROR("Object %p for cache %s is not %lu byte aligned\n", obj, c->name, c->align);
+	free(obj);
+	return 0;
+    }
+
+    if (c->ctor && c->ctor(obj)) {
+	CACHE_ERROR("Failed to construct object for cache %s\n", c->name);
+	free(obj);
+	return 0;
+    }
+
+    __sync_fetch_and_add(&c->constructed, 1);
+
+    return obj;
+}
+
+static void cache_destruct(struct nk_kmem_cache *c, void *obj)
+{
+    if (c->dtor) {
+	c->dtor(obj);
+    }
+    free(obj);
+    __sync_fetch_and_add(&c->destructed, 1);
+}
+
+
+void *nk_kmem_cache_alloc(struct nk_kmem_cache *c)
+{
+    struct nk_kmem_cache_cpu *pc;
+    uint8_t flags;
+    uint32_t n;
+    void *obj;
+
+    flags = irq_disable_save();
+
+    pc = &c->cpus[my_cpu_id()];
+
+    pc->allocs++;
+
+    if (pc->count) {
+	pc->cpu_hits++;
+	obj = pc->objs[--pc->count];
+	irq_enable_restore(flags);
+	return obj;
+    }
+
+    spin_lock(&c->lock);
+    n = c->depot_count < CACHE_BATCH ? c->depot_count : CACHE_BATCH;
+    c->depot_count -= n;
+    memcpy(pc->objs, &c->depot[c->depot_count], n * sizeof(void*));
+    spin_unlock(&c->lock);
+
+    if (n) {
+	pc->depot_hits++;
+	pc->count = n - 1;
+	obj = pc->objs[n - 1];
+	irq_enable_restore(flags);
+	return obj;
+    }
+
+    irq_enable_restore(flags);
+
+    return cache_construct(c, -1);
+}
+
+void *nk_kmem_cache_alloc_specific(struct nk_kmem_cache *c, int cpu)
+{
+    struct sys_info *sys = per_cpu_get(system);
+
+    // the objects cached on this cpu will do for any cpu in the same domain
+    if (cpu < 0 || cpu >= sys->num_cpus || cpu == my_cpu_id() ||
+	sys->cpus[cpu]->domain == sys->cpus[my_cpu_id()]->domain) {
+	return nk_kmem_cache_alloc(c);
+    }
+
+    __sync_fetch_and_add(&c->cpus[my_cpu_id()].allocs, 1);
+
+    return cache_construct(c, cpu);
+}
+
+void nk_kmem_cache_free(struct nk_kmem_cache *c, void *obj)
+{
+    struct nk_kmem_cache_cpu *pc;
+    void *excess[CACHE_BATCH];
+    uint32_t n, room, i;
+    uint8_t flags;
+
+    if (!obj) {
+	return;
+    }
+
+    flags = irq_disable_save();
+
+    pc = &c->cpus[my_cpu_id()];
+
+    pc->frees++;
+
+    if (pc->count < CACHE_CPU_OBJS) {
+	pc->objs[pc->count++] = obj;
+	irq_enable_restore(flags);
+	return;
+    }
+
+    // move the oldest batch to the depot, and destroy what does not fit
+    spin_lock(&c->lock);
+    room = CACHE_DEPOT_OBJS - c->depot_count;
+    n = room < CACHE_BATCH ? room : CACHE_BATCH;
+    memcpy(&c->depot[c->depot_count], pc->objs, n * sizeof(void*));
+    c->depot_count += n;
+    spin_unlock(&c->lock);
+
+    memcpy(excess, &pc->objs[n], (CACHE_BATCH - n) * sizeof(void*));
+    memmove(pc->objs, &pc->objs[CACHE_BATCH], (CACHE_CPU_OBJS - CACHE_BATCH) * sizeof(void*));
+    pc->count = CACHE_CPU_OBJS - CACHE_BATCH;
+    pc->objs[pc->count++] = obj;
+
+    irq_enable_restore(flags);
+
+    for (i = 0; i < CACHE_BATCH - n; i++) {
+	cache_destruct(c, excess[i]);
+    }
+}
+
+// destroy up to nr of the objects in the depot
+static uint64_t cache_shrink(struct nk_kmem_cache *c, uint64_t nr)
+{
+    void *objs[CACHE_DEPOT_OBJS];
+    uint32_t n, i;
+    uint8_t flags;
+
+    flags = spin_lock_irq_save(&c->lock);
+    n = c->depot_count < nr ? c->depot_count : nr;
+    c->depot_count -= n;
+    memcpy(objs, &c->depot[c->depot_count], n * sizeof(void*));
+    spin_unlock_irq_restore(&c->lock, flags);
+
+    for (i = 0; i < n; i++) {
+	cache_destruct(c, objs[i]);
+    }
+
+    CACHE_DEBUG("Shrink of cache %s destroyed %u objects\n", c->name, n);
+
+    return n;
+}
+
+uint64_t nk_kmem_cache_shrink(struct nk_kmem_cache *c)
+{
+    return cache_shrink(c, CACHE_DEPOT_OBJS);
+}
+
+// The cache list lock is only try-locked, since a shrink can come
+// from an allocation made while it is held
+static uint64_t caches_shrink_count(void)
+{
+    CACHE_LIST_LOCK_CONF;
+    struct nk_kmem_cache *c;
+    uint64_t n = 0;
+
+    if (spin_try_lock_irq_save(&cache_list_lock, &_cache_list_lock_flags)) {
+	return 0;
+    }
+
+    list_for_each_entry(c, &cache_list, node) {
+	n += c->depot_count;
+    }
+
+    CACHE_LIST_UNLOCK();
+
+    return n;
+}
+
+static uint64_t caches_shrink_scan(uint64_t nr)
+{
+    CACHE_LIST_LOCK_CONF;
+    struct nk_kmem_cache *c;
+    uint64_t n = 0;
+
+    if (spin_try_lock_irq_save(&cache_list_lock, &_cache_list_lock_flags)) {
+	return 0;
+    }
+
+    list_for_each_entry(c, &cache_list, node) {
+	if (n >= nr) {
+	    break;
+	}
+	n += cache_shrink(c, nr - n);
+    }
+
+    CACHE_LIST_UNLOCK();
+
+    return n;
+}
+
+void nk_kmem_cache_destroy(struct nk_kmem_cache *c)
+{
+    CACHE_LIST_LOCK_CONF;
+    uint32_t i, j;
+
+    CACHE_LIST_LOCK();
+    list_del_init(&c->node);
+    CACHE_LIST_UNLOCK();
+
+    // no one else may use the cache at this point, so we can
+    // empty the other cpus' caches
+    for (i = 0; i < c->num_cpus; i++) {
+	for (j = 0; j < c->cpus[i].count; j++) {
+	    cache_destruct(c, c->cpus[i].objs[j]);
+	}
+    }
+
+    nk_kmem_cache_shrink(c);
+
+    if (c->constructed != c->destructed) {
+	CACHE_ERROR("Cache %s destroyed with %lu objects outstanding\n",
+		    c->name, c->constructed - c->destructed);
+    }
+
+    free(c->cpus);
+    free(c);
+}
+
+
+static int
+handle_caches (char * buf, void * priv)
+{
+    CACHE_LIST_LOCK_CONF;
+    struct nk_kmem_cache *c;
+    uint64_t allocs, frees, hits, depot_hits, cached, objs;
+    uint32_t i;
+
+    nk_vc_printf("%-24s %6s %10s %10s %10s %10s %10s %5s\n",
+		 "name", "size", "objs", "in use", "cached", "allocs", "frees", "hit%");
+
+    CACHE_LIST_LOCK();
+
+    list_for_each_entry(c, &cache_list, node) {
+	allocs = frees = hits = depot_hits = 0;
+	cached = c->depot_count;
+	for (i = 0; i < c->num_cpus; i++) {
+	    allocs += c->cpus[i].allocs;
+	    frees += c->cpus[i].frees;
+	    hits += c->cpus[i].cpu_hits;
+	    depot_hits += c->cpus[i].depot_hits;
+	    cached += c->cpus[i].count;
+	}
+	// counts are read racily, so keep in use from going negative
+	objs = c->constructed - c->destructed;
+	nk_vc_printf("%-24s %6lu %10lu %10lu %10lu %10lu %10lu %4lu%%\n",
+		     c->name, c->size, objs, objs > cached ? objs - cached : 0,
+		     cached, allocs, frees,
+		     allocs ? (100 * (hits + depot_hits)) / allocs : 0);
+    }
+
+    CACHE_LIST_UNLOCK();
+
+    return 0;
+}
+
+static struct shell_cmd_impl caches_impl = {
+    .cmd      = "caches",
+    .help_str = "caches",
+    .handler  = handle_caches,
+};
+nk_register_shell_cmd(caches_impl);
@@ -0,0 +1,232 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/mm.h>
+#include <nautilus/shrinker.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/list.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+
+#ifndef NAUT_CONFIG_DEBUG_KMEM
+#undef DEBUG_PRINT
+#define DEBUG_PRINT(fmt, args...)
+#endif
+
+#define SHRINK_DEBUG(fmt, args...) DEBUG_PRINT("shrinker: " fmt, ##args)
+#define SHRINK_ERROR(fmt, args...) ERROR_PRINT("shrinker: " fmt, ##args)
+#define SHRINK_INFO(fmt, args...)  INFO_PRINT("shrinker: " fmt, ##args)
+
+struct nk_kmem_shrinker {
+    char                      name[NK_KMEM_SHRINKER_NAME_LEN];
+    nk_kmem_shrinker_count_t  count;
+    nk_kmem_shrinker_scan_t   scan;
+
+    uint64_t                  calls;    // scans asked of this shrinker
+    uint64_t                  freed;    // objects it freed in them
+
+    struct list_head          node;
+};
+
+// The lock is held while shrinkers run, which is done without
+// disabling interrupts, and only ever try-locked by a shrink, since
+// a shrink may be invoked by an allocation made with the lock held
+static spinlock_t       shrinker_lock;
+static struct list_head shrinker_list = LIST_HEAD_INIT(shrinker_list);
+
+static uint64_t         shrink_calls;    // shrinks that ran
+static uint64_t         shrink_busy;     // shrinks skipped as one was running
+static uint64_t         watermark_runs;  // shrinks by the watermark thread
+
+
+struct nk_kmem_shrinker *nk_kmem_register_shrinker(char *name,
+						   nk_kmem_shrinker_count_t count,
+						   nk_kmem_shrinker_scan_t scan)
+{
+    struct nk_kmem_shrinker *s;
+
+    if (!count || !scan) {
+	SHRINK_ERROR("Shrinker %s lacks a count or scan function\n", name);
+	return 0;
+    }
+
+    s = malloc(sizeof(*s));
+
+    if (!s) {
+	SHRINK_ERROR("Failed to allocate shrinker %s\n", name);
+	return 0;
+    }
+
+    memset(s, 0, sizeof(*s));
+
+    strncpy(s->name, name, NK_KMEM_SHRINKER_NAME_LEN);
+    s->name[NK_KMEM_SHRINKER_NAME_LEN-1] = 0;
+    s->count = count;
+    s->scan = scan;
+
+    spin_lock(&shrinker_lock);
+    list_add_tail(&s->node, &shrinker_list);
+    spin_unlock(&shrinker_lock);
+
+    SHRINK_DEBUG("Registered shrinker %s\n", s->name);
+
+    return s;
+}
+
+void nk_kmem_unregister_shrinker(struct nk_kmem_shrinker *s)
+{
+    if (!s) {
+	return;
+    }
+
+    spin_lock(&shrinker_lock);
+    list_del_init(&s->node);
+    spin_unlock(&shrinker_lock);
+
+    SHRINK_DEBUG("Unregistered shrinker %s\n", s->name);
+
+    free(s);
+}
+
+uint64_t nk_kmem_shrink(int priority)
+{
+    struct nk_kmem_shrinker *s;
+    uint64_t n, freed, total = 0;
+
+    if (spin_try_lock(&shrinker_lock)) {
+	// someone else is already getting memory back
+	__sync_fetch_and_add(&shrink_busy, 1);
+	return 0;
+    }
+
+    shrink_calls++;
+
+    list_for_each_entry(s, &shrinker_list, node) {
+	n = s->count() >> priority;
+	if (!n) {
+	    continue;
+	}
+	freed = s->scan(n);
+	s->calls++;
+	s->freed += freed;
+	total += freed;
+	SHRINK_DEBUG("Shrinker %s freed %lu of %lu objects\n", s->name, freed, n);
+    }
+
+    spin_unlock(&shrinker_lock);
+
+    return total;
+}
+
+
+#ifdef NAUT_CONFIG_KMEM_WATERMARK_THREAD
+#define WATERMARK_THREAD_STACK_SIZE (PAGE_SIZE_4KB*4)
+
+static int below_watermark(void)
+{
+    uint64_t managed, allocated;
+
+    kmem_get_usage(&managed, &allocated);
+
+    return (managed - allocated) * 100 < managed * NAUT_CONFIG_KMEM_WATERMARK_LOW;
+}
+
+static void watermark(void *in, void **out)
+{
+    int priority;
+
+    if (nk_thread_name(get_cur_thread(),"(kmem-watermark)")) {
+	SHRINK_ERROR("Failed to name watermark thread\n");
+	return;
+    }
+
+    struct nk_sched_constraints c = { .type=APERIODIC,
+				      .aperiodic.priority=-1 }; // lowest priority
+
+    if (nk_sched_thread_change_constraints(&c)) {
+	SHRINK_ERROR("Unable to set constraints for watermark thread\n");
+	return;
+    }
+
+    while (1) {
+	nk_sleep(NAUT_CONFIG_KMEM_WATERMARK_PERIOD_MS*1000000ULL);
+	// ask for half of what can be freed first, then for more
+	// each round that memory remains low
+	for (priority = 1; priority >= 0 && below_watermark(); priority--) {
+	    SHRINK_DEBUG("Free memory below watermark, shrinking at priority %d\n", priority);
+	    __sync_fetch_and_add(&watermark_runs, 1);
+	    nk_kmem_shrink(priority);
+	}
+    }
+}
+#endif
+
+int nk_kmem_watermark_start(void)
+{
+#ifdef NAUT_CONFIG_KMEM_WATERMARK_THREAD
+    nk_thread_id_t tid;
+
+    if (nk_thread_start(watermark, 0, 0, 1, WATERMARK_THREAD_STACK_SIZE, &tid, 0)) {
+	SHRINK_ERROR("Failed to start watermark thread\n");
+	return -1;
+    }
+
+    SHRINK_INFO("Watermark thread started (low watermark %d%% free)\n", NAUT_CONFIG_KMEM_WATERMARK_LOW);
+#endif
+    return 0;
+}
+
+
+static int
+handle_shrinkers (char * buf, void * priv)
+{
+    struct nk_kmem_shrinker *s;
+    uint64_t n;
+    int priority;
+
+    if (sscanf(buf,"shrinkers %d", &priority)==1) {
+	n = nk_kmem_shrink(priority);
+	nk_vc_printf("shrink at priority %d freed %lu objects\n", priority, n);
+	return 0;
+    }
+
+    nk_vc_printf("%lu shrinks (%lu skipped while busy, %lu by watermark thread)\n",
+		 shrink_calls, shrink_busy, watermark_runs);
+
+    nk_vc_printf("%-24s %10s %10s %10s\n", "name", "freeable", "calls", "freed");
+
+    spin_lock(&shrinker_lock);
+    list_for_each_entry(s, &shrinker_list, node) {
+	nk_vc_printf("%-24s %10lu %10lu %10lu\n", s->name, s->count(), s->calls, s->freed);
+    }
+    spin_unlock(&shrinker_lock);
+
+    return 0;
+}
+
+static struct shell_cmd_impl shrinkers_impl = {
+    .cmd      = "shrinkers",
+    .help_str = "shrinkers [priority]",
+    .handler  = handle_shrinkers,
+};
+nk_register_shell_cmd(shrinkers_impl);
@@ -39,6 +39,15 @@
 // this is also a place where we can enhance performance by adding new types
 // of message queues
 
+// NK_MSG_QUEUE_MPMC is such a type.  It is a bounded lock-free ring in
+// which each cell carries a sequence number (Vyukov's MPMC queue).  A
+// cell at position pos is free for a push when its sequence is pos and
+// holds a message for a pull when it is pos+1.  A pull leaves it as
+// pos+queue_size, free for the next lap.  Pushers and pullers only
+// claim positions with a compare-and-swap on head or tail.  They go to
+// the wait queues only when the ring is full or empty, and they wake
+// the other side only when it has sleepers.
+
 // set this to one to use the tried and true polling based implementation
 // of push/pull with timeout instead of the (efficient) multiple wait queue
 // implementations
@@ -54,11 +63,27 @@ struct nk_msg_queue {
     nk_wait_queue_t    *push_wait_queue;
     nk_wait_queue_t    *pull_wait_queue;
 
+    nk_msg_queue_type_t type;
+
     uint64_t           queue_size;
     uint64_t           cur_count;
     uint64_t           cur_push;
     uint64_t           cur_pull;
-    void              *msgs[0];
+
+    // MPMC only - pushers and pullers each get their own cache line
+    // sleepers on one side are counted on the other side's line
+    uint64_t           head __attribute__((aligned(64)));  // next push
+    uint64_t           pull_waiters;
+    uint64_t           tail __attribute__((aligned(64)));  // next pull
+    uint64_t           push_waiters;
+
+    // DEFAULT: void *, MPMC: struct mpmc_cell
+    void              *msgs[0] __attribute__((aligned(64)));
+};
+
+struct mpmc_cell {
+    uint64_t seq;
+    void    *msg;
 };
 
 #ifndef NAUT_CONFIG_DEBUG_MSG_QUEUES
@@ -123,7 +148,17 @@ struct nk_msg_queue *nk_msg_queue_create(char *name,
 
     DEBUG("create %s with size %lu\n",name,size);
     
-    struct nk_msg_queue *q = malloc(sizeof(*q)+size*sizeof(void*));
+    if (type!=NK_MSG_QUEUE_DEFAULT && type!=NK_MSG_QUEUE_MPMC) {
+	ERROR("Unknown queue type %d\n",type);
+	return 0;
+    }
+
+    if (type==NK_MSG_QUEUE_MPMC && !size) {
+	ERROR("MPMC queues must have at least one slot\n");
+	return 0;
+    }
+
+    struct nk_msg_queue *q = malloc(sizeof(*q)+size*(type==NK_MSG_QUEUE_MPMC ? sizeof(struct mpmc_cell) : sizeof(void*)));
 
     if (!q) {
 	ERROR("Cannot allocate\n");
@@ -132,6 +167,17 @@ struct nk_msg_queue *nk_msg_queue_create(char *name,
 
     memset(q,0,sizeof(*q));
 
+    q->type = type;
+
+    if (type==NK_MSG_QUEUE_MPMC) {
+	struct mpmc_cell *cells = (struct mpmc_cell *)q->msgs;
+	uint64_t i;
+	for (i=0;i<size;i++) {
+	    cells[i].seq = i;
+	    cells[i].msg = 0;
+	}
+    }
+
     spinlock_init(&q->lock);
     INIT_LIST_HEAD(&q->node);
     q->refcount = 1;
@@ -209,8 +255,14 @@ void nk_msg_queue_dump_queues()
     STATE_LOCK();
     list_for_each(cur,&queue_list) {
 	q = list_entry(cur,struct nk_msg_queue, node);
-	nk_vc_printf("%s : refcount=%lu cur_count=%lu cur_push=%lu cur_pull=%lu\n",
-		     q->name, q->refcount, q->cur_count, q->cur_push, q->cur_pull);
+	if (q->type==NK_MSG_QUEUE_MPMC) {
+	    nk_vc_printf("%s : mpmc refcount=%lu size=%lu head=%lu tail=%lu push_waiters=%lu pull_waiters=%lu\n",
+			 q->name, q->refcount, q->queue_size, q->head, q->tail,
+			 q->push_waiters, q->pull_waiters);
+	} else {
+	    nk_vc_printf("%s : refcount=%lu cur_count=%lu cur_push=%lu cur_pull=%lu\n",
+			 q->name, q->refcount, q->cur_count, q->cur_push, q->cur_pull);
+	}
     }
     STATE_UNLOCK();
 }
@@ -246,17 +298,210 @@ void nk_msg_queue_release(struct nk_msg_queue *q)
     }
 }
 
+#define CELL(q,pos) (&((struct mpmc_cell *)((q)->msgs))[(pos) % ((q)->queue_size)])
+
+// nonzero if the cell at head is free, or head has already moved past it
+static int mpmc_can_push(void *s)
+{
+    struct nk_msg_queue *q = (struct nk_msg_queue *)s;
+    uint64_t pos = __atomic_load_n(&q->head,__ATOMIC_RELAXED);
+
+    return (sint64_t)(__atomic_load_n(&CELL(q,pos)->seq,__ATOMIC_ACQUIRE) - pos) >= 0;
+}
+
+// nonzero if the cell at tail holds a message, or tail has already moved past it
+static int mpmc_can_pull(void *s)
+{
+    struct nk_msg_queue *q = (struct nk_msg_queue *)s;
+    uint64_t pos = __atomic_load_n(&q->tail,__ATOMIC_RELAXED);
+
+    return (sint64_t)(__atomic_load_n(&CELL(q,pos)->seq,__ATOMIC_ACQUIRE) - (pos+1)) >= 0;
+}
+
 int nk_msg_queue_full(struct nk_msg_queue *q)
 {
     //DEBUG("full %s q->curcount=%lu q->queue_size=%lu\n", q->name, q->cur_count, q->queue_size);
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	return !mpmc_can_push(q);
+    }
     return  q->cur_count==q->queue_size;
 }    
 
 int nk_msg_queue_empty(struct nk_msg_queue *q)
 {
     //DEBUG("empty %s q->curcount=%lu q->queue_size=%lu\n", q->name, q->cur_count, q->queue_size);
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	return !mpmc_can_pull(q);
+    }
     return  q->cur_count==0;
 }    
+
+
+// never waits on another cpu, so these are fine for interrupt handlers
+static int _mpmc_try_push(struct nk_msg_queue *q, void *m)
+{
+    uint64_t pos = __atomic_load_n(&q->head,__ATOMIC_RELAXED);
+    struct mpmc_cell *c;
+    sint64_t dif;
+
+    while (1) {
+	c = CELL(q,pos);
+	dif = (sint64_t)(__atomic_load_n(&c->seq,__ATOMIC_ACQUIRE) - pos);
+	if (!dif) {
+	    if (__atomic_compare_exchange_n(&q->head,&pos,pos+1,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+		break;
+	    }
+	    // pos is now the current head
+	} else if (dif<0) {
+	    // full
+	    return -1;
+	} else {
+	    // someone else pushed here
+	    pos = __atomic_load_n(&q->head,__ATOMIC_RELAXED);
+	}
+    }
+
+    c->msg = m;
+    __atomic_store_n(&c->seq,pos+1,__ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int _mpmc_try_pull(struct nk_msg_queue *q, void **m)
+{
+    uint64_t pos = __atomic_load_n(&q->tail,__ATOMIC_RELAXED);
+    struct mpmc_cell *c;
+    sint64_t dif;
+
+    while (1) {
+	c = CELL(q,pos);
+	dif = (sint64_t)(__atomic_load_n(&c->seq,__ATOMIC_ACQUIRE) - (pos+1));
+	if (!dif) {
+	    if (__atomic_compare_exchange_n(&q->tail,&pos,pos+1,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+		break;
+	    }
+	} else if (dif<0) {
+	    // empty
+	    return -1;
+	} else {
+	    pos = __atomic_load_n(&q->tail,__ATOMIC_RELAXED);
+	}
+    }
+
+    *m = c->msg;
+    __atomic_store_n(&c->seq,pos+q->queue_size,__ATOMIC_RELEASE);
+
+    return 0;
+}
+
+// A batch claims k positions with one compare-and-swap, using head and
+// tail to see how many there are.  Those counts include positions that
+// another thread has claimed but not yet filled or emptied, so we may
+// briefly wait on that thread for a cell.  This is why the batch
+// functions are not for interrupt handlers.
+static uint64_t _mpmc_try_push_many(struct nk_msg_queue *q, void **msgs, uint64_t n)
+{
+    uint64_t pos = __atomic_load_n(&q->head,__ATOMIC_RELAXED);
+    uint64_t tail, used, k, i;
+    struct mpmc_cell *c;
+
+    while (1) {
+	tail = __atomic_load_n(&q->tail,__ATOMIC_ACQUIRE);
+	used = pos - tail;
+	if ((sint64_t)used < 0) {
+	    // pulls got ahead of our stale head
+	    pos = __atomic_load_n(&q->head,__ATOMIC_RELAXED);
+	    continue;
+	}
+	k = used < q->queue_size ? q->queue_size - used : 0;
+	if (k > n) {
+	    k = n;
+	}
+	if (!k) {
+	    return 0;
+	}
+	if (__atomic_compare_exchange_n(&q->head,&pos,pos+k,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+	    break;
+	}
+    }
+
+    for (i=0;i<k;i++) {
+	c = CELL(q,pos+i);
+	PAUSE_WHILE(__atomic_load_n(&c->seq,__ATOMIC_ACQUIRE) != pos+i);
+	c->msg = msgs[i];
+	__atomic_store_n(&c->seq,pos+i+1,__ATOMIC_RELEASE);
+    }
+
+    return k;
+}
+
+static uint64_t _mpmc_try_pull_many(struct nk_msg_queue *q, void **msgs, uint64_t n)
+{
+    uint64_t pos = __atomic_load_n(&q->tail,__ATOMIC_RELAXED);
+    uint64_t head, k, i;
+    struct mpmc_cell *c;
+
+    while (1) {
+	// head can never be behind a tail we read earlier
+	head = __atomic_load_n(&q->head,__ATOMIC_ACQUIRE);
+	k = head - pos;
+	if (k > n) {
+	    k = n;
+	}
+	if (!k) {
+	    return 0;
+	}
+	if (__atomic_compare_exchange_n(&q->tail,&pos,pos+k,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+	    break;
+	}
+    }
+
+    for (i=0;i<k;i++) {
+	c = CELL(q,pos+i);
+	PAUSE_WHILE(__atomic_load_n(&c->seq,__ATOMIC_ACQUIRE) != pos+i+1);
+	msgs[i] = c->msg;
+	__atomic_store_n(&c->seq,pos+i+q->queue_size,__ATOMIC_RELEASE);
+    }
+
+    return k;
+}
+
+// Called after we have pushed or pulled n messages.  A sleeper counts
+// itself before it checks the queue under the wait queue lock, so
+// either we see its count here or it sees what we did.
+static inline void _mpmc_wake(uint64_t *waiters, nk_wait_queue_t *wq, uint64_t n)
+{
+    __sync_synchronize();
+    if (__atomic_load_n(waiters,__ATOMIC_RELAXED)) {
+	if (n>1) {
+	    nk_wait_queue_wake_all(wq);
+	} else {
+	    nk_wait_queue_wake_one(wq);
+	}
+    }
+}
+
+static void _mpmc_push(struct nk_msg_queue *q, void *m)
+{
+    while (_mpmc_try_push(q,m)) {
+	DEBUG("push sleep %s\n", q->name);
+	__sync_fetch_and_add(&q->push_waiters,1);
+	nk_wait_queue_sleep_extended(q->push_wait_queue,mpmc_can_push,q);
+	__sync_fetch_and_sub(&q->push_waiters,1);
+    }
+    _mpmc_wake(&q->pull_waiters,q->pull_wait_queue,1);
+}
+
+static void _mpmc_pull(struct nk_msg_queue *q, void **m)
+{
+    while (_mpmc_try_pull(q,m)) {
+	DEBUG("pull sleep %s\n", q->name);
+	__sync_fetch_and_add(&q->pull_waiters,1);
+	nk_wait_queue_sleep_extended(q->pull_wait_queue,mpmc_can_pull,q);
+	__sync_fetch_and_sub(&q->pull_waiters,1);
+    }
+    _mpmc_wake(&q->push_waiters,q->push_wait_queue,1);
+}
     
     
 
@@ -301,6 +546,14 @@ int  nk_msg_queue_try_push(struct nk_msg_queue *q, void *m)
 
     //DEBUG("try push %s\n",q->name);
 
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	rc = _mpmc_try_push(q,m);
+	if (!rc) {
+	    _mpmc_wake(&q->pull_waiters,q->pull_wait_queue,1);
+	}
+	return rc;
+    }
+
     if (QUEUE_TRY_LOCK(q)) {
 	return -1;
     }
@@ -322,6 +575,14 @@ int  nk_msg_queue_try_pull(struct nk_msg_queue *q, void **m)
 
     //DEBUG("try pull %s\n",q->name);
 
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	rc = _mpmc_try_pull(q,m);
+	if (!rc) {
+	    _mpmc_wake(&q->push_waiters,q->push_wait_queue,1);
+	}
+	return rc;
+    }
+
     if (QUEUE_TRY_LOCK(q)) {
 	return -1;
     }
@@ -343,6 +604,13 @@ void nk_msg_queue_push(struct nk_msg_queue *q, void *m)
     QUEUE_LOCK_CONF;
 
     DEBUG("push begin %s\n",q->name);
+
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	_mpmc_push(q,m);
+	DEBUG("push end %s\n",q->name);
+	return;
+    }
+
  retry:
     QUEUE_LOCK(q);
     if (!_nk_msg_queue_try_push(q,m)) {
@@ -384,6 +652,13 @@ void nk_msg_queue_pull(struct nk_msg_queue *q, void **m)
     QUEUE_LOCK_CONF;
 
     DEBUG("pull begin %s\n",q->name);
+
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	_mpmc_pull(q,m);
+	DEBUG("pull end %s\n",q->name);
+	return;
+    }
+
  retry:
     QUEUE_LOCK(q);
     if (!_nk_msg_queue_try_pull(q,m)) {
@@ -489,9 +764,37 @@ static int check_timer(void *s)
 }
 
 
-static int _nk_msg_queue_push_pull_timeout(struct nk_msg_queue *q, void **m, uint64_t timeout_ns, int pull)
+// one attempt at a push or pull, waking the other side on success
+static int _nk_msg_queue_try_op(struct nk_msg_queue *q, void **m, int pull)
 {
     QUEUE_LOCK_CONF;
+    int done;
+
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	done = pull ? !_mpmc_try_pull(q,m) : !_mpmc_try_push(q,*m);
+	if (done) {
+	    if (pull) {
+		_mpmc_wake(&q->push_waiters,q->push_wait_queue,1);
+	    } else {
+		_mpmc_wake(&q->pull_waiters,q->pull_wait_queue,1);
+	    }
+	}
+	return done;
+    }
+
+    QUEUE_LOCK(q);
+    done = pull ? !_nk_msg_queue_try_pull(q,m) : !_nk_msg_queue_try_push(q,*m);
+    QUEUE_UNLOCK(q);
+
+    if (done) {
+	nk_wait_queue_wake_one(pull ? q->push_wait_queue : q->pull_wait_queue);
+    }
+
+    return done;
+}
+
+static int _nk_msg_queue_push_pull_timeout(struct nk_msg_queue *q, void **m, uint64_t timeout_ns, int pull)
+{
     uint64_t start = nk_sched_get_realtime();
     uint64_t now = start;
     int done=0;
@@ -506,9 +809,7 @@ static int _nk_msg_queue_push_pull_timeout(struct nk_msg_queue *q, void **m, uin
 	return 1;
     }
     
-    QUEUE_LOCK(q);
-    done = pull ? !_nk_msg_queue_try_pull(q,m) : !_nk_msg_queue_try_push(q,*m);
-    QUEUE_UNLOCK(q);
+    done = _nk_msg_queue_try_op(q,m,pull);
 
     if (done) {
 	DEBUG("%s timeout  %s ends with action\n",kind,q->name);
@@ -543,8 +844,13 @@ static int _nk_msg_queue_push_pull_timeout(struct nk_msg_queue *q, void **m, uin
 	}
 
 	DEBUG("starting multiple sleep\n");
-	
+
+	// MPMC wakers only look at the wait queue if we are counted
+	uint64_t *waiters = pull ? &q->pull_waiters : &q->push_waiters;
+
+	__sync_fetch_and_add(waiters,1);
 	nk_wait_queue_sleep_extended_multiple(2,queues,condchecks,states);
+	__sync_fetch_and_sub(waiters,1);
 
 	DEBUG("returned from multiple sleep and checking\n");
 
@@ -574,6 +880,106 @@ int nk_msg_queue_pull_timeout(struct nk_msg_queue *q, void **m, uint64_t timeout
 
 #endif
 
+
+uint64_t nk_msg_queue_try_push_many(struct nk_msg_queue *q, void **msgs, uint64_t n)
+{
+    QUEUE_LOCK_CONF;
+    uint64_t k;
+
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	k = _mpmc_try_push_many(q,msgs,n);
+	if (k) {
+	    _mpmc_wake(&q->pull_waiters,q->pull_wait_queue,k);
+	}
+	return k;
+    }
+
+    if (QUEUE_TRY_LOCK(q)) {
+	return 0;
+    }
+    for (k=0;k<n && !_nk_msg_queue_try_push(q,msgs[k]);k++) {
+    }
+    QUEUE_UNLOCK(q);
+
+    if (k>1) {
+	nk_wait_queue_wake_all(q->pull_wait_queue);
+    } else if (k) {
+	nk_wait_queue_wake_one(q->pull_wait_queue);
+    }
+
+    return k;
+}
+
+uint64_t nk_msg_queue_try_pull_many(struct nk_msg_queue *q, void **msgs, uint64_t n)
+{
+    QUEUE_LOCK_CONF;
+    uint64_t k;
+
+    if (q->type==NK_MSG_QUEUE_MPMC) {
+	k = _mpmc_try_pull_many(q,msgs,n);
+	if (k) {
+	    _mpmc_wake(&q->push_waiters,q->push_wait_queue,k);
+	}
+	return k;
+    }
+
+    if (QUEUE_TRY_LOCK(q)) {
+	return 0;
+    }
+    for (k=0;k<n && !_nk_msg_queue_try_pull(q,&msgs[k]);k++) {
+    }
+    QUEUE_UNLOCK(q);
+
+    if (k>1) {
+	nk_wait_queue_wake_all(q->push_wait_queue);
+    } else if (k) {
+	nk_wait_queue_wake_one(q->push_wait_queue);
+    }
+
+    return k;
+}
+
+// when a batch makes no progress, we block on a single message
+void nk_msg_queue_push_many(struct nk_msg_queue *q, void **msgs, uint64_t n)
+{
+    uint64_t i = 0;
+
+    DEBUG("push many begin %s %lu\n",q->name,n);
+
+    while (i<n) {
+	i += nk_msg_queue_try_push_many(q,msgs+i,n-i);
+	if (i<n) {
+	    nk_msg_queue_push(q,msgs[i]);
+	    i++;
+	}
+    }
+
+    DEBUG("push many end %s\n",q->name);
+}
+
+uint64_t nk_msg_queue_pull_many(struct nk_msg_queue *q, void **msgs, uint64_t n)
+{
+    uint64_t k;
+
+    if (!n) {
+	return 0;
+    }
+
+    DEBUG("pull many begin %s %lu\n",q->name,n);
+
+    k = nk_msg_queue_try_pull_many(q,msgs,n);
+
+    if (!k) {
+	nk_msg_queue_pull(q,&msgs[0]);
+	k = 1 + nk_msg_queue_try_pull_many(q,msgs+1,n-1);
+    }
+
+    DEBUG("pull many end %s %lu\n",q->name,k);
+
+    return k;
+}
+
+
 static int
 handle_mqs (char * buf, void * priv)
 {
@@ -0,0 +1,218 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/waitqueue.h>
+#include <nautilus/mutex.h>
+#include <nautilus/shell.h>
+
+#ifndef NAUT_CONFIG_DEBUG_SYNCH
+#undef DEBUG_PRINT
+#define DEBUG_PRINT(fmt, args...)
+#endif
+
+#define ERROR(fmt, args...) ERROR_PRINT("mutex: " fmt, ##args)
+#define DEBUG(fmt, args...) DEBUG_PRINT("mutex: " fmt, ##args)
+
+static uint64_t   count=0;
+static spinlock_t state_lock;
+static LIST_HEAD(mutex_list);
+
+#define STATE_LOCK_CONF uint8_t _state_lock_flags
+#define STATE_LOCK() _state_lock_flags = spin_lock_irq_save(&state_lock)
+#define STATE_UNLOCK() spin_unlock_irq_restore(&state_lock, _state_lock_flags);
+
+#define OWNER(v) ((struct nk_thread *)((v) & ~NK_MUTEX_WAITERS))
+
+
+nk_mutex_t *nk_mutex_create(char *name)
+{
+    STATE_LOCK_CONF;
+    char buf[NK_WAIT_QUEUE_NAME_LEN];
+
+    nk_mutex_t *m = malloc(sizeof(*m));
+
+    if (!m) {
+	ERROR("Failed to allocate mutex\n");
+	return 0;
+    }
+
+    memset(m,0,sizeof(*m));
+
+    if (name) {
+	strncpy(m->name,name,NK_MUTEX_NAME_LEN); m->name[NK_MUTEX_NAME_LEN-1]=0;
+    } else {
+	snprintf(m->name,NK_MUTEX_NAME_LEN,"mutex%lu",__sync_fetch_and_add(&count,1));
+    }
+
+    snprintf(buf,NK_WAIT_QUEUE_NAME_LEN,"%s-wait",m->name);
+    m->wait = nk_wait_queue_create(buf);
+
+    if (!m->wait) {
+	ERROR("Failed to allocate wait queue\n");
+	free(m);
+	return 0;
+    }
+
+    STATE_LOCK();
+    list_add_tail(&m->node,&mutex_list);
+    STATE_UNLOCK();
+
+    DEBUG("created %s\n",m->name);
+
+    return m;
+}
+
+void nk_mutex_destroy(nk_mutex_t *m)
+{
+    STATE_LOCK_CONF;
+
+    if (m->owner) {
+	ERROR("Destroying held mutex %s\n",m->name);
+    }
+
+    STATE_LOCK();
+    list_del(&m->node);
+    STATE_UNLOCK();
+
+    nk_wait_queue_destroy(m->wait);
+    free(m);
+}
+
+
+// is the thread on a cpu right now?  The owner may have released the
+// mutex and exited since we read it, but thread structures are never
+// unmapped, so at worst we read a stale cpu and guess wrong once
+static inline int owner_running(struct nk_thread *t)
+{
+    int cpu = t->current_cpu;
+
+    return cpu!=my_cpu_id() && nk_sched_get_cur_thread_on_cpu(cpu)==t;
+}
+
+// nonzero => do not sleep, since the waiters bit that tells the
+// owner to wake us is gone
+static int mutex_no_sleep(void *state)
+{
+    nk_mutex_t *m = (nk_mutex_t *)state;
+
+    return !(m->owner & NK_MUTEX_WAITERS);
+}
+
+void _nk_mutex_lock_slow(nk_mutex_t *m)
+{
+    uint64_t me = (uint64_t)get_cur_thread();
+    uint64_t v;
+    int blocked = 0;
+
+    DEBUG("%s contended\n",m->name);
+
+    while (1) {
+	v = m->owner;
+
+	if (!v) {
+	    // once we have slept, others may still be sleeping, so
+	    // the next owner must wake them
+	    if (__sync_bool_compare_and_swap(&m->owner, 0, blocked ? me|NK_MUTEX_WAITERS : me)) {
+		break;
+	    }
+	    continue;
+	}
+
+	if (owner_running(OWNER(v))) {
+	    // it will likely release it before we could sleep and wake
+	    asm volatile ("pause");
+	    continue;
+	}
+
+	// the owner is off cpu, so wait for it to wake us
+	if (!(v & NK_MUTEX_WAITERS) &&
+	    !__sync_bool_compare_and_swap(&m->owner, v, v|NK_MUTEX_WAITERS)) {
+	    continue;
+	}
+
+	nk_wait_queue_sleep_extended(m->wait, mutex_no_sleep, m);
+	blocked++;
+    }
+
+#ifdef NAUT_CONFIG_MUTEX_STATS
+    m->stats.contended++;
+    if (blocked) {
+	m->stats.blocked += blocked;
+    } else {
+	m->stats.spun++;
+    }
+#endif
+}
+
+void _nk_mutex_unlock_slow(nk_mutex_t *m)
+{
+    uint64_t v = __sync_lock_test_and_set(&m->owner, 0);
+
+    if (OWNER(v)!=get_cur_thread()) {
+	ERROR("%s released by thread %p, not its owner %p\n", m->name, get_cur_thread(), OWNER(v));
+    }
+
+    if (v & NK_MUTEX_WAITERS) {
+	nk_wait_queue_wake_one(m->wait);
+    }
+}
+
+
+void nk_mutex_dump_mutexes(void)
+{
+    STATE_LOCK_CONF;
+    struct list_head *cur;
+    nk_mutex_t *m;
+    uint64_t v;
+
+    STATE_LOCK();
+    list_for_each(cur,&mutex_list) {
+	m = list_entry(cur,nk_mutex_t,node);
+	v = m->owner;
+	nk_vc_printf("%s : owner=%lu%s\n", m->name,
+		     v ? OWNER(v)->tid : 0,
+		     v & NK_MUTEX_WAITERS ? " (waiters)" : "");
+#ifdef NAUT_CONFIG_MUTEX_STATS
+	nk_vc_printf("  acquires=%lu contended=%lu spun=%lu blocked=%lu hold avg=%lu max=%lu cycles\n",
+		     m->stats.acquires, m->stats.contended, m->stats.spun, m->stats.blocked,
+		     m->stats.acquires ? m->stats.hold_cycles/m->stats.acquires : 0,
+		     m->stats.hold_max);
+#endif
+    }
+    STATE_UNLOCK();
+}
+
+
+static int
+handle_mutexes (char * buf, void * priv)
+{
+    nk_mutex_dump_mutexes();
+    return 0;
+}
+
+static struct shell_cmd_impl mutexes_impl = {
+    .cmd      = "mutexes",
+    .help_str = "mutexes",
+    .handler  = handle_mutexes,
+};
+nk_register_shell_cmd(mutexes_impl);
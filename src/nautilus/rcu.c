@@ -0,0 +1,270 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/rcu.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/waitqueue.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+
+#define RCU_ERROR(fmt, args...) ERROR_PRINT("rcu: " fmt, ##args)
+#define RCU_INFO(fmt, args...)  INFO_PRINT("rcu: " fmt, ##args)
+
+// how often a waiter checks on a grace period, and prods the cpus
+// that have not been through the scheduler since it started
+#define RCU_POLL_NS 1000000ULL
+
+/*
+  Grace period k starts with gp_left set to the number of cpus and
+  then gp_seq set to k.  The first time each cpu is quiescent after
+  that, it records k in its qs_seq and decrements gp_left.  The cpu
+  that takes gp_left to zero completes the grace period by setting
+  gp_done to k.  There is only one grace period at a time.  Whoever
+  waits for one starts it, and waiters on the same one share it.
+*/
+static spinlock_t         gp_lock;
+static volatile uint64_t  gp_seq;
+static volatile uint64_t  gp_done;
+static volatile uint64_t  gp_left;
+
+// callbacks are queued on the cpu that asks for them
+static struct rcu_cpu {
+    volatile uint64_t   qs_seq;
+    spinlock_t          lock;
+    struct nk_rcu_head *head;
+    struct nk_rcu_head *tail;
+    uint64_t            queued;
+} __attribute__((aligned(64))) rcu_cpus[NAUT_CONFIG_MAX_CPUS];
+
+static nk_wait_queue_t   *rcu_wq;
+static volatile int       rcu_work;
+static uint64_t           rcu_invoked;
+
+
+// called by the scheduler with interrupts off and preemption on
+void nk_rcu_quiescent(void)
+{
+    struct rcu_cpu *r = &rcu_cpus[my_cpu_id()];
+    uint64_t seq = gp_seq;
+
+    if (r->qs_seq != seq) {
+	r->qs_seq = seq;
+	if (!__sync_sub_and_fetch(&gp_left,1)) {
+	    gp_done = seq;
+	}
+    }
+}
+
+// with gp_lock held and no grace period under way
+static void rcu_start_gp(void)
+{
+    gp_left = nk_get_num_cpus();
+    __sync_synchronize();
+    __sync_fetch_and_add(&gp_seq,1);
+}
+
+// wait until grace period seq is complete, starting it if need be
+static void rcu_wait_gp(uint64_t seq)
+{
+    uint32_t num_cpus = nk_get_num_cpus();
+    uint8_t flags;
+    uint32_t i;
+
+    while (1) {
+	flags = spin_lock_irq_save(&gp_lock);
+	if (gp_done==gp_seq && gp_seq<seq) {
+	    rcu_start_gp();
+	}
+	spin_unlock_irq_restore(&gp_lock,flags);
+
+	if (gp_done>=seq) {
+	    return;
+	}
+
+	// this cpu is quiescent as we sleep, while an idle cpu
+	// may sleep until it is kicked
+	nk_sleep(RCU_POLL_NS);
+
+	for (i=0;i<num_cpus;i++) {
+	    if (i!=my_cpu_id() && rcu_cpus[i].qs_seq!=gp_seq) {
+		nk_sched_kick_cpu(i);
+	    }
+	}
+    }
+}
+
+void nk_synchronize_rcu(void)
+{
+    // the caller's updates are visible before we look at gp_seq, and
+    // a grace period under way may have started before them
+    __sync_synchronize();
+    rcu_wait_gp(gp_seq+1);
+}
+
+void nk_call_rcu(struct nk_rcu_head *head, void (*func)(struct nk_rcu_head *head))
+{
+    struct rcu_cpu *r;
+    uint8_t flags;
+
+    head->func = func;
+    head->next = 0;
+
+    flags = irq_disable_save();
+
+    r = &rcu_cpus[my_cpu_id()];
+
+    spin_lock(&r->lock);
+    if (r->tail) {
+	r->tail->next = head;
+    } else {
+	r->head = head;
+    }
+    r->tail = head;
+    r->queued++;
+    spin_unlock(&r->lock);
+
+    irq_enable_restore(flags);
+
+    if (!__sync_lock_test_and_set(&rcu_work,1) && rcu_wq) {
+	nk_wait_queue_wake_all(rcu_wq);
+    }
+}
+
+
+static int rcu_have_work(void *state)
+{
+    return rcu_work;
+}
+
+static void rcu_thread(void *in, void **out)
+{
+    uint32_t num_cpus = nk_get_num_cpus();
+    struct nk_rcu_head *head, *tail, *next;
+    struct rcu_cpu *r;
+    uint8_t flags;
+    uint32_t i;
+
+    if (nk_thread_name(get_cur_thread(),"(rcu)")) {
+	RCU_ERROR("Failed to name rcu thread\n");
+	return;
+    }
+
+    while (1) {
+	nk_wait_queue_sleep_extended(rcu_wq, rcu_have_work, 0);
+
+	__sync_lock_release(&rcu_work);
+
+	// gather every cpu's callbacks into one batch for the next
+	// grace period
+	head = tail = 0;
+	for (i=0;i<num_cpus;i++) {
+	    r = &rcu_cpus[i];
+	    flags = spin_lock_irq_save(&r->lock);
+	    if (r->head) {
+		if (tail) {
+		    tail->next = r->head;
+		} else {
+		    head = r->head;
+		}
+		tail = r->tail;
+		r->head = r->tail = 0;
+	    }
+	    spin_unlock_irq_restore(&r->lock,flags);
+	}
+
+	if (!head) {
+	    continue;
+	}
+
+	nk_synchronize_rcu();
+
+	while (head) {
+	    next = head->next;
+	    head->func(head);
+	    head = next;
+	    rcu_invoked++;
+	}
+    }
+}
+
+int nk_rcu_init(void)
+{
+    nk_thread_id_t tid;
+
+    spinlock_init(&gp_lock);
+
+    rcu_wq = nk_wait_queue_create("rcu");
+
+    if (!rcu_wq) {
+	RCU_ERROR("Failed to allocate wait queue\n");
+	return -1;
+    }
+
+    if (nk_thread_start(rcu_thread, 0, 0, 1, TSTACK_DEFAULT, &tid, -1)) {
+	RCU_ERROR("Failed to start rcu thread\n");
+	return -1;
+    }
+
+    RCU_INFO("inited\n");
+
+    return 0;
+}
+
+
+static int
+handle_rcu (char * buf, void * priv)
+{
+    uint64_t queued = 0;
+    uint64_t start, end;
+    int i;
+
+    if (!strcmp(buf,"rcu sync")) {
+	start = nk_sched_get_realtime();
+	nk_synchronize_rcu();
+	end = nk_sched_get_realtime();
+	nk_vc_printf("grace period took %lu ns\n", end-start);
+	return 0;
+    }
+
+    for (i=0;i<nk_get_num_cpus();i++) {
+	queued += rcu_cpus[i].queued;
+    }
+
+    nk_vc_printf("grace period %lu (%s), %lu callbacks queued, %lu run\n",
+		 gp_seq, gp_done==gp_seq ? "done" : "waiting", queued, rcu_invoked);
+
+    for (i=0;i<nk_get_num_cpus();i++) {
+	if (rcu_cpus[i].qs_seq!=gp_seq) {
+	    nk_vc_printf("  cpu %d last quiescent in %lu\n", i, rcu_cpus[i].qs_seq);
+	}
+    }
+
+    return 0;
+}
+
+static struct shell_cmd_impl rcu_impl = {
+    .cmd      = "rcu",
+    .help_str = "rcu [sync]",
+    .handler  = handle_rcu,
+};
+nk_register_shell_cmd(rcu_impl);
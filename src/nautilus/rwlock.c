@@ -143,6 +143,154 @@ nk_rwlock_wr_unlock_irq_restore (nk_rwlock_t * l, uint8_t flags)
 }
 
 
+
+/*
+ * Big reader lock
+ *
+ * A reader announces itself in its cpu's slot and then checks for a
+ * writer, while a writer announces itself and then checks the
+ * slots.  Both use full barriers, so at least one sees the other.  A
+ * reader that sees a writer backs out and waits for it to finish,
+ * unless its cpu is already reading, in which case the writer is
+ * waiting on that cpu and backing out would deadlock.  Only a cpu
+ * touches its own depth, and with preemption off anything nested on
+ * it is done before it continues, so the depth needs no atomics.
+ */
+
+// spins before a writer waiting for another writer yields the cpu
+#define BRLOCK_WRITER_SPINS 1000
+
+static inline int
+brlock_cpu (void)
+{
+    // before the per-cpu state is up, only the BSP is running
+    return __cpu_state_get_cpu() ? my_cpu_id() : 0;
+}
+
+static inline struct nk_brlock_slot *
+brlock_slot (nk_brlock_t * l, int cpu)
+{
+    return &l->slots[cpu % NK_BRLOCK_SLOTS];
+}
+
+static inline uint8_t *
+brlock_depth (nk_brlock_t * l, int cpu)
+{
+    return &brlock_slot(l, cpu)->depth[cpu / NK_BRLOCK_SLOTS];
+}
+
+
+void
+nk_brlock_init (nk_brlock_t * l)
+{
+    DEBUG_PRINT("brlock init (%p)\n", (void*)l);
+    memset(l, 0, sizeof(*l));
+}
+
+
+void
+nk_brlock_rd_lock (nk_brlock_t * l)
+{
+    struct nk_brlock_slot * s;
+    uint8_t * d;
+    int cpu;
+
+    NK_PROFILE_ENTRY();
+
+    preempt_disable();
+
+    cpu = brlock_cpu();
+    s = brlock_slot(l, cpu);
+    d = brlock_depth(l, cpu);
+
+    while (1) {
+        __sync_fetch_and_add(&s->readers, 1);
+
+        // nested reader - the outer one keeps any writer out
+        if (likely(!l->writer) || *d) {
+            break;
+        }
+
+        // writer preference
+        __sync_fetch_and_sub(&s->readers, 1);
+
+        while (l->writer) {
+            asm volatile ("pause");
+        }
+    }
+
+    (*d)++;
+
+    NK_PROFILE_EXIT();
+}
+
+
+void
+nk_brlock_rd_unlock (nk_brlock_t * l)
+{
+    int cpu = brlock_cpu();
+
+    NK_PROFILE_ENTRY();
+    (*brlock_depth(l, cpu))--;
+    __sync_fetch_and_sub(&brlock_slot(l, cpu)->readers, 1);
+    preempt_enable();
+    NK_PROFILE_EXIT();
+}
+
+
+uint8_t
+nk_brlock_wr_lock_irq_save (nk_brlock_t * l)
+{
+    uint8_t flags;
+    int spins = 0;
+    int i;
+
+    NK_PROFILE_ENTRY();
+    DEBUG_PRINT("brlock write lock (irq): %p\n", (void*)l);
+
+    while (1) {
+        flags = irq_disable_save();
+
+        if (__sync_bool_compare_and_swap(&l->writer, 0, 1)) {
+            break;
+        }
+
+        irq_enable_restore(flags);
+
+        // another writer has it, so let others run if we can
+        if (++spins >= BRLOCK_WRITER_SPINS && flags &&
+            !preempt_is_disabled() && !in_interrupt_context()) {
+            nk_yield();
+            spins = 0;
+        } else {
+            asm volatile ("pause");
+        }
+    }
+
+    // no new readers get in, and the ones inside are running with
+    // preemption off on other cpus, or they would be in our way here
+    for (i=0;i<NK_BRLOCK_SLOTS;i++) {
+        while (l->slots[i].readers) {
+            asm volatile ("pause");
+        }
+    }
+
+    NK_PROFILE_EXIT();
+    return flags;
+}
+
+
+void
+nk_brlock_wr_unlock_irq_restore (nk_brlock_t * l, uint8_t flags)
+{
+    NK_PROFILE_ENTRY();
+    DEBUG_PRINT("brlock write unlock (irq): %p\n", (void*)l);
+    __sync_lock_release(&l->writer);
+    irq_enable_restore(flags);
+    NK_PROFILE_EXIT();
+}
+
+
 static void 
 reader1 (void * in, void ** out) 
 {
@@ -0,0 +1,283 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/cpu.h>
+#include <nautilus/mm.h>
+#include <nautilus/schedtrace.h>
+#include <nautilus/shell.h>
+
+#define TRACE_ERROR(fmt, args...) ERROR_PRINT("schedtrace: " fmt, ##args)
+#define TRACE_INFO(fmt, args...)  INFO_PRINT("schedtrace: " fmt, ##args)
+
+#define TRACE_DEFAULT_ENTRIES 4096
+
+// the binary stream, one 32 byte line per header or record
+#define TRACE_MAGIC     0x54534b4e   // "NKST"
+#define TRACE_CPU_MAGIC 0x20555043   // "CPU "
+#define TRACE_VERSION   1
+
+struct trace_ring {
+    uint64_t head;    // records ever claimed, the next is at head & mask
+    uint64_t mask;
+    struct nk_sched_trace_rec recs[0];
+};
+
+volatile int nk_sched_trace_on = 0;
+
+// rings are never freed once allocated, since a cpu may be recording
+// into one as tracing is stopped
+static struct trace_ring *rings[NAUT_CONFIG_MAX_CPUS];
+static uint64_t           ring_entries;
+static uint64_t           start_tsc;
+
+void _nk_sched_trace(nk_sched_trace_event_t event, uint64_t tid, uint32_t cpu, uint64_t arg)
+{
+    struct trace_ring *r = rings[my_cpu_id()];
+    struct nk_sched_trace_rec *rec;
+
+    if (!r) {
+	return;
+    }
+
+    rec = &r->recs[__sync_fetch_and_add(&r->head,1) & r->mask];
+
+    rec->tsc = rdtsc();
+    rec->event = event;
+    rec->cpu = cpu;
+    rec->tid = tid;
+    rec->arg = arg;
+}
+
+int nk_sched_trace_start(uint64_t entries)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int i;
+
+    if (nk_sched_trace_on) {
+	return 0;
+    }
+
+    if (!ring_entries) {
+	if (!entries) {
+	    entries = TRACE_DEFAULT_ENTRIES;
+	}
+	// round up to a power of two
+	ring_entries = 1;
+	while (ring_entries < entries) {
+	    ring_entries <<= 1;
+	}
+    }
+
+    for (i=0;i<sys->num_cpus;i++) {
+	if (!rings[i]) {
+	    rings[i] = malloc_specific(sizeof(struct trace_ring) +
+				       ring_entries*sizeof(struct nk_sched_trace_rec), i);
+	    if (!rings[i]) {
+		TRACE_ERROR("Cannot allocate ring for cpu %d\n", i);
+		return -1;
+	    }
+	    rings[i]->mask = ring_entries - 1;
+	}
+	rings[i]->head = 0;
+    }
+
+    start_tsc = rdtsc();
+
+    __sync_synchronize();
+    nk_sched_trace_on = 1;
+
+    TRACE_INFO("Started with %lu entries per cpu\n", ring_entries);
+
+    return 0;
+}
+
+void nk_sched_trace_stop(void)
+{
+    nk_sched_trace_on = 0;
+    __sync_synchronize();
+}
+
+
+static char *event_name(uint32_t event)
+{
+    switch (event) {
+    case NK_SCHED_TRACE_SWITCH: return "switch";
+    case NK_SCHED_TRACE_WAKEUP: return "wakeup";
+    case NK_SCHED_TRACE_MIGRATE: return "migrate";
+    case NK_SCHED_TRACE_STEAL: return "steal";
+    case NK_SCHED_TRACE_ADMIT: return "admit";
+    case NK_SCHED_TRACE_DEADLINE_MISS: return "miss";
+    default: return "unknown";
+    }
+}
+
+// oldest record still in the ring and how many there are
+static void ring_window(struct trace_ring *r, uint64_t *first, uint64_t *count)
+{
+    uint64_t head = *(volatile uint64_t *)&r->head;
+
+    *count = head > ring_entries ? ring_entries : head;
+    *first = head - *count;
+}
+
+static void dump_text(int cpu)
+{
+    struct trace_ring *r = rings[cpu];
+    struct nk_sched_trace_rec *rec;
+    uint64_t first, count, i;
+
+    if (!r) {
+	return;
+    }
+
+    ring_window(r,&first,&count);
+
+    nk_vc_printf("cpu %d: %lu records (%lu lost)\n", cpu, count, first);
+
+    for (i=first;i<first+count;i++) {
+	rec = &r->recs[i & r->mask];
+	nk_vc_printf("%3d %14lu %-8s tid=%lu cpu=%u arg=0x%lx\n",
+		     cpu, rec->tsc - start_tsc, event_name(rec->event),
+		     rec->tid, rec->cpu, rec->arg);
+    }
+}
+
+static void hex_line(void *data)
+{
+    static const char digits[] = "0123456789abcdef";
+    uint8_t *p = (uint8_t *)data;
+    char buf[2*sizeof(struct nk_sched_trace_rec)+1];
+    int i;
+
+    for (i=0;i<sizeof(struct nk_sched_trace_rec);i++) {
+	buf[2*i] = digits[p[i]>>4];
+	buf[2*i+1] = digits[p[i]&0xf];
+    }
+    buf[2*i] = 0;
+
+    nk_vc_printf("ST %s\n", buf);
+}
+
+static void dump_binary(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    uint64_t first, count, i;
+    int cpu;
+
+    struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_cpus;
+	uint32_t rec_size;
+	uint64_t tsc_hz;     // 0 => unknown
+	uint64_t start_tsc;
+    } hdr = { TRACE_MAGIC, TRACE_VERSION, sys->num_cpus,
+	      sizeof(struct nk_sched_trace_rec),
+	      get_cpu()->cpu_khz*1000ULL, start_tsc };
+
+    struct {
+	uint32_t magic;
+	uint32_t cpu;
+	uint64_t count;
+	uint64_t lost;
+	uint64_t reserved;
+    } cpu_hdr;
+
+    nk_vc_printf("schedtrace-begin\n");
+
+    hex_line(&hdr);
+
+    for (cpu=0;cpu<sys->num_cpus;cpu++) {
+	if (!rings[cpu]) {
+	    continue;
+	}
+	ring_window(rings[cpu],&first,&count);
+	cpu_hdr.magic = TRACE_CPU_MAGIC;
+	cpu_hdr.cpu = cpu;
+	cpu_hdr.count = count;
+	cpu_hdr.lost = first;
+	cpu_hdr.reserved = 0;
+	hex_line(&cpu_hdr);
+	for (i=first;i<first+count;i++) {
+	    hex_line(&rings[cpu]->recs[i & rings[cpu]->mask]);
+	}
+    }
+
+    nk_vc_printf("schedtrace-end\n");
+}
+
+static int
+handle_schedtrace (char * buf, void * priv)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    uint64_t entries = 0;
+    uint64_t first, count;
+    int cpu = -1;
+
+    if (sscanf(buf,"schedtrace start %lu",&entries)==1 ||
+	!strcmp(buf,"schedtrace start")) {
+	if (nk_sched_trace_start(entries)) {
+	    nk_vc_printf("Failed to start tracing\n");
+	}
+	return 0;
+    }
+
+    if (!strcmp(buf,"schedtrace stop")) {
+	nk_sched_trace_stop();
+	return 0;
+    }
+
+    if (!strcmp(buf,"schedtrace bin")) {
+	dump_binary();
+	return 0;
+    }
+
+    if (sscanf(buf,"schedtrace dump %d",&cpu)==1 ||
+	!strcmp(buf,"schedtrace dump")) {
+	if (nk_sched_trace_on) {
+	    nk_vc_printf("Tracing is still on, so records may be overwritten\n");
+	}
+	for (int i=0;i<sys->num_cpus;i++) {
+	    if (cpu<0 || cpu==i) {
+		dump_text(i);
+	    }
+	}
+	return 0;
+    }
+
+    nk_vc_printf("tracing is %s, %lu entries per cpu\n",
+		 nk_sched_trace_on ? "on" : "off", ring_entries);
+    for (int i=0;i<sys->num_cpus;i++) {
+	if (rings[i]) {
+	    ring_window(rings[i],&first,&count);
+	    nk_vc_printf("cpu %d: %lu records (%lu lost)\n", i, count, first);
+	}
+    }
+
+    return 0;
+}
+
+static struct shell_cmd_impl schedtrace_impl = {
+    .cmd      = "schedtrace",
+    .help_str = "schedtrace [start [entries] | stop | dump [cpu] | bin]",
+    .handler  = handle_schedtrace,
+};
+nk_register_shell_cmd(schedtrace_impl);
@@ -56,6 +56,8 @@
 #include <nautilus/task.h>
 #include <nautilus/timer.h>
 #include <nautilus/scheduler.h>
+#include <nautilus/kmem_cache.h>
+#include <nautilus/shrinker.h>
 #include <nautilus/irq.h>
 #include <nautilus/cpu.h>
 #include <nautilus/cpuid.h>
@@ -63,6 +65,8 @@
 #include <nautilus/backtrace.h>
 #include <nautilus/shell.h>
 #include <nautilus/topo.h>
+#include <nautilus/schedtrace.h>
+#include <nautilus/rcu.h>
 #include <dev/apic.h>
 #include <dev/gpio.h>
 
@@ -199,6 +203,13 @@ static volatile uint8_t      stop_flags;
 
 static struct nk_sched_global_state global_sched_state;
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+// whether cpus skip ticks they do not need (see set_timer)
+static volatile int sched_tickless = 1;
+#endif
+
+static struct nk_kmem_cache *task_cache;
+
 //
 // List implementation for use in scheduler
 // Avoids changing thread structures
@@ -232,7 +243,8 @@ static int        rt_list_empty(rt_list *l);
 
 typedef enum { RUNNABLE_QUEUE = 0, 
 	       PENDING_QUEUE = 1, 
-	       APERIODIC_QUEUE = 2} queue_type;
+	       APERIODIC_QUEUE = 2,
+	       BATCH_QUEUE = 3} queue_type;
 
 //
 // Queue specific to scheduler (circular buffer)
@@ -273,6 +285,31 @@ static rt_thread* rt_priority_queue_remove(rt_priority_queue *queue, rt_thread *
 static int        rt_priority_queue_empty(rt_priority_queue *queue);
 static void       rt_priority_queue_dump(rt_priority_queue *queue, char *pre);
 
+#if NAUT_CONFIG_APERIODIC_BITMAP
+//
+// Aperiodic queue of FIFO lists, one per priority level, indexed by
+// a two level bitmap of the nonempty levels.  Enqueue, dequeue, and
+// remove are constant time.  Priorities map to levels logarithmically
+// (see rt_bitmap_level()), and the idle thread has the last level.
+//
+#define APERIODIC_LEVELS 1024
+
+typedef struct rt_bitmap_queue {
+    queue_type       type;
+    uint64_t         size;
+    uint64_t         summary;                      // bit i set => map[i] nonzero
+    uint64_t         map[APERIODIC_LEVELS/64];     // bit set => level nonempty
+    struct list_head levels[APERIODIC_LEVELS];
+} rt_bitmap_queue;
+
+static void       rt_bitmap_queue_init(rt_bitmap_queue *queue);
+static int        rt_bitmap_queue_enqueue(rt_bitmap_queue *queue, rt_thread *thread);
+static rt_thread* rt_bitmap_queue_dequeue(rt_bitmap_queue *queue);
+static rt_thread* rt_bitmap_queue_remove(rt_bitmap_queue *queue, rt_thread *thread);
+static int        rt_bitmap_queue_empty(rt_bitmap_queue *queue);
+static void       rt_bitmap_queue_dump(rt_bitmap_queue *queue, char *pre);
+#endif
+
 //
 // Per-CPU scheduler state - hangs off off global cpu struct
 //
@@ -286,6 +323,69 @@ typedef struct tsc_info {
 } tsc_info;
 
 
+#ifdef NAUT_CONFIG_SCHED_STATS
+// log2 histogram of times in ns: bucket i counts times in [2^(i-1),2^i)
+#define SCHED_HIST_BUCKETS 64
+
+typedef struct sched_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[SCHED_HIST_BUCKETS];
+} sched_hist;
+
+typedef struct sched_stats {
+    sched_hist wake;   // from being made runnable by a wakeup to running
+    sched_hist run;    // from being switched to to being switched away from
+    sched_hist sched;  // in a scheduling pass
+} sched_stats;
+
+static inline void sched_hist_add(sched_hist *h, sint64_t ns)
+{
+    if (ns<0) {
+	// clock skew between cpus
+	ns = 0;
+    }
+    h->count++;
+    h->sum += ns;
+    if (!h->min || ns < h->min) {
+	h->min = ns;
+    }
+    if (ns > h->max) {
+	h->max = ns;
+    }
+    h->buckets[ns ? 64 - __builtin_clzl(ns) : 0]++;
+}
+
+#define SCHED_STAT(s,which,ns) sched_hist_add(&(s)->stats.which,(sint64_t)(ns))
+#else
+#define SCHED_STAT(s,which,ns)
+#endif
+
+// Work stealing tries victims in order of how much of the memory
+// hierarchy they share with the thief
+typedef enum {
+    STEAL_LEVEL_CORE = 0,  // hwthread siblings on my physical core
+    STEAL_LEVEL_SOCKET,
+    STEAL_LEVEL_DOMAIN,    // NUMA domain
+    STEAL_LEVEL_SYSTEM,
+    STEAL_NUM_LEVELS
+} steal_level_t;
+
+// A Chase-Lev work-stealing deque of unsized tasks.  Only the cpu
+// that owns it pushes and pops at the bottom, with interrupts off,
+// while other cpus steal from the top.  It does not grow, so tasks
+// that do not fit go on the locked queues instead.
+#define TASK_DEQUE_SIZE 1024   // power of two
+
+typedef struct task_deque {
+    sint64_t          top;       // next task to steal
+    uint8_t           pad[56];   // keeps the thieves off the owner's line
+    sint64_t          bottom;    // next free slot
+    struct nk_task   *slots[TASK_DEQUE_SIZE];
+} task_deque;
+
 typedef struct nk_sched_task_state {
     spinlock_t  lock;
     nk_wait_queue_t   *waitq;            // where the task thread blocks ultimately
@@ -294,7 +394,11 @@ typedef struct nk_sched_task_state {
     struct list_head   sized_queue;      // tasks with known sizes
     uint64_t           unsized_enqueued; // number of unsized tasks enqueud
     uint64_t           unsized_dequeued; //   and dequeued (locally or remotely)
-    struct list_head   unsized_queue;    // tasks with unknown sizes;
+    struct list_head   unsized_queue;    // tasks with unknown sizes from other cpus;
+    task_deque         deque;            // unsized tasks produced on this cpu
+    uint64_t           deque_pushed;     // by the owner
+    uint64_t           deque_popped;     //   and popped by the owner
+    uint64_t           deque_stolen;     //   or stolen by other cpus
 } task_info;
 
 typedef struct nk_sched_percpu_state {
@@ -313,6 +417,12 @@ typedef struct nk_sched_percpu_state {
 #if NAUT_CONFIG_APERIODIC_DYNAMIC_LIFETIME || NAUT_CONFIG_APERIODIC_DYNAMIC_QUANTUM
     rt_priority_queue aperiodic;   // Aperiodic threads that are runnable
 #endif
+#if NAUT_CONFIG_APERIODIC_BITMAP
+    rt_bitmap_queue   aperiodic;   // Aperiodic threads that are runnable
+#endif
+#ifdef NAUT_CONFIG_SCHED_BATCH
+    rt_priority_queue batch;       // Batch threads that are runnable
+#endif
 
     task_info tasks;       // tasks known to this local scheduler
     
@@ -321,9 +431,29 @@ typedef struct nk_sched_percpu_state {
     uint64_t slack;        // allowed slop for scheduler execution itself
 
     uint64_t num_thefts;   // how many threads I've successfully stolen
+    uint64_t num_thefts_level[STEAL_NUM_LEVELS];  // ... and from how near
+    uint64_t last_steal_level[STEAL_NUM_LEVELS];  // when a level was last tried
+
+    // for thread and task thieves, see steal_order_init()
+    int     *steal_order;                          // the other cpus, nearest first
+    int      steal_num;
+    int      steal_level_end[STEAL_NUM_LEVELS];    // end of each level in steal_order
+
+    uint64_t resched_seq;     // scheduling passes begun, see nk_sched_wake_placement()
+    uint64_t num_wake_last;   // threads woken onto me because they last ran here
+    uint64_t num_wake_idle;   // ... because I was idle and share an LLC with their last cpu
+    uint64_t num_wake_waker;  // ... because I woke them
 
     uint64_t reinject_count;  // how many timer/kick interrupts I've had to reinject
 
+#ifdef NAUT_CONFIG_SCHED_STATS
+    sched_stats stats;
+#endif
+
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    int      tick_stopped;    // my timer is not set to end the current quantum
+#endif
+
 #if INSTRUMENT
     uint64_t resched_fast_num;
     uint64_t resched_fast_sum;
@@ -413,6 +543,21 @@ typedef struct nk_sched_percpu_state {
 #endif
 #define PEEK_APERIODIC(s,k) rt_queue_peek(&(s)->aperiodic,k)
 #define SIZE_APERIODIC(s) ((s)->aperiodic.size)
+#elif NAUT_CONFIG_APERIODIC_BITMAP
+#define GET_NEXT_APERIODIC(s) rt_bitmap_queue_dequeue(&(s)->aperiodic)
+#define PUT_APERIODIC(s,t) rt_bitmap_queue_enqueue(&(s)->aperiodic,t)
+#define REMOVE_APERIODIC(s,t) rt_bitmap_queue_remove(&(s)->aperiodic,t)
+#define SIZE_APERIODIC(s) ((s)->aperiodic.size)
+#define HAVE_APERIODIC(s) (!rt_bitmap_queue_empty(&(s)->aperiodic))
+#ifdef NAUT_CONFIG_DEBUG_SCHED
+#if DUMP_SCHED_STATE
+#define DUMP_APERIODIC(s,p) rt_bitmap_queue_dump(&(s)->aperiodic,p)
+#else
+#define DUMP_APERIODIC(s,p) 
+#endif
+#else
+#define DUMP_APERIODIC(s,p) 
+#endif
 #else
 #define GET_NEXT_APERIODIC(s) rt_priority_queue_dequeue(&(s)->aperiodic)
 #define PUT_APERIODIC(s,t) rt_priority_queue_enqueue(&(s)->aperiodic,t)
@@ -446,6 +591,27 @@ typedef struct nk_sched_percpu_state {
 #define DUMP_RT_PENDING(s,p)
 #endif
 
+#ifdef NAUT_CONFIG_SCHED_BATCH
+#define GET_NEXT_BATCH(s) rt_priority_queue_dequeue(&(s)->batch)
+#define PUT_BATCH(s,t) rt_priority_queue_enqueue(&(s)->batch,t)
+#define REMOVE_BATCH(s,t) rt_priority_queue_remove(&(s)->batch,t)
+#define PEEK_BATCH(s,k) rt_priority_queue_peek(&(s)->batch,k)
+#define SIZE_BATCH(s) ((s)->batch.size)
+#define HAVE_BATCH(s) (!rt_priority_queue_empty(&(s)->batch))
+#define BATCH_QUANTUM_MAX (NAUT_CONFIG_SCHED_BATCH_QUANTUM_MAX_MS*1000000ULL)
+// Batch threads run only if the idle thread is the only aperiodic
+// thread, and it is always in the aperiodic queue when not running
+#define GET_NEXT_NONRT(s) (HAVE_BATCH(s) && SIZE_APERIODIC(s)<=1 ? GET_NEXT_BATCH(s) : GET_NEXT_APERIODIC(s))
+// the current thread is batch, and an aperiodic thread wants the cpu
+#define BATCH_PREEMPT(s,t) ((t)->constraints.type==BATCH && SIZE_APERIODIC(s)>1)
+#else
+#define REMOVE_BATCH(s,t) 0
+#define SIZE_BATCH(s) 0
+#define HAVE_BATCH(s) 0
+#define GET_NEXT_NONRT(s) GET_NEXT_APERIODIC(s)
+#define BATCH_PREEMPT(s,t) 0
+#endif
+
 #define GET_NEXT_RT(s)   rt_priority_queue_dequeue(&(s)->runnable)
 #define PUT_RT(s,t) rt_priority_queue_enqueue(&(s)->runnable,t)
 #define REMOVE_RT(s,t) rt_priority_queue_remove(&(s)->runnable,t)
@@ -512,12 +678,33 @@ typedef struct nk_sched_thread_state {
     uint64_t miss_time_sum;   // sum of missed time
     uint64_t miss_time_sum2;  // sum of squares of missed time
 
+    nk_sched_wake_policy_t wake_policy;  // where to place it when woken
+    int      wake_cpu;        // >=0 => where its next wakeup must place it
+    uint64_t sleep_time;      // when it last went to sleep
+    uint64_t switch_seq;      // its cpu's resched_seq when it last ran there
+
+    nk_sched_fit_t global_fit; // how global admission placed it, 0 => it did not
+
+#ifdef NAUT_CONFIG_SCHED_STATS
+    uint64_t ready_time;      // when a wakeup made it runnable, 0 => not since it last ran
+#endif
+
+#ifdef NAUT_CONFIG_SCHED_BATCH
+    uint64_t batch_quantum;   // current quantum of a batch thread
+#endif
+
     // the thread context itself
     struct nk_thread *thread;
 
     // the thread node in a thread list (the global thread list)
     struct rt_node   *list; 
 
+#if NAUT_CONFIG_APERIODIC_BITMAP
+    // the thread's place in the aperiodic queue, if it is on it
+    struct list_head  aperiodic_node;
+    uint32_t          aperiodic_level;
+#endif
+
 } rt_thread ;
 
 static void       rt_thread_dump(rt_thread *thread, char *prefix);
@@ -526,6 +713,9 @@ static int        rt_thread_check_deadlines(rt_thread *t, rt_scheduler *schedule
 static void       rt_thread_update_periodic(rt_thread *t, rt_scheduler *scheduler, uint64_t now);
 static void       rt_thread_update_sporadic(rt_thread *t, rt_scheduler *scheduler, uint64_t now);
 static void       rt_thread_update_aperiodic(rt_thread *thread, rt_scheduler *scheduler, uint64_t now);
+#ifdef NAUT_CONFIG_SCHED_BATCH
+static int        rt_thread_update_batch(rt_thread *thread, rt_scheduler *scheduler, uint64_t now, int sleeping);
+#endif
 
 
 
@@ -546,6 +736,9 @@ static inline void     get_periodic_util(rt_scheduler *sched, uint64_t *util, ui
 static inline void     get_sporadic_util(rt_scheduler *sched, uint64_t now, uint64_t *util, uint64_t *count);
 static inline uint64_t get_random();
 
+// a real-time thread is gone for good
+static void           rt_exited(rt_thread *r);
+
 
 
 static void print_thread(rt_thread *r, void *priv)
@@ -599,6 +792,9 @@ static void print_thread(rt_thread *r, void *priv)
 	case PERIODIC:
 	    nk_vc_printf(" periodic(%utp, %llu,%llu)", r->constraints.interrupt_priority_class,CO(r->constraints.periodic.period), CO(r->constraints.periodic.slice));
 	    break;
+	case BATCH:
+	    nk_vc_printf(" batch(%utp, %llu)", r->constraints.interrupt_priority_class,CO(r->constraints.batch.priority));
+	    break;
 	}
 
 	nk_vc_printf(" stats: %llua %llure %llurl %llusw %llum",
@@ -657,13 +853,13 @@ void nk_sched_dump_cores(int cpu_arg)
 
     for (cpu=0;cpu<sys->num_cpus;cpu++) { 
 	if (cpu_arg<0 || cpu_arg==cpu) {
-	    char buf[256];
+	    char buf[384];
 	    struct apic_dev *apic = sys->cpus[cpu]->apic;
 	    struct nk_aspace *aspace = sys->cpus[cpu]->cur_aspace;
 
 	    s = sys->cpus[cpu]->sched_state;
 	    LOCAL_LOCK(s);
-	    snprintf(buf,256,"%dc %s %unl %luin %luex %luri %lut %s %utp %lup %lur %lua %lum (%s) (%luul %lusp %luap %luaq %luadp) (%luste %lustd %luute %luutd) (%luapic) [%s]\n",
+	    snprintf(buf,384,"%dc %s %unl %luin %luex %luri %lut %s %utp %lup %lur %lua %lum (%luc %lus %lud %luy) (%luwl %luwi %luww) (%s) (%luul %lusp %luap %luaq %luadp) (%luste %lustd %luute %luutd) (%luapic) [%s]\n",
 		     cpu, 
 		     intr_model,
 		     sys->cpus[cpu]->interrupt_nesting_level,
@@ -675,6 +871,11 @@ void nk_sched_dump_cores(int cpu_arg)
 		     s->current->thread->sched_state->constraints.interrupt_priority_class,
 		     s->pending.size, s->runnable.size, s->aperiodic.size,
 		     s->num_thefts,
+		     s->num_thefts_level[STEAL_LEVEL_CORE],
+		     s->num_thefts_level[STEAL_LEVEL_SOCKET],
+		     s->num_thefts_level[STEAL_LEVEL_DOMAIN],
+		     s->num_thefts_level[STEAL_LEVEL_SYSTEM],
+		     s->num_wake_last, s->num_wake_idle, s->num_wake_waker,
 		     
 #if NAUT_CONFIG_APERIODIC_ROUND_ROBIN
 		     "RR",
@@ -691,11 +892,16 @@ void nk_sched_dump_cores(int cpu_arg)
 #if NAUT_CONFIG_APERIODIC_LOTTERY
 		     "LO",
 #endif
+
+#if NAUT_CONFIG_APERIODIC_BITMAP
+		     "BM",
+#endif
 		     s->cfg.util_limit,
 		     s->cfg.sporadic_reservation, s->cfg.aperiodic_reservation, 
 		     s->cfg.aperiodic_quantum, s->cfg.aperiodic_default_priority,
 		     s->tasks.sized_enqueued, s->tasks.sized_dequeued,
-		     s->tasks.unsized_enqueued, s->tasks.unsized_dequeued,
+		     s->tasks.unsized_enqueued + s->tasks.deque_pushed,
+		     s->tasks.unsized_dequeued + s->tasks.deque_popped + s->tasks.deque_stolen,
 		     apic->timer_count,
 		     aspace ? aspace->name : "default");
 #if INSTRUMENT
@@ -736,6 +942,83 @@ void nk_sched_dump_time(int cpu_arg)
     }
 }
 
+#ifdef NAUT_CONFIG_SCHED_STATS
+static void print_hist(int cpu, char *what, sched_hist *h)
+{
+    int i;
+
+    nk_vc_printf("%dc %-5s %lun %lumin %lumean %lumax (ns)\n",
+		 cpu, what, h->count, h->min,
+		 h->count ? h->sum/h->count : 0, h->max);
+
+    for (i=0;i<SCHED_HIST_BUCKETS;i++) {
+	if (h->buckets[i]) {
+	    nk_vc_printf("%dc %-5s [%lu, %lu) %lu\n",
+			 cpu, what, i ? 1UL<<(i-1) : 0UL,
+			 i<SCHED_HIST_BUCKETS-1 ? 1UL<<i : -1UL, h->buckets[i]);
+	}
+    }
+}
+
+void nk_sched_dump_stats(int cpu_arg)
+{
+    LOCAL_LOCK_CONF;
+    int cpu;
+
+    struct sys_info * sys = per_cpu_get(system);
+    rt_scheduler *s;
+    sched_stats stats;
+
+    for (cpu=0;cpu<sys->num_cpus;cpu++) {
+	if (cpu_arg<0 || cpu_arg==cpu) {
+	    s = sys->cpus[cpu]->sched_state;
+	    LOCAL_LOCK(s);
+	    stats = s->stats;
+	    LOCAL_UNLOCK(s);
+
+	    nk_vc_printf("%dc (%s)\n", cpu,
+#if NAUT_CONFIG_APERIODIC_ROUND_ROBIN
+			 "RR"
+#endif
+#if NAUT_CONFIG_APERIODIC_DYNAMIC_QUANTUM
+			 "DQ"
+#endif
+#if NAUT_CONFIG_APERIODIC_DYNAMIC_LIFETIME
+			 "DL"
+#endif
+#if NAUT_CONFIG_APERIODIC_LOTTERY
+			 "LO"
+#endif
+#if NAUT_CONFIG_APERIODIC_BITMAP
+			 "BM"
+#endif
+			 );
+	    print_hist(cpu,"wake",&stats.wake);
+	    print_hist(cpu,"run",&stats.run);
+	    print_hist(cpu,"sched",&stats.sched);
+	}
+    }
+}
+
+void nk_sched_reset_stats(int cpu_arg)
+{
+    LOCAL_LOCK_CONF;
+    int cpu;
+
+    struct sys_info * sys = per_cpu_get(system);
+    rt_scheduler *s;
+
+    for (cpu=0;cpu<sys->num_cpus;cpu++) {
+	if (cpu_arg<0 || cpu_arg==cpu) {
+	    s = sys->cpus[cpu]->sched_state;
+	    LOCAL_LOCK(s);
+	    memset(&s->stats,0,sizeof(s->stats));
+	    LOCAL_UNLOCK(s);
+	}
+    }
+}
+#endif
+
 void nk_sched_dump_threads(int cpu)
 {
     GLOBAL_LOCK_CONF;
@@ -1064,6 +1347,51 @@ void nk_sched_reap(int uncond)
     __sync_fetch_and_and(&global_sched_state.reaping,0);
 }
 
+static void count_reapable_thread(rt_thread *r, void *priv)
+{
+    nk_thread_t *t = r->thread;
+
+    if (!t->refcount && t->status==NK_THR_EXITED && r->status==REAPABLE) {
+	(*(uint64_t*)priv)++;
+    }
+}
+
+//
+// Exited threads stay on the global thread list, with their stacks,
+// so that they can be reanimated, until they are reaped.  This is
+// the count and scan of the shrinker for that reanimation pool.
+//
+static uint64_t reanimation_count(void)
+{
+    GLOBAL_LOCK_CONF;
+    uint64_t n = 0;
+
+    // reaping cannot happen in interrupt context, and a reap in
+    // progress will get the memory back anyway
+    if (in_interrupt_context() || __sync_fetch_and_or(&global_sched_state.reaping,0)) {
+	return 0;
+    }
+
+    GLOBAL_LOCK();
+    rt_list_map(global_sched_state.thread_list,count_reapable_thread,&n);
+    GLOBAL_UNLOCK();
+
+    return n;
+}
+
+static uint64_t reanimation_scan(uint64_t nr)
+{
+    uint64_t before = reanimation_count();
+    uint64_t after;
+
+    // a reaping pass takes all the exited threads it can
+    nk_sched_reap(1);
+
+    after = reanimation_count();
+
+    return before > after ? before - after : 0;
+}
+
 //
 // The current implementation is essentially a specialized reaping pass,
 // looking in reverse order on the logic that recent threads will be similar
@@ -1131,6 +1459,7 @@ struct nk_thread *nk_sched_reanimate(nk_stack_size_t min_stack_size,
     __sync_fetch_and_and(&global_sched_state.reaping,0);
     
     if (rt) {
+	rt_exited(rt);
 	DEBUG("Reanimation successful - returning thread %p (sched state %p name \"%s\")\n", rt->thread, rt, rt->thread->name);
 	return rt->thread;
     } else {
@@ -1185,6 +1514,12 @@ struct nk_sched_thread_state *nk_sched_thread_state_init(struct nk_thread *threa
 
     ZERO(t);
 
+#if NAUT_CONFIG_APERIODIC_BITMAP
+    INIT_LIST_HEAD(&t->aperiodic_node);
+#endif
+
+    t->wake_cpu = -1;
+
     if (!constraints) { 
 	constraints = &default_constraints;
     }
@@ -1287,6 +1622,8 @@ int nk_sched_thread_pre_destroy(nk_thread_t * t)
     global_sched_state.num_threads--;
     
     GLOBAL_UNLOCK();
+
+    rt_exited(r);
     
     return 0;
 }
@@ -1428,6 +1765,18 @@ static inline rt_thread *lottery_remove_aperiodic(rt_scheduler *s, rt_thread *t)
 
 #endif
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+// something became runnable on this cpu, which no timer will notice
+// if the tick is stopped, so get a scheduling pass to restart it
+// (see nk_sched_tickless_timer_started)
+static void tick_restart_local(rt_scheduler *s)
+{
+    if (s && *(volatile int *)&s->tick_stopped && !get_cpu()->in_timer_interrupt) {
+	apic_self_ipi(per_cpu_get(apic),APIC_NULL_KICK_VEC);
+    }
+}
+#endif
+
 static int    _sched_make_runnable(struct nk_thread *thread, int cpu, int admit, int have_lock)
 {
     LOCAL_LOCK_CONF;
@@ -1453,9 +1802,12 @@ static int    _sched_make_runnable(struct nk_thread *thread, int cpu, int admit,
     if (admit) {
 	if (rt_thread_admit(s,t,cur_time())) { 
 	    DEBUG("Failed to admit thread\n");
+	    NK_SCHED_TRACE(NK_SCHED_TRACE_ADMIT,thread->tid,cpu,
+			   t->constraints.type | NK_SCHED_TRACE_ADMIT_FAILED);
 	    goto out_bad;
 	} else {
 	    DEBUG("Admitted thread %p (tid=%d)\n",thread,thread->tid);
+	    NK_SCHED_TRACE(NK_SCHED_TRACE_ADMIT,thread->tid,cpu,t->constraints.type);
 	}
     }
 
@@ -1468,6 +1820,12 @@ static int    _sched_make_runnable(struct nk_thread *thread, int cpu, int admit,
 	    //	    ERROR("queue has %llu entries\n", s->aperiodic->size);
 	    goto out_bad;
 	} else {
+#ifdef NAUT_CONFIG_SCHED_STATS
+	    // a wakeup or a new thread, not a move between cpus
+	    if (t->status!=ADMITTED) {
+		t->ready_time = cur_time();
+	    }
+#endif
 	    thread->status = NK_THR_SUSPENDED;
 	    thread->sched_state->status = ADMITTED;	    
 
@@ -1475,6 +1833,23 @@ static int    _sched_make_runnable(struct nk_thread *thread, int cpu, int admit,
 	    goto out_good;
 	}
 	break;
+    case BATCH:
+#ifdef NAUT_CONFIG_SCHED_BATCH
+	if (PUT_BATCH(s,t)) {
+	    ERROR("Failed to make batch thread runnable (%llu)\n",SIZE_BATCH(s));
+	    goto out_bad;
+	} else {
+#ifdef NAUT_CONFIG_SCHED_STATS
+	    if (t->status!=ADMITTED) {
+		t->ready_time = cur_time();
+	    }
+#endif
+	    thread->status = NK_THR_SUSPENDED;
+	    thread->sched_state->status = ADMITTED;
+	    goto out_good;
+	}
+#endif
+	break;
     case SPORADIC:
     case PERIODIC:
 	if (PUT_RT_PENDING(s,t)) {
@@ -1497,13 +1872,25 @@ static int    _sched_make_runnable(struct nk_thread *thread, int cpu, int admit,
  out_good:
     if (!have_lock) { 
 	LOCAL_UNLOCK(s);
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+	// with the lock held, we are within a scheduling pass already
+	if (s==per_cpu_get(sched_state)) {
+	    tick_restart_local(s);
+	}
+#endif
     }
     return 0;
 }
 
 int nk_sched_make_runnable(struct nk_thread *thread, int cpu, int admit)
 {
-    return _sched_make_runnable(thread,cpu,admit,0);
+    int rc = _sched_make_runnable(thread,cpu,admit,0);
+
+    if (!rc && !admit) {
+	NK_SCHED_TRACE(NK_SCHED_TRACE_WAKEUP,thread->tid,cpu,0);
+    }
+
+    return rc;
 }
 
 
@@ -1774,6 +2161,112 @@ static void rt_queue_dump(rt_queue *queue, char *pre)
     DEBUG("======%s==END=====\n",pre);
 }
 
+#if NAUT_CONFIG_APERIODIC_BITMAP
+
+// levels are logarithmic in the priority, with 16 steps per power of two
+static inline uint32_t rt_bitmap_level(rt_thread *t)
+{
+    uint64_t p = t->constraints.aperiodic.priority;
+    uint64_t e;
+
+    if (t->thread->is_idle) {
+	return APERIODIC_LEVELS-1;
+    }
+
+    if (p < 16) {
+	return p;
+    }
+
+    e = 63 - __builtin_clzl(p);   // >= 4
+
+    return ((e-3) << 4) | ((p >> (e-4)) & 0xf);
+}
+
+static void rt_bitmap_queue_init(rt_bitmap_queue *queue)
+{
+    int i;
+
+    queue->size = 0;
+    queue->summary = 0;
+    memset(queue->map,0,sizeof(queue->map));
+    for (i=0;i<APERIODIC_LEVELS;i++) {
+	INIT_LIST_HEAD(&queue->levels[i]);
+    }
+}
+
+static int rt_bitmap_queue_enqueue(rt_bitmap_queue *queue, rt_thread *thread)
+{
+    uint32_t l = rt_bitmap_level(thread);
+
+    thread->aperiodic_level = l;
+    list_add_tail(&thread->aperiodic_node, &queue->levels[l]);
+    queue->map[l/64] |= 1ULL << (l%64);
+    queue->summary |= 1ULL << (l/64);
+    queue->size++;
+
+    return 0;
+}
+
+static rt_thread* rt_bitmap_queue_remove(rt_bitmap_queue *queue, rt_thread *thread)
+{
+    uint32_t l = thread->aperiodic_level;
+
+    if (list_empty(&thread->aperiodic_node)) {
+	// not queued
+	return 0;
+    }
+
+    list_del_init(&thread->aperiodic_node);
+
+    if (list_empty(&queue->levels[l])) {
+	queue->map[l/64] &= ~(1ULL << (l%64));
+	if (!queue->map[l/64]) {
+	    queue->summary &= ~(1ULL << (l/64));
+	}
+    }
+
+    queue->size--;
+
+    return thread;
+}
+
+static rt_thread* rt_bitmap_queue_dequeue(rt_bitmap_queue *queue)
+{
+    uint32_t w, l;
+
+    if (!queue->summary) {
+	return 0;
+    }
+
+    w = __builtin_ctzl(queue->summary);
+    l = w*64 + __builtin_ctzl(queue->map[w]);
+
+    return rt_bitmap_queue_remove(queue, list_first_entry(&queue->levels[l], rt_thread, aperiodic_node));
+}
+
+static int rt_bitmap_queue_empty(rt_bitmap_queue *queue)
+{
+    return queue->size==0;
+}
+
+static void rt_bitmap_queue_dump(rt_bitmap_queue *queue, char *pre)
+{
+    rt_thread *t;
+    int l;
+
+    DEBUG("======%s==BEGIN=====\n",pre);
+    for (l=0;l<APERIODIC_LEVELS;l++) {
+	list_for_each_entry(t, &queue->levels[l], aperiodic_node) {
+	    DEBUG("   %llu %s (level %d)\n",t->thread->tid,
+		  t->thread->is_idle ? "*idle*" : 
+		  t->thread->name[0] ? t->thread->name : "(no name)", l);
+	}
+    }
+    DEBUG("======%s==END=====\n",pre);
+}
+
+#endif
+
 #if SANITY_CHECKS
 #define parent(i) ({ uint64_t _t = ((i) ? (((i) - 1) >> 1) : 0); if (_t>=MAX_QUEUE) panic("parent too big\n"); _t; })
 #define left_child(i) ({ uint64_t _t = (((i) << 1) + 1); if (_t>=MAX_QUEUE) panic("left too big\n"); _t; })
@@ -1802,7 +2295,8 @@ static int rt_priority_queue_enqueue(rt_priority_queue *queue, rt_thread *thread
 	ERROR("Too many threads for priority queue %s\n", 
 	      queue->type==RUNNABLE_QUEUE ? "Runnable" :
 	      queue->type==PENDING_QUEUE ? "Pending" :
-	      queue->type==APERIODIC_QUEUE ? "Aperiodic Runnable" : "UNKNOWN");
+	      queue->type==APERIODIC_QUEUE ? "Aperiodic Runnable" :
+	      queue->type==BATCH_QUEUE ? "Batch Runnable" : "UNKNOWN");
 	      
 	return -1;
     }
@@ -1838,6 +2332,8 @@ static rt_thread* rt_priority_queue_dequeue(rt_priority_queue *queue)
 	qstr = "Pending";
     } else if (queue->type == APERIODIC_QUEUE) { 
 	qstr = "Aperiodic Runnable";
+    } else if (queue->type == BATCH_QUEUE) {
+	qstr = "Batch Runnable";
     } else {
 	ERROR("Unknown Queue\n");
 	return NULL;
@@ -1927,6 +2423,8 @@ static void rt_thread_dump(rt_thread *thread, char *pre)
 	DEBUG("%s: Thread %llu \"%s\" %s: PERIODIC (%llu, %llu): START TIME: %llu RUN TIME: %llu EXIT TIME: %llu DEADLINE: %llu CURRENT TIME: %llu\n", pre, thread->thread->tid, thread->thread->name,thread->thread->is_idle ? "*idle*" : "", thread->constraints.periodic.period, thread->constraints.periodic.slice, thread->start_time, thread->run_time, thread->exit_time, thread->deadline, cur_time() );
     } else if (thread->constraints.type == SPORADIC)    {
 	DEBUG("%s: Thread %llu \"%s\" %s: SPORADIC (%llu): START TIME: %llu RUN TIME: %llu EXIT TIME: %llu DEADLINE: %llu CURRENT TIME: %llu\n", pre, thread->thread->tid, thread->thread->name, thread->thread->is_idle ? "*idle*" : "",thread->constraints.sporadic.size,thread->start_time, thread->run_time, thread->exit_time, thread->deadline, cur_time() );
+    } else if (thread->constraints.type == BATCH)    {
+	DEBUG("%s: Thread %llu \"%s\" %s: BATCH (%llu): START TIME: %llu RUN TIME: %llu EXIT TIME: %llu DEADLINE: %llu CURRENT TIME: %llu\n", pre, thread->thread->tid, thread->thread->name, "", thread->constraints.batch.priority, thread->start_time, thread->run_time, thread->exit_time, thread->deadline, cur_time() );
     } else {
         DEBUG("%s: Thread %llu \"%s\" %s: APERIODIC (%llu): START TIME: %llu RUN TIME: %llu EXIT TIME: %llu DEADLINE: %llu CURRENT TIME: %llu\n", pre, thread->thread->tid,  thread->thread->name, thread->thread->is_idle ? "*idle*" : "", thread->constraints.aperiodic.priority, thread->start_time, thread->run_time, thread->exit_time, thread->deadline, cur_time() );
 
@@ -1935,23 +2433,77 @@ static void rt_thread_dump(rt_thread *thread, char *pre)
 }
 
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+// Does an aperiodic thread need to be preempted at the end of its
+// quantum?  Only if some other aperiodic thread is waiting for the
+// cpu, the idle thread aside.  Real-time arrivals are handled
+// separately.
+static inline int tick_needed(rt_scheduler *scheduler, rt_thread *thread)
+{
+    if (thread->thread->is_idle) {
+#if NAUT_CONFIG_WORK_STEALING
+	// the idle thread must keep running to steal
+	return 1;
+#else
+	return HAVE_APERIODIC(scheduler) || HAVE_BATCH(scheduler);
+#endif
+    } else {
+	// the idle thread is always in the queue when it is not running
+	// and batch threads only share the cpu among themselves
+	return SIZE_APERIODIC(scheduler) > 1 ||
+	    (thread->constraints.type==BATCH && HAVE_BATCH(scheduler));
+    }
+}
+
+// the tick was stopped, but the current thread now has company
+#define TICK_RESTART(s,t) ((s)->tick_stopped && tick_needed(s,t))
+#else
+#define TICK_RESTART(s,t) 0
+#endif
+
 static void set_timer(rt_scheduler *scheduler, rt_thread *thread, uint64_t now)
 {
     struct sys_info *sys = per_cpu_get(system);
 
     uint64_t next_arrival = -1; //big num
     uint64_t next_preempt = -1; //big num
+    nk_timer_condition_t cond = IF_EARLIER;
 
     if (HAVE_RT_PENDING(scheduler)) { 
 	// the current deadline is the next arrival
 	next_arrival = PEEK_RT_PENDING(scheduler)->deadline;
     }
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    scheduler->tick_stopped = 0;
+#endif
+
     if (thread) { 
 	uint64_t remaining_time;
 	switch (thread->constraints.type) { 
 	case APERIODIC:
+	case BATCH:
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+	    if (sched_tickless && !tick_needed(scheduler,thread)) {
+		// nothing to share the cpu with, so wake only for the
+		// next real event, which may be later than the timer
+		// currently set, or never
+		scheduler->tick_stopped = 1;
+		cond = UNCOND;
+		if (my_cpu_id()==0) {
+		    // cpu 0 handles the timers (see nk_timer_handler)
+		    next_preempt = nk_timer_next_event();
+		}
+		break;
+	    }
+#endif
 	    next_preempt = now + scheduler->cfg.aperiodic_quantum;
+#ifdef NAUT_CONFIG_SCHED_BATCH
+	    if (thread->constraints.type==BATCH) {
+		// whatever is left of its current quantum
+		next_preempt = now + thread->batch_quantum - MIN(thread->cur_run_time,thread->batch_quantum);
+	    }
+#endif
 	    break;
 	case SPORADIC:
 	    ASSERT(thread->constraints.sporadic.size >= thread->run_time);
@@ -1975,11 +2527,24 @@ static void set_timer(rt_scheduler *scheduler, rt_thread *thread, uint64_t now)
     scheduler->tsc.set_time = MIN(next_arrival,next_preempt);
     
   
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    if (scheduler->tsc.set_time == -1ULL) {
+	// no event at all, so leave the timer quiet
+	arch_update_timer(-1, cond);
+	return;
+    }
+#endif
+
     // the set time has been computed based on the "now" argument
     // which is the start of the scheduling pass.   We need to set
     // the cycle counter delay based on the set time relative 
     // to the *current time*
-    uint32_t ticks = arch_realtime_to_ticks(scheduler->tsc.set_time - cur_time() + scheduler->slack);
+    uint64_t delay = scheduler->tsc.set_time - cur_time() + scheduler->slack;
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    // a far-off event is approached in steps the timer can count
+    delay = MIN(delay, (0x7fffffffULL/MAX(arch_realtime_to_ticks(1000000ULL),1))*1000000ULL);
+#endif
+    uint32_t ticks = arch_realtime_to_ticks(delay);
 
     
     if (cur_time() >= scheduler->tsc.set_time) {
@@ -1995,7 +2560,7 @@ static void set_timer(rt_scheduler *scheduler, rt_thread *thread, uint64_t now)
     //    DEBUG("Setting timer to at most %llu ns (%llu ticks)\n",scheduler->tsc.set_time - now + scheduler->slack,
     //	  arch_realtime_to_ticks(arch, scheduler->tsc.set_time - now + scheduler->slack));
 
-    arch_update_timer(ticks, IF_EARLIER);
+    arch_update_timer(ticks, cond);
 			      
 
 }
@@ -2198,6 +2763,10 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	}
     }
 
+    // no rcu read section can be open here: readers run with
+    // preemption off, and a forced pass is a sleep, yield, or exit
+    nk_rcu_quiescent();
+
     INST_SCHED_IN();
 
     uint64_t now = cur_time();
@@ -2217,6 +2786,10 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 
     scheduler->tsc.end_time = now;
 
+    // any pass after this one means the current thread has been
+    // switched out, if it is being switched out
+    scheduler->resched_seq++;
+
     rt_c->run_time += now - rt_c->start_time;
 
     rt_c->cur_run_time += now - rt_c->start_time;
@@ -2244,12 +2817,20 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 
     DEBUG("need_resched (cur=%d, sleep=%d, exit=%d, changing=%d)\n", c->tid, going_to_sleep,going_to_exit, changing);
 
+    rt_c->switch_seq = scheduler->resched_seq;
+
+    if (going_to_sleep) {
+	rt_c->sleep_time = now;
+    }
+
     rt_c->resched_count++;
 
     if (!timed_out && !apic_timer && !apic_kick
 	&& CUR_IS_NOT_SPECIAL 
 	&& !yielding 
-	&& !idle) { 
+	&& !idle
+	&& !TICK_RESTART(scheduler,rt_c)
+	&& !BATCH_PREEMPT(scheduler,rt_c)) { 
 	// we got here either due to some non-timer interrupt or
 	// by a direct call on a thread, and the thread is not
 	// trying to do anything special, nor has it timed out 
@@ -2344,7 +2925,7 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	//DEBUG("No RT threads available\n");
 	// if there is no runnable realtime task, choose
 	// the highest priority aperiodic thread that is runnable
-	rt_n = GET_NEXT_APERIODIC(scheduler);
+	rt_n = GET_NEXT_NONRT(scheduler);
 	if (rt_n == NULL) {
 	    goto panic_no_aperiodic;
 	}
@@ -2413,7 +2994,7 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	    DEBUG("No RT tasks available\n");
 
 	    // If nothing RT to do, then go aperiodic	    
-	    rt_n = GET_NEXT_APERIODIC(scheduler);
+	    rt_n = GET_NEXT_NONRT(scheduler);
 	    
 	    if (rt_n == NULL) {
 		goto panic_no_aperiodic;
@@ -2470,7 +3051,7 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	    // We are not enqueuing ourselves here since 
 	    // someone else already has dropped us into the right queue
 	    // in which case we need to find an aperiodic
-	    rt_n = GET_NEXT_APERIODIC(scheduler);
+	    rt_n = GET_NEXT_NONRT(scheduler);
 	    if (rt_n == NULL) {
 		goto panic_no_aperiodic;
 	    }
@@ -2620,7 +3201,7 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	// or we are being suspended an there are no RT threads
 	if (CUR_IS_SPECIAL || rt_c->thread->status==NK_THR_SUSPENDED) {
 	    // in which case we need to find an aperiodic
-	    rt_n = GET_NEXT_APERIODIC(scheduler);
+	    rt_n = GET_NEXT_NONRT(scheduler);
 	    if (rt_n == NULL) {
 		goto panic_no_aperiodic;
 	    }
@@ -2640,26 +3221,77 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	
 	break;
 	
-    default:
-	ERROR("Unknown current task type %d... just letting it run\n",rt_c->constraints.type);
-	goto out_good_early;
-	break;
-    }    
-    
- panic_no_aperiodic:
-    // This cannot happen since there must at least be an idle thread available
-    ERROR("APERIODIC QUEUE IS EMPTY.\n THE WORLD IS GOVERNED BY MADNESS.\n");
-    panic("ATTEMPTING TO RUN A NULL RT_THREAD.\n");
-    return 0;
-    
- panic_queue:
-    ERROR("UNEXPECTED QUEUE OVERFLOW\n");
-    panic("UNEXPECTED QUEUE OVERFLOW IN nk_sched_need_resched()\n");
-    return 0;
-
-
+#ifdef NAUT_CONFIG_SCHED_BATCH
+    case BATCH: {
+	// a thread changing to batch is already on the batch queue
+	int expired = !changing && rt_thread_update_batch(rt_c,scheduler,now,going_to_sleep);
+
+	if (CUR_IS_NOT_SPECIAL && !yielding && !expired &&
+	    !HAVE_RT(scheduler) && SIZE_APERIODIC(scheduler)<=1) {
+	    // nothing it gives way to has arrived, and its quantum
+	    // is not over, so it keeps the cpu
+	    DEBUG("Sticking with current batch task\n");
+	    rt_n = rt_c;
+	    rt_n->thread->status = NK_THR_SUSPENDED;
+	    goto out_good;
+	}
+
+	if (expired) {
+	    // its next, longer, quantum starts when it next runs
+	    rt_c->cur_run_time = 0;
+	}
+
+	if (CUR_IS_NOT_SPECIAL) {
+	    rt_c->thread->status=NK_THR_SUSPENDED;
+	    if (PUT_BATCH(scheduler, rt_c)) {
+		goto panic_queue;
+	    }
+	} else {
+	    DEBUG_DUMP(rt_c,CUR_SPECIAL_STR);
+	}
+
+	if (HAVE_RT(scheduler)) {
+	    rt_n = GET_NEXT_RT(scheduler);
+	    if (rt_n != NULL) {
+		DEBUG_DUMP(rt_n,"Next (Batch->RT)");
+		goto out_good;
+	    } else {
+		ERROR("RACE CONDITION DETECTED: No RT threads found on switch from batch\n");
+		// continue on to aperiodic, since this is salvageable
+	    }
+	}
+
+	rt_n = GET_NEXT_NONRT(scheduler);
+	if (rt_n == NULL) {
+	    goto panic_no_aperiodic;
+	}
+	DEBUG_DUMP(rt_n,"Next (Batch->NonRT)");
+	goto out_good;
+    }
+	break;
+#endif
+
+    default:
+	ERROR("Unknown current task type %d... just letting it run\n",rt_c->constraints.type);
+	goto out_good_early;
+	break;
+    }    
+    
+ panic_no_aperiodic:
+    // This cannot happen since there must at least be an idle thread available
+    ERROR("APERIODIC QUEUE IS EMPTY.\n THE WORLD IS GOVERNED BY MADNESS.\n");
+    panic("ATTEMPTING TO RUN A NULL RT_THREAD.\n");
+    return 0;
+    
+ panic_queue:
+    ERROR("UNEXPECTED QUEUE OVERFLOW\n");
+    panic("UNEXPECTED QUEUE OVERFLOW IN nk_sched_need_resched()\n");
+    return 0;
+
+
  out_good_early:
     //   DEBUG("Have not timed out yet (set_time=%llu now=%llu caller=%p) - early exit\n",scheduler->tsc.set_time,now,__builtin_return_address(0));
+    SCHED_STAT(scheduler,sched,cur_time()-now);
     if (!have_lock) {
 	LOCAL_UNLOCK(scheduler);
     }
@@ -2702,6 +3334,7 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
     // set timer according to nature of thread
     set_timer(scheduler, rt_n, now);
     if (rt_n!=rt_c) {
+	NK_SCHED_TRACE(NK_SCHED_TRACE_SWITCH,rt_n->thread->tid,my_cpu_id(),rt_c->thread->tid);
 	//if (!rt_n->is_intr) {
 	//    INFO("Switching to non-interrupt thread (%lu, %s)\n",rt_n->thread->tid,rt_n->thread->name);
 	//}  else {
@@ -2735,6 +3368,16 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	      my_cpu_id());
 
 	rt_n->switch_in_count++;
+
+#ifdef NAUT_CONFIG_SCHED_STATS
+	if (rt_n->ready_time) {
+	    SCHED_STAT(scheduler,wake,now - rt_n->ready_time);
+	    rt_n->ready_time = 0;
+	}
+	if (!rt_c->thread->is_idle) {
+	    SCHED_STAT(scheduler,run,now - rt_c->start_time);
+	}
+#endif
 	      
 	// we are switching threads, start accounting for the new one
 	rt_n->cur_run_time=0;
@@ -2742,6 +3385,8 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 	// instantiate our interrupt priority class
 	set_interrupt_priority(rt_n);
 
+	SCHED_STAT(scheduler,sched,cur_time()-now);
+
 	if (!have_lock) {
 	    LOCAL_UNLOCK(scheduler);
 	}
@@ -2769,6 +3414,8 @@ struct nk_thread *_sched_need_resched(int have_lock, int force_resched)
 
 	DEBUG("Staying with current task %llu (%s)\n", rt_c->thread->tid, rt_c->thread->name);
 
+	SCHED_STAT(scheduler,sched,cur_time()-now);
+
 	if (!have_lock) {
 	    LOCAL_UNLOCK(scheduler);
 	}
@@ -2800,6 +3447,9 @@ int nk_sched_thread_change_constraints(struct nk_sched_constraints *constraints)
 
     DEBUG("Changing constraints of %llu \"%s\"\n", t->tid,t->name);
 
+    // global admission notes itself once this succeeds
+    r->global_fit = 0;
+
     LOCAL_LOCK(scheduler);
 
     if (r->constraints.type != APERIODIC && 
@@ -2910,7 +3560,7 @@ int nk_sched_thread_move(struct nk_thread *t, int new_cpu, int block)
 	return 0;
     }
     
-    if (rt->constraints.type!=APERIODIC) { 
+    if (rt->constraints.type!=APERIODIC && rt->constraints.type!=BATCH) { 
 	ERROR("Currently only non-RT threads can be migrated\n");
 	return -1;
     }
@@ -2935,10 +3585,10 @@ int nk_sched_thread_move(struct nk_thread *t, int new_cpu, int block)
 	goto out_good_or_retry_if_blocking;
     }
     
-    // now, if it's in the old cpu's aperiodic queue, we need to 
+    // now, if it's in the old cpu's aperiodic or batch queue, we need to 
     // remove it.  
-    if (!REMOVE_APERIODIC(os,rt)) { 
-	DEBUG("Thread cannot be migrated as it is not in the aperiodic ready queue\n");
+    if (!(rt->constraints.type==BATCH ? REMOVE_BATCH(os,rt) : REMOVE_APERIODIC(os,rt))) { 
+	DEBUG("Thread cannot be migrated as it is not in the aperiodic or batch ready queue\n");
 	rc = -1;
 	goto out_good_or_retry_if_blocking;
     }
@@ -2978,6 +3628,7 @@ int nk_sched_thread_move(struct nk_thread *t, int new_cpu, int block)
 		return -1;
 	    }
 	} else {
+	    NK_SCHED_TRACE(NK_SCHED_TRACE_MIGRATE,t->tid,new_cpu,old_cpu);
 	    return 0;
 	}
     }
@@ -2988,23 +3639,83 @@ int nk_sched_thread_move(struct nk_thread *t, int new_cpu, int block)
 }
 
 
+// how near cpus a and b are for work stealing
+static steal_level_t steal_level(struct cpu *a, struct cpu *b)
+{
+    if (a->coord && b->coord) {
+	if (nk_topo_cpus_share_phys_core(a,b)) {
+	    return STEAL_LEVEL_CORE;
+	}
+	if (nk_topo_cpus_share_socket(a,b)) {
+	    return STEAL_LEVEL_SOCKET;
+	}
+    }
+    if (a->domain == b->domain) {
+	return STEAL_LEVEL_DOMAIN;
+    }
+    return STEAL_LEVEL_SYSTEM;
+}
+
+// minimum time between attempts to steal at each level, so
+// that nearer levels are tried more often than farther ones
+#if NAUT_CONFIG_WORK_STEALING
+static const uint64_t steal_interval[STEAL_NUM_LEVELS] = {
+    [STEAL_LEVEL_CORE]   = 0,  // on every attempt of the idle thread
+    [STEAL_LEVEL_SOCKET] = NAUT_CONFIG_WORK_STEALING_SOCKET_INTERVAL_MS * 1000000ULL,
+    [STEAL_LEVEL_DOMAIN] = NAUT_CONFIG_WORK_STEALING_DOMAIN_INTERVAL_MS * 1000000ULL,
+    [STEAL_LEVEL_SYSTEM] = NAUT_CONFIG_WORK_STEALING_SYSTEM_INTERVAL_MS * 1000000ULL,
+};
+#else
+static const uint64_t steal_interval[STEAL_NUM_LEVELS] = { 0 };
+#endif
+
+// threads a cpu could give up to a thief
+#define STEAL_LOAD(s) (SIZE_APERIODIC(s) + SIZE_BATCH(s))
+
 static int select_victim(int new_cpu)
 {
-    int a,b;
     struct sys_info *sys = per_cpu_get(system);
- 
-    // power of two random choices selection
+    rt_scheduler *ns = sys->cpus[new_cpu]->sched_state;
+    uint64_t now = cur_time();
+    steal_level_t level;
+    int a,b,i,first,num;
+
+    if (!ns->steal_order) {
+	// too early to know the topology
+	return -1;
+    }
+
+    // nearest level first, and within a level, power of two random
+    // choices: pick two, return the one with the most threads, if it
+    // has more than I do
+
+    for (level=STEAL_LEVEL_CORE, first=0; level<STEAL_NUM_LEVELS; first=ns->steal_level_end[level], level++) {
+
+	num = ns->steal_level_end[level] - first;
 
-    // pick two, return the one with the most threads
+	if (!num || (now - ns->last_steal_level[level]) < steal_interval[level]) {
+	    continue;
+	}
+
+	ns->last_steal_level[level] = now;
 
-    do {
-	a = (int)(get_random() % sys->num_cpus);
-	b = (int)(get_random() % sys->num_cpus);
-    } while (a==new_cpu || b==new_cpu);
+	// pick two distinct cpus of the level uniformly at random
+	i = (int)(get_random() % num);
+	a = ns->steal_order[first + i];
+	b = num > 1 ? ns->steal_order[first + (i + 1 + (int)(get_random() % (num - 1))) % num] : -1;
 
-    return (sys->cpus[a]->sched_state->aperiodic.size  >
-	    sys->cpus[b]->sched_state->aperiodic.size) ? a : b;
+	if (b>=0 && 
+	    STEAL_LOAD(sys->cpus[b]->sched_state) > 
+	    STEAL_LOAD(sys->cpus[a]->sched_state)) {
+	    a = b;
+	}
 
+	if (STEAL_LOAD(sys->cpus[a]->sched_state) > STEAL_LOAD(ns)) {
+	    return a;
+	}
+    }
+
+    return -1;
 }
 
 uint64_t nk_sched_get_runtime(struct nk_thread *t)
@@ -3012,6 +3723,254 @@ uint64_t nk_sched_get_runtime(struct nk_thread *t)
     return t->sched_state->run_time;
 }
 
+// do not steal the idle thread, interrupt thread, task thread, or any bound thread
+static inline int can_steal(rt_thread *t)
+{
+    return t && !t->thread->is_idle && !t->is_intr && !t->is_task && t->thread->bound_cpu<0;
+}
+
+
+//
+// Wakeup placement
+//
+// A woken thread can only be placed on a cpu other than its last one
+// once it has been completely switched out there.  It is taken off
+// its wait queue as soon as its last cpu has decided to switch away
+// from it, but before the switch itself, so it may still be on its
+// stack.  Its last cpu will not run it before the switch is done, but
+// another cpu could.  We know that the switch is done if its last cpu
+// has since begun another scheduling pass.
+//
+
+#ifndef NAUT_CONFIG_WAKE_AFFINE_HOT_NS
+#define NAUT_CONFIG_WAKE_AFFINE_HOT_NS 1000000
+#endif
+
+int nk_sched_thread_set_wake_policy(struct nk_thread *thread, nk_sched_wake_policy_t policy)
+{
+    if (policy<NK_SCHED_WAKE_DEFAULT || policy>NK_SCHED_WAKE_AFFINE) {
+	ERROR("Unknown wake policy %d\n",policy);
+	return -1;
+    }
+
+    thread->sched_state->wake_policy = policy;
+
+    return 0;
+}
+
+// threads that want the cpu, other than the idle thread, which is
+// either running or in the aperiodic queue, so a cpu running one
+// thread has a load of 1
+static inline uint64_t wake_load(rt_scheduler *s)
+{
+    return SIZE_APERIODIC(s) + SIZE_BATCH(s) + s->runnable.size;
+}
+
+// last level caches are approximated by sockets, or by NUMA domains
+// if we do not know the topology
+static inline int wake_share_llc(struct cpu *a, struct cpu *b)
+{
+    return steal_level(a,b) <= (a->coord && b->coord ? STEAL_LEVEL_SOCKET : STEAL_LEVEL_DOMAIN);
+}
+
+// an idle cpu sharing an LLC with cpu, preferring its hwthread siblings
+static int wake_idle_sibling(int cpu)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct cpu *me = sys->cpus[cpu];
+    int i, found = -1;
+
+    for (i=0;i<sys->num_cpus;i++) {
+	if (i==cpu || !wake_share_llc(me,sys->cpus[i]) ||
+	    wake_load(sys->cpus[i]->sched_state)) {
+	    continue;
+	}
+	if (steal_level(me,sys->cpus[i])==STEAL_LEVEL_CORE) {
+	    return i;
+	}
+	if (found<0) {
+	    found = i;
+	}
+    }
+
+    return found;
+}
+
+int nk_sched_wake_placement(struct nk_thread *thread)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    rt_thread *t = thread->sched_state;
+    nk_sched_wake_policy_t policy = t->wake_policy;
+    int last = thread->current_cpu;
+    int waker = -1;
+    int cpu = last;
+    rt_scheduler *ls, *ws = 0;
+    uint64_t slept;
+    int idle;
+
+    if (policy==NK_SCHED_WAKE_DEFAULT) {
+#ifdef NAUT_CONFIG_WAKE_AFFINE
+	policy = NK_SCHED_WAKE_AFFINE;
+#else
+	policy = NK_SCHED_WAKE_LAST;
+#endif
+    }
+
+    if (!can_steal(t) ||
+	(t->constraints.type!=APERIODIC && t->constraints.type!=BATCH) ||
+	last<0 || last>=sys->num_cpus) {
+	goto out;
+    }
+
+    ls = sys->cpus[last]->sched_state;
+
+    if (*(volatile uint64_t *)&ls->resched_seq == t->switch_seq) {
+	// it may still be switching out
+	goto out;
+    }
+
+    if (t->wake_cpu>=0 && t->wake_cpu<sys->num_cpus) {
+	// it is moving itself (see sched_move_self())
+	NK_SCHED_TRACE(NK_SCHED_TRACE_MIGRATE,thread->tid,t->wake_cpu,last);
+	thread->current_cpu = t->wake_cpu;
+	return t->wake_cpu;
+    }
+
+    if (policy==NK_SCHED_WAKE_LAST) {
+	goto out;
+    }
+
+    // a wakeup from an interrupt handler says nothing about
+    // which cpu shares the thread's data, nor does one from the
+    // idle thread
+    if (!in_interrupt_context() && !get_cur_thread()->is_idle) {
+	waker = my_cpu_id();
+	ws = sys->cpus[waker]->sched_state;
+    }
+
+    if (policy==NK_SCHED_WAKE_WAKER) {
+	if (waker>=0) {
+	    cpu = waker;
+	}
+	goto out;
+    }
+
+    if (!wake_load(ls)) {
+	// idle, and its caches are as warm as they will be anywhere
+	goto out;
+    }
+
+    slept = cur_time() - t->sleep_time;
+
+    if (slept < NAUT_CONFIG_WAKE_AFFINE_HOT_NS) {
+	// its working set is likely still in the last cpu's caches,
+	// so stay in its LLC, and wait for it if none there is idle
+	idle = wake_idle_sibling(last);
+	if (idle>=0) {
+	    cpu = idle;
+	}
+	goto out;
+    }
+
+    // its caches have gone cold, so the waker's cpu, which is
+    // likely touching the data the thread will want, is as good,
+    // provided the waker is the only thread there
+    if (waker>=0 && waker!=last && wake_load(ws)<=1) {
+	cpu = waker;
+	goto out;
+    }
+
+    idle = wake_idle_sibling(last);
+    if (idle>=0) {
+	cpu = idle;
+    } else if (waker>=0 && wake_load(ws) < wake_load(ls)) {
+	cpu = waker;
+    }
+
+ out:
+    if (cpu!=last) {
+	if (cpu==waker) {
+	    __sync_fetch_and_add(&sys->cpus[cpu]->sched_state->num_wake_waker,1);
+	} else {
+	    __sync_fetch_and_add(&sys->cpus[cpu]->sched_state->num_wake_idle,1);
+	}
+	NK_SCHED_TRACE(NK_SCHED_TRACE_MIGRATE,thread->tid,cpu,last);
+	thread->current_cpu = cpu;
+    } else if (cpu>=0 && cpu<sys->num_cpus) {
+	__sync_fetch_and_add(&sys->cpus[cpu]->sched_state->num_wake_last,1);
+    }
+
+    return cpu;
+}
+
+// find up to maxcount threads to steal on the aperiodic queue of s,
+// whose lock the caller holds
+#if NAUT_CONFIG_APERIODIC_BITMAP
+static uint64_t find_steal_candidates(rt_scheduler *s, rt_thread **prosp, uint64_t maxcount)
+{
+    rt_bitmap_queue *q = &s->aperiodic;
+    uint64_t count=0;
+    uint64_t m;
+    int w, b;
+    rt_thread *t;
+
+    // the lowest priority threads first, as they will wait longest here
+    for (w=APERIODIC_LEVELS/64-1; w>=0 && count<maxcount; w--) {
+	for (m=q->map[w]; m && count<maxcount; m &= ~(1ULL << b)) {
+	    b = 63 - __builtin_clzl(m);
+	    list_for_each_entry_reverse(t, &q->levels[w*64+b], aperiodic_node) {
+		if (can_steal(t)) {
+		    DEBUG("Found thread %llu %s\n",t->thread->tid,t->thread->name);
+		    prosp[count++] = t;
+		    if (count>=maxcount) {
+			break;
+		    }
+		}
+	    }
+	}
+    }
+
+    return count;
+}
+#else
+static uint64_t find_steal_candidates(rt_scheduler *s, rt_thread **prosp, uint64_t maxcount)
+{
+    uint64_t count=0;
+    uint64_t cur;
+
+    for (cur=0;cur<SIZE_APERIODIC(s);cur++) {
+	rt_thread *t = PEEK_APERIODIC(s,cur);
+	if (can_steal(t)) { 
+	    DEBUG("Found thread %llu %s\n",t->thread->tid,t->thread->name);
+	    prosp[count++] = t;
+	    if (count>=maxcount) { 
+		break;
+	    }
+	}
+    }
+
+    return count;
+}
+#endif
+
+#ifdef NAUT_CONFIG_SCHED_BATCH
+static uint64_t find_batch_steal_candidates(rt_scheduler *s, rt_thread **prosp, uint64_t maxcount)
+{
+    uint64_t count=0;
+    uint64_t cur;
+
+    for (cur=0;cur<SIZE_BATCH(s) && count<maxcount;cur++) {
+	rt_thread *t = PEEK_BATCH(s,cur);
+	if (can_steal(t)) {
+	    DEBUG("Found batch thread %llu %s\n",t->thread->tid,t->thread->name);
+	    prosp[count++] = t;
+	}
+    }
+
+    return count;
+}
+#endif
+
 int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
 {
     LOCAL_LOCK_CONF;
@@ -3029,6 +3988,10 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
 
     if (old_cpu==-1) { 
 	old_cpu = select_victim(new_cpu);
+	if (old_cpu==-1) {
+	    DEBUG("No cpu is worth stealing from now\n");
+	    return 0;
+	}
     }
 
     if (old_cpu==new_cpu) {
@@ -3046,7 +4009,7 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
 	return -1;
     }
 
-    if (SIZE_APERIODIC(os) <= SIZE_APERIODIC(ns)) { 
+    if (STEAL_LOAD(os) <= STEAL_LOAD(ns)) { 
 	DEBUG("Avoiding theft from insufficiently rich CPU\n");
 	return 0;
     }
@@ -3055,18 +4018,12 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
     // and examine it for prospective threads
     LOCAL_LOCK(os);
 
-    count=0;
-
-    for (cur=0;cur<SIZE_APERIODIC(os);cur++) {
-	rt_thread *t = PEEK_APERIODIC(os,cur);
-	// do not steal the idle thread, interrupt thread, task thread, or any bound thread
-	if (t && !t->thread->is_idle && !t->is_intr && !t->is_task && t->thread->bound_cpu<0 ) { 
-	    DEBUG("Found thread %llu %s\n",t->thread->tid,t->thread->name);
-	    prosp[count++] = t;
-	    if (count>=maxcount) { 
-		break;
-	    }
-	}
+#ifdef NAUT_CONFIG_SCHED_BATCH
+    // batch threads go first, as no one is waiting on them
+    count = find_batch_steal_candidates(os,prosp,maxcount);
+#endif
+    if (count<maxcount) {
+	count += find_steal_candidates(os,prosp+count,maxcount-count);
     }
     
     LOCAL_UNLOCK(os);
@@ -3085,11 +4042,13 @@ int nk_sched_cpu_mug(int old_cpu, uint64_t maxcount, uint64_t *actualcount)
 	    DEBUG("Could not steal thread %llu %s\n",prosp[cur]->thread->tid,prosp[cur]->thread->name);
 	} else {
 	    DEBUG("Stole thread %llu %s\n",prosp[cur]->thread->tid,prosp[cur]->thread->name);
+	    NK_SCHED_TRACE(NK_SCHED_TRACE_STEAL,prosp[cur]->thread->tid,old_cpu,0);
 	    (*actualcount)++;
 	}
     }
     
     ns->num_thefts += *actualcount;
+    ns->num_thefts_level[steal_level(sys->cpus[new_cpu],sys->cpus[old_cpu])] += *actualcount;
     
     DEBUG("Thread theft complete\n");
 
@@ -3108,10 +4067,41 @@ void    nk_sched_kick_cpu(int cpu)
     } else {
 	// we do not reschedule here since
 	// we do not know if it is safe to do so 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+	// but a stopped tick must not hide the wakeup
+	tick_restart_local(per_cpu_get(sched_state));
+#endif
     }
 #endif
 }
 
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+int nk_sched_set_tickless(int on)
+{
+    return __sync_lock_test_and_set(&sched_tickless,!!on);
+}
+
+void nk_sched_tickless_timer_started(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    rt_scheduler *s = sys->cpus[0]->sched_state;
+
+    if (!s || !*(volatile int *)&s->tick_stopped) {
+	// cpu 0 will get to the timer on its next tick
+	return;
+    }
+
+    if (my_cpu_id()!=0) {
+	nk_sched_kick_cpu(0);
+    } else if (!get_cpu()->in_timer_interrupt) {
+	// the kick handler leads to a scheduling pass, which will
+	// set the timer to include this one - within the timer
+	// interrupt, that pass happens anyway
+	apic_self_ipi(per_cpu_get(apic),APIC_NULL_KICK_VEC);
+    }
+}
+#endif
+
 extern void nk_thread_switch(nk_thread_t *new);
 extern void nk_thread_switch_exit_helper(nk_thread_t *new, rt_status *statusp, rt_status newval);
 
@@ -3294,6 +4284,7 @@ static int rt_thread_check_deadlines(rt_thread *t, rt_scheduler *s, uint64_t now
         DEBUG("Missed Deadline = %llu\t\t Current Timer = %llu\n", t->deadline, now);
         DEBUG("Difference =  %llu\n", now - t->deadline);
         rt_thread_dump(t,"Missed Deadline");
+	NK_SCHED_TRACE(NK_SCHED_TRACE_DEADLINE_MISS,t->thread->tid,my_cpu_id(),now - t->deadline);
 	t->miss_count++;
 	t->miss_time_sum += now - t->deadline;
 	t->miss_time_sum2 += (now - t->deadline)*(now - t->deadline);
@@ -3330,8 +4321,8 @@ static inline void rt_thread_update_sporadic(rt_thread *t, rt_scheduler *schedul
 static inline void rt_thread_update_aperiodic(rt_thread *t, rt_scheduler *scheduler, uint64_t now)
 {
     if (t->constraints.type == APERIODIC) {
-#if NAUT_CONFIG_APERIODIC_ROUND_ROBIN || NAUT_CONFIG_APERIODIC_LOTTERY
-	// nothing is done, as there is no notion of priority
+#if NAUT_CONFIG_APERIODIC_ROUND_ROBIN || NAUT_CONFIG_APERIODIC_LOTTERY || NAUT_CONFIG_APERIODIC_BITMAP
+	// nothing is done, as there is no notion of dynamic priority
 	// and the PUT_APERIODIC() will put it at the end of the queue
 	// and update probability if needed
 	return;
@@ -3382,6 +4373,35 @@ static inline void rt_thread_update_aperiodic(rt_thread *t, rt_scheduler *schedu
     }
 }
 
+#ifdef NAUT_CONFIG_SCHED_BATCH
+//
+// Batch threads are ordered among themselves as with the dynamic
+// quantum-based priority of aperiodic threads, but against their own
+// quantum, which doubles each time they use all of it, and starts
+// over at the aperiodic quantum when they sleep.
+//
+// returns nonzero if the thread has used its whole quantum
+static int rt_thread_update_batch(rt_thread *t, rt_scheduler *scheduler, uint64_t now, int sleeping)
+{
+    int expired = t->cur_run_time >= t->batch_quantum;
+
+    t->deadline = t->constraints.batch.priority + MIN(t->cur_run_time,t->batch_quantum);
+    if ((t->deadline < t->constraints.batch.priority)
+	|| (t->deadline > (-1ULL - 2048ULL))) {
+	t->deadline = -1ULL - 2048ULL;
+    }
+    t->deadline += now & 0xfff;
+
+    if (sleeping) {
+	t->batch_quantum = scheduler->cfg.aperiodic_quantum;
+    } else if (expired) {
+	t->batch_quantum = MIN(2*t->batch_quantum,BATCH_QUANTUM_MAX);
+    }
+
+    return expired;
+}
+#endif
+
 
 // in nanoseconds
 static uint64_t cur_time()
@@ -3407,7 +4427,7 @@ static void reset_state(rt_thread *thread)
 
 static void reset_stats(rt_thread *thread)
 {
-    if (thread->constraints.type==APERIODIC) {
+    if (thread->constraints.type==APERIODIC || thread->constraints.type==BATCH) {
 	thread->arrival_count = 1;
     } else {
 	thread->arrival_count = 0;
@@ -3530,7 +4550,8 @@ static int rt_thread_admit(rt_scheduler *scheduler, rt_thread *thread, uint64_t
     DEBUG("Admission: %s tpr=%u util_limit=%llu aper_res=%llu spor_res=%llu per_res=%llu\n",
 	  thread->constraints.type==APERIODIC ? "Aperiodic" :
 	  thread->constraints.type==PERIODIC ? "Periodic" :
-	  thread->constraints.type==SPORADIC ? "Sporadic" : "Unknown",
+	  thread->constraints.type==SPORADIC ? "Sporadic" :
+	  thread->constraints.type==BATCH ? "Batch" : "Unknown",
 	  thread->constraints.interrupt_priority_class,
 	  util_limit,aper_res,spor_res,per_res);
 
@@ -3549,6 +4570,17 @@ static int rt_thread_admit(rt_scheduler *scheduler, rt_thread *thread, uint64_t
 	DEBUG("Admitting APERIODIC thread\n");
 	return 0;
 	break;
+#ifdef NAUT_CONFIG_SCHED_BATCH
+    case BATCH:
+	// BATCH always admitted too
+	reset_state(thread);
+	reset_stats(thread);
+	thread->deadline = thread->constraints.batch.priority;
+	thread->batch_quantum = scheduler->cfg.aperiodic_quantum;
+	DEBUG("Admitting BATCH thread\n");
+	return 0;
+	break;
+#endif
     case PERIODIC: {
 	uint64_t this_util = (thread->constraints.periodic.slice*UTIL_ONE)/thread->constraints.periodic.period;
 	uint64_t cur_util, cur_count;
@@ -3622,31 +4654,319 @@ static int rt_thread_admit(rt_scheduler *scheduler, rt_thread *thread, uint64_t
 	time_left = (thread->constraints.sporadic.deadline - (now + thread->constraints.periodic.phase));
 	this_util = (thread->constraints.sporadic.size*UTIL_ONE)/time_left;
 
-	get_sporadic_util(scheduler,now,&cur_util,&cur_count);
-	our_limit = spor_res;
+	get_sporadic_util(scheduler,now,&cur_util,&cur_count);
+	our_limit = spor_res;
+
+	DEBUG("Sporadic admission:  this_util=%llu cur_util=%llu our_limit=%llu\n",this_util,cur_util,our_limit);
+
+	if ((cur_util+this_util) < our_limit) { 
+	    // admit task
+	    reset_state(thread);
+	    reset_stats(thread);
+	    // the next arrival of this thread will be at this time
+	    thread->deadline = now + thread->constraints.sporadic.phase;
+	    DEBUG("Admitting SPORADIC thread\n");
+	    return 0;
+	} else {
+	    DEBUG("Rejected SPORADIC thread\n");
+	    return -1;
+	}
+    }
+	break;
+    default:
+	ERROR("Attempt to admit unknown kind of thread\n");
+	return -1;
+	break;
+    }
+}
+
+//
+// Global admission
+//
+// rt_thread_admit() only considers the cpu the thread is on.  Here,
+// the cpus are ranked by how the thread's reservation fits on each
+// under the same limits, and the thread moves itself to each in turn
+// until one admits it.  Nothing is held across cpus, so concurrent
+// admissions can rank a cpu on stale utilization, but admission on
+// the cpu itself still has the final word.
+//
+
+// utilization of a real-time type on the cpu, and the
+// limit for it with one more thread of the type
+static void rt_cpu_util(int cpu, rt_type type, uint64_t now, uint64_t *util, uint64_t *limit)
+{
+    LOCAL_LOCK_CONF;
+    struct sys_info *sys = per_cpu_get(system);
+    rt_scheduler *s = sys->cpus[cpu]->sched_state;
+    uint64_t per_res = s->cfg.util_limit - s->cfg.aperiodic_reservation - s->cfg.sporadic_reservation;
+    rt_thread *c;
+    uint64_t count;
+
+    LOCAL_LOCK(s);
+
+    // the running thread is on no queue
+    c = s->current;
+
+    if (type==PERIODIC) {
+	get_periodic_util(s,util,&count);
+	if (c->constraints.type==PERIODIC) {
+	    *util += (c->constraints.periodic.slice * UTIL_ONE) / c->constraints.periodic.period;
+	    count++;
+	}
+	*limit = MIN(get_periodic_util_rms_limit(count+1),per_res);
+    } else {
+	get_sporadic_util(s,now,util,&count);
+	if (c->constraints.type==SPORADIC &&
+	    c->constraints.sporadic.deadline > now &&
+	    c->constraints.sporadic.size > c->run_time) {
+	    *util += ((c->constraints.sporadic.size - c->run_time) * UTIL_ONE) / (c->constraints.sporadic.deadline - now);
+	}
+	*limit = s->cfg.sporadic_reservation;
+    }
+
+    LOCAL_UNLOCK(s);
+}
+
+// utilization a reservation asks for, -1 if it is impossible
+static uint64_t rt_util(rt_constraints *c, uint64_t now)
+{
+    if (c->type==PERIODIC) {
+	return (c->periodic.slice * UTIL_ONE) / c->periodic.period;
+    }
+    if (c->type==SPORADIC) {
+	if ((now + c->sporadic.phase + c->sporadic.size) >= c->sporadic.deadline) {
+	    return -1;
+	}
+	return (c->sporadic.size * UTIL_ONE) / (c->sporadic.deadline - (now + c->sporadic.phase));
+    }
+    return 0;
+}
+
+// a thread moves itself by sleeping and having its wakeup place it
+// on the cpu (see nk_sched_wake_placement()), which may take a few
+// tries if the wakeup comes before its old cpu has switched away
+#define RT_MOVE_SELF_TRIES 8
+
+static int sched_move_self(int cpu)
+{
+    struct nk_thread *me = get_cur_thread();
+    rt_thread *r = me->sched_state;
+    int i;
+
+    for (i=0;i<RT_MOVE_SELF_TRIES && me->current_cpu!=cpu;i++) {
+	r->wake_cpu = cpu;
+	nk_sleep(0);
+    }
+
+    r->wake_cpu = -1;
+
+    return me->current_cpu==cpu ? 0 : -1;
+}
+
+int nk_sched_thread_change_constraints_global(struct nk_sched_constraints *constraints,
+					      nk_sched_fit_t fit)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct nk_thread *me = get_cur_thread();
+    rt_thread *r = me->sched_state;
+    int num_cpus = sys->num_cpus;
+    int order[num_cpus];
+    uint64_t left[num_cpus];
+    uint64_t now = cur_time();
+    uint64_t this_util, util, limit;
+    int cpu, i, n;
+
+    if (fit!=NK_SCHED_FIT_FIRST && fit!=NK_SCHED_FIT_WORST) {
+	ERROR("Unknown fit %d\n",fit);
+	return -1;
+    }
+
+    if (constraints->type==APERIODIC || constraints->type==BATCH || me->bound_cpu>=0) {
+	// there is nowhere else to go
+	return nk_sched_thread_change_constraints(constraints);
+    }
+
+    if ((this_util = rt_util(constraints,now)) == -1ULL) {
+	DEBUG("Rejected impossible SPORADIC thread\n");
+	return -1;
+    }
+
+    if (r->constraints.type!=APERIODIC) {
+	// only aperiodic threads can move
+	struct nk_sched_constraints a = { .type = APERIODIC,
+					  .aperiodic.priority = sys->cpus[my_cpu_id()]->sched_state->cfg.aperiodic_default_priority };
+	if (nk_sched_thread_change_constraints(&a)) {
+	    ERROR("Cannot make %llu \"%s\" aperiodic to move it\n",me->tid,me->name);
+	    return -1;
+	}
+    }
+
+    // rank the cpus it fits on, keeping cpu order for first fit, and
+    // putting the most reservation left after admission first for
+    // worst fit
+    n = 0;
+    for (cpu=0;cpu<num_cpus;cpu++) {
+	rt_cpu_util(cpu,constraints->type,now,&util,&limit);
+	if (util+this_util >= limit) {
+	    continue;
+	}
+	for (i=n; i>0 && fit==NK_SCHED_FIT_WORST && left[i-1] < limit-util-this_util; i--) {
+	    order[i] = order[i-1];
+	    left[i] = left[i-1];
+	}
+	order[i] = cpu;
+	left[i] = limit-util-this_util;
+	n++;
+    }
+
+    for (i=0;i<n;i++) {
+	if (sched_move_self(order[i])) {
+	    DEBUG("Could not move %llu \"%s\" to cpu %d\n",me->tid,me->name,order[i]);
+	    continue;
+	}
+	if (!nk_sched_thread_change_constraints(constraints)) {
+	    DEBUG("Admitted %llu \"%s\" on cpu %d\n",me->tid,me->name,order[i]);
+	    r->global_fit = fit;
+	    return 0;
+	}
+    }
+
+    DEBUG("No cpu admitted %llu \"%s\"\n",me->tid,me->name);
+
+    return -1;
+}
+
+#ifdef NAUT_CONFIG_RT_REBALANCE
+#define RT_REBALANCE_MAX_MOVES 16
+
+// move a periodic thread waiting on cpu for its next arrival to cpu to,
+// where it is admitted anew.  Both cpus are locked, lower cpu first,
+// so the thread only leaves cpu once to has admitted it, and cpu's
+// utilization cannot be taken by anyone else meanwhile.  Nothing else
+// holds two scheduler locks at once.
+static int rt_move_pending(rt_thread *r, int cpu, int to)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    rt_scheduler *s = sys->cpus[cpu]->sched_state;
+    rt_scheduler *d = sys->cpus[to]->sched_state;
+    struct nk_thread *t;
+    uint8_t flags;
+    int rc = -1;
+
+    flags = irq_disable_save();
+    spin_lock(cpu < to ? &s->lock : &d->lock);
+    spin_lock(cpu < to ? &d->lock : &s->lock);
+
+    // r may have exited since we looked, so find it before touching it
+    if (!REMOVE_RT_PENDING(s,r)) {
+	goto out;
+    }
+
+    t = r->thread;
+
+    if (s->resched_seq == r->switch_seq) {
+	// it may still be switching out
+	PUT_RT_PENDING(s,r);
+	goto out;
+    }
+
+    t->current_cpu = to;
+
+    if (_sched_make_runnable(t,to,1,1)) {
+	DEBUG("Cpu %d did not admit %llu \"%s\" - leaving it\n",to,t->tid,t->name);
+	// it never left, as far as cpu's admission is concerned
+	t->current_cpu = cpu;
+	PUT_RT_PENDING(s,r);
+	goto out;
+    }
+
+    NK_SCHED_TRACE(NK_SCHED_TRACE_MIGRATE,t->tid,to,cpu);
+
+    rc = 0;
+
+ out:
+    spin_unlock(&s->lock);
+    spin_unlock(&d->lock);
+    irq_enable_restore(flags);
+
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    if (!rc && d==per_cpu_get(sched_state)) {
+	tick_restart_local(d);
+    }
+#endif
+
+    return rc;
+}
+
+// a periodic thread placed by global admission has left cpu freed, so
+// pull others onto it, largest first: for first fit, from later cpus,
+// and for worst fit, from cpus left more loaded than freed would be
+static void rt_rebalance(int freed, nk_sched_fit_t fit)
+{
+    LOCAL_LOCK_CONF;
+    struct sys_info *sys = per_cpu_get(system);
+    uint64_t now, futil, flimit, util, limit, u, best_util;
+    rt_thread *r, *best;
+    int best_cpu, cpu, i, moves;
+
+    for (moves=0;moves<RT_REBALANCE_MAX_MOVES;moves++) {
 
-	DEBUG("Sporadic admission:  this_util=%llu cur_util=%llu our_limit=%llu\n",this_util,cur_util,our_limit);
+	now = cur_time();
+	rt_cpu_util(freed,PERIODIC,now,&futil,&flimit);
 
-	if ((cur_util+this_util) < our_limit) { 
-	    // admit task
-	    reset_state(thread);
-	    reset_stats(thread);
-	    // the next arrival of this thread will be at this time
-	    thread->deadline = now + thread->constraints.sporadic.phase;
-	    DEBUG("Admitting SPORADIC thread\n");
-	    return 0;
-	} else {
-	    DEBUG("Rejected SPORADIC thread\n");
-	    return -1;
+	best = 0;
+	best_util = 0;
+	best_cpu = -1;
+
+	for (cpu=(fit==NK_SCHED_FIT_FIRST ? freed+1 : 0);cpu<sys->num_cpus;cpu++) {
+	    rt_scheduler *s = sys->cpus[cpu]->sched_state;
+
+	    if (cpu==freed) {
+		continue;
+	    }
+
+	    rt_cpu_util(cpu,PERIODIC,now,&util,&limit);
+
+	    LOCAL_LOCK(s);
+	    for (i=0;i<s->pending.size;i++) {
+		r = s->pending.threads[i];
+		if (r->constraints.type!=PERIODIC ||
+		    r->global_fit!=fit ||
+		    r->thread->bound_cpu>=0) {
+		    continue;
+		}
+		u = rt_util(&r->constraints,now);
+		if (futil+u >= flimit ||
+		    (fit==NK_SCHED_FIT_WORST && futil+u >= util) ||
+		    u <= best_util) {
+		    continue;
+		}
+		best = r;
+		best_util = u;
+		best_cpu = cpu;
+	    }
+	    LOCAL_UNLOCK(s);
+	}
+
+	if (!best || rt_move_pending(best,best_cpu,freed)) {
+	    break;
 	}
     }
-	break;
-    default:
-	ERROR("Attempt to admit unknown kind of thread\n");
-	return -1;
-	break;
+
+    DEBUG("Rebalanced %d threads onto cpu %d\n",moves,freed);
+}
+
+static void rt_exited(rt_thread *r)
+{
+    if (r->constraints.type==PERIODIC && r->global_fit) {
+	rt_rebalance(r->thread->current_cpu,r->global_fit);
     }
 }
+#else
+static void rt_exited(rt_thread *r)
+{
+}
+#endif
 
 int nk_sched_thread_get_constraints(struct nk_thread *t, struct nk_sched_constraints *c)
 {
@@ -3715,21 +5035,117 @@ static inline uint64_t get_min_per(rt_priority_queue *runnable, rt_priority_queu
     return min_period;
 }
 
-static int task_initial_placement()
+static int task_deque_push(task_deque *d, struct nk_task *t)
 {
-    struct sys_info * sys = per_cpu_get(system);
-    return (int)(get_random() % sys->num_cpus);
+    sint64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    sint64_t top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+
+    if (b - top >= TASK_DEQUE_SIZE) {
+	// full
+	return -1;
+    }
+
+    d->slots[b & (TASK_DEQUE_SIZE-1)] = t;
+    // the task must be visible before the thieves can see the new bottom
+    __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELEASE);
+
+    return 0;
 }
 
+static struct nk_task *task_deque_pop(task_deque *d)
+{
+    sint64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    sint64_t t;
+    struct nk_task *x = 0;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (t <= b) {
+	x = d->slots[b & (TASK_DEQUE_SIZE-1)];
+	if (t == b) {
+	    // last task, so race the thieves for it
+	    if (!__atomic_compare_exchange_n(&d->top, &t, t+1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		x = 0;
+	    }
+	    __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+	}
+    } else {
+	// empty
+	__atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+    }
 
-struct nk_task *nk_task_produce(int cpu, uint64_t size_ns, void *(*f)(void*), void *input, uint64_t flags)
+    return x;
+}
+
+static struct nk_task *task_deque_steal(task_deque *d)
 {
-    TASK_LOCK_CONF;
-    
-    int placement_cpu = cpu>=0 ? cpu : task_initial_placement();
-    uint64_t start = cur_time();
-    
-    struct nk_task *t = MALLOC_SPECIFIC(sizeof(struct nk_task),placement_cpu);
+    sint64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    sint64_t b;
+    struct nk_task *x;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b) {
+	// empty
+	return 0;
+    }
+
+    x = d->slots[t & (TASK_DEQUE_SIZE-1)];
+    if (!__atomic_compare_exchange_n(&d->top, &t, t+1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+	// lost to the owner or another thief
+	return 0;
+    }
+
+    return x;
+}
+
+static inline uint64_t task_deque_size(task_deque *d)
+{
+    sint64_t n = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    return n > 0 ? n : 0;
+}
+
+// order the other cpus by how near they are to me, for the thread
+// and task thieves, once the topology of all cpus is known, so that
+// a thief only samples the cpus of the level it is trying
+static int steal_order_init(struct cpu *me)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    rt_scheduler *s = me->sched_state;
+    steal_level_t level;
+    int *order;
+    int i, n=0;
+
+    order = (int *)MALLOC_SPECIFIC(sizeof(int)*sys->num_cpus, me->id);
+    if (!order) {
+	ERROR("Failed to allocate steal order\n");
+	return -1;
+    }
+
+    for (level=STEAL_LEVEL_CORE; level<STEAL_NUM_LEVELS; level++) {
+	for (i=0;i<sys->num_cpus;i++) {
+	    if (i!=me->id && steal_level(me,sys->cpus[i])==level) {
+		order[n++] = i;
+	    }
+	}
+	s->steal_level_end[level] = n;
+    }
+
+    s->steal_num = n;
+    __sync_synchronize();
+    s->steal_order = order;
+
+    return 0;
+}
+
+static struct nk_task *task_create(uint64_t size_ns, void *(*f)(void*), void *input, uint64_t flags, uint64_t start, int placement_cpu)
+{
+    struct nk_task *t = placement_cpu>=0 ?
+	nk_kmem_cache_alloc_specific(task_cache,placement_cpu) : 
+	nk_kmem_cache_alloc(task_cache);
 
     if (!t) {
 	TASK_ERROR("Failed to allocate a task\n");
@@ -3747,45 +5163,141 @@ struct nk_task *nk_task_produce(int cpu, uint64_t size_ns, void *(*f)(void*), vo
 
     INIT_LIST_HEAD(&t->queue_node);
 
+    return t;
+}
+
+// queue tasks of the given size on a cpu (-1 => this cpu), returns the cpu
+// unsized tasks produced for this cpu go on its deque, other tasks, and
+// those that do not fit, on its locked queues
+static int task_enqueue(int cpu, uint64_t size_ns, struct nk_task **tasks, uint64_t count)
+{
+    TASK_LOCK_CONF;
     struct sys_info * sys = per_cpu_get(system);
-    task_info *ti = &sys->cpus[placement_cpu]->sched_state->tasks;
+    uint8_t flags;
+    uint64_t i=0;
+    task_info *ti;
+    int me;
 
-    // own the target scheduler's task queue
-    TASK_LOCK(ti);
-    if (t->stats.size_ns) {
-	list_add_tail(&t->queue_node, &ti->sized_queue);
-	ti->sized_enqueued++;
-    } else {
-	list_add_tail(&t->queue_node, &ti->unsized_queue);
-	ti->unsized_enqueued++;
+    flags = irq_disable_save();
+    me = my_cpu_id();
+    if (cpu<0) {
+	cpu = me;
     }
-    TASK_UNLOCK(ti);
+    ti = &sys->cpus[cpu]->sched_state->tasks;
+    if (!size_ns && cpu==me) {
+	for (i=0; i<count && !task_deque_push(&ti->deque,tasks[i]); i++) {
+	}
+	ti->deque_pushed += i;
+    }
+    irq_enable_restore(flags);
 
-    // kick any waitqueue
-    nk_wait_queue_wake_all(ti->waitq);
+    if (i<count) {
+	// own the target scheduler's task queue
+	TASK_LOCK(ti);
+	for (; i<count; i++) {
+	    if (size_ns) {
+		list_add_tail(&tasks[i]->queue_node, &ti->sized_queue);
+		ti->sized_enqueued++;
+	    } else {
+		list_add_tail(&tasks[i]->queue_node, &ti->unsized_queue);
+		ti->unsized_enqueued++;
+	    }
+	}
+	TASK_UNLOCK(ti);
+    }
 
-    return t;
+    return cpu;
 }
 
-static int task_cpu_selection()
+#define TASK_WAKE_SCAN 8 // cpus beyond those needed to look at for sleeping task threads
+
+// wake the task thread of the cpu, and, if it has more work than it can
+// do at once, sleeping task threads nearby that can steal it
+static void task_wake(int cpu, uint64_t count)
 {
     struct sys_info * sys = per_cpu_get(system);
-    return (int)(get_random() % sys->num_cpus);
+    rt_scheduler *s = sys->cpus[cpu]->sched_state;
+    task_info *ti = &s->tasks;
+    uint64_t want, queued;
+    int i;
+
+    // the task thread checks for work and queues itself under the wait
+    // queue lock, so only a locked wake is sure not to miss it
+    nk_wait_queue_wake_all(ti->waitq);
+
+    // the neighbors are only a hint - if we miss one as it goes to
+    // sleep, the work is still done by this cpu's task thread
+    queued = task_deque_size(&ti->deque);
+    want = (count > queued ? count : queued);
+    want = want ? want-1 : 0;
+
+    for (i=0; want && s->steal_order && i<s->steal_num && i<want+TASK_WAKE_SCAN; i++) {
+	nk_wait_queue_t *q = sys->cpus[s->steal_order[i]]->sched_state->tasks.waitq;
+	if (!nk_wait_queue_empty(q)) {
+	    nk_wait_queue_wake_all(q);
+	    want--;
+	}
+    }
 }
 
-// dequeue a task, typically used internally
-// dequeuing a task does not execute it.
-static struct nk_task *_nk_task_consume(int cpu, uint64_t size_ns, uint64_t search_limit, int try)
+#define TASK_BATCH 64  // tasks queued at a time by nk_task_produce_batch
+
+uint64_t nk_task_produce_batch(int cpu, uint64_t size_ns, void *(*f)(void*), void **inputs, uint64_t count, uint64_t flags, struct nk_task **tasks)
+{
+    struct nk_task *batch[TASK_BATCH];
+    uint64_t start = cur_time();
+    uint64_t done = 0;
+    uint64_t i, n;
+    int target;
+
+    while (done < count) {
+	n = count - done < TASK_BATCH ? count - done : TASK_BATCH;
+	for (i=0;i<n;i++) {
+	    if (!(batch[i] = task_create(size_ns, f, inputs[done+i], flags, start, cpu))) {
+		break;
+	    }
+	    if (tasks) {
+		tasks[done+i] = batch[i];
+	    }
+	}
+	if (i) {
+	    target = task_enqueue(cpu, size_ns, batch, i);
+	    task_wake(target, i);
+	    done += i;
+	}
+	if (i<n) {
+	    break;
+	}
+    }
+
+    return done;
+}
+
+struct nk_task *nk_task_produce(int cpu, uint64_t size_ns, void *(*f)(void*), void *input, uint64_t flags)
+{
+    struct nk_task *t;
+
+    if (nk_task_produce_batch(cpu,size_ns,f,&input,1,flags,&t)!=1) {
+	return 0;
+    }
+
+    return t;
+}
+
+// dequeue a task from a cpu's locked queues
+static struct nk_task *task_dequeue_locked(task_info *ti, uint64_t size_ns, uint64_t search_limit, int try)
 {
     TASK_LOCK_CONF;
     
-    int source_cpu = cpu>=0 ? cpu : task_cpu_selection();
-
-    struct sys_info * sys = per_cpu_get(system);
-    task_info *ti = &sys->cpus[source_cpu]->sched_state->tasks;
     struct nk_task *t = 0;
     struct list_head *cur;
 
+    if (ti->sized_enqueued==ti->sized_dequeued && 
+	(size_ns || ti->unsized_enqueued==ti->unsized_dequeued)) {
+	// nothing to see here, so do not touch the lock
+	return 0;
+    }
+
     if (try) {
 	if (TASK_TRY_LOCK(ti)) {
 	    // failed, so just leave
@@ -3831,6 +5343,83 @@ static struct nk_task *_nk_task_consume(int cpu, uint64_t size_ns, uint64_t sear
 
     TASK_UNLOCK(ti);
 
+    return t;
+}
+
+// dequeue a task from a cpu, popping its deque if it is this cpu,
+// and stealing from it otherwise
+static struct nk_task *task_dequeue(int cpu, uint64_t size_ns, uint64_t search_limit, int try)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    task_info *ti = &sys->cpus[cpu]->sched_state->tasks;
+    struct nk_task *t = 0;
+    uint8_t flags;
+
+    if (!size_ns) {
+	flags = irq_disable_save();
+	if (cpu==my_cpu_id()) {
+	    if ((t = task_deque_pop(&ti->deque))) {
+		ti->deque_popped++;
+	    }
+	    irq_enable_restore(flags);
+	} else {
+	    irq_enable_restore(flags);
+	    if ((t = task_deque_steal(&ti->deque))) {
+		__sync_fetch_and_add(&ti->deque_stolen,1);
+	    }
+	}
+    }
+
+    if (!t) {
+	t = task_dequeue_locked(ti, size_ns, search_limit, try);
+    }
+
+    return t;
+}
+
+// steal a task from the other cpus, nearest first, and at random
+// within a level
+static struct nk_task *task_steal(uint64_t size_ns, uint64_t search_limit, int try)
+{
+    struct sys_info * sys = per_cpu_get(system);
+    rt_scheduler *s = sys->cpus[my_cpu_id()]->sched_state;
+    steal_level_t level;
+    struct nk_task *t;
+    int first, num, off, i;
+
+    if (!s->steal_order) {
+	// too early to know the topology
+	return task_dequeue((int)(get_random() % sys->num_cpus), size_ns, search_limit, try);
+    }
+
+    for (level=STEAL_LEVEL_CORE, first=0; level<STEAL_NUM_LEVELS; first=s->steal_level_end[level], level++) {
+	num = s->steal_level_end[level] - first;
+	if (!num) {
+	    continue;
+	}
+	off = (int)(get_random() % num);
+	for (i=0;i<num;i++) {
+	    if ((t = task_dequeue(s->steal_order[first + (off+i)%num], size_ns, search_limit, try))) {
+		return t;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+// dequeue a task, typically used internally
+// dequeuing a task does not execute it.
+static struct nk_task *_nk_task_consume(int cpu, uint64_t size_ns, uint64_t search_limit, int try)
+{
+    struct nk_task *t;
+
+    if (cpu>=0) {
+	t = task_dequeue(cpu, size_ns, search_limit, try);
+    } else {
+	t = task_steal(size_ns, search_limit, try);
+    }
+
     if (t) {
 	t->stats.dequeue_time_ns = cur_time();
     }
@@ -3858,7 +5447,7 @@ int nk_task_complete(struct nk_task *task, void *output)
     __sync_fetch_and_or(&task->flags,NK_TASK_COMPLETED);
     task->stats.complete_time_ns = cur_time();
     if (task->flags & NK_TASK_DETACHED) {
-	free(task);
+	nk_kmem_cache_free(task_cache,task);
     }
     return 0;
 }
@@ -3910,7 +5499,7 @@ static int _nk_task_wait(struct nk_task *task, void **output, struct nk_task_sta
 	*stats = task->stats;
     }
 
-    free(task);
+    nk_kmem_cache_free(task_cache,task);
 
     return 0;
 }
@@ -3944,6 +5533,12 @@ static struct nk_sched_percpu_state *init_local_state(struct nk_sched_config *cf
 	state->runnable.type = RUNNABLE_QUEUE;
         state->pending.type = PENDING_QUEUE;
         state->aperiodic.type = APERIODIC_QUEUE;
+#ifdef NAUT_CONFIG_SCHED_BATCH
+	state->batch.type = BATCH_QUEUE;
+#endif
+#if NAUT_CONFIG_APERIODIC_BITMAP
+	rt_bitmap_queue_init(&state->aperiodic);
+#endif
 
     }
     
@@ -4028,7 +5623,8 @@ static int await_task(void *p)
 {
     task_info *ti = (task_info *) p;
 
-    return (ti->sized_enqueued > ti->sized_dequeued) || (ti->unsized_enqueued > ti->unsized_dequeued);
+    return (ti->sized_enqueued > ti->sized_dequeued) || (ti->unsized_enqueued > ti->unsized_dequeued) ||
+	task_deque_size(&ti->deque);
 }
 
 static void task(void *in, void **out)
@@ -4212,6 +5808,17 @@ static int init_global_state()
 
     nk_counting_barrier_init(&stop_barrier,nk_get_num_cpus());
 
+    task_cache = nk_kmem_cache_create("task",sizeof(struct nk_task),0,0,0);
+    if (!task_cache) {
+	ERROR("Cannot create task cache\n");
+	return -1;
+    }
+
+    if (!nk_kmem_register_shrinker("sched-reanimation",reanimation_count,reanimation_scan)) {
+	ERROR("Cannot register reanimation pool shrinker\n");
+	return -1;
+    }
+
     return 0;
 
 }
@@ -4351,6 +5958,11 @@ void nk_sched_start()
     }
 #endif	
 
+    // all cpus know their topology now
+    if (steal_order_init(my_cpu)) {
+	ERROR("Cannot order cpus for stealing\n");
+    }
+
 #ifdef NAUT_CONFIG_TASK_THREAD
     DEBUG("Starting task thread for CPU %d\n",my_cpu->id);
     if (start_task_thread_for_this_cpu()) {
@@ -4404,6 +6016,11 @@ nk_sched_init(struct nk_sched_config *cfg)
     //INFO("Hanging\n");
     //while (1) { arch_halt(); }
 
+    if (nk_thread_init()) {
+	ERROR("Could not initialize threads\n");
+	return -1;
+    }
+
     if (init_global_state()) { 
 	ERROR("Could not initialize global scheduler state\n");
 	return -1;
@@ -4549,6 +6166,40 @@ static struct shell_cmd_impl time_impl = {
 };
 nk_register_shell_cmd(time_impl);
 
+#ifdef NAUT_CONFIG_SCHED_STATS
+static int
+handle_schedstat (char * buf, void * priv)
+{
+    int cpu;
+
+    if (sscanf(buf, "schedstat reset %d", &cpu) == 1) {
+	nk_sched_reset_stats(cpu);
+	return 0;
+    }
+
+    if (!strcmp(buf, "schedstat reset")) {
+	nk_sched_reset_stats(-1);
+	return 0;
+    }
+
+    if (sscanf(buf, "schedstat %d", &cpu) != 1) {
+        cpu = -1;
+    }
+
+    nk_sched_dump_stats(cpu);
+
+    return 0;
+}
+
+
+static struct shell_cmd_impl schedstat_impl = {
+    .cmd      = "schedstat",
+    .help_str = "schedstat [reset] [n]",
+    .handler  = handle_schedstat,
+};
+nk_register_shell_cmd(schedstat_impl);
+#endif
+
 struct burner_args {
     struct nk_virtual_console *vc;
     char     name[SHELL_MAX_CMD];
@@ -4646,6 +6297,39 @@ launch_aperiodic_burner (char * name,
     }
 }
 
+#ifdef NAUT_CONFIG_SCHED_BATCH
+static int 
+launch_batch_burner (char * name, 
+                     uint64_t size_ns, 
+                     uint32_t tpr, 
+                     uint64_t priority)
+{
+    nk_thread_id_t tid;
+    struct burner_args *a;
+
+    a = malloc(sizeof(struct burner_args));
+
+    if (!a) { 
+        return -1;
+    }
+    
+    strncpy(a->name,name,SHELL_MAX_CMD); a->name[SHELL_MAX_CMD-1]=0;
+
+    a->vc                                   = get_cur_thread()->vc;
+    a->size_ns                              = size_ns;
+    a->constraints.type                     = BATCH;
+    a->constraints.interrupt_priority_class = (uint8_t) tpr;
+    a->constraints.batch.priority           = priority;
+
+    if (nk_thread_start(burner, (void*)a , NULL, 1, PAGE_SIZE_4KB, &tid, 1)) { 
+        free(a);
+        return -1;
+    } else {
+        return 0;
+    }
+}
+#endif
+
 static int 
 launch_sporadic_burner (char * name, 
                         uint64_t size_ns, 
@@ -4733,6 +6417,15 @@ handle_burn (char * buf, void * priv)
         return 0;
     }
 
+#ifdef NAUT_CONFIG_SCHED_BATCH
+    if (sscanf(buf, "burn b %s %llu %u %llu", name, &size_ns, &tpr, &priority) == 4) { 
+        nk_vc_printf("Starting batch burner %s with tpr %u, size %llu ms and priority %llu\n", name, tpr, size_ns, priority);
+        size_ns *= 1000000;
+        launch_batch_burner(name,size_ns,tpr,priority);
+        return 0;
+    }
+#endif
+
     if (sscanf(buf,"burn s %s %llu %u %llu %llu %llu %llu", name, &size_ns, &tpr, &phase, &size, &deadline, &priority) == 7) { 
 
         nk_vc_printf("Starting sporadic burner %s with size %llu ms tpr %u phase %llu from now size %llu ms deadline %llu ms from now and priority %lu\n",name,size_ns,tpr,phase,size,deadline,priority);
@@ -4779,6 +6472,9 @@ handle_burn (char * buf, void * priv)
 static struct shell_cmd_impl burn_impl = {
     .cmd      = "burn",
     .help_str = "burn a name size_ms tpr priority\n" 
+#ifdef NAUT_CONFIG_SCHED_BATCH
+                "  burn b name size_ms tpr priority\n" 
+#endif
                 "  burn s name size_ms tpr phase size deadline priority\n" 
                 "  burn p name size_ms tpr phase period slice",
     .handler  = handle_burn,
@@ -400,6 +400,10 @@ smp_ap_finish (struct cpu * core)
     BARRIER_WHILE(smp_core_count != core->system->num_cpus);
 #endif
 
+#ifdef NAUT_CONFIG_KMEM_PARALLEL_INIT
+    nk_kmem_init_deferred();
+#endif
+
     nk_sched_start();
 
 #ifdef NAUT_CONFIG_FIBER_ENABLE
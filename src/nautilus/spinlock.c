@@ -27,6 +27,7 @@ void
 spinlock_init (volatile spinlock_t * lock) 
 {
     *lock = 0;
+    NK_LOCKSTAT_INIT(lock);
 }
 
 
@@ -34,22 +35,19 @@ void
 spinlock_deinit (volatile spinlock_t * lock) 
 {
     *lock = 0;
+    NK_LOCKSTAT_DEINIT(lock);
 }
 
 void
 spin_lock_nopause (volatile spinlock_t * lock)
 {
-    while (__sync_lock_test_and_set(lock, 1)) {
-        /* nothing */
-    }
+    NK_LOCKSTAT_SPIN(lock, __sync_lock_test_and_set(lock, 1), /* nothing */);
 }
 
 uint8_t
 spin_lock_irq_save_nopause (volatile spinlock_t * lock)
 {
     uint8_t flags = irq_disable_save();
-    while (__sync_lock_test_and_set(lock, 1)) {
-        /* nothing */
-    }
+    NK_LOCKSTAT_SPIN(lock, __sync_lock_test_and_set(lock, 1), /* nothing */);
     return flags;
 }
@@ -37,6 +37,8 @@
 #include <nautilus/list.h>
 #include <nautilus/errno.h>
 #include <nautilus/mm.h>
+#include <nautilus/kmem_cache.h>
+#include <nautilus/shrinker.h>
 
 #ifdef NAUT_CONFIG_ENABLE_BDWGC
 #include <gc/bdwgc/bdwgc.h>
@@ -57,6 +59,8 @@ extern uint8_t malloc_cpus_ready;
 
 static unsigned long next_tid = 0;
 
+static struct nk_kmem_cache *thread_cache;
+
 extern addr_t boot_stack_start;
 extern void nk_thread_switch(nk_thread_t*);
 extern void nk_thread_entry(void *);
@@ -294,10 +298,308 @@ thread_setup_init_stack (nk_thread_t * t, nk_thread_fun_t fun, void * arg)
 static void nk_thread_brain_wipe(nk_thread_t *t);
 
 
+#ifdef NAUT_CONFIG_THREAD_POOL
+//
+// Per-cpu pools of warm threads
+//
+// A warm thread has its stack, scheduler state, and wait queue, but
+// is on no scheduler list, and so looks like a thread that has just
+// been reanimated.  Each cpu keeps a pool for each stack size class.
+// A class is kept full by the idle thread once a thread of its size
+// has been created on the cpu, and reaped threads are returned to
+// the pool of their cpu if there is room.
+//
+
+static const nk_stack_size_t thread_pool_sizes[] = { TSTACK_4KB, 0x10000, TSTACK_1MB, TSTACK_2MB };
+
+#define THREAD_POOL_CLASSES (sizeof(thread_pool_sizes)/sizeof(thread_pool_sizes[0]))
+
+struct thread_pool_class {
+    spinlock_t    lock;
+    uint32_t      count;
+    uint32_t      target;   // how many to keep warm, 0 until first used
+    uint64_t      hits;
+    uint64_t      misses;
+    uint64_t      recycled;
+    nk_thread_t  *threads[NAUT_CONFIG_THREAD_POOL_SIZE];
+};
+
+struct thread_pool {
+    struct thread_pool_class classes[THREAD_POOL_CLASSES];
+};
+
+static struct thread_pool *thread_pools[NAUT_CONFIG_MAX_CPUS];
+static volatile int        thread_pool_on = 1;
+
+static int thread_pool_class(nk_stack_size_t size)
+{
+    int i;
+
+    for (i=0;i<THREAD_POOL_CLASSES;i++) {
+	if (size <= thread_pool_sizes[i]) {
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+static nk_thread_t *thread_pool_alloc(int cpu, nk_stack_size_t size)
+{
+    nk_thread_t *t = nk_kmem_cache_alloc_specific(thread_cache,cpu);
+
+    if (!t) {
+	return 0;
+    }
+
+    memset(t, 0, sizeof(nk_thread_t));
+
+    t->stack_size = size;
+    t->current_cpu = cpu;
+
+    if (!(t->stack = malloc_specific(size,cpu))) {
+	goto out_err;
+    }
+
+    if (!(t->sched_state = nk_sched_thread_state_init(t,0))) {
+	goto out_err;
+    }
+
+    if (!(t->waitq = nk_wait_queue_create(0))) {
+	goto out_err;
+    }
+
+    return t;
+
+ out_err:
+    if (t->sched_state) {
+	nk_sched_thread_state_deinit(t);
+    }
+    free(t->stack);
+    nk_kmem_cache_free(thread_cache,t);
+    return 0;
+}
+
+static void thread_pool_free(nk_thread_t *t)
+{
+    if (t->timer) {
+	nk_timer_destroy(t->timer);
+    }
+    nk_wait_queue_destroy(t->waitq);
+    nk_sched_thread_state_deinit(t);
+    free(t->stack);
+    nk_kmem_cache_free(thread_cache,t);
+}
+
+// a warm thread with a stack of at least size, for cpu
+static nk_thread_t *thread_pool_get(nk_stack_size_t size, int cpu)
+{
+    int c = thread_pool_class(size);
+    struct thread_pool_class *p;
+    nk_thread_t *t = 0;
+    uint8_t flags;
+
+    if (c<0 || !thread_pool_on || !thread_pools[cpu]) {
+	return 0;
+    }
+
+    p = &thread_pools[cpu]->classes[c];
+
+    flags = spin_lock_irq_save(&p->lock);
+    if (p->count) {
+	t = p->threads[--p->count];
+	p->hits++;
+    } else {
+	// keep this class warm from now on
+	p->target = NAUT_CONFIG_THREAD_POOL_SIZE;
+	p->misses++;
+    }
+    spin_unlock_irq_restore(&p->lock,flags);
+
+    return t;
+}
+
+// take a thread that is being destroyed, returns nonzero if taken
+static int thread_pool_put(nk_thread_t *t)
+{
+    int c = thread_pool_class(t->stack_size);
+    int cpu = t->placement_cpu;
+    struct thread_pool_class *p;
+    uint8_t flags;
+    int taken = 0;
+
+    if (c<0 || thread_pool_sizes[c]!=t->stack_size ||
+	cpu<0 || cpu>=NAUT_CONFIG_MAX_CPUS || !thread_pools[cpu]) {
+	return 0;
+    }
+
+    p = &thread_pools[cpu]->classes[c];
+
+    if (p->count >= p->target) {
+	return 0;
+    }
+
+    nk_thread_brain_wipe(t);
+
+    flags = spin_lock_irq_save(&p->lock);
+    if (p->count < p->target) {
+	p->threads[p->count++] = t;
+	p->recycled++;
+	taken = 1;
+    }
+    spin_unlock_irq_restore(&p->lock,flags);
+
+    if (!taken) {
+	thread_pool_free(t);
+    }
+
+    return 1;
+}
+
+int nk_thread_pool_fill(void)
+{
+    int cpu = my_cpu_id();
+    struct thread_pool *tp = thread_pools[cpu];
+    struct thread_pool_class *p;
+    nk_thread_t *t;
+    uint8_t flags;
+    int c;
+
+    if (!tp || !thread_pool_on) {
+	return 0;
+    }
+
+    for (c=0;c<THREAD_POOL_CLASSES;c++) {
+	p = &tp->classes[c];
+	if (*(volatile uint32_t *)&p->count < p->target) {
+	    if (!(t = thread_pool_alloc(cpu,thread_pool_sizes[c]))) {
+		return 0;
+	    }
+	    flags = spin_lock_irq_save(&p->lock);
+	    if (p->count < p->target) {
+		p->threads[p->count++] = t;
+		t = 0;
+	    }
+	    spin_unlock_irq_restore(&p->lock,flags);
+	    if (t) {
+		thread_pool_free(t);
+	    }
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+int nk_thread_pool_enable(int on)
+{
+    return __sync_lock_test_and_set(&thread_pool_on,!!on);
+}
+
+static uint64_t thread_pool_count(void)
+{
+    uint64_t n = 0;
+    int cpu, c;
+
+    for (cpu=0;cpu<NAUT_CONFIG_MAX_CPUS;cpu++) {
+	if (thread_pools[cpu]) {
+	    for (c=0;c<THREAD_POOL_CLASSES;c++) {
+		n += thread_pools[cpu]->classes[c].count;
+	    }
+	}
+    }
+
+    return n;
+}
+
+// give back the largest stacks first
+static uint64_t thread_pool_scan(uint64_t nr)
+{
+    struct thread_pool_class *p;
+    nk_thread_t *t;
+    uint64_t freed = 0;
+    uint8_t flags;
+    int cpu, c;
+
+    for (c=THREAD_POOL_CLASSES-1;c>=0;c--) {
+	for (cpu=0;cpu<NAUT_CONFIG_MAX_CPUS;cpu++) {
+	    if (!thread_pools[cpu]) {
+		continue;
+	    }
+	    p = &thread_pools[cpu]->classes[c];
+	    while (freed<nr) {
+		if (spin_try_lock_irq_save(&p->lock,&flags)) {
+		    break;
+		}
+		t = p->count ? p->threads[--p->count] : 0;
+		spin_unlock_irq_restore(&p->lock,flags);
+		if (!t) {
+		    break;
+		}
+		thread_pool_free(t);
+		freed++;
+	    }
+	}
+    }
+
+    return freed;
+}
+
+static int thread_pool_init(void)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    int cpu;
+
+    for (cpu=0;cpu<sys->num_cpus;cpu++) {
+	thread_pools[cpu] = malloc_specific(sizeof(struct thread_pool),cpu);
+	if (!thread_pools[cpu]) {
+	    THREAD_ERROR("Could not allocate thread pool for cpu %d\n",cpu);
+	    return -1;
+	}
+	memset(thread_pools[cpu],0,sizeof(struct thread_pool));
+	// default-sized threads are always kept warm
+	thread_pools[cpu]->classes[thread_pool_class(PAGE_SIZE)].target = NAUT_CONFIG_THREAD_POOL_SIZE;
+    }
+
+    if (!nk_kmem_register_shrinker("thread-pool",thread_pool_count,thread_pool_scan)) {
+	THREAD_ERROR("Could not register thread pool shrinker\n");
+    }
+
+    return 0;
+}
+#endif
+
+
 /****** EXTERNAL THREAD INTERFACE ******/
 
 
 
+/*
+ * nk_thread_init
+ *
+ * sets up the cache that thread structs are allocated from
+ *
+ */
+int
+nk_thread_init (void)
+{
+    thread_cache = nk_kmem_cache_create("thread", sizeof(nk_thread_t), 64, 0, 0);
+
+    if (!thread_cache) {
+	THREAD_ERROR("Could not create thread cache\n");
+	return -1;
+    }
+
+#ifdef NAUT_CONFIG_THREAD_POOL
+    if (thread_pool_init()) {
+	return -1;
+    }
+#endif
+
+    return 0;
+}
+
+
 /*
  * nk_thread_create
  *
@@ -331,9 +633,18 @@ nk_thread_create (nk_thread_fun_t fun,
     int placement_cpu = bound_cpu<0 ? nk_sched_initial_placement() : bound_cpu;
     nk_stack_size_t required_stack_size = stack_size ? stack_size: PAGE_SIZE;
 
-    // First try to get a thread from the scheduler's pools
-    if ((t=nk_sched_reanimate(required_stack_size,
-			      placement_cpu))) {
+#ifdef NAUT_CONFIG_THREAD_POOL
+    // First try the warm threads of the cpu
+    t = thread_pool_get(required_stack_size,placement_cpu);
+#endif
+
+    if (t) {
+	// a warm thread is set up as a brain-wiped reanimated one,
+	// so there is nothing more to do
+
+    } else if ((t=nk_sched_reanimate(required_stack_size,
+				     placement_cpu))) {
+	// Then try to get a thread from the scheduler's pools
 	// we have succeeded in reanimating a dead thread, so
 	// now all we need to do is the management that
 	// nk_thread_destroy() would otherwise have done
@@ -346,7 +657,7 @@ nk_thread_create (nk_thread_fun_t fun,
 	// failed to reanimate existing dead thread, so we need to
 	// make our own
 
-	t = malloc_specific(sizeof(nk_thread_t),placement_cpu);
+	t = nk_kmem_cache_alloc_specific(thread_cache,placement_cpu);
 
 	if (!t) {
 	    THREAD_ERROR("Could not allocate thread struct\n");
@@ -362,7 +673,7 @@ nk_thread_create (nk_thread_fun_t fun,
 	if (!t->stack) {
 
 	    THREAD_ERROR("Failed to allocate a stack\n");
-	    free(t);
+	    nk_kmem_cache_free(thread_cache,t);
 	    return -EINVAL;
 	}
 
@@ -382,6 +693,10 @@ nk_thread_create (nk_thread_fun_t fun,
     // a thread joins its creator's address space
     t->aspace = get_cur_thread()->aspace;
 
+    // and allocates memory as its creator does
+    t->mem_policy = get_cur_thread()->mem_policy;
+    t->mem_policy.il_bytes = 0;
+
     t->fun = fun;
     t->input = input;
     t->output_loc = output;
@@ -422,7 +737,7 @@ out_err:
     // so we do not need to clean it up
 
     free(t->stack);
-    free(t);
+    nk_kmem_cache_free(thread_cache,t);
 
     return -EINVAL;
 }
@@ -659,6 +974,14 @@ nk_thread_destroy (nk_thread_id_t t)
 		     thethread, thethread->tid, thethread->name, thethread->num_wait);
     }
 
+#ifdef NAUT_CONFIG_THREAD_POOL
+    // keep it warm for the next thread created on its cpu
+    if (thread_pool_put(thethread)) {
+	preempt_enable();
+	return;
+    }
+#endif
+
     /* remove its own wait queue
      * (waiters should already have been notified */
     nk_wait_queue_destroy(thethread->waitq);
@@ -675,7 +998,7 @@ nk_thread_destroy (nk_thread_id_t t)
 #endif
 
     free(thethread->stack);
-    free(thethread);
+    nk_kmem_cache_free(thread_cache,thethread);
 
     preempt_enable();
 }
@@ -29,6 +29,7 @@ void
 nk_ticket_lock_init (nk_ticket_lock_t * l)
 {
     l->val = 0;
+    NK_LOCKSTAT_INIT(l);
 }
 
 
@@ -36,6 +37,7 @@ void
 nk_ticket_lock_deinit (nk_ticket_lock_t * l)
 {
     l->val = 0;
+    NK_LOCKSTAT_DEINIT(l);
 }
 
 
@@ -45,7 +47,7 @@ nk_ticket_lock (nk_ticket_lock_t * l)
     NK_PROFILE_ENTRY();
 
     uint16_t t = __atomic_add_fetch(&l->lock.users, 1, __ATOMIC_SEQ_CST);
-    while (__atomic_load_n(&l->lock.ticket, __ATOMIC_SEQ_CST) != t) {}
+    NK_LOCKSTAT_SPIN(l, __atomic_load_n(&l->lock.ticket, __ATOMIC_SEQ_CST) != t, );
 
     /* asm volatile ("movw $1, %%ax\n\t" */
     /*               "lock xaddw %%ax, %[_users]\n\t" */
@@ -66,6 +68,8 @@ nk_ticket_unlock (nk_ticket_lock_t * l)
 {
     NK_PROFILE_ENTRY();
 
+    NK_LOCKSTAT_RELEASED(l);
+
     __atomic_add_fetch(&l->lock.ticket, 1, __ATOMIC_SEQ_CST);
 
 /* #ifndef NAUT_CONFIG_XEON_PHI */
@@ -113,6 +117,7 @@ nk_ticket_trylock (nk_ticket_lock_t * l)
     uint32_t cmpnew = ((uint32_t) menew << 16) + me;
 
     if (cmpxchg32(&(l->val), cmp, cmpnew) == cmp) {
+        NK_LOCKSTAT_ACQUIRED(l, 0);
         return 0;
     }
 
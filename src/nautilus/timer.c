@@ -32,6 +32,7 @@
 #include <nautilus/waitqueue.h>
 #include <nautilus/scheduler.h>
 #include <nautilus/spinlock.h>
+#include <nautilus/kmem_cache.h>
 #include <nautilus/shell.h>
 
 #include <stddef.h>
@@ -65,20 +66,55 @@ static struct list_head active_timer_list;
 
 static uint64_t count=0;
 
+// free timers are kept constructed, that is, inactive, off of both
+// timer lists, and with their wait queue
+static struct nk_kmem_cache *timer_cache;
+
+static int timer_ctor(void *obj)
+{
+    struct nk_timer *t = (struct nk_timer *)obj;
+
+    memset(t,0,sizeof(struct nk_timer));
+
+    t->waitq = nk_wait_queue_create(0);
+
+    if (!t->waitq) {
+	ERROR("Timer allocation of thread queue failed\n");
+	return -1;
+    }
+
+    INIT_LIST_HEAD(&t->node);
+    INIT_LIST_HEAD(&t->active_node);
+
+    return 0;
+}
+
+static void timer_dtor(void *obj)
+{
+    struct nk_timer *t = (struct nk_timer *)obj;
+
+    nk_wait_queue_destroy(t->waitq);
+}
+
 
 nk_timer_t *nk_timer_create(char *name)
 {
     char buf[NK_TIMER_NAME_LEN];
-    char mbuf[NK_WAIT_QUEUE_NAME_LEN];
+    char wq_name[NK_WAIT_QUEUE_NAME_LEN];
     
-    struct nk_timer *t = malloc(sizeof(struct nk_timer));
+    struct nk_timer *t = nk_kmem_cache_alloc(timer_cache);
     
     if (!t) { 
 	ERROR("Timer allocation failed\n");
 	return 0;
     }
     
-    memset(t,0,sizeof(struct nk_timer));
+    t->state = NK_TIMER_INACTIVE;
+    t->flags = 0;
+    t->time_ns = 0;
+    t->cpu = 0;
+    t->callback = 0;
+    t->priv = 0;
 
     if (!name) {
 	snprintf(buf,NK_TIMER_NAME_LEN,"timer%lu",__sync_fetch_and_add(&count,1));
@@ -88,18 +124,8 @@ nk_timer_t *nk_timer_create(char *name)
     strncpy(t->name,name,NK_TIMER_NAME_LEN);
     t->name[NK_TIMER_NAME_LEN-1] = 0;
     
-    snprintf(mbuf,NK_WAIT_QUEUE_NAME_LEN,"%s-wait",t->name);
-    t->waitq = nk_wait_queue_create(mbuf);
-
-    if (!t->waitq) { 
-	ERROR("Timer allocation of thread queue failed\n");
-	free(t);
-	return 0;
-    }
-
-    INIT_LIST_HEAD(&t->node);
-    INIT_LIST_HEAD(&t->active_node);
-    
+    snprintf(wq_name,NK_WAIT_QUEUE_NAME_LEN,"%s-wait",t->name);
+    nk_wait_queue_rename(t->waitq,wq_name);
     
     STATE_LOCK_CONF;
 
@@ -115,13 +141,13 @@ void nk_timer_destroy(nk_timer_t *t)
     STATE_LOCK_CONF;
     
     nk_timer_cancel(t); // remove from active list 
-    nk_wait_queue_destroy(t->waitq);
+    // the wait queue stays with the timer in the cache
     
     STATE_LOCK();
     list_del_init(&t->node); // remove from timer list
     STATE_UNLOCK();
     
-    free(t);
+    nk_kmem_cache_free(timer_cache,t);
 }
 
 int nk_timer_set(nk_timer_t *t, 
@@ -217,6 +243,10 @@ int nk_timer_start(nk_timer_t *t)
 	ERROR("Weird:  started already active timer %s\n",t->name);
     } else {
 	DEBUG("start %s\n",t->name);
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+	// the cpu that handles timers may not be expecting to wake up
+	nk_sched_tickless_timer_started();
+#endif
     }
 
     return 0;
@@ -447,6 +477,23 @@ uint64_t nk_timer_handler (void)
 #endif
 }
 
+uint64_t nk_timer_next_event(void)
+{
+    ACTIVE_LOCK_CONF;
+    nk_timer_t *cur;
+    uint64_t earliest = -1;
+
+    ACTIVE_LOCK();
+    list_for_each_entry(cur, &active_timer_list, active_node) {
+	if (cur->time_ns < earliest) {
+	    earliest = cur->time_ns;
+	}
+    }
+    ACTIVE_UNLOCK();
+
+    return earliest;
+}
+
 
 int nk_timer_init()
 {
@@ -455,6 +502,13 @@ int nk_timer_init()
     INIT_LIST_HEAD(&timer_list);
     INIT_LIST_HEAD(&active_timer_list);
 
+    timer_cache = nk_kmem_cache_create("timer",sizeof(struct nk_timer),0,timer_ctor,timer_dtor);
+
+    if (!timer_cache) {
+	ERROR("Failed to create timer cache\n");
+	return -1;
+    }
+
     INFO("Timers inited\n");
     return 0;
 }
@@ -26,6 +26,7 @@
 #include <nautilus/nautilus.h>
 #include <nautilus/waitqueue.h>
 #include <nautilus/scheduler.h>
+#include <nautilus/kmem_cache.h>
 #include <nautilus/shell.h>
 
 
@@ -47,27 +48,37 @@ static uint64_t count=0;
 static spinlock_t state_lock;
 static struct list_head wq_list;
 
+// free wait queues are kept constructed, that is, empty, with all
+// slots unused, and with the lock initialized
+static struct nk_kmem_cache *wq_cache;
+
 #define STATE_LOCK_CONF uint8_t _state_lock_flags
 #define STATE_LOCK() _state_lock_flags = spin_lock_irq_save(&state_lock)
 #define STATE_UNLOCK() spin_unlock_irq_restore(&state_lock, _state_lock_flags);
 
 
 
+static int wq_ctor(void *obj)
+{
+    nk_wait_queue_t *q = (nk_wait_queue_t *)obj;
+    memset(q,0,sizeof(*q));
+    INIT_LIST_HEAD(&q->list);
+    INIT_LIST_HEAD(&q->node);
+    spinlock_init(&q->lock);
+    return 0;
+}
+
 nk_wait_queue_t *nk_wait_queue_create(char *name)
 {
-    nk_wait_queue_t *q = malloc(sizeof(*q));
+    nk_wait_queue_t *q = nk_kmem_cache_alloc(wq_cache);
     if (q) {
 	STATE_LOCK_CONF;
-	memset(q,0,sizeof(*q));
 	if (name) {
 	    strncpy(q->name,name,NK_WAIT_QUEUE_NAME_LEN);
 	    q->name[NK_WAIT_QUEUE_NAME_LEN-1] = 0;
 	} else {
 	    snprintf(q->name,NK_WAIT_QUEUE_NAME_LEN,"waitqueue%lu",__sync_fetch_and_add(&count,1));
 	}
-	INIT_LIST_HEAD(&q->list);
-	INIT_LIST_HEAD(&q->node);
-	spinlock_init(&q->lock);
 	STATE_LOCK();
 	list_add_tail(&q->node,&wq_list);
 	STATE_UNLOCK();
@@ -81,7 +92,16 @@ void  nk_wait_queue_destroy(nk_wait_queue_t *q)
     STATE_LOCK();
     list_del_init(&q->node);
     STATE_UNLOCK();
-    free(q);
+    nk_kmem_cache_free(wq_cache,q);
+}
+
+void  nk_wait_queue_rename(nk_wait_queue_t *q, char *name)
+{
+    STATE_LOCK_CONF;
+    STATE_LOCK();
+    strncpy(q->name,name,NK_WAIT_QUEUE_NAME_LEN);
+    q->name[NK_WAIT_QUEUE_NAME_LEN-1] = 0;
+    STATE_UNLOCK();
 }
 
 
@@ -338,7 +358,7 @@ void nk_wait_queue_wake_one_extended(nk_wait_queue_t * q, int havelock)
     if (__sync_bool_compare_and_swap(&t->status, NK_THR_WAITING, NK_THR_SUSPENDED)) {
 	// if we switched it from waiting to suspended, we are responsible for getting
 	// the scheduler involved
-	if (nk_sched_awaken(t, t->current_cpu)) { 
+	if (nk_sched_awaken(t, nk_sched_wake_placement(t))) { 
 	    WQ_ERROR("Failed to awaken thread\n");
 	    goto out;
 	}
@@ -383,7 +403,7 @@ void nk_wait_queue_wake_all_extended(nk_wait_queue_t * q, int havelock)
 	if (__sync_bool_compare_and_swap(&t->status, NK_THR_WAITING, NK_THR_SUSPENDED)) {
 	    // if we switched it from waiting to suspended, we are responsible for getting
 	    // the scheduler involved
-	    if (nk_sched_awaken(t, t->current_cpu)) { 
+	    if (nk_sched_awaken(t, nk_sched_wake_placement(t))) { 
 		WQ_ERROR("Failed to awaken thread\n");
 		goto out;
 	    }
@@ -409,6 +429,11 @@ int nk_wait_queue_init()
 {
     INIT_LIST_HEAD(&wq_list);
     spinlock_init(&state_lock);
+    wq_cache = nk_kmem_cache_create("waitqueue",sizeof(nk_wait_queue_t),0,wq_ctor,0);
+    if (!wq_cache) {
+	WQ_ERROR("failed to create cache\n");
+	return -1;
+    }
     WQ_INFO("inited\n");
     return 0;
 }
@@ -24,7 +24,9 @@
 #include <nautilus/nautilus.h>
 #include <nautilus/list.h>
 #include <nautilus/spinlock.h>
+#include <nautilus/rcu.h>
 #include <nautilus/netdev.h>
+#include <nautilus/kmem_cache.h>
 #include <net/ethernet/ethernet_packet.h>
 #include <net/ethernet/ethernet_agent.h>
 
@@ -58,9 +60,6 @@
 #define DEV_LOCK(d) _dev_lock_flags = spin_lock_irq_save(&d->lock)
 #define DEV_UNLOCK(d) spin_unlock_irq_restore(&d->lock, _dev_lock_flags)
 
-#define OP_FREE_LIST_LOCK_CONF uint8_t _op_free_list_lock_flags
-#define OP_FREE_LIST_LOCK() _op_free_list_lock_flags = spin_lock_irq_save(&op_free_list_lock)
-#define OP_FREE_LIST_UNLOCK() spin_unlock_irq_restore(&op_free_list_lock, _op_free_list_lock_flags)
 
 
 
@@ -109,39 +108,24 @@ struct netdev_op
     
 };
 
-static spinlock_t       op_free_list_lock;
-static struct list_head op_free_list;
+// free ops are kept constructed, that is, off of any queue
+static struct nk_kmem_cache *op_cache;
 
+static int op_ctor(void *obj)
+{
+    struct netdev_op *o = (struct netdev_op *)obj;
+    INIT_LIST_HEAD(&o->node);
+    return 0;
+}
 
 static inline void free_op(struct netdev_op *o)
 {
-    OP_FREE_LIST_LOCK_CONF;
-    
-    OP_FREE_LIST_LOCK();
-    list_add(&o->node,&op_free_list);
-    OP_FREE_LIST_UNLOCK();
+    nk_kmem_cache_free(op_cache,o);
 }
 
 static inline struct netdev_op *alloc_op()
 {
-    OP_FREE_LIST_LOCK_CONF;
-    struct list_head *n;
-    struct netdev_op *o = 0;
-    
-    OP_FREE_LIST_LOCK();
-    if (!list_empty(&op_free_list)) {
-	n = op_free_list.next;
-	list_del_init(n);
-	o = list_entry(n,struct netdev_op,node);
-    }
-    OP_FREE_LIST_UNLOCK();
-    if (!o) {
-	o = (struct netdev_op *) malloc(sizeof(*o));
-	if (o) {
-	    INIT_LIST_HEAD(&o->node);
-	}
-    }
-    return o;
+    return nk_kmem_cache_alloc(op_cache);
 }
 
 
@@ -262,13 +246,13 @@ static int type_filter(nk_ethernet_packet_t *p, void *state)
     return ntohs(p->header.type)==type;
 }
 
-// assumes agent is locked
+// in an rcu read section, or with the agent locked
 static struct nk_net_ethernet_agent_net_dev *match_device(struct nk_net_ethernet_agent *a, nk_ethernet_packet_t *p)
 {
     struct list_head *cur=0;
     struct nk_net_ethernet_agent_net_dev *d;
 
-    list_for_each(cur,&a->dev_list) {
+    list_for_each_rcu(cur,&a->dev_list) {
 	d = list_entry(cur,struct nk_net_ethernet_agent_net_dev, devnode);
 	if (d->filter && d->filter(p,d->filter_state)) {
 	    return d;
@@ -344,13 +328,14 @@ static void recv_callback(nk_net_dev_status_t status,
 	ERROR("Receive failure for packet %p\n", p);
     } else {
 
-	AGENT_LOCK(a);
+	// the device cannot be freed until we are out of the read
+	// section, so it also covers completing the receive
+	nk_rcu_read_lock();
 	if (a->state==RUNNING) {
 	    d = match_device(a,p);
 	} else {
 	    d = 0;
 	}
-	AGENT_UNLOCK(a);
 
 	if (!d) {
 	    // no device found or we are not running, so just discard packet
@@ -363,6 +348,7 @@ static void recv_callback(nk_net_dev_status_t status,
 	    }
 	    // up to receiver to release packet when they are done wit it
 	}
+	nk_rcu_read_unlock();
     }
 
 
@@ -609,7 +595,7 @@ struct nk_net_dev *nk_net_ethernet_agent_register_filter(struct nk_net_ethernet_
     }
     
     AGENT_LOCK(agent);
-    list_add(&d->devnode,&agent->dev_list);
+    list_add_rcu(&d->devnode,&agent->dev_list);
     AGENT_UNLOCK(agent);
 
     return d->netdev;
@@ -631,9 +617,12 @@ int                nk_net_ethernet_agent_unregister(struct nk_net_dev *dev)
     struct nk_net_ethernet_agent *agent = netdev->agent;
 
     AGENT_LOCK(agent);
-    list_del_init(&netdev->devnode);
+    list_del_rcu(&netdev->devnode);
     AGENT_UNLOCK(agent);
 
+    // wait out receives that may have matched it
+    nk_synchronize_rcu();
+
     // now we have exclusive access to this device (no lock needed)
     // so clear out the queues
     struct list_head *cur, *temp;
@@ -647,13 +636,13 @@ int                nk_net_ethernet_agent_unregister(struct nk_net_dev *dev)
     list_for_each_safe(cur,temp,&netdev->receive_op_queue) {
 	struct netdev_op *op = list_entry(cur,struct netdev_op,node);
 	list_del_init(cur);
-	free(op);
+	free_op(op);
     }
 
     list_for_each_safe(cur,temp,&netdev->send_op_queue) {
 	struct netdev_op *op = list_entry(cur,struct netdev_op,node);
 	list_del_init(cur);
-	free(op);
+	free_op(op);
     }
 
     if (nk_net_dev_unregister(netdev->netdev)) {
@@ -885,8 +874,11 @@ int  nk_net_ethernet_agent_init()
     spinlock_init(&agent_list_lock);
     INIT_LIST_HEAD(&agent_list);
 
-    spinlock_init(&op_free_list_lock);
-    INIT_LIST_HEAD(&op_free_list);
+    op_cache = nk_kmem_cache_create("ethernet-op",sizeof(struct netdev_op),0,op_ctor,0);
+    if (!op_cache) {
+	ERROR("Failed to create op cache\n");
+	return -1;
+    }
     
     INFO("inited\n");
 
@@ -25,6 +25,7 @@
 #include <nautilus/list.h>
 #include <nautilus/spinlock.h>
 #include <nautilus/netdev.h>
+#include <nautilus/shrinker.h>
 #include <net/ethernet/ethernet_packet.h>
 
 // right now this is a trivial implementation that just has a single pool
@@ -153,6 +154,55 @@ void nk_net_ethernet_release_packet(nk_ethernet_packet_t *p)
 
 
 
+// The free list is never shrunk below its initial size
+static uint64_t pool_shrink_count(void)
+{
+    uint64_t len = free_list_len;
+
+    return len > POOL_INIT_START ? len - POOL_INIT_START : 0;
+}
+
+// We may be called from an allocation made while growing the pool,
+// that is, with the lock held, so we only try to take it
+static uint64_t pool_shrink_scan(uint64_t nr)
+{
+    struct list_head victims;
+    struct list_head *cur, *tmp;
+    uint64_t n = 0;
+
+    INIT_LIST_HEAD(&victims);
+
+    if (spin_try_lock(&lock)) {
+	return 0;
+    }
+
+    while (n<nr && free_list_len>POOL_INIT_START) {
+	cur = free_list.prev; // the coldest packet
+	list_del_init(cur);
+	list_add(cur,&victims);
+	free_list_len--;
+	n++;
+    }
+
+    // reset the control thresholds around the new length, as when growing
+    if (n) {
+	free_list_low = free_list_len/2;
+	free_list_high = free_list_len*2;
+    }
+
+    spin_unlock(&lock);
+
+    list_for_each_safe(cur,tmp,&victims) {
+	nk_ethernet_packet_t *p = list_entry(cur,nk_ethernet_packet_t,node);
+	list_del_init(cur);
+	free(p);
+    }
+
+    DEBUG("shrink freed %lu packets (low=%lu, high=%lu)\n", n, free_list_low, free_list_high);
+
+    return n;
+}
+
 int  nk_net_ethernet_packet_init()
 {
     uint64_t i;
@@ -165,6 +215,10 @@ int  nk_net_ethernet_packet_init()
     free_list_high = POOL_INIT_HIGH;
 
     try_grow_if_needed();
+
+    if (!nk_kmem_register_shrinker("ethernet-packet-pool",pool_shrink_count,pool_shrink_scan)) {
+	ERROR("Failed to register packet pool shrinker\n");
+    }
     
     INFO("inited and seeded with %lu packets of size %lu (low=%lu, high=%lu)\n",free_list_len, MAX_ETHERNET_PACKET_LEN, free_list_low, free_list_high);
 
@@ -560,14 +560,14 @@ void time_threads_long(void)
 }
 
 
-void time_thread_create(void);
-void
-time_thread_create (void)
+static void
+time_thread_create_loop (char * what)
 {
     THREAD_T t;
 
     int i;
 	uint64_t start,end;
+    uint64_t sum = 0, min = -1, max = 0;
 
     for (i = 0; i < THR_CREATE_LOOPS; i++) {
         rdtscll(start);
@@ -588,9 +588,33 @@ time_thread_create (void)
 		DELAY(10000);
 		PRINT("Trial %u %llu \n", i, end-start);
 
+        sum += end-start;
+        min = end-start < min ? end-start : min;
+        max = end-start > max ? end-start : max;
+
         JOIN_FUNC(t, NULL);
 
     }
+
+    PRINT("Thread create (%s): avg %llu min %llu max %llu cycles\n",
+          what, sum/THR_CREATE_LOOPS, min, max);
+}
+
+
+void time_thread_create(void);
+void
+time_thread_create (void)
+{
+#if !defined(__USER) && defined(NAUT_CONFIG_THREAD_POOL)
+    // compare creating threads without and with the warm pools
+    int old = nk_thread_pool_enable(0);
+    time_thread_create_loop("no pool");
+    nk_thread_pool_enable(1);
+    time_thread_create_loop("warm pool");
+    nk_thread_pool_enable(old);
+#else
+    time_thread_create_loop("default");
+#endif
 }
 
 
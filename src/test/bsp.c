@@ -390,6 +390,9 @@ int test_bsp_eval()
 		case PERIODIC:						\
 		    nk_vc_printf(" p %u %llu %llu", constraints.interrupt_priority_class,constraints.periodic.period,constraints.periodic.slice); \
 		    break;						\
+		case BATCH:						\
+		    nk_vc_printf(" b %u %llu 0", constraints.interrupt_priority_class,constraints.batch.priority); \
+		    break;						\
 		}							\
 		nk_vc_printf("\n");					\
 	    }								\
@@ -0,0 +1,663 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+#include <nautilus/kmem_cache.h>
+#include <nautilus/shrinker.h>
+#include <nautilus/paging.h>
+#include <nautilus/numa.h>
+
+#define DO_PRINT       0
+
+#if DO_PRINT
+#define PRINT(...) nk_vc_printf(__VA_ARGS__)
+#else
+#define PRINT(...)
+#endif
+
+#define NUM_PASSES 10
+#define NUM_BLOCKS 4096
+#define MAX_SIZE   8192
+
+static uint64_t next_rand(uint64_t *s)
+{
+    *s = *s * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *s >> 33;
+}
+
+static void fill(void *p, size_t n, uint8_t v)
+{
+    memset(p,v,n);
+}
+
+static int check(void *p, size_t n, uint8_t v)
+{
+    size_t i;
+    for (i=0;i<n;i++) {
+	if (((uint8_t*)p)[i]!=v) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+// allocate and free a random mix of sizes on the current cpu
+static int test_mixed(int nump, int numb)
+{
+    void   **blocks = malloc(sizeof(void*)*numb);
+    size_t  *sizes = malloc(sizeof(size_t)*numb);
+    uint64_t seed = 42;
+    int i,j;
+    int rc = 0;
+
+    if (!blocks || !sizes) {
+	free(blocks);
+	free(sizes);
+	return -1;
+    }
+
+    for (i=0;i<nump && !rc;i++) {
+	for (j=0;j<numb;j++) {
+	    sizes[j] = 1 + next_rand(&seed) % MAX_SIZE;
+	    blocks[j] = (j&1) ? kmem_mallocz(sizes[j]) : malloc(sizes[j]);
+	    if (!blocks[j]) {
+		PRINT("Failed to allocate block %d (%lu bytes) on pass %d\n",j,sizes[j],i);
+		rc = -1;
+		numb = j;
+		break;
+	    }
+	    if ((j&1) && check(blocks[j],sizes[j],0)) {
+		PRINT("Block %d (%lu bytes) on pass %d is not zeroed\n",j,sizes[j],i);
+		rc = -1;
+	    }
+	    fill(blocks[j],sizes[j],(uint8_t)j);
+	}
+	// free every other block, then the rest, checking contents
+	for (j=0;j<numb;j+=2) {
+	    if (check(blocks[j],sizes[j],(uint8_t)j)) {
+		PRINT("Block %d on pass %d was corrupted\n",j,i);
+		rc = -1;
+	    }
+	    free(blocks[j]);
+	}
+	for (j=1;j<numb;j+=2) {
+	    if (check(blocks[j],sizes[j],(uint8_t)j)) {
+		PRINT("Block %d on pass %d was corrupted\n",j,i);
+		rc = -1;
+	    }
+	    free(blocks[j]);
+	}
+    }
+
+    free(blocks);
+    free(sizes);
+
+    return rc;
+}
+
+
+struct xcpu_state {
+    void * volatile  *blocks;
+    int               numb;
+    volatile int      produced;
+    volatile int      failed;
+};
+
+static void xcpu_producer(void *in, void **out)
+{
+    struct xcpu_state *s = (struct xcpu_state *)in;
+    uint64_t seed = my_cpu_id();
+    int i;
+
+    for (i=0;i<s->numb;i++) {
+	size_t size = 1 + next_rand(&seed) % 512;
+	void *p = malloc(size);
+	if (!p) {
+	    s->failed = 1;
+	    break;
+	}
+	*(uint8_t*)p = (uint8_t)i;
+	s->blocks[i] = p;
+	__sync_fetch_and_add(&s->produced,1);
+    }
+}
+
+static void xcpu_consumer(void *in, void **out)
+{
+    struct xcpu_state *s = (struct xcpu_state *)in;
+    int i;
+
+    for (i=0;i<s->numb;i++) {
+	while (i>=s->produced && !s->failed) {
+	    nk_yield();
+	}
+	if (i>=s->produced) {
+	    break;
+	}
+	if (*(uint8_t*)s->blocks[i] != (uint8_t)i) {
+	    s->failed = 1;
+	}
+	free(s->blocks[i]);
+    }
+}
+
+// allocate on one cpu and free on another
+static int test_cross_cpu(int nump, int numb)
+{
+    struct xcpu_state s;
+    int i;
+    int ncpus = nk_get_num_cpus();
+
+    if (ncpus<2) {
+	PRINT("Skipping cross-cpu test on a single cpu\n");
+	return 0;
+    }
+
+    s.blocks = malloc(sizeof(void*)*numb);
+    if (!s.blocks) {
+	return -1;
+    }
+    s.numb = numb;
+    s.failed = 0;
+
+    for (i=0;i<nump && !s.failed;i++) {
+	s.produced = 0;
+	if (nk_thread_start(xcpu_producer,&s,0,0,PAGE_SIZE_4KB,NULL,i%ncpus) ||
+	    nk_thread_start(xcpu_consumer,&s,0,0,PAGE_SIZE_4KB,NULL,(i+ncpus/2)%ncpus)) {
+	    PRINT("Failed to launch threads on pass %d\n",i);
+	    s.failed = 1;
+	}
+	nk_join_all_children(0);
+	nk_sched_reap(1);
+    }
+
+    free((void*)s.blocks);
+
+    return s.failed ? -1 : 0;
+}
+
+
+// returns the objects in use in the size class for size, or -1
+// if there is no such class
+static sint64_t class_in_use(uint64_t size)
+{
+    struct kmem_stats s;
+    uint64_t i;
+
+    s.max_pools = 0;
+    kmem_stats(&s);
+
+    for (i=0;i<s.num_classes;i++) {
+	if (s.class_stats[i].size >= size) {
+	    return s.class_stats[i].size < 2*size ? (sint64_t)s.class_stats[i].objs_in_use : -1;
+	}
+    }
+    return -1;
+}
+
+#define CLASS_SIZE 176
+
+// allocate many objects of an odd size, which should land in a size
+// class, and be cache line aligned since they are at least that big
+static int test_classes(int nump, int numb)
+{
+    void   **blocks = malloc(sizeof(void*)*numb);
+    sint64_t  before, during, after;
+    int i,j;
+    int rc = 0;
+
+    if (!blocks) {
+	return -1;
+    }
+
+    for (i=0;i<nump && !rc;i++) {
+	before = class_in_use(CLASS_SIZE);
+	for (j=0;j<numb;j++) {
+	    blocks[j] = malloc(CLASS_SIZE);
+	    if (!blocks[j] || ((addr_t)blocks[j] & 0x3f)) {
+		PRINT("Bad allocation %p of block %d on pass %d\n",blocks[j],j,i);
+		rc = -1;
+		numb = j + !!blocks[j];
+		break;
+	    }
+	    fill(blocks[j],CLASS_SIZE,(uint8_t)j);
+	}
+	during = class_in_use(CLASS_SIZE);
+	for (j=0;j<numb;j++) {
+	    if (check(blocks[j],CLASS_SIZE,(uint8_t)j)) {
+		PRINT("Block %d on pass %d was corrupted\n",j,i);
+		rc = -1;
+	    }
+	    free(blocks[j]);
+	}
+	after = class_in_use(CLASS_SIZE);
+	// other cpus may allocate from the class concurrently, so
+	// only insist on what we did ourselves being visible
+	if (before>=0 && !rc && (during-before<numb || after>during-numb)) {
+	    PRINT("Size class accounting is off on pass %d (%ld %ld %ld)\n",i,before,during,after);
+	    rc = -1;
+	}
+    }
+
+    free(blocks);
+
+    return rc;
+}
+
+
+// grow blocks step by step and shrink them back, checking that
+// contents survive whether or not the block moves
+static int test_realloc(int nump, int numb)
+{
+    uint64_t seed = 7;
+    int i,j;
+    int rc = 0;
+
+    for (i=0;i<nump && !rc;i++) {
+	for (j=0;j<numb/64 && !rc;j++) {
+	    size_t size = 1 + next_rand(&seed) % 64;
+	    size_t max = 1 + next_rand(&seed) % (4*MAX_SIZE);
+	    uint8_t *p = malloc(size);
+	    if (!p) {
+		rc = -1;
+		break;
+	    }
+	    fill(p,size,(uint8_t)j);
+	    while (size < max && !rc) {
+		size_t new_size = size + 1 + next_rand(&seed) % (2*size);
+		uint8_t *q = realloc(p,new_size);
+		if (!q || check(q,size,(uint8_t)j)) {
+		    PRINT("Realloc of %p from %lu to %lu bytes failed or lost data\n",p,size,new_size);
+		    rc = -1;
+		    p = q;
+		    break;
+		}
+		p = q;
+		fill(p,new_size,(uint8_t)j);
+		size = new_size;
+	    }
+	    while (p && size > 1 && !rc) {
+		size /= 2;
+		p = realloc(p,size);
+		if (!p || check(p,size,(uint8_t)j)) {
+		    PRINT("Realloc shrink to %lu bytes failed or lost data\n",size);
+		    rc = -1;
+		}
+	    }
+	    if (p) {
+		free(p);
+	    }
+	}
+    }
+
+    return rc;
+}
+
+
+#define CACHE_OBJ_SIZE 200
+#define CACHE_MAGIC    0xc0ffee
+
+static volatile uint64_t cache_ctors, cache_dtors;
+
+static int cache_ctor(void *obj)
+{
+    *(uint64_t*)obj = CACHE_MAGIC;
+    __sync_fetch_and_add(&cache_ctors,1);
+    return 0;
+}
+
+static void cache_dtor(void *obj)
+{
+    __sync_fetch_and_add(&cache_dtors,1);
+}
+
+// objects from a typed cache stay constructed and aligned
+static int test_cache(int nump, int numb)
+{
+    struct nk_kmem_cache *c = nk_kmem_cache_create("kmemtest",CACHE_OBJ_SIZE,64,cache_ctor,cache_dtor);
+    void **objs = malloc(sizeof(void*)*numb);
+    int i,j;
+    int rc = 0;
+
+    if (!c || !objs) {
+	if (c) {
+	    nk_kmem_cache_destroy(c);
+	}
+	free(objs);
+	return -1;
+    }
+
+    cache_ctors = cache_dtors = 0;
+
+    for (i=0;i<nump && !rc;i++) {
+	// use fewer objects than a cpu keeps, so that
+	// after the first pass there should be no constructions
+	for (j=0;j<16;j++) {
+	    objs[j] = nk_kmem_cache_alloc(c);
+	    if (!objs[j] || ((addr_t)objs[j] & 63) || *(uint64_t*)objs[j] != CACHE_MAGIC) {
+		PRINT("Bad object %p on pass %d\n",objs[j],i);
+		rc = -1;
+		break;
+	    }
+	}
+	while (j>0) {
+	    nk_kmem_cache_free(c,objs[--j]);
+	}
+    }
+
+    if (!rc && cache_ctors > 16) {
+	PRINT("Cache constructed %lu objects for 16 live objects\n",cache_ctors);
+	rc = -1;
+    }
+
+    // then churn through more objects than the per-cpu and depot hold
+    for (i=0;i<nump && !rc;i++) {
+	for (j=0;j<numb;j++) {
+	    if (!(objs[j] = nk_kmem_cache_alloc(c))) {
+		rc = -1;
+		break;
+	    }
+	}
+	while (j>0) {
+	    nk_kmem_cache_free(c,objs[--j]);
+	}
+    }
+
+    nk_kmem_cache_destroy(c);
+
+    if (cache_ctors != cache_dtors) {
+	PRINT("Cache constructed %lu objects but destructed %lu\n",cache_ctors,cache_dtors);
+	rc = -1;
+    }
+
+    free(objs);
+
+    return rc;
+}
+
+
+// allocate 2MB-aligned memory of sizes that are not multiples of 2MB
+// and check that it is aligned, intact, and accounted for
+static int test_huge(int nump)
+{
+    struct kmem_stats s;
+    uint64_t seed = 11;
+    uint64_t before;
+    int i;
+    int rc = 0;
+
+    s.max_pools = 0;
+    kmem_stats(&s);
+    before = s.huge_bytes;
+
+    for (i=0;i<nump && !rc;i++) {
+	size_t size = PAGE_SIZE_2MB * (1 + next_rand(&seed) % 4) - next_rand(&seed) % PAGE_SIZE_2MB;
+	uint8_t *p = nk_malloc_huge(size, PAGE_SIZE_2MB, -1);
+	if (!p) {
+	    PRINT("Huge allocation of %lu bytes failed on pass %d\n",size,i);
+	    rc = -1;
+	    break;
+	}
+	if ((addr_t)p & (PAGE_SIZE_2MB-1)) {
+	    PRINT("Huge allocation %p is not aligned\n",p);
+	    rc = -1;
+	}
+	fill(p,size,(uint8_t)i);
+	kmem_stats(&s);
+	if (s.huge_bytes < before + size) {
+	    PRINT("Huge allocation of %lu bytes not accounted for\n",size);
+	    rc = -1;
+	}
+	if (check(p,size,(uint8_t)i)) {
+	    PRINT("Huge allocation %p was corrupted\n",p);
+	    rc = -1;
+	}
+	nk_free_huge(p);
+    }
+
+    return rc;
+}
+
+
+static int domain_of(void *p)
+{
+    struct mem_region *reg = kmem_get_region_by_addr(va_to_pa((addr_t)p));
+    return reg ? (int)reg->domain_id : -1;
+}
+
+// bind to each domain in turn and check where allocations land, then
+// interleave and check that page-sized allocations visit every domain
+static int test_policy(int numb)
+{
+    void   **blocks = malloc(sizeof(void*)*numb);
+    unsigned num_domains = nk_get_nautilus_info()->sys.locality_info.num_domains;
+    uint64_t seen = 0;
+    int d, j, n;
+    int rc = 0;
+
+    if (!blocks) {
+	return -1;
+    }
+
+    for (d=0;d<num_domains && !rc;d++) {
+	if (nk_mem_policy_set(NK_MEM_POLICY_BIND,d)) {
+	    continue; // domain without memory
+	}
+	seen |= 1ULL << d;
+	for (n=0;n<numb;n++) {
+	    blocks[n] = malloc(64 + n % 4096);
+	    if (!blocks[n]) {
+		break;
+	    }
+	    if (domain_of(blocks[n]) != d) {
+		PRINT("Block %p bound to domain %d is in domain %d\n",blocks[n],d,domain_of(blocks[n]));
+		rc = -1;
+	    }
+	}
+	nk_mem_policy_set(NK_MEM_POLICY_LOCAL,0);
+	for (j=0;j<n;j++) {
+	    free(blocks[j]);
+	}
+    }
+
+    if (!rc && nk_mem_policy_set(NK_MEM_POLICY_INTERLEAVE,0)) {
+	rc = -1;
+    }
+
+    if (!rc) {
+	uint64_t visited = 0;
+	for (n=0;n<numb && n<64;n++) {
+	    blocks[n] = malloc(PAGE_SIZE_4KB);
+	    if (!blocks[n]) {
+		break;
+	    }
+	    visited |= 1ULL << domain_of(blocks[n]);
+	}
+	nk_mem_policy_set(NK_MEM_POLICY_LOCAL,0);
+	for (j=0;j<n;j++) {
+	    free(blocks[j]);
+	}
+	if (n>=num_domains && visited != seen) {
+	    PRINT("Interleaving visited domains 0x%lx instead of 0x%lx\n",visited,seen);
+	    rc = -1;
+	}
+    }
+
+    free(blocks);
+
+    return rc;
+}
+
+// dirty blocks of the sizes the pre-zeroed pools hold, free them, and
+// check that zeroing allocations of the same sizes come back zeroed
+static int test_mallocz(int nump)
+{
+    uint64_t seed = 13;
+    int i;
+    int rc = 0;
+
+    for (i=0;i<nump && !rc;i++) {
+	size_t size = 1 + next_rand(&seed) % (1UL << (12 + i % 10));
+	uint8_t *p = malloc(size);
+	if (!p) {
+	    rc = -1;
+	    break;
+	}
+	fill(p,size,0xa5);
+	free(p);
+	p = kmem_mallocz(size);
+	if (!p || check(p,size,0)) {
+	    PRINT("Zeroing allocation of %lu bytes failed or was not zeroed\n",size);
+	    rc = -1;
+	}
+	if (p) {
+	    kmem_free(p);
+	}
+    }
+
+    return rc;
+}
+
+static uint64_t test_shrinker_objs;
+
+static uint64_t test_shrinker_count(void)
+{
+    return test_shrinker_objs;
+}
+
+static uint64_t test_shrinker_scan(uint64_t nr)
+{
+    uint64_t n = nr < test_shrinker_objs ? nr : test_shrinker_objs;
+    test_shrinker_objs -= n;
+    return n;
+}
+
+// register a shrinker and check that shrinks ask it for the
+// right share of its objects
+static int test_shrink(void)
+{
+    struct nk_kmem_shrinker *s;
+    int i;
+    int rc = 0;
+
+    s = nk_kmem_register_shrinker("kmemtest",test_shrinker_count,test_shrinker_scan);
+    if (!s) {
+	return -1;
+    }
+
+    // a shrink is skipped while another one is running, so retry
+    test_shrinker_objs = 64;
+    for (i=0;i<100 && test_shrinker_objs==64;i++) {
+	nk_kmem_shrink(1);
+    }
+    if (test_shrinker_objs > 32) {
+	PRINT("Shrink at priority 1 left %lu of 64 objects\n",test_shrinker_objs);
+	rc = -1;
+    }
+    for (i=0;i<100 && test_shrinker_objs;i++) {
+	nk_kmem_shrink(0);
+    }
+    if (test_shrinker_objs) {
+	PRINT("Shrink at priority 0 left %lu objects\n",test_shrinker_objs);
+	rc = -1;
+    }
+
+    nk_kmem_unregister_shrinker(s);
+
+    return rc;
+}
+
+int test_kmem()
+{
+    int mixed;
+    int cross;
+    int classes;
+    int cache;
+    int re;
+    int huge;
+    int policy;
+    int zero;
+    int shrink;
+
+    mixed = test_mixed(NUM_PASSES,NUM_BLOCKS);
+
+    nk_vc_printf("Mixed-size malloc/free test of %lu passes with %lu blocks each: %s\n",
+		 NUM_PASSES,NUM_BLOCKS, mixed ? "FAIL" : "PASS");
+
+    cross = test_cross_cpu(NUM_PASSES,NUM_BLOCKS);
+
+    nk_vc_printf("Cross-cpu malloc/free test of %lu passes with %lu blocks each: %s\n",
+		 NUM_PASSES,NUM_BLOCKS, cross ? "FAIL" : "PASS");
+
+    classes = test_classes(NUM_PASSES,NUM_BLOCKS);
+
+    nk_vc_printf("Size class malloc/free test of %lu passes with %lu blocks each: %s\n",
+		 NUM_PASSES,NUM_BLOCKS, classes ? "FAIL" : "PASS");
+
+    cache = test_cache(NUM_PASSES,NUM_BLOCKS);
+
+    nk_vc_printf("Typed cache alloc/free test of %lu passes with %lu objects each: %s\n",
+		 NUM_PASSES,NUM_BLOCKS, cache ? "FAIL" : "PASS");
+
+    re = test_realloc(NUM_PASSES,NUM_BLOCKS);
+
+    nk_vc_printf("Realloc grow/shrink test of %lu passes with %lu blocks each: %s\n",
+		 NUM_PASSES,NUM_BLOCKS/64, re ? "FAIL" : "PASS");
+
+    huge = test_huge(NUM_PASSES);
+
+    nk_vc_printf("Huge page aligned malloc/free test of %lu passes: %s\n",
+		 NUM_PASSES, huge ? "FAIL" : "PASS");
+
+    policy = test_policy(NUM_BLOCKS/16);
+
+    nk_vc_printf("Memory policy bind/interleave test with %lu blocks: %s\n",
+		 NUM_BLOCKS/16, policy ? "FAIL" : "PASS");
+
+    zero = test_mallocz(NUM_PASSES*10);
+
+    nk_vc_printf("Zeroing malloc test of %lu passes: %s\n",
+		 NUM_PASSES*10, zero ? "FAIL" : "PASS");
+
+    shrink = test_shrink();
+
+    nk_vc_printf("Shrinker registration test: %s\n", shrink ? "FAIL" : "PASS");
+
+    return mixed | cross | classes | cache | re | huge | policy | zero | shrink;
+}
+
+
+static int
+handle_kmem (char * buf, void * priv)
+{
+    test_kmem();
+    return 0;
+}
+
+static struct shell_cmd_impl kmem_impl = {
+    .cmd      = "kmemtest",
+    .help_str = "kmemtest",
+    .handler  = handle_kmem,
+};
+nk_register_shell_cmd(kmem_impl);
@@ -0,0 +1,264 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+#include <nautilus/rwlock.h>
+#include <nautilus/mutex.h>
+
+#define DEFAULT_READS 1000000
+#define DEFAULT_INCS  100000
+
+//
+// Read-side scaling: n threads, one per cpu, take and release the
+// read lock as fast as they can.  Ideally, total throughput grows
+// linearly with n.
+//
+
+typedef enum { RWLOCK, BRLOCK } lock_kind_t;
+
+struct read_bench {
+    lock_kind_t       kind;
+    nk_rwlock_t       rw;
+    nk_brlock_t       br;
+    uint64_t          reads;
+    volatile uint64_t shared;      // what the readers read
+    volatile int      ready;
+    volatile int      go;
+    uint64_t          start[NAUT_CONFIG_MAX_CPUS];
+    uint64_t          end[NAUT_CONFIG_MAX_CPUS];
+};
+
+struct read_arg {
+    struct read_bench *b;
+    int                id;
+};
+
+static void reader(void *in, void **out)
+{
+    struct read_arg *a = (struct read_arg *)in;
+    struct read_bench *b = a->b;
+    uint64_t sum = 0;
+    uint64_t i;
+
+    __sync_fetch_and_add(&b->ready,1);
+
+    while (!b->go) {
+	asm volatile ("pause");
+    }
+
+    b->start[a->id] = nk_sched_get_realtime();
+
+    if (b->kind==RWLOCK) {
+	for (i=0;i<b->reads;i++) {
+	    nk_rwlock_rd_lock(&b->rw);
+	    sum += b->shared;
+	    nk_rwlock_rd_unlock(&b->rw);
+	}
+    } else {
+	for (i=0;i<b->reads;i++) {
+	    nk_brlock_rd_lock(&b->br);
+	    sum += b->shared;
+	    nk_brlock_rd_unlock(&b->br);
+	}
+    }
+
+    b->end[a->id] = nk_sched_get_realtime();
+
+    // keep the reads
+    if (sum==1) {
+	nk_vc_printf("%lu\n",sum);
+    }
+}
+
+// returns reads per ms across all readers, 0 on failure
+static uint64_t run_read_bench(struct read_bench *b, int n)
+{
+    struct read_arg args[n];
+    nk_thread_id_t tids[n];
+    uint64_t first, last;
+    int i;
+
+    b->ready = 0;
+    b->go = 0;
+
+    for (i=0;i<n;i++) {
+	args[i].b = b;
+	args[i].id = i;
+	if (nk_thread_start(reader, &args[i], 0, 0, TSTACK_DEFAULT, &tids[i], i)) {
+	    nk_vc_printf("Failed to start reader on cpu %d\n", i);
+	    b->go = 1;
+	    while (--i>=0) {
+		nk_join(tids[i],0);
+	    }
+	    return 0;
+	}
+    }
+
+    while (b->ready<n) {
+	nk_yield();
+    }
+
+    b->go = 1;
+
+    for (i=0;i<n;i++) {
+	nk_join(tids[i],0);
+    }
+
+    first = b->start[0];
+    last = b->end[0];
+    for (i=1;i<n;i++) {
+	first = b->start[i]<first ? b->start[i] : first;
+	last = b->end[i]>last ? b->end[i] : last;
+    }
+
+    return last>first ? (b->reads*n*1000000ULL)/(last-first) : 0;
+}
+
+static int
+handle_brlockbench (char * buf, void * priv)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct read_bench *b;
+    uint64_t reads = DEFAULT_READS;
+    uint64_t rw, br;
+    int n;
+
+    if (sscanf(buf,"brlockbench %lu",&reads)!=1) {
+	reads = DEFAULT_READS;
+    }
+
+    b = malloc(sizeof(*b));
+    if (!b) {
+	nk_vc_printf("Cannot allocate benchmark state\n");
+	return 0;
+    }
+    memset(b,0,sizeof(*b));
+    nk_rwlock_init(&b->rw);
+    nk_brlock_init(&b->br);
+    b->reads = reads;
+
+    nk_vc_printf("%lu reads per reader, reads/ms total\n", reads);
+    nk_vc_printf("readers       rwlock      brlock\n");
+
+    for (n=1;n<=sys->num_cpus;n = (n==sys->num_cpus || 2*n<=sys->num_cpus) ? 2*n : sys->num_cpus) {
+	b->kind = RWLOCK;
+	rw = run_read_bench(b,n);
+	b->kind = BRLOCK;
+	br = run_read_bench(b,n);
+	nk_vc_printf("%7d %12lu %11lu\n", n, rw, br);
+    }
+
+    free(b);
+
+    return 0;
+}
+
+static struct shell_cmd_impl brlockbench_impl = {
+    .cmd      = "brlockbench",
+    .help_str = "brlockbench [reads]",
+    .handler  = handle_brlockbench,
+};
+nk_register_shell_cmd(brlockbench_impl);
+
+
+//
+// Mutual exclusion: n threads, one per cpu, increment a counter
+// under a mutex, and the total must come out right.
+//
+
+struct mutex_test {
+    nk_mutex_t       *m;
+    uint64_t          incs;
+    volatile uint64_t counter;
+};
+
+static void incrementer(void *in, void **out)
+{
+    struct mutex_test *mt = (struct mutex_test *)in;
+    uint64_t i;
+
+    for (i=0;i<mt->incs;i++) {
+	nk_mutex_lock(mt->m);
+	mt->counter++;
+	nk_mutex_unlock(mt->m);
+    }
+}
+
+static int
+handle_mutextest (char * buf, void * priv)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct mutex_test mt;
+    nk_thread_id_t tids[sys->num_cpus];
+    uint64_t start, end;
+    int n = sys->num_cpus;
+    int i;
+
+    mt.incs = DEFAULT_INCS;
+    mt.counter = 0;
+
+    if (sscanf(buf,"mutextest %d %lu",&n,&mt.incs)<1 || n<1 || n>sys->num_cpus) {
+	n = sys->num_cpus;
+    }
+
+    mt.m = nk_mutex_create("mutextest");
+    if (!mt.m) {
+	nk_vc_printf("Cannot create mutex\n");
+	return 0;
+    }
+
+    start = nk_sched_get_realtime();
+
+    for (i=0;i<n;i++) {
+	if (nk_thread_start(incrementer, &mt, 0, 0, TSTACK_DEFAULT, &tids[i], i)) {
+	    nk_vc_printf("Failed to start thread on cpu %d\n", i);
+	    break;
+	}
+    }
+
+    n = i;
+
+    for (i=0;i<n;i++) {
+	nk_join(tids[i],0);
+    }
+
+    end = nk_sched_get_realtime();
+
+    nk_vc_printf("%d threads: counter=%lu (expected %lu) in %lu ns - %s\n",
+		 n, mt.counter, n*mt.incs, end-start,
+		 mt.counter==n*mt.incs ? "PASSED" : "FAILED");
+
+    nk_mutex_dump_mutexes();
+
+    nk_mutex_destroy(mt.m);
+
+    return 0;
+}
+
+static struct shell_cmd_impl mutextest_impl = {
+    .cmd      = "mutextest",
+    .help_str = "mutextest [threads] [increments]",
+    .handler  = handle_mutextest,
+};
+nk_register_shell_cmd(mutextest_impl);
@@ -0,0 +1,251 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2026, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/shell.h>
+#include <nautilus/vc.h>
+#include <nautilus/msg_queue.h>
+
+#define DEFAULT_MSGS  100000
+#define DEFAULT_BATCH 1
+#define DEFAULT_SIZE  256
+#define MAX_BATCH     64
+
+//
+// Throughput: n producers push msgs messages each through one queue
+// to n consumers, in batches of batch.  Messages are never 0, since a
+// 0 tells a consumer to stop.  The consumers sum what they get, and
+// the sum must come out right.
+//
+
+struct mq_bench {
+    struct nk_msg_queue *q;
+    uint64_t             msgs;
+    uint64_t             batch;
+    volatile uint64_t    sum;
+    volatile int         ready;
+    volatile int         go;
+    volatile int         abort;
+};
+
+struct mq_arg {
+    struct mq_bench *b;
+    uint64_t         id;
+};
+
+// returns nonzero if the run was abandoned before it began
+static int wait_go(struct mq_bench *b)
+{
+    __sync_fetch_and_add(&b->ready,1);
+
+    while (!b->go) {
+	asm volatile ("pause");
+    }
+
+    return b->abort;
+}
+
+static void producer(void *in, void **out)
+{
+    struct mq_arg *a = (struct mq_arg *)in;
+    struct mq_bench *b = a->b;
+    void *msgs[MAX_BATCH];
+    uint64_t i, j, k;
+
+    if (wait_go(b)) {
+	return;
+    }
+
+    for (i=0;i<b->msgs;i+=k) {
+	k = b->msgs-i < b->batch ? b->msgs-i : b->batch;
+	for (j=0;j<k;j++) {
+	    msgs[j] = (void*)((a->id<<32) + i + j + 1);
+	}
+	if (k==1) {
+	    nk_msg_queue_push(b->q,msgs[0]);
+	} else {
+	    nk_msg_queue_push_many(b->q,msgs,k);
+	}
+    }
+}
+
+static void consumer(void *in, void **out)
+{
+    struct mq_arg *a = (struct mq_arg *)in;
+    struct mq_bench *b = a->b;
+    void *msgs[MAX_BATCH];
+    uint64_t sum = 0;
+    uint64_t stops = 0;
+    uint64_t i, k;
+
+    if (wait_go(b)) {
+	return;
+    }
+
+    while (!stops) {
+	if (b->batch==1) {
+	    nk_msg_queue_pull(b->q,&msgs[0]);
+	    k = 1;
+	} else {
+	    k = nk_msg_queue_pull_many(b->q,msgs,b->batch);
+	}
+	for (i=0;i<k;i++) {
+	    if (msgs[i]) {
+		sum += (uint64_t)msgs[i];
+	    } else {
+		stops++;
+	    }
+	}
+    }
+
+    // hand back the stops that belong to other consumers
+    while (--stops) {
+	nk_msg_queue_push(b->q,0);
+    }
+
+    __sync_fetch_and_add(&b->sum,sum);
+}
+
+// returns messages per ms, 0 on failure
+// each consumer keeps exactly one stop, so the queue ends up empty
+static uint64_t run_mq_bench(struct mq_bench *b, int n)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct mq_arg args[2*n];
+    nk_thread_id_t tids[2*n];
+    uint64_t start, end, expect, id;
+    int i;
+
+    b->ready = 0;
+    b->go = 0;
+    b->abort = 0;
+    b->sum = 0;
+
+    // producers on the first n cpus, consumers on the next n
+    for (i=0;i<2*n;i++) {
+	args[i].b = b;
+	args[i].id = i;
+	if (nk_thread_start(i<n ? producer : consumer, &args[i], 0, 0, TSTACK_DEFAULT,
+			    &tids[i], i % sys->num_cpus)) {
+	    nk_vc_printf("Failed to start thread %d\n", i);
+	    break;
+	}
+    }
+
+    if (i<2*n) {
+	// send whoever started home before they touch the queue
+	b->abort = 1;
+	b->go = 1;
+	while (--i>=0) {
+	    nk_join(tids[i],0);
+	}
+	return 0;
+    }
+
+    while (b->ready<2*n) {
+	nk_yield();
+    }
+
+    start = nk_sched_get_realtime();
+
+    b->go = 1;
+
+    for (i=0;i<n;i++) {
+	nk_join(tids[i],0);
+    }
+
+    for (i=0;i<n;i++) {
+	nk_msg_queue_push(b->q,0);
+    }
+
+    for (i=n;i<2*n;i++) {
+	nk_join(tids[i],0);
+    }
+
+    end = nk_sched_get_realtime();
+
+    expect = 0;
+    for (id=0;id<n;id++) {
+	expect += b->msgs*(id<<32) + b->msgs*(b->msgs+1)/2;
+    }
+
+    if (b->sum!=expect) {
+	nk_vc_printf("sum=%lu expected %lu - FAILED\n", b->sum, expect);
+    }
+
+    return end>start ? (b->msgs*n*1000000ULL)/(end-start) : 0;
+}
+
+static int
+handle_mqbench (char * buf, void * priv)
+{
+    struct sys_info *sys = per_cpu_get(system);
+    struct mq_bench b;
+    uint64_t size = DEFAULT_SIZE;
+    uint64_t def, mpmc;
+    int max, n;
+
+    b.msgs = DEFAULT_MSGS;
+    b.batch = DEFAULT_BATCH;
+
+    sscanf(buf,"mqbench %lu %lu %lu",&b.msgs,&b.batch,&size);
+
+    if (!b.msgs || !b.batch || b.batch>MAX_BATCH || !size) {
+	nk_vc_printf("need msgs>0, 0<batch<=%d, size>0\n", MAX_BATCH);
+	return 0;
+    }
+
+    max = sys->num_cpus/2 ? sys->num_cpus/2 : 1;
+
+    nk_vc_printf("%lu msgs per producer, batch %lu, queue size %lu, msgs/ms total\n",
+		 b.msgs, b.batch, size);
+    nk_vc_printf("producers/consumers      default         mpmc\n");
+
+    for (n=1;n<=max;n = (n==max || 2*n<=max) ? 2*n : max) {
+	b.q = nk_msg_queue_create("mqbench",size,NK_MSG_QUEUE_DEFAULT,0);
+	if (!b.q) {
+	    nk_vc_printf("Cannot create queue\n");
+	    return 0;
+	}
+	def = run_mq_bench(&b,n);
+	nk_msg_queue_release(b.q);
+
+	b.q = nk_msg_queue_create("mqbench",size,NK_MSG_QUEUE_MPMC,0);
+	if (!b.q) {
+	    nk_vc_printf("Cannot create queue\n");
+	    return 0;
+	}
+	mpmc = run_mq_bench(&b,n);
+	nk_msg_queue_release(b.q);
+
+	nk_vc_printf("%19d %12lu %12lu\n", n, def, mpmc);
+    }
+
+    return 0;
+}
+
+static struct shell_cmd_impl mqbench_impl = {
+    .cmd      = "mqbench",
+    .help_str = "mqbench [msgs] [batch] [size]",
+    .handler  = handle_mqbench,
+};
+nk_register_shell_cmd(mqbench_impl);
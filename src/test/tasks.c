@@ -121,6 +121,46 @@ static int test_create_wait(int nump, int numt)
 }
 
 
+static void *batch_func(void *in)
+{
+    return in;
+}
+
+static int test_batch_create_wait(int nump, int numt)
+{
+    static void *inputs[NUM_TASKS];
+    uint64_t start, end, create=0, wait=0;
+    int i,j;
+
+    for (j=0;j<numt;j++) {
+	inputs[j] = (void*)(uint64_t)j;
+    }
+
+    for (i=0;i<nump;i++) {
+	start = nk_sched_get_realtime();
+	if (nk_task_produce_batch(-1,0,batch_func,inputs,numt,0,tasks)!=numt) {
+	    PRINT("Failed to launch batch of %d tasks on pass %d\n", numt, i);
+	    return -1;
+	}
+	end = nk_sched_get_realtime();
+	create += end - start;
+	for (j=0;j<numt;j++) {
+	    void *result;
+	    if (nk_task_wait(tasks[j], &result, 0) || result!=inputs[j]) {
+		PRINT("Failed to wait on task %d pass %d\n", j, i);
+		return -1;
+	    }
+	}
+	wait += nk_sched_get_realtime() - end;
+    }
+
+    nk_vc_printf("batch: create=%lu ns/task wait=%lu ns/task\n",
+		 create/(numt*nump), wait/(numt*nump));
+
+    return 0;
+}
+
+
 static void *_test_recursive_create_wait(void *in)
 {
     uint64_t depth = (uint64_t) in;
@@ -172,6 +212,7 @@ static int test_recursive_create_wait()
 int test_tasks()
 {
     int create_wait;
+    int batch_create_wait;
     int recursive_create_wait;
 
     create_wait = test_create_wait(NUM_PASSES,NUM_TASKS);
@@ -179,12 +220,17 @@ int test_tasks()
     nk_vc_printf("Create-wait test of %lu passes with %lu tasks each: %s\n", 
 		 NUM_PASSES,NUM_TASKS, create_wait ? "FAIL" : "PASS");
 
+    batch_create_wait = test_batch_create_wait(NUM_PASSES,NUM_TASKS);
+
+    nk_vc_printf("Batch create-wait test of %lu passes with %lu tasks each: %s\n", 
+		 NUM_PASSES,NUM_TASKS, batch_create_wait ? "FAIL" : "PASS");
+
     recursive_create_wait = test_recursive_create_wait();
 
     nk_vc_printf("Recursive create-wait test of %lu passes with %lu tasks each: %s\n", 
 		 NUM_PASSES,NUM_TASKS, recursive_create_wait ? "FAIL" : "PASS");
 
-    return create_wait | recursive_create_wait;
+    return create_wait | batch_create_wait | recursive_create_wait;
 
 }
 
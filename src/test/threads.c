@@ -24,6 +24,7 @@
 #include <nautilus/nautilus.h>
 #include <nautilus/thread.h>
 #include <nautilus/scheduler.h>
+#include <nautilus/waitqueue.h>
 #include <nautilus/shell.h>
 #include <nautilus/vc.h>
 
@@ -312,3 +313,552 @@ static struct shell_cmd_impl threads_impl = {
     .handler  = handle_threads,
 };
 nk_register_shell_cmd(threads_impl);
+
+
+// Run queue benchmark: many runnable threads on one cpu yield to
+// each other, so each yield is a pass through its aperiodic queue
+
+static volatile int      runq_go;
+static volatile uint64_t runq_yields;
+
+static void runq_thread(void *in, void **out)
+{
+    uint64_t i;
+
+    while (!runq_go) {
+	nk_yield();
+    }
+
+    for (i=0;i<runq_yields;i++) {
+	nk_yield();
+    }
+}
+
+// leaves room for the threads the system already has
+#define RUNQ_DEFAULT_THREADS (NAUT_CONFIG_MAX_THREADS/2)
+
+static int
+handle_runqbench (char * buf, void * priv)
+{
+    uint64_t numt=RUNQ_DEFAULT_THREADS, numy=16;
+    uint64_t i, start, end;
+    int cpu = my_cpu_id();
+
+    sscanf(buf,"runqbench %lu %lu",&numt,&numy);
+
+    if (numt > NAUT_CONFIG_MAX_THREADS) {
+	nk_vc_printf("At most %d threads can exist, using %d\n",
+		     NAUT_CONFIG_MAX_THREADS, RUNQ_DEFAULT_THREADS);
+	numt = RUNQ_DEFAULT_THREADS;
+    }
+
+    runq_go = 0;
+    runq_yields = numy;
+
+    for (i=0;i<numt;i++) {
+	if (nk_thread_start(runq_thread, 0, 0, 0, PAGE_SIZE_4KB, NULL, cpu)) {
+	    nk_vc_printf("Failed to launch thread %lu\n", i);
+	    break;
+	}
+    }
+
+    start = nk_sched_get_realtime();
+    runq_go = 1;
+
+    if (nk_join_all_children(0)) {
+	nk_vc_printf("Failed to join threads\n");
+	return 0;
+    }
+
+    end = nk_sched_get_realtime();
+
+    nk_sched_reap(1);
+
+    if (i) {
+	nk_vc_printf("%lu threads on cpu %d, %lu yields each: %lu ns total, %lu ns per yield\n",
+		     i, cpu, numy, end-start, (end-start)/(i*(numy+1)));
+    }
+
+    return 0;
+}
+
+static struct shell_cmd_impl runqbench_impl = {
+    .cmd      = "runqbench",
+    .help_str = "runqbench [threads] [yields]",
+    .handler  = handle_runqbench,
+};
+nk_register_shell_cmd(runqbench_impl);
+
+
+// Jitter benchmark: a thread alone on a cpu does a fixed amount of
+// work per sample, so any variation in how long a sample takes is
+// interference from interrupts and scheduling.  With dynamic ticks
+// configured, it is run both with and without them
+
+struct jitter_run {
+    uint64_t  samples;
+    uint64_t  work;
+    uint64_t *cycles;
+    uint64_t  interrupts;
+};
+
+static void jitter_thread(void *in, void **out)
+{
+    struct jitter_run *r = (struct jitter_run *)in;
+    volatile uint64_t sink = 0;
+    uint64_t i, j, start, intr;
+
+    // let the scheduler settle on how to handle this cpu
+    for (j=0;j<r->work*16;j++) {
+	sink += j;
+    }
+
+    intr = get_cpu()->interrupt_count;
+
+    for (i=0;i<r->samples;i++) {
+	start = rdtsc();
+	for (j=0;j<r->work;j++) {
+	    sink += j;
+	}
+	r->cycles[i] = rdtsc() - start;
+    }
+
+    r->interrupts = get_cpu()->interrupt_count - intr;
+}
+
+static int jitter_measure(char *mode, int cpu, uint64_t samples, uint64_t work)
+{
+    struct jitter_run r = { .samples = samples, .work = work };
+    nk_thread_id_t tid;
+    uint64_t i, min=-1, max=0, sum=0, noisy=0;
+
+    r.cycles = malloc(sizeof(uint64_t)*samples);
+
+    if (!r.cycles) {
+	nk_vc_printf("Cannot allocate samples\n");
+	return -1;
+    }
+
+    if (nk_thread_start(jitter_thread, &r, 0, 0, PAGE_SIZE_4KB, &tid, cpu)) {
+	nk_vc_printf("Failed to launch thread on cpu %d\n", cpu);
+	free(r.cycles);
+	return -1;
+    }
+
+    nk_join(tid,0);
+
+    for (i=0;i<samples;i++) {
+	if (r.cycles[i] < min) {
+	    min = r.cycles[i];
+	}
+	if (r.cycles[i] > max) {
+	    max = r.cycles[i];
+	}
+	sum += r.cycles[i];
+    }
+    for (i=0;i<samples;i++) {
+	// more than 5% over the best case
+	if (r.cycles[i] > min + min/20) {
+	    noisy++;
+	}
+    }
+
+    nk_vc_printf("%-8s cpu %d: %lu samples of %lu: min %lu mean %lu max %lu cycles (jitter %lu), %lu noisy, %lu interrupts\n",
+		 mode, cpu, samples, work, min, sum/samples, max, max-min, noisy, r.interrupts);
+
+    free(r.cycles);
+
+    return 0;
+}
+
+static int
+handle_jitter (char * buf, void * priv)
+{
+    uint64_t samples=10000, work=100000;
+    int cpu = nk_get_num_cpus()-1;
+
+    sscanf(buf,"jitter %lu %lu %d",&samples,&work,&cpu);
+
+    if (!samples || cpu<0 || cpu>=nk_get_num_cpus()) {
+	nk_vc_printf("Bad arguments\n");
+	return 0;
+    }
+
+#ifdef NAUT_CONFIG_SCHED_TICKLESS
+    int old = nk_sched_set_tickless(0);
+    jitter_measure("tick",cpu,samples,work);
+    nk_sched_set_tickless(1);
+    jitter_measure("tickless",cpu,samples,work);
+    nk_sched_set_tickless(old);
+#else
+    jitter_measure("tick",cpu,samples,work);
+#endif
+
+    return 0;
+}
+
+static struct shell_cmd_impl jitter_impl = {
+    .cmd      = "jitter",
+    .help_str = "jitter [samples] [work] [cpu]",
+    .handler  = handle_jitter,
+};
+nk_register_shell_cmd(jitter_impl);
+
+
+// Wakeup benchmarks: two threads ping-pong through wait queues, and
+// a producer wakes a consumer for each item it produces, while the
+// first half of the cpus are kept busy by spinning threads.  Each is
+// run with woken threads placed on their last cpu, then with
+// cache-affine placement.  The threads start on random cpus, so
+// results vary from run to run
+
+static volatile int wake_spin_stop;
+
+static void wake_spinner(void *in, void **out)
+{
+    while (!wake_spin_stop) {
+	// keep the cpu busy without ever blocking or yielding
+    }
+}
+
+struct wake_pp {
+    nk_wait_queue_t        *wq[2];
+    volatile int            turn;    // which thread may go (-1 => neither yet)
+    uint64_t                iters;
+    nk_sched_wake_policy_t  policy;
+    uint64_t                end;
+};
+
+struct wake_pp_arg {
+    struct wake_pp *pp;
+    int             me;
+};
+
+static int wake_pp_cond(void *state)
+{
+    struct wake_pp_arg *a = (struct wake_pp_arg *)state;
+
+    return a->pp->turn == a->me;
+}
+
+static void wake_pp_thread(void *in, void **out)
+{
+    struct wake_pp_arg *a = (struct wake_pp_arg *)in;
+    struct wake_pp *pp = a->pp;
+    uint64_t i;
+
+    nk_sched_thread_set_wake_policy(get_cur_thread(), pp->policy);
+
+    for (i=0;i<pp->iters;i++) {
+	while (!wake_pp_cond(a)) {
+	    nk_wait_queue_sleep_extended(pp->wq[a->me], wake_pp_cond, a);
+	}
+	pp->turn = !a->me;
+	nk_wait_queue_wake_one(pp->wq[!a->me]);
+    }
+
+    if (a->me) {
+	pp->end = rdtsc();
+    }
+}
+
+static int wake_pingpong(char *mode, nk_sched_wake_policy_t policy, uint64_t iters)
+{
+    struct wake_pp pp = { .turn = -1, .iters = iters, .policy = policy };
+    struct wake_pp_arg args[2] = { { &pp, 0 }, { &pp, 1 } };
+    nk_thread_id_t tids[2];
+    uint64_t start;
+    int i;
+
+    pp.wq[0] = nk_wait_queue_create(0);
+    pp.wq[1] = nk_wait_queue_create(0);
+
+    if (!pp.wq[0] || !pp.wq[1]) {
+	nk_vc_printf("Cannot allocate wait queues\n");
+	goto out;
+    }
+
+    for (i=0;i<2;i++) {
+	if (nk_thread_start(wake_pp_thread, &args[i], 0, 0, PAGE_SIZE_4KB, &tids[i], CPU_ANY)) {
+	    nk_vc_printf("Failed to launch thread\n");
+	    if (i) {
+		// the first thread has not started, so let it go alone
+		pp.iters = 1;
+		pp.turn = 0;
+		nk_wait_queue_wake_one(pp.wq[0]);
+		nk_join(tids[0],0);
+	    }
+	    goto out;
+	}
+    }
+
+    start = rdtsc();
+    pp.turn = 0;
+    nk_wait_queue_wake_one(pp.wq[0]);
+
+    nk_join(tids[0],0);
+    nk_join(tids[1],0);
+
+    nk_vc_printf("pingpong %-6s: %lu round trips, %lu cycles per round trip\n",
+		 mode, iters, (pp.end-start)/iters);
+
+ out:
+    if (pp.wq[0]) {
+	nk_wait_queue_destroy(pp.wq[0]);
+    }
+    if (pp.wq[1]) {
+	nk_wait_queue_destroy(pp.wq[1]);
+    }
+    return 0;
+}
+
+struct wake_pc {
+    nk_wait_queue_t        *wq;
+    volatile uint64_t       produced;
+    volatile uint64_t       consumed;
+    volatile uint64_t       stamp;     // when the last item was produced
+    uint64_t                items;
+    uint64_t                work;      // spin iterations between items
+    nk_sched_wake_policy_t  policy;
+    uint64_t                sum;
+    uint64_t                max;
+};
+
+static int wake_pc_cond(void *state)
+{
+    struct wake_pc *pc = (struct wake_pc *)state;
+
+    return pc->produced > pc->consumed;
+}
+
+static void wake_producer(void *in, void **out)
+{
+    struct wake_pc *pc = (struct wake_pc *)in;
+    volatile uint64_t sink = 0;
+    uint64_t i, j;
+
+    nk_sched_thread_set_wake_policy(get_cur_thread(), pc->policy);
+
+    for (i=0;i<pc->items;i++) {
+	for (j=0;j<pc->work;j++) {
+	    sink += j;
+	}
+	while (pc->consumed < i) {
+	    // one item outstanding at a time
+	}
+	pc->stamp = rdtsc();
+	pc->produced++;
+	nk_wait_queue_wake_one(pc->wq);
+    }
+}
+
+static void wake_consumer(void *in, void **out)
+{
+    struct wake_pc *pc = (struct wake_pc *)in;
+    uint64_t i, lat;
+
+    nk_sched_thread_set_wake_policy(get_cur_thread(), pc->policy);
+
+    for (i=0;i<pc->items;i++) {
+	while (!wake_pc_cond(pc)) {
+	    nk_wait_queue_sleep_extended(pc->wq, wake_pc_cond, pc);
+	}
+	lat = rdtsc() - pc->stamp;
+	pc->sum += lat;
+	if (lat > pc->max) {
+	    pc->max = lat;
+	}
+	pc->consumed++;
+    }
+}
+
+static int wake_prodcons(char *mode, nk_sched_wake_policy_t policy, uint64_t items, uint64_t work)
+{
+    struct wake_pc pc = { .items = items, .work = work, .policy = policy };
+    nk_thread_id_t cons, prod;
+
+    if (!(pc.wq = nk_wait_queue_create(0))) {
+	nk_vc_printf("Cannot allocate wait queue\n");
+	return 0;
+    }
+
+    if (nk_thread_start(wake_consumer, &pc, 0, 0, PAGE_SIZE_4KB, &cons, CPU_ANY)) {
+	nk_vc_printf("Failed to launch consumer\n");
+	goto out;
+    }
+
+    if (nk_thread_start(wake_producer, &pc, 0, 0, PAGE_SIZE_4KB, &prod, CPU_ANY)) {
+	nk_vc_printf("Failed to launch producer\n");
+	// let the consumer finish
+	pc.items = 0;
+	pc.produced = 1;
+	nk_wait_queue_wake_one(pc.wq);
+	nk_join(cons,0);
+	goto out;
+    }
+
+    nk_join(prod,0);
+    nk_join(cons,0);
+
+    nk_vc_printf("prodcons %-6s: %lu items, wakeup latency mean %lu max %lu cycles\n",
+		 mode, items, pc.sum/items, pc.max);
+
+ out:
+    nk_wait_queue_destroy(pc.wq);
+    return 0;
+}
+
+static int
+handle_wakebench (char * buf, void * priv)
+{
+    uint64_t iters=10000, work=10000;
+    int num_cpus = nk_get_num_cpus();
+    int i, spinners = 0;
+
+    sscanf(buf,"wakebench %lu %lu",&iters,&work);
+
+    if (!iters) {
+	nk_vc_printf("Bad arguments\n");
+	return 0;
+    }
+
+    wake_spin_stop = 0;
+
+    for (i=0;i<num_cpus/2;i++) {
+	if (nk_thread_start(wake_spinner, 0, 0, 0, PAGE_SIZE_4KB, NULL, i)) {
+	    nk_vc_printf("Failed to launch spinner on cpu %d\n", i);
+	    break;
+	}
+	spinners++;
+    }
+
+    nk_vc_printf("%d of %d cpus busy\n", spinners, num_cpus);
+
+    wake_pingpong("last",NK_SCHED_WAKE_LAST,iters);
+    wake_pingpong("affine",NK_SCHED_WAKE_AFFINE,iters);
+    wake_prodcons("last",NK_SCHED_WAKE_LAST,iters,work);
+    wake_prodcons("affine",NK_SCHED_WAKE_AFFINE,iters,work);
+
+    wake_spin_stop = 1;
+
+    if (nk_join_all_children(0)) {
+	nk_vc_printf("Failed to join spinners\n");
+    }
+
+    nk_sched_reap(1);
+
+    return 0;
+}
+
+static struct shell_cmd_impl wakebench_impl = {
+    .cmd      = "wakebench",
+    .help_str = "wakebench [iters] [work]",
+    .handler  = handle_wakebench,
+};
+nk_register_shell_cmd(wakebench_impl);
+
+
+// Global real-time admission: launch periodic threads that place
+// themselves with first or worst fit, and show where they landed
+
+struct rtplace_arg {
+    struct nk_sched_constraints c;
+    nk_sched_fit_t              fit;
+    volatile int                cpu;   // -1 => rejected
+};
+
+static volatile int rtplace_stop;
+
+static void rtplace_thread(void *in, void **out)
+{
+    struct rtplace_arg *a = (struct rtplace_arg *)in;
+
+    if (nk_sched_thread_change_constraints_global(&a->c, a->fit)) {
+	a->cpu = -1;
+	return;
+    }
+
+    a->cpu = my_cpu_id();
+
+    while (!rtplace_stop) {
+	nk_yield();
+    }
+}
+
+static int
+handle_rtplace (char * buf, void * priv)
+{
+    uint64_t numt=8, period=1000, slice=250;
+    char how[16] = "worst";
+    nk_sched_fit_t fit;
+    uint64_t i, n;
+
+    sscanf(buf,"rtplace %lu %lu %lu %15s",&numt,&period,&slice,how);
+
+    if (!strcmp(how,"first")) {
+	fit = NK_SCHED_FIT_FIRST;
+    } else if (!strcmp(how,"worst")) {
+	fit = NK_SCHED_FIT_WORST;
+    } else {
+	nk_vc_printf("Unknown fit %s\n", how);
+	return 0;
+    }
+
+    if (!numt || !period || !slice || slice>period) {
+	nk_vc_printf("Bad arguments\n");
+	return 0;
+    }
+
+    struct rtplace_arg *args = malloc(sizeof(struct rtplace_arg)*numt);
+
+    if (!args) {
+	nk_vc_printf("Cannot allocate arguments\n");
+	return 0;
+    }
+
+    rtplace_stop = 0;
+
+    for (n=0;n<numt;n++) {
+	args[n].c.type = PERIODIC;
+	args[n].c.interrupt_priority_class = 0;
+	args[n].c.periodic.phase = 0;
+	args[n].c.periodic.period = period*1000;
+	args[n].c.periodic.slice = slice*1000;
+	args[n].fit = fit;
+	args[n].cpu = -2;
+	if (nk_thread_start(rtplace_thread, &args[n], 0, 0, PAGE_SIZE_4KB, NULL, CPU_ANY)) {
+	    nk_vc_printf("Failed to launch thread %lu\n", n);
+	    break;
+	}
+    }
+
+    for (i=0;i<n;i++) {
+	while (args[i].cpu==-2) {
+	    nk_yield();
+	}
+	if (args[i].cpu<0) {
+	    nk_vc_printf("thread %lu: rejected\n", i);
+	} else {
+	    nk_vc_printf("thread %lu: cpu %d\n", i, args[i].cpu);
+	}
+    }
+
+    rtplace_stop = 1;
+
+    if (nk_join_all_children(0)) {
+	nk_vc_printf("Failed to join threads\n");
+    }
+
+    nk_sched_reap(1);
+
+    free(args);
+
+    return 0;
+}
+
+static struct shell_cmd_impl rtplace_impl = {
+    .cmd      = "rtplace",
+    .help_str = "rtplace [threads] [period_us] [slice_us] [first|worst]",
+    .handler  = handle_rtplace,
+};
+nk_register_shell_cmd(rtplace_impl);